@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/capture.h"
+
+/* Converts a capture file written by meshlink_set_capture_file() to pcapng.
+ *
+ * Each record becomes a packet with link type LINKTYPE_USER0,
+ * containing the SPTPS record type, the length of the peer's name, the peer's name and the record itself.
+ * The direction is stored in the packet flags.
+ */
+
+#define LINKTYPE_USER0 147
+
+static FILE *out;
+
+static void write_block(uint32_t type, const void *body, uint32_t len) {
+	static const uint8_t padding[4];
+	uint32_t padded = (len + 3) & ~3u;
+	uint32_t total = padded + 12;
+
+	fwrite(&type, sizeof(type), 1, out);
+	fwrite(&total, sizeof(total), 1, out);
+	fwrite(body, len, 1, out);
+	fwrite(padding, padded - len, 1, out);
+	fwrite(&total, sizeof(total), 1, out);
+}
+
+static size_t add_option(uint8_t *buf, uint16_t code, const void *data, uint16_t len) {
+	memcpy(buf, &code, 2);
+	memcpy(buf + 2, &len, 2);
+	memcpy(buf + 4, data, len);
+	memset(buf + 4 + len, 0, ((len + 3) & ~3u) - len);
+	return 4 + ((len + 3) & ~3u);
+}
+
+static void write_section_header(void) {
+	struct {
+		uint32_t magic;
+		uint16_t major;
+		uint16_t minor;
+		int64_t length;
+	} shb = {0x1a2b3c4d, 1, 0, -1};
+
+	write_block(0x0a0d0d0a, &shb, sizeof(shb));
+}
+
+static void write_interface(const char *name) {
+	uint8_t buf[128];
+	size_t len = 0;
+
+	uint16_t linktype = LINKTYPE_USER0;
+	uint16_t reserved = 0;
+	uint32_t snaplen = 2 + CAPTURE_NAME_SIZE + CAPTURE_SNAPLEN;
+	memcpy(buf, &linktype, 2);
+	memcpy(buf + 2, &reserved, 2);
+	memcpy(buf + 4, &snaplen, 4);
+	len += 8;
+
+	char ifname[CAPTURE_NAME_SIZE + 16];
+	snprintf(ifname, sizeof(ifname), "meshlink %.*s", CAPTURE_NAME_SIZE, name);
+	len += add_option(buf + len, 2, ifname, strlen(ifname));
+
+	// Timestamps are in nanoseconds
+	uint8_t tsresol = 9;
+	len += add_option(buf + len, 9, &tsresol, 1);
+	len += add_option(buf + len, 0, NULL, 0);
+
+	write_block(1, buf, len);
+}
+
+static void write_record(const capture_record_t *record) {
+	uint8_t buf[20 + 2 + CAPTURE_NAME_SIZE + CAPTURE_SNAPLEN + 3 + 16];
+	const char *end = memchr(record->peer, 0, CAPTURE_NAME_SIZE);
+	size_t namelen = end ? (size_t)(end - record->peer) : CAPTURE_NAME_SIZE;
+	uint32_t caplen = 2 + namelen + record->caplen;
+	uint32_t origlen = 2 + namelen + record->len;
+
+	uint32_t interface = 0;
+	uint32_t time_high = record->time >> 32;
+	uint32_t time_low = record->time;
+	memcpy(buf, &interface, 4);
+	memcpy(buf + 4, &time_high, 4);
+	memcpy(buf + 8, &time_low, 4);
+	memcpy(buf + 12, &caplen, 4);
+	memcpy(buf + 16, &origlen, 4);
+
+	uint8_t *data = buf + 20;
+	data[0] = record->type;
+	data[1] = namelen;
+	memcpy(data + 2, record->peer, namelen);
+	memcpy(data + 2 + namelen, record + 1, record->caplen);
+
+	size_t len = 20 + ((caplen + 3) & ~3u);
+	memset(buf + 20 + caplen, 0, len - 20 - caplen);
+
+	// The epb_flags option has the direction in the lowest two bits, 1 is inbound and 2 is outbound
+	uint32_t flags = record->direction == CAPTURE_IN ? 1 : 2;
+	len += add_option(buf + len, 2, &flags, sizeof(flags));
+	len += add_option(buf + len, 0, NULL, 0);
+
+	write_block(6, buf, len);
+}
+
+int main(int argc, char *argv[]) {
+	if(argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s capture-file [output.pcapng]\n", argv[0]);
+		return 1;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+
+	if(!in) {
+		fprintf(stderr, "Could not open %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	capture_header_t header;
+
+	if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) || header.version != CAPTURE_VERSION) {
+		fprintf(stderr, "%s is not a MeshLink capture file\n", argv[1]);
+		return 1;
+	}
+
+	if(header.slot_size < sizeof(capture_record_t) + CAPTURE_SNAPLEN || !header.slot_count) {
+		fprintf(stderr, "%s is corrupt\n", argv[1]);
+		return 1;
+	}
+
+	out = argc > 2 ? fopen(argv[2], "wb") : stdout;
+
+	if(!out) {
+		fprintf(stderr, "Could not open %s: %s\n", argv[2], strerror(errno));
+		return 1;
+	}
+
+	write_section_header();
+	write_interface(header.name);
+
+	// Start with the oldest record
+	uint64_t first = header.head > header.slot_count ? header.head - header.slot_count : 0;
+	capture_record_t *record = malloc(header.slot_size);
+
+	if(!record) {
+		return 1;
+	}
+
+	for(uint64_t i = first; i < header.head; i++) {
+		if(fseek(in, header.header_size + (i % header.slot_count) * header.slot_size, SEEK_SET) || fread(record, header.slot_size, 1, in) != 1) {
+			fprintf(stderr, "%s is truncated\n", argv[1]);
+			return 1;
+		}
+
+		if(record->caplen > CAPTURE_SNAPLEN) {
+			fprintf(stderr, "Skipping corrupt record %lu\n", (unsigned long)i);
+			continue;
+		}
+
+		write_record(record);
+	}
+
+	free(record);
+	fclose(in);
+
+	if(fclose(out)) {
+		fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
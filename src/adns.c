@@ -0,0 +1,429 @@
+/*
+    adns.c -- asynchronous DNS resolution
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#include "adns.h"
+#include "logger.h"
+#include "xalloc.h"
+
+/* Lookups are done by a worker thread, since getaddrinfo() can block for a long time.
+   Results are handed back to the event loop via a signal, and the callbacks are called from there.
+   The results are cached for a while, so retrying a connection does not cause a new lookup.
+   Since getaddrinfo() does not return the TTL of the DNS records, fixed TTLs are used.
+*/
+
+#define ADNS_SIGNUM 1
+#define ADNS_CACHE_SIZE 4
+#define ADNS_POSITIVE_TTL 60
+#define ADNS_NEGATIVE_TTL 10
+
+typedef struct adns_request {
+	struct adns_request *next;
+	char *host;
+	char *serv;
+	adns_cb_t cb;
+	void *data;
+	sockaddr_t *addresses;
+	int count;
+	int err;
+} adns_request_t;
+
+typedef struct adns_cache_entry {
+	char *host;
+	char *serv;
+	sockaddr_t *addresses;
+	int count;
+	time_t expires;
+} adns_cache_entry_t;
+
+struct adns {
+	struct meshlink_handle *mesh;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool running;                   /* the worker thread has been started */
+	bool stop;                      /* the worker thread should free everything and exit */
+	adns_request_t *queue;          /* requests waiting to be resolved */
+	adns_request_t *current;        /* the request being resolved right now */
+	adns_request_t *done;           /* resolved requests waiting to be delivered */
+	signal_t signal;
+
+	// Only accessed from the event loop
+	adns_cache_entry_t cache[ADNS_CACHE_SIZE];
+};
+
+static void free_request(adns_request_t *req) {
+	free(req->host);
+	free(req->serv);
+	free(req->addresses);
+	free(req);
+}
+
+static void free_requests(adns_request_t *req) {
+	for(adns_request_t *next; req; req = next) {
+		next = req->next;
+		free_request(req);
+	}
+}
+
+static void free_adns_struct(struct adns *adns) {
+	free_requests(adns->queue);
+	free_requests(adns->done);
+
+	for(int i = 0; i < ADNS_CACHE_SIZE; i++) {
+		free(adns->cache[i].host);
+		free(adns->cache[i].serv);
+		free(adns->cache[i].addresses);
+	}
+
+	pthread_cond_destroy(&adns->cond);
+	pthread_mutex_destroy(&adns->mutex);
+	free(adns);
+}
+
+static void resolve(adns_request_t *req) {
+	struct addrinfo *ai;
+	struct addrinfo hint = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+
+	req->err = getaddrinfo(req->host, req->serv, &hint, &ai);
+
+	if(req->err) {
+		return;
+	}
+
+	for(struct addrinfo *aip = ai; aip; aip = aip->ai_next) {
+		if(aip->ai_addrlen > sizeof(sockaddr_t)) {
+			continue;
+		}
+
+		req->addresses = xrealloc(req->addresses, (req->count + 1) * sizeof(*req->addresses));
+		memset(&req->addresses[req->count], 0, sizeof(*req->addresses));
+		memcpy(&req->addresses[req->count], aip->ai_addr, aip->ai_addrlen);
+		req->count++;
+	}
+
+	freeaddrinfo(ai);
+}
+
+static void *adns_loop(void *arg) {
+	struct adns *adns = arg;
+
+	if(pthread_mutex_lock(&adns->mutex) != 0) {
+		abort();
+	}
+
+	while(!adns->stop) {
+		adns_request_t *req = adns->queue;
+
+		if(!req) {
+			pthread_cond_wait(&adns->cond, &adns->mutex);
+			continue;
+		}
+
+		adns->queue = req->next;
+		req->next = NULL;
+		adns->current = req;
+		pthread_mutex_unlock(&adns->mutex);
+
+		resolve(req);
+
+		if(pthread_mutex_lock(&adns->mutex) != 0) {
+			abort();
+		}
+
+		adns->current = NULL;
+
+		if(adns->stop) {
+			free_request(req);
+			break;
+		}
+
+		adns_request_t **tail = &adns->done;
+
+		while(*tail) {
+			tail = &(*tail)->next;
+		}
+
+		*tail = req;
+
+		// Only wake up the event loop if it is listening, init_adns() picks up the rest
+		if(adns->signal.cb) {
+			signal_trigger(&adns->mesh->loop, &adns->signal);
+		}
+	}
+
+	// The mesh is gone, we are the last user of this struct
+	pthread_mutex_unlock(&adns->mutex);
+	free_adns_struct(adns);
+	return NULL;
+}
+
+static void update_cache(meshlink_handle_t *mesh, struct adns *adns, const adns_request_t *req) {
+	adns_cache_entry_t *entry = NULL;
+
+	for(int i = 0; i < ADNS_CACHE_SIZE; i++) {
+		adns_cache_entry_t *e = &adns->cache[i];
+
+		if(e->host && !strcmp(e->host, req->host) && !strcmp(e->serv, req->serv)) {
+			entry = e;
+			break;
+		}
+
+		// Otherwise, replace the entry that expires first
+		if(!entry || !e->host || (entry->host && e->expires < entry->expires)) {
+			entry = e;
+		}
+	}
+
+	free(entry->host);
+	free(entry->serv);
+	free(entry->addresses);
+
+	entry->host = xstrdup(req->host);
+	entry->serv = xstrdup(req->serv);
+	entry->count = req->count;
+	entry->addresses = NULL;
+
+	if(req->count) {
+		entry->addresses = xmalloc(req->count * sizeof(*entry->addresses));
+		memcpy(entry->addresses, req->addresses, req->count * sizeof(*entry->addresses));
+	}
+
+	entry->expires = mesh->loop.now.tv_sec + (req->count ? ADNS_POSITIVE_TTL : ADNS_NEGATIVE_TTL);
+}
+
+static void adns_cb_handler(event_loop_t *loop, void *data) {
+	meshlink_handle_t *mesh = loop->data;
+	struct adns *adns = data;
+
+	// Deliver one result at a time, so callbacks can still cancel the others
+	while(true) {
+		if(pthread_mutex_lock(&adns->mutex) != 0) {
+			abort();
+		}
+
+		adns_request_t *req = adns->done;
+
+		if(req) {
+			adns->done = req->next;
+		}
+
+		adns_cb_t cb = req ? req->cb : NULL;
+		pthread_mutex_unlock(&adns->mutex);
+
+		if(!req) {
+			break;
+		}
+
+		if(req->err) {
+			logger(mesh, MESHLINK_WARNING, "Error looking up %s port %s: %s", req->host, req->serv, gai_strerror(req->err));
+		}
+
+		update_cache(mesh, adns, req);
+
+		if(cb) {
+			cb(mesh, req->data, req->addresses, req->count);
+		}
+
+		free_request(req);
+	}
+}
+
+static struct adns *get_adns(meshlink_handle_t *mesh) {
+	if(!mesh->adns) {
+		struct adns *adns = xzalloc(sizeof(*adns));
+		adns->mesh = mesh;
+		pthread_mutex_init(&adns->mutex, NULL);
+		pthread_cond_init(&adns->cond, NULL);
+		mesh->adns = adns;
+	}
+
+	return mesh->adns;
+}
+
+/// Start delivering results to the event loop.
+void init_adns(meshlink_handle_t *mesh) {
+	struct adns *adns = get_adns(mesh);
+
+	if(pthread_mutex_lock(&adns->mutex) != 0) {
+		abort();
+	}
+
+	signal_add(&mesh->loop, &adns->signal, adns_cb_handler, adns, ADNS_SIGNUM);
+
+	// Deliver anything that was resolved while the event loop was not running
+	if(adns->done) {
+		signal_trigger(&mesh->loop, &adns->signal);
+	}
+
+	pthread_mutex_unlock(&adns->mutex);
+}
+
+/// Stop delivering results to the event loop.
+void exit_adns(meshlink_handle_t *mesh) {
+	struct adns *adns = mesh->adns;
+
+	if(!adns) {
+		return;
+	}
+
+	if(pthread_mutex_lock(&adns->mutex) != 0) {
+		abort();
+	}
+
+	if(adns->signal.cb) {
+		signal_del(&mesh->loop, &adns->signal);
+	}
+
+	pthread_mutex_unlock(&adns->mutex);
+}
+
+/// Free all resources. The worker thread is not waited for, it cleans up after itself.
+void free_adns(meshlink_handle_t *mesh) {
+	struct adns *adns = mesh->adns;
+
+	if(!adns) {
+		return;
+	}
+
+	assert(!adns->signal.cb);
+	mesh->adns = NULL;
+
+	if(pthread_mutex_lock(&adns->mutex) != 0) {
+		abort();
+	}
+
+	bool running = adns->running;
+	adns->stop = true;
+	pthread_cond_signal(&adns->cond);
+	pthread_mutex_unlock(&adns->mutex);
+
+	if(!running) {
+		free_adns_struct(adns);
+	}
+}
+
+/// Look up a cached result. Returns true if there was one, even if the name could not be resolved.
+bool adns_lookup_cached(meshlink_handle_t *mesh, const char *host, const char *serv, const sockaddr_t **addresses, int *count) {
+	struct adns *adns = mesh->adns;
+
+	if(!adns) {
+		return false;
+	}
+
+	for(int i = 0; i < ADNS_CACHE_SIZE; i++) {
+		adns_cache_entry_t *entry = &adns->cache[i];
+
+		if(entry->host && entry->expires > mesh->loop.now.tv_sec && !strcmp(entry->host, host) && !strcmp(entry->serv, serv)) {
+			*addresses = entry->addresses;
+			*count = entry->count;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Queue a lookup. The callback will be called from the event loop, unless the request is cancelled first.
+void adns_queue(meshlink_handle_t *mesh, const char *host, const char *serv, adns_cb_t cb, void *data) {
+	struct adns *adns = get_adns(mesh);
+
+	adns_request_t *req = xzalloc(sizeof(*req));
+	req->host = xstrdup(host);
+	req->serv = xstrdup(serv);
+	req->cb = cb;
+	req->data = data;
+
+	if(pthread_mutex_lock(&adns->mutex) != 0) {
+		abort();
+	}
+
+	adns_request_t **tail = &adns->queue;
+
+	while(*tail) {
+		tail = &(*tail)->next;
+	}
+
+	*tail = req;
+
+	if(!adns->running) {
+		pthread_t thread;
+
+		if(pthread_create(&thread, NULL, adns_loop, adns) == 0) {
+			pthread_detach(thread);
+			adns->running = true;
+		} else {
+			// Fall back to resolving it ourself, the result is still delivered via the event loop
+			logger(mesh, MESHLINK_WARNING, "Could not start resolver thread");
+			adns->queue = NULL;
+			resolve(req);
+			adns_request_t **done = &adns->done;
+
+			while(*done) {
+				done = &(*done)->next;
+			}
+
+			*done = req;
+
+			if(adns->signal.cb) {
+				signal_trigger(&mesh->loop, &adns->signal);
+			}
+		}
+	}
+
+	pthread_cond_signal(&adns->cond);
+	pthread_mutex_unlock(&adns->mutex);
+}
+
+/// Make sure the callback will not be called for any outstanding requests with the given data.
+void adns_cancel(meshlink_handle_t *mesh, void *data) {
+	struct adns *adns = mesh->adns;
+
+	if(!adns) {
+		return;
+	}
+
+	if(pthread_mutex_lock(&adns->mutex) != 0) {
+		abort();
+	}
+
+	for(adns_request_t *req = adns->queue; req; req = req->next) {
+		if(req->data == data) {
+			req->cb = NULL;
+		}
+	}
+
+	if(adns->current && adns->current->data == data) {
+		adns->current->cb = NULL;
+	}
+
+	for(adns_request_t *req = adns->done; req; req = req->next) {
+		if(req->data == data) {
+			req->cb = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&adns->mutex);
+}
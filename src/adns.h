@@ -0,0 +1,37 @@
+#ifndef MESHLINK_ADNS_H
+#define MESHLINK_ADNS_H
+
+/*
+    adns.h -- header for adns.c
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "meshlink_internal.h"
+#include "sockaddr.h"
+
+typedef void (*adns_cb_t)(struct meshlink_handle *mesh, void *data, const sockaddr_t *addresses, int count);
+
+void init_adns(struct meshlink_handle *mesh);
+void exit_adns(struct meshlink_handle *mesh);
+void free_adns(struct meshlink_handle *mesh);
+bool adns_lookup_cached(struct meshlink_handle *mesh, const char *host, const char *serv, const sockaddr_t **addresses, int *count) __attribute__((__warn_unused_result__));
+void adns_queue(struct meshlink_handle *mesh, const char *host, const char *serv, adns_cb_t cb, void *data);
+void adns_cancel(struct meshlink_handle *mesh, void *data);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+    capture.c -- capture of decrypted meta-connection records
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "capture.h"
+#include "connection.h"
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "xalloc.h"
+
+/* Records are written by the event loop while it holds the mesh mutex,
+   so there is only one writer. The file is mapped, so capturing a record only costs a copy,
+   and the records written so far survive a crash of the application. */
+
+struct capture {
+	void *map;
+	size_t size;
+	capture_header_t *header;
+	uint8_t *slots;
+};
+
+static const size_t slot_size = (sizeof(capture_record_t) + CAPTURE_SNAPLEN + 7) & ~(size_t)7;
+
+static void copy_name(char dst[CAPTURE_NAME_SIZE], const char *src) {
+	size_t len = src ? strlen(src) : 0;
+
+	if(len > CAPTURE_NAME_SIZE) {
+		len = CAPTURE_NAME_SIZE;
+	}
+
+	memset(dst, 0, CAPTURE_NAME_SIZE);
+
+	if(len) {
+		memcpy(dst, src, len);
+	}
+}
+
+bool capture_open(meshlink_handle_t *mesh, const char *path, size_t size) {
+#ifdef HAVE_SYS_MMAN_H
+	size_t header_size = (sizeof(capture_header_t) + 63) & ~(size_t)63;
+
+	if(size < header_size + slot_size || size > UINT32_MAX) {
+		logger(mesh, MESHLINK_ERROR, "Invalid capture file size %lu", (unsigned long)size);
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+	if(fd == -1) {
+		logger(mesh, MESHLINK_ERROR, "Could not open capture file %s: %s", path, strerror(errno));
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	if(ftruncate(fd, size)) {
+		logger(mesh, MESHLINK_ERROR, "Could not resize capture file %s: %s", path, strerror(errno));
+		close(fd);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(map == MAP_FAILED) {
+		logger(mesh, MESHLINK_ERROR, "Could not map capture file %s: %s", path, strerror(errno));
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	capture_close(mesh);
+
+	struct capture *capture = xzalloc(sizeof(*capture));
+	capture->map = map;
+	capture->size = size;
+	capture->header = map;
+	capture->slots = (uint8_t *)map + header_size;
+
+	capture_header_t *header = capture->header;
+	header->version = CAPTURE_VERSION;
+	header->header_size = header_size;
+	header->slot_size = slot_size;
+	header->slot_count = (size - header_size) / slot_size;
+	header->head = 0;
+	copy_name(header->name, mesh->name);
+
+	// Only mark the file as valid once the rest of the header is filled in
+	atomic_thread_fence(memory_order_release);
+	memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+
+	mesh->capture = capture;
+	logger(mesh, MESHLINK_INFO, "Capturing %u records in %s", header->slot_count, path);
+	return true;
+#else
+	(void)path;
+	(void)size;
+	logger(mesh, MESHLINK_ERROR, "Capture files are not supported on this platform");
+	meshlink_errno = MESHLINK_ENOTSUP;
+	return false;
+#endif
+}
+
+void capture_close(meshlink_handle_t *mesh) {
+	struct capture *capture = mesh->capture;
+
+	if(!capture) {
+		return;
+	}
+
+	mesh->capture = NULL;
+
+#ifdef HAVE_SYS_MMAN_H
+	msync(capture->map, capture->size, MS_ASYNC);
+	munmap(capture->map, capture->size);
+#endif
+
+	free(capture);
+}
+
+void capture_record(meshlink_handle_t *mesh, const connection_t *c, int direction, uint8_t type, const void *data, size_t len) {
+	struct capture *capture = mesh->capture;
+	capture_header_t *header = capture->header;
+	capture_record_t *record = (capture_record_t *)(capture->slots + (header->head % header->slot_count) * slot_size);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	record->time = now.tv_sec * 1000000000ull + now.tv_nsec;
+	record->len = len;
+	record->caplen = len < CAPTURE_SNAPLEN ? len : CAPTURE_SNAPLEN;
+	record->direction = direction;
+	record->type = type;
+	copy_name(record->peer, c->name);
+	memcpy(record + 1, data, record->caplen);
+
+	// Readers of a live capture use head to tell which slots are complete
+	atomic_thread_fence(memory_order_release);
+	header->head++;
+}
@@ -0,0 +1,65 @@
+#ifndef MESHLINK_CAPTURE_H
+#define MESHLINK_CAPTURE_H
+
+/*
+    capture.h -- capture of decrypted meta-connection records
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* A capture file consists of a header, followed by a ring of fixed size slots.
+   Each slot holds one record, truncated to CAPTURE_SNAPLEN bytes.
+   The header counts how many records have been written in total,
+   so the oldest record is in slot head % slot_count once the ring has wrapped.
+   All fields are in host byte order. This file is also used by examples/capture2pcapng.c.
+*/
+
+#define CAPTURE_MAGIC "MLCAPT\r\n"
+#define CAPTURE_VERSION 1
+#define CAPTURE_NAME_SIZE 32
+#define CAPTURE_SNAPLEN 200
+
+#define CAPTURE_IN 0
+#define CAPTURE_OUT 1
+
+typedef struct capture_header_t {
+	char magic[8];                  /* CAPTURE_MAGIC, without the terminating NUL byte */
+	uint32_t version;               /* CAPTURE_VERSION */
+	uint32_t header_size;           /* offset of the first slot */
+	uint32_t slot_size;             /* size of a slot, including its capture_record_t */
+	uint32_t slot_count;            /* number of slots in the ring */
+	uint64_t head;                  /* number of records written so far */
+	char name[CAPTURE_NAME_SIZE];   /* name of the local node, NUL padded */
+} capture_header_t;
+
+typedef struct capture_record_t {
+	uint64_t time;                  /* wall clock time in nanoseconds since the epoch */
+	uint32_t len;                   /* original length of the record */
+	uint32_t caplen;                /* number of bytes of the record stored after this header */
+	uint8_t direction;              /* CAPTURE_IN or CAPTURE_OUT */
+	uint8_t type;                   /* SPTPS record type */
+	uint8_t reserved[6];
+	char peer[CAPTURE_NAME_SIZE];   /* name of the peer, NUL padded */
+} capture_record_t;
+
+struct meshlink_handle;
+struct connection_t;
+
+bool capture_open(struct meshlink_handle *mesh, const char *path, size_t size);
+void capture_close(struct meshlink_handle *mesh);
+void capture_record(struct meshlink_handle *mesh, const struct connection_t *c, int direction, uint8_t type, const void *data, size_t len);
+
+#endif
@@ -20,34 +20,18 @@
 #include "system.h"
 #include <assert.h>
 #include <sys/types.h>
-#include <utime.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "conf.h"
 #include "crypto.h"
 #include "logger.h"
 #include "meshlink_internal.h"
+#include "trace.h"
 #include "xalloc.h"
 #include "packmsg.h"
 
-/// Generate a path to the main configuration file.
-static void make_main_path(meshlink_handle_t *mesh, const char *conf_subdir, char *path, size_t len) {
-	assert(conf_subdir);
-	assert(path);
-	assert(len);
-
-	snprintf(path, len, "%s" SLASH "%s" SLASH "meshlink.conf", mesh->confbase, conf_subdir);
-}
-
-/// Generate a path to a host configuration file.
-static void make_host_path(meshlink_handle_t *mesh, const char *conf_subdir, const char *name, char *path, size_t len) {
-	assert(conf_subdir);
-	assert(name);
-	assert(path);
-	assert(len);
-
-	snprintf(path, len, "%s" SLASH "%s" SLASH "hosts" SLASH "%s", mesh->confbase, conf_subdir, name);
-}
-
 /// Remove a directory recursively
 static bool deltree(const char *dirname) {
 	assert(dirname);
@@ -110,6 +94,11 @@ bool sync_path(const char *pathname) {
 	return true;
 }
 
+/// Check whether the storage operations keep their data in the configuration directory.
+bool config_in_confbase(const meshlink_storage_ops_t *ops) {
+	return !ops || ops == &config_files_ops || ops == &config_log_ops;
+}
+
 /// Try decrypting the main configuration file from the given sub-directory.
 static bool main_config_decrypt(meshlink_handle_t *mesh, const char *conf_subdir) {
 	assert(mesh->config_key);
@@ -139,6 +128,14 @@ bool config_init(meshlink_handle_t *mesh, const char *conf_subdir) {
 		return true;
 	}
 
+	config_writer_flush(mesh);
+	config_log_close(mesh);
+	config_snapshot_free(mesh);
+
+	if(!config_in_confbase(mesh->storage_ops)) {
+		return config_ops_wipe(mesh->storage_ops, mesh->storage_priv, conf_subdir);
+	}
+
 	char path[PATH_MAX];
 
 	// Create "current" sub-directory in the confbase
@@ -154,7 +151,12 @@ bool config_init(meshlink_handle_t *mesh, const char *conf_subdir) {
 		return false;
 	}
 
-	make_host_path(mesh, conf_subdir, "", path, sizeof(path));
+	// The log engine keeps everything in a single file
+	if(mesh->storage_ops == &config_log_ops) {
+		return true;
+	}
+
+	snprintf(path, sizeof(path), "%s" SLASH "%s" SLASH "hosts", mesh->confbase, conf_subdir);
 
 	if(mkdir(path, 0700)) {
 		logger(mesh, MESHLINK_DEBUG, "Could not create directory %s: %s\n", path, strerror(errno));
@@ -165,13 +167,17 @@ bool config_init(meshlink_handle_t *mesh, const char *conf_subdir) {
 }
 
 /// Wipe an existing configuration directory
-bool config_destroy(const char *confbase, const char *conf_subdir) {
+bool config_destroy(const char *confbase, const meshlink_storage_ops_t *ops, void *priv, const char *conf_subdir) {
 	assert(conf_subdir);
 
 	if(!confbase) {
 		return true;
 	}
 
+	if(!config_in_confbase(ops)) {
+		return config_ops_wipe(ops, priv, conf_subdir);
+	}
+
 	struct stat st;
 
 	char path[PATH_MAX];
@@ -189,14 +195,18 @@ bool config_destroy(const char *confbase, const char *conf_subdir) {
 		}
 	}
 
-	// Remove meshlink.conf
-	snprintf(path, sizeof(path), "%s" SLASH "%s" SLASH "meshlink.conf", confbase, conf_subdir);
+	// Remove meshlink.conf or meshlink.log
+	static const char *const main_files[] = {"meshlink.conf", "meshlink.log"};
 
-	if(unlink(path)) {
-		if(errno != ENOENT) {
-			logger(NULL, MESHLINK_ERROR, "Cannot delete %s: %s\n", path, strerror(errno));
-			meshlink_errno = MESHLINK_ESTORAGE;
-			return false;
+	for(size_t i = 0; i < sizeof(main_files) / sizeof(*main_files); i++) {
+		snprintf(path, sizeof(path), "%s" SLASH "%s" SLASH "%s", confbase, conf_subdir, main_files[i]);
+
+		if(unlink(path)) {
+			if(errno != ENOENT) {
+				logger(NULL, MESHLINK_ERROR, "Cannot delete %s: %s\n", path, strerror(errno));
+				meshlink_errno = MESHLINK_ESTORAGE;
+				return false;
+			}
 		}
 	}
 
@@ -211,138 +221,13 @@ bool config_destroy(const char *confbase, const char *conf_subdir) {
 	return sync_path(confbase);
 }
 
-static bool copytree(const char *src_dir_name, const void *src_key, const char *dst_dir_name, const void *dst_key) {
-	assert(src_dir_name);
-	assert(dst_dir_name);
-
-	char src_filename[PATH_MAX];
-	char dst_filename[PATH_MAX];
-	struct dirent *ent;
-
-	DIR *src_dir = opendir(src_dir_name);
-
-	if(!src_dir) {
-		logger(NULL, MESHLINK_ERROR, "Could not open directory file %s\n", src_dir_name);
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
-
-	// Delete if already exists and create a new destination directory
-	if(!deltree(dst_dir_name)) {
-		logger(NULL, MESHLINK_ERROR, "Cannot delete %s: %s\n", dst_dir_name, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
-
-	if(mkdir(dst_dir_name, 0700)) {
-		logger(NULL, MESHLINK_ERROR, "Could not create directory %s\n", dst_filename);
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
-
-	while((ent = readdir(src_dir))) {
-		if(ent->d_name[0] == '.') {
-			continue;
-		}
-
-		snprintf(dst_filename, sizeof(dst_filename), "%s" SLASH "%s", dst_dir_name, ent->d_name);
-		snprintf(src_filename, sizeof(src_filename), "%s" SLASH "%s", src_dir_name, ent->d_name);
-
-		if(ent->d_type == DT_DIR) {
-			if(!copytree(src_filename, src_key, dst_filename, dst_key)) {
-				logger(NULL, MESHLINK_ERROR, "Copying %s to %s failed\n", src_filename, dst_filename);
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			if(!sync_path(dst_filename)) {
-				return false;
-			}
-		} else if(ent->d_type == DT_REG) {
-			struct stat st;
-			config_t config;
-
-			if(stat(src_filename, &st)) {
-				logger(NULL, MESHLINK_ERROR, "Could not stat file `%s': %s\n", src_filename, strerror(errno));
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			FILE *f = fopen(src_filename, "r");
-
-			if(!f) {
-				logger(NULL, MESHLINK_ERROR, "Failed to open `%s': %s\n", src_filename, strerror(errno));
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			if(!config_read_file(NULL, f, &config, src_key)) {
-				logger(NULL, MESHLINK_ERROR, "Failed to read `%s': %s\n", src_filename, strerror(errno));
-				fclose(f);
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			if(fclose(f)) {
-				logger(NULL, MESHLINK_ERROR, "Failed to close `%s': %s\n", src_filename, strerror(errno));
-				config_free(&config);
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			f = fopen(dst_filename, "w");
-
-			if(!f) {
-				logger(NULL, MESHLINK_ERROR, "Failed to open `%s': %s", dst_filename, strerror(errno));
-				config_free(&config);
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			if(!config_write_file(NULL, f, &config, dst_key)) {
-				logger(NULL, MESHLINK_ERROR, "Failed to write `%s': %s", dst_filename, strerror(errno));
-				config_free(&config);
-				fclose(f);
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			if(fclose(f)) {
-				logger(NULL, MESHLINK_ERROR, "Failed to close `%s': %s", dst_filename, strerror(errno));
-				config_free(&config);
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-
-			config_free(&config);
-
-			struct utimbuf times;
-			times.modtime = st.st_mtime;
-			times.actime = st.st_atime;
-
-			if(utime(dst_filename, &times)) {
-				logger(NULL, MESHLINK_ERROR, "Failed to utime `%s': %s", dst_filename, strerror(errno));
-				meshlink_errno = MESHLINK_ESTORAGE;
-				return false;
-			}
-		}
-	}
-
-	closedir(src_dir);
-	return true;
-}
-
+/// Copy all configuration files to another sub-directory, re-encrypting them with a different key.
 bool config_copy(meshlink_handle_t *mesh, const char *src_dir_name, const void *src_key, const char *dst_dir_name, const void *dst_key) {
 	assert(src_dir_name);
 	assert(dst_dir_name);
 
-	char src_filename[PATH_MAX];
-	char dst_filename[PATH_MAX];
-
-	snprintf(dst_filename, sizeof(dst_filename), "%s" SLASH "%s", mesh->confbase, dst_dir_name);
-	snprintf(src_filename, sizeof(src_filename), "%s" SLASH "%s", mesh->confbase, src_dir_name);
-
-	return copytree(src_filename, src_key, dst_filename, dst_key);
+	config_writer_flush(mesh);
+	return config_ops_copy(mesh, src_dir_name, src_key, dst_dir_name, dst_key);
 }
 
 /// Check the presence of the main configuration file.
@@ -353,9 +238,7 @@ bool main_config_exists(meshlink_handle_t *mesh, const char *conf_subdir) {
 		return false;
 	}
 
-	char path[PATH_MAX];
-	make_main_path(mesh, conf_subdir, path, sizeof(path));
-	return access(path, F_OK) == 0;
+	return config_ops_exists(mesh, conf_subdir, "");
 }
 
 bool config_rename(meshlink_handle_t *mesh, const char *old_conf_subdir, const char *new_conf_subdir) {
@@ -369,6 +252,14 @@ bool config_rename(meshlink_handle_t *mesh, const char *old_conf_subdir, const c
 	char old_path[PATH_MAX];
 	char new_path[PATH_MAX];
 
+	config_writer_flush(mesh);
+	config_log_close(mesh);
+	config_snapshot_free(mesh);
+
+	if(!config_in_confbase(mesh->storage_ops)) {
+		return config_ops_rename(mesh, old_conf_subdir, new_conf_subdir);
+	}
+
 	snprintf(old_path, sizeof(old_path), "%s" SLASH "%s", mesh->confbase, old_conf_subdir);
 	snprintf(new_path, sizeof(new_path), "%s" SLASH "%s", mesh->confbase, new_conf_subdir);
 
@@ -382,20 +273,7 @@ bool config_sync(meshlink_handle_t *mesh, const char *conf_subdir) {
 		return true;
 	}
 
-	char path[PATH_MAX];
-	snprintf(path, sizeof(path), "%s" SLASH "%s" SLASH "hosts", mesh->confbase, conf_subdir);
-
-	if(!sync_path(path)) {
-		return false;
-	}
-
-	snprintf(path, sizeof(path), "%s" SLASH "%s", mesh->confbase, conf_subdir);
-
-	if(!sync_path(path)) {
-		return false;
-	}
-
-	return true;
+	return config_ops_sync(mesh);
 }
 
 bool meshlink_confbase_exists(meshlink_handle_t *mesh) {
@@ -418,7 +296,10 @@ bool meshlink_confbase_exists(meshlink_handle_t *mesh) {
 		confbase_exists = true;
 
 		if(main_config_decrypt(mesh, "new")) {
-			if(!config_destroy(mesh->confbase, "current")) {
+			// Don't keep the logs of sub-directories that are about to be removed open
+			config_log_close(mesh);
+
+			if(!config_destroy(mesh->confbase, mesh->storage_ops, mesh->storage_priv, "current")) {
 				return false;
 			}
 
@@ -434,7 +315,9 @@ bool meshlink_confbase_exists(meshlink_handle_t *mesh) {
 		confbase_exists = true;
 
 		if(main_config_decrypt(mesh, "old")) {
-			if(!config_destroy(mesh->confbase, "current")) {
+			config_log_close(mesh);
+
+			if(!config_destroy(mesh->confbase, mesh->storage_ops, mesh->storage_priv, "current")) {
 				return false;
 			}
 
@@ -448,7 +331,9 @@ bool meshlink_confbase_exists(meshlink_handle_t *mesh) {
 
 	// Cleanup if current is existing with old and new
 	if(confbase_exists && confbase_decryptable) {
-		if(!config_destroy(mesh->confbase, "old") || !config_destroy(mesh->confbase, "new")) {
+		config_log_close(mesh);
+
+		if(!config_destroy(mesh->confbase, mesh->storage_ops, mesh->storage_priv, "old") || !config_destroy(mesh->confbase, mesh->storage_ops, mesh->storage_priv, "new")) {
 			return false;
 		}
 	}
@@ -458,7 +343,7 @@ bool meshlink_confbase_exists(meshlink_handle_t *mesh) {
 
 /// Lock the main configuration file. Creates confbase if necessary.
 bool main_config_lock(meshlink_handle_t *mesh, const char *lock_filename) {
-	if(!mesh->confbase) {
+	if(!mesh->confbase || !config_in_confbase(mesh->storage_ops)) {
 		return true;
 	}
 
@@ -506,6 +391,71 @@ void main_config_unlock(meshlink_handle_t *mesh) {
 	}
 }
 
+/// Get a buffer for the contents of a configuration file.
+/** If available, the mesh's scratch arena is used, otherwise the buffer is allocated on the heap.
+ *  Either way, it is released by config_free().
+ */
+uint8_t *config_buffer(meshlink_handle_t *mesh, config_t *config, size_t len) {
+	config->mapped = false;
+	config->arena = NULL;
+
+	if(!mesh || mesh->config_arena.busy) {
+		return xmalloc(len);
+	}
+
+	config_arena_t *arena = &mesh->config_arena;
+
+	if(arena->size < len) {
+		arena->buf = xrealloc(arena->buf, len);
+		arena->size = len;
+	}
+
+	arena->busy = true;
+	config->arena = arena;
+	return arena->buf;
+}
+
+/// Free the mesh's scratch arena.
+void config_arena_free(meshlink_handle_t *mesh) {
+	assert(!mesh->config_arena.busy);
+
+	if(mesh->config_arena.buf) {
+		memset(mesh->config_arena.buf, 0, mesh->config_arena.size);
+	}
+
+	free(mesh->config_arena.buf);
+	mesh->config_arena.buf = NULL;
+	mesh->config_arena.size = 0;
+}
+
+/// Decrypt the contents of a configuration file.
+static bool config_decrypt(meshlink_handle_t *mesh, const uint8_t *buf, size_t len, config_t *config, const void *key) {
+	if(len <= 12) {
+		logger(mesh, MESHLINK_ERROR, "Cannot decrypt config file\n");
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	uint8_t *decrypted = config_buffer(mesh, config, len);
+	size_t decrypted_len = len;
+	chacha_poly1305_ctx_t *ctx = chacha_poly1305_init();
+	chacha_poly1305_set_key(ctx, key);
+	bool success = chacha_poly1305_decrypt_iv96(ctx, buf, buf + 12, len - 12, decrypted, &decrypted_len);
+	chacha_poly1305_exit(ctx);
+
+	config->buf = decrypted;
+	config->len = decrypted_len;
+
+	if(!success) {
+		logger(mesh, MESHLINK_ERROR, "Cannot decrypt config file\n");
+		meshlink_errno = MESHLINK_ESTORAGE;
+		config_free(config);
+		return false;
+	}
+
+	return true;
+}
+
 /// Read a configuration file from a FILE handle.
 bool config_read_file(meshlink_handle_t *mesh, FILE *f, config_t *config, const void *key) {
 	assert(f);
@@ -518,44 +468,51 @@ bool config_read_file(meshlink_handle_t *mesh, FILE *f, config_t *config, const
 		return false;
 	}
 
+#ifdef HAVE_MMAP
+	// Parse plaintext directly from the page cache, and decrypt without an intermediate copy
+	void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+
+	if(map != MAP_FAILED) {
+		if(key) {
+			bool success = config_decrypt(mesh, map, len, config, key);
+			munmap(map, len);
+			return success;
+		}
+
+		config->buf = map;
+		config->len = len;
+		config->mapped = true;
+		config->arena = NULL;
+		return true;
+	}
+
+#endif
+
 	uint8_t *buf = xmalloc(len);
 
 	if(fread(buf, len, 1, f) != 1) {
 		logger(mesh, MESHLINK_ERROR, "Cannot read config file: %s\n", strerror(errno));
 		meshlink_errno = MESHLINK_ESTORAGE;
+		free(buf);
 		return false;
 	}
 
 	if(key) {
-		uint8_t *decrypted = xmalloc(len);
-		size_t decrypted_len = len;
-		chacha_poly1305_ctx_t *ctx = chacha_poly1305_init();
-		chacha_poly1305_set_key(ctx, key);
-
-		if(len > 12 && chacha_poly1305_decrypt_iv96(ctx, buf, buf + 12, len - 12, decrypted, &decrypted_len)) {
-			chacha_poly1305_exit(ctx);
-			free(buf);
-			config->buf = decrypted;
-			config->len = decrypted_len;
-			return true;
-		} else {
-			logger(mesh, MESHLINK_ERROR, "Cannot decrypt config file\n");
-			meshlink_errno = MESHLINK_ESTORAGE;
-			chacha_poly1305_exit(ctx);
-			free(decrypted);
-			free(buf);
-			return false;
-		}
+		bool success = config_decrypt(mesh, buf, len, config, key);
+		free(buf);
+		return success;
 	}
 
 	config->buf = buf;
 	config->len = len;
+	config->mapped = false;
+	config->arena = NULL;
 
 	return true;
 }
 
-/// Write a configuration file to a FILE handle.
-bool config_write_file(meshlink_handle_t *mesh, FILE *f, const config_t *config, const void *key) {
+/// Write the (possibly encrypted) contents of a configuration file to a FILE handle, without syncing it.
+static bool config_write_data(meshlink_handle_t *mesh, FILE *f, const config_t *config, const void *key) {
 	assert(f);
 
 	if(key) {
@@ -572,19 +529,19 @@ bool config_write_file(meshlink_handle_t *mesh, FILE *f, const config_t *config,
 
 			if(!success) {
 				logger(mesh, MESHLINK_ERROR, "Cannot write config file: %s", strerror(errno));
+				meshlink_errno = MESHLINK_ESTORAGE;
 			}
-
-			meshlink_errno = MESHLINK_ESTORAGE;
 		} else {
 			logger(mesh, MESHLINK_ERROR, "Cannot encrypt config file\n");
 			meshlink_errno = MESHLINK_ESTORAGE;
 		}
 
 		chacha_poly1305_exit(ctx);
-		return success;
-	}
 
-	if(fwrite(config->buf, config->len, 1, f) != 1) {
+		if(!success) {
+			return false;
+		}
+	} else if(fwrite(config->buf, config->len, 1, f) != 1) {
 		logger(mesh, MESHLINK_ERROR, "Cannot write config file: %s", strerror(errno));
 		meshlink_errno = MESHLINK_ESTORAGE;
 		return false;
@@ -596,6 +553,15 @@ bool config_write_file(meshlink_handle_t *mesh, FILE *f, const config_t *config,
 		return false;
 	}
 
+	return true;
+}
+
+/// Write a configuration file to a FILE handle.
+bool config_write_file(meshlink_handle_t *mesh, FILE *f, const config_t *config, const void *key) {
+	if(!config_write_data(mesh, f, config, key)) {
+		return false;
+	}
+
 	if(fsync(fileno(f))) {
 		logger(mesh, MESHLINK_ERROR, "Failed to sync file: %s\n", strerror(errno));
 		meshlink_errno = MESHLINK_ESTORAGE;
@@ -609,11 +575,32 @@ bool config_write_file(meshlink_handle_t *mesh, FILE *f, const config_t *config,
 void config_free(config_t *config) {
 	assert(!config->len || config->buf);
 
-	free((uint8_t *)config->buf);
+	if(config->arena) {
+		config->arena->busy = false;
+#ifdef HAVE_MMAP
+	} else if(config->mapped) {
+		munmap((void *)config->buf, config->len);
+#endif
+	} else {
+		free((uint8_t *)config->buf);
+	}
+
 	config->buf = NULL;
 	config->len = 0;
+	config->mapped = false;
+	config->arena = NULL;
 }
 
+/// The state of a host configuration file in the queue of the background writer.
+typedef enum config_queued_t {
+	CONFIG_NOT_QUEUED,
+	CONFIG_QUEUED,                  ///< queued, and copied if a config_t was given
+	CONFIG_QUEUED_OTHER_KEY,        ///< queued, but encrypted with a different key than requested
+} config_queued_t;
+
+static config_queued_t config_writer_read(meshlink_handle_t *mesh, const char *conf_subdir, const char *name, config_t *config, const void *key);
+static size_t config_writer_names(meshlink_handle_t *mesh, const char *conf_subdir, char ***names);
+
 /// Check the presence of a host configuration file.
 bool config_exists(meshlink_handle_t *mesh, const char *conf_subdir, const char *name) {
 	assert(conf_subdir);
@@ -622,10 +609,16 @@ bool config_exists(meshlink_handle_t *mesh, const char *conf_subdir, const char
 		return false;
 	}
 
-	char path[PATH_MAX];
-	make_host_path(mesh, conf_subdir, name, path, sizeof(path));
+	if(mesh->config_snapshot && !strcmp(conf_subdir, "current")) {
+		return config_snapshot_exists(mesh, name);
+	}
 
-	return access(path, F_OK) == 0;
+	// A file that is still queued might not be on storage yet
+	if(config_writer_read(mesh, conf_subdir, name, NULL, NULL) != CONFIG_NOT_QUEUED) {
+		return true;
+	}
+
+	return config_ops_exists(mesh, conf_subdir, name);
 }
 
 /// Read a host configuration file.
@@ -636,25 +629,45 @@ bool config_read(meshlink_handle_t *mesh, const char *conf_subdir, const char *n
 		return false;
 	}
 
-	char path[PATH_MAX];
-	make_host_path(mesh, conf_subdir, name, path, sizeof(path));
+	if(mesh->config_snapshot && !strcmp(conf_subdir, "current") && key == mesh->config_key) {
+		return config_snapshot_read(mesh, name, config);
+	}
 
-	FILE *f = fopen(path, "r");
+	// Return the newest version if it is still queued, instead of waiting for the writer.
+	// Only a read with a different key than the queued write, as during key rotation, has to wait.
+	switch(config_writer_read(mesh, conf_subdir, name, config, key)) {
+	case CONFIG_QUEUED:
+		return true;
 
-	if(!f) {
-		logger(mesh, MESHLINK_ERROR, "Failed to open `%s': %s", path, strerror(errno));
-		return false;
-	}
+	case CONFIG_QUEUED_OTHER_KEY:
+		config_writer_flush(mesh);
+		break;
 
-	if(!config_read_file(mesh, f, config, key)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to read `%s': %s", path, strerror(errno));
-		fclose(f);
-		return false;
+	case CONFIG_NOT_QUEUED:
+		break;
 	}
 
-	fclose(f);
+	return config_ops_read(mesh, conf_subdir, name, config, key);
+}
+
+/// Names of queued files, which config_scan_all() reports itself instead of their versions on storage.
+typedef struct queued_scan {
+	config_scan_action_t action;
+	void *arg;
+	char **names;
+	size_t count;
+} queued_scan_t;
 
-	return true;
+static bool scan_unless_queued(meshlink_handle_t *mesh, const char *name, void *arg) {
+	queued_scan_t *scan = arg;
+
+	for(size_t i = 0; i < scan->count; i++) {
+		if(!strcmp(scan->names[i], name)) {
+			return true;
+		}
+	}
+
+	return scan->action(mesh, name, scan->arg);
 }
 
 bool config_scan_all(meshlink_handle_t *mesh, const char *conf_subdir, const char *conf_type, config_scan_action_t action, void *arg) {
@@ -665,32 +678,28 @@ bool config_scan_all(meshlink_handle_t *mesh, const char *conf_subdir, const cha
 		return true;
 	}
 
-	DIR *dir;
-	struct dirent *ent;
-	char dname[PATH_MAX];
-	snprintf(dname, sizeof(dname), "%s" SLASH "%s" SLASH "%s", mesh->confbase, conf_subdir, conf_type);
+	if(mesh->config_snapshot && !strcmp(conf_subdir, "current") && !strcmp(conf_type, "hosts")) {
+		return config_snapshot_scan_all(mesh, action, arg);
+	}
 
-	dir = opendir(dname);
+	assert(!strcmp(conf_type, "hosts"));
 
-	if(!dir) {
-		logger(mesh, MESHLINK_ERROR, "Could not open %s: %s", dname, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
+	// Files that are still queued might not be on storage yet, so report those separately
+	queued_scan_t scan = {.action = action, .arg = arg};
+	scan.count = config_writer_names(mesh, conf_subdir, &scan.names);
 
-	while((ent = readdir(dir))) {
-		if(ent->d_name[0] == '.') {
-			continue;
-		}
+	bool success = config_ops_scan_all(mesh, conf_subdir, scan_unless_queued, &scan);
 
-		if(!action(mesh, ent->d_name, arg)) {
-			closedir(dir);
-			return false;
+	for(size_t i = 0; i < scan.count; i++) {
+		if(success && !action(mesh, scan.names[i], arg)) {
+			success = false;
 		}
+
+		free(scan.names[i]);
 	}
 
-	closedir(dir);
-	return true;
+	free(scan.names);
+	return success;
 }
 
 /// Write a host configuration file.
@@ -703,38 +712,13 @@ bool config_write(meshlink_handle_t *mesh, const char *conf_subdir, const char *
 		return true;
 	}
 
-	char path[PATH_MAX];
-	char tmp_path[PATH_MAX + 4];
-	make_host_path(mesh, conf_subdir, name, path, sizeof(path));
-	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
-
-	FILE *f = fopen(tmp_path, "w");
-
-	if(!f) {
-		logger(mesh, MESHLINK_ERROR, "Failed to open `%s': %s", tmp_path, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
-
-	if(!config_write_file(mesh, f, config, key)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to write `%s': %s", tmp_path, strerror(errno));
-		fclose(f);
-		return false;
-	}
-
-	if(fclose(f)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to close `%s': %s", tmp_path, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
+	TRACE3(config_write, conf_subdir, name, config->len);
 
-	if(rename(tmp_path, path)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to rename `%s' to `%s': %s", tmp_path, path, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
+	// Don't let an older queued write overwrite this one
+	config_writer_flush(mesh);
+	config_snapshot_free(mesh);
 
-	return true;
+	return config_snapshot_remove(mesh) && config_ops_write(mesh, conf_subdir, name, config, key) && config_ops_sync(mesh);
 }
 
 /// Delete a host configuration file.
@@ -746,16 +730,10 @@ bool config_delete(meshlink_handle_t *mesh, const char *conf_subdir, const char
 		return true;
 	}
 
-	char path[PATH_MAX];
-	make_host_path(mesh, conf_subdir, name, path, sizeof(path));
-
-	if(unlink(path) && errno != ENOENT) {
-		logger(mesh, MESHLINK_ERROR, "Failed to unlink `%s': %s", path, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
-	}
+	config_writer_flush(mesh);
+	config_snapshot_free(mesh);
 
-	return true;
+	return config_snapshot_remove(mesh) && config_ops_delete(mesh, conf_subdir, name);
 }
 
 /// Read the main configuration file.
@@ -767,67 +745,434 @@ bool main_config_read(meshlink_handle_t *mesh, const char *conf_subdir, config_t
 		return false;
 	}
 
-	char path[PATH_MAX];
-	make_main_path(mesh, conf_subdir, path, sizeof(path));
+	if(mesh->config_snapshot && !strcmp(conf_subdir, "current") && key == mesh->config_key) {
+		return config_snapshot_read(mesh, "", config);
+	}
 
-	FILE *f = fopen(path, "r");
+	return config_ops_read(mesh, conf_subdir, "", config, key);
+}
 
-	if(!f) {
-		logger(mesh, MESHLINK_ERROR, "Failed to open `%s': %s", path, strerror(errno));
+/// Write the main configuration file.
+bool main_config_write(meshlink_handle_t *mesh, const char *conf_subdir, const config_t *config, void *key) {
+	assert(conf_subdir);
+	assert(config);
+
+	if(!mesh->confbase) {
+		return true;
+	}
+
+	TRACE3(config_write, conf_subdir, "", config->len);
+	config_snapshot_free(mesh);
+
+	return config_snapshot_remove(mesh) && config_ops_write(mesh, conf_subdir, "", config, key) && config_ops_sync(mesh);
+}
+
+/// A host configuration file waiting to be written by the background writer.
+typedef struct config_pending {
+	struct config_pending *next;
+	char *conf_subdir;
+	char *name;
+	uint8_t *buf;
+	size_t len;
+	bool encrypted;
+	uint8_t key[CHACHA_POLY1305_KEYLEN];
+} config_pending_t;
+
+/// A log message of the background writer, waiting to be passed to the log callback.
+typedef struct config_message {
+	struct config_message *next;
+	meshlink_log_level_t level;
+	char text[];
+} config_message_t;
+
+#define CONFIG_WRITER_MAX_MESSAGES 16
+
+/// State of the background configuration writer.
+struct config_writer {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	config_pending_t *pending;
+	config_message_t *messages;
+	config_message_t **messages_tail;
+	int message_count;
+	int messages_dropped;
+	struct timespec deadline;
+	config_pending_t *writing;              /* the batch being written, readers use it until it has been synced */
+	bool flush;
+	bool stop;
+	bool failed;
+};
+
+/// The writer whose thread is the current thread, if any.
+static __thread struct config_writer *current_writer;
+
+static void free_pending(config_pending_t *p) {
+	free(p->conf_subdir);
+	free(p->name);
+	free(p->buf);
+	memset(p->key, 0, sizeof(p->key));
+	free(p);
+}
+
+/// Write out a batch of configuration files, syncing the storage only once.
+static bool config_write_batch(meshlink_handle_t *mesh, config_pending_t *batch) {
+	// The snapshot must not outlive the files it describes, the event loop leaves removing it to us
+	if(!config_snapshot_remove(mesh)) {
 		return false;
 	}
 
-	if(!config_read_file(mesh, f, config, key)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to read `%s': %s", path, strerror(errno));
-		fclose(f);
+	bool success = true;
+
+	// All files are written before the storage is synced once
+	for(config_pending_t *p = batch; p; p = p->next) {
+		config_t config = {.buf = p->buf, .len = p->len};
+
+		if(!config_ops_write(mesh, p->conf_subdir, p->name, &config, p->encrypted ? p->key : NULL)) {
+			success = false;
+		}
+	}
+
+	return config_ops_sync(mesh) && success;
+}
+
+/// Keep a log message of the writer thread, so it can be logged later by a thread holding the mesh mutex.
+bool config_writer_log(meshlink_handle_t *mesh, int level, const char *message) {
+	struct config_writer *writer = current_writer;
+
+	if(!writer || writer != mesh->config_writer) {
 		return false;
 	}
 
-	fclose(f);
+	size_t len = strlen(message) + 1;
+	config_message_t *m = xmalloc(sizeof(*m) + len);
+	m->next = NULL;
+	m->level = level;
+	memcpy(m->text, message, len);
 
+	pthread_mutex_lock(&writer->mutex);
+
+	if(writer->message_count < CONFIG_WRITER_MAX_MESSAGES) {
+		*writer->messages_tail = m;
+		writer->messages_tail = &m->next;
+		writer->message_count++;
+		m = NULL;
+	} else {
+		writer->messages_dropped++;
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
+
+	free(m);
 	return true;
 }
 
-/// Write the main configuration file.
-bool main_config_write(meshlink_handle_t *mesh, const char *conf_subdir, const config_t *config, void *key) {
+/// Log the messages the writer thread kept, must be called with the mesh mutex held.
+static void report_messages(meshlink_handle_t *mesh, struct config_writer *writer) {
+	pthread_mutex_lock(&writer->mutex);
+	config_message_t *messages = writer->messages;
+	int dropped = writer->messages_dropped;
+	writer->messages = NULL;
+	writer->messages_tail = &writer->messages;
+	writer->message_count = 0;
+	writer->messages_dropped = 0;
+	pthread_mutex_unlock(&writer->mutex);
+
+	for(config_message_t *next; messages; messages = next) {
+		next = messages->next;
+		logger(mesh, messages->level, "%s", messages->text);
+		free(messages);
+	}
+
+	if(dropped) {
+		logger(mesh, MESHLINK_ERROR, "%d more messages from the configuration writer were dropped", dropped);
+	}
+}
+
+static void *config_writer_thread(void *arg) {
+	meshlink_handle_t *mesh = arg;
+	struct config_writer *writer = mesh->config_writer;
+
+	// Log messages are kept until the event loop can pass them to the application
+	current_writer = writer;
+
+	pthread_mutex_lock(&writer->mutex);
+
+	while(true) {
+		while(!writer->pending && !writer->stop) {
+			pthread_cond_wait(&writer->cond, &writer->mutex);
+		}
+
+		if(!writer->pending) {
+			break;
+		}
+
+		// Give other writes the chance to join this batch
+		while(!writer->flush && !writer->stop) {
+			if(pthread_cond_timedwait(&writer->cond, &writer->mutex, &writer->deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+
+		config_pending_t *batch = writer->pending;
+		writer->pending = NULL;
+		writer->writing = batch;
+		pthread_mutex_unlock(&writer->mutex);
+
+		TRACE1(config_batch_start, batch->conf_subdir);
+		bool success = config_write_batch(mesh, batch);
+		TRACE1(config_batch_done, success);
+
+		pthread_mutex_lock(&writer->mutex);
+		writer->writing = NULL;
+
+		for(config_pending_t *next; batch; batch = next) {
+			next = batch->next;
+			free_pending(batch);
+		}
+
+		if(!success) {
+			writer->failed = true;
+		}
+
+		pthread_cond_broadcast(&writer->cond);
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
+	return NULL;
+}
+
+/// Queue a host configuration file to be written by the background writer.
+bool config_write_async(meshlink_handle_t *mesh, const char *conf_subdir, const char *name, const config_t *config, void *key) {
 	assert(conf_subdir);
+	assert(name);
 	assert(config);
 
 	if(!mesh->confbase) {
 		return true;
 	}
 
-	char path[PATH_MAX];
-	char tmp_path[PATH_MAX + 4];
-	make_main_path(mesh, conf_subdir, path, sizeof(path));
-	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	config_snapshot_free(mesh);
 
-	FILE *f = fopen(tmp_path, "w");
+	struct config_writer *writer = mesh->config_writer;
 
-	if(!f) {
-		logger(mesh, MESHLINK_ERROR, "Failed to open `%s': %s", tmp_path, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
+	if(!writer) {
+		writer = xzalloc(sizeof(*writer));
+		pthread_mutex_init(&writer->mutex, NULL);
+		pthread_cond_init(&writer->cond, NULL);
+		writer->messages_tail = &writer->messages;
+		mesh->config_writer = writer;
+
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, 128 * 1024);
+
+		int err = pthread_create(&writer->thread, &attr, config_writer_thread, mesh);
+
+		if(err) {
+			logger(mesh, MESHLINK_WARNING, "Could not start config writer thread: %s\n", strerror(err));
+			pthread_attr_destroy(&attr);
+			pthread_cond_destroy(&writer->cond);
+			pthread_mutex_destroy(&writer->mutex);
+			free(writer);
+			mesh->config_writer = NULL;
+			return config_write(mesh, conf_subdir, name, config, key);
+		}
+
+		pthread_attr_destroy(&attr);
 	}
 
-	if(!config_write_file(mesh, f, config, key)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to write `%s': %s", tmp_path, strerror(errno));
-		fclose(f);
-		return false;
+	uint8_t *buf = xmalloc(config->len);
+	memcpy(buf, config->buf, config->len);
+
+	pthread_mutex_lock(&writer->mutex);
+
+	bool first = !writer->pending;
+
+	// Coalesce with a write to the same file that is still pending
+	config_pending_t **pp = &writer->pending;
+
+	for(; *pp; pp = &(*pp)->next) {
+		if(!strcmp((*pp)->name, name) && !strcmp((*pp)->conf_subdir, conf_subdir)) {
+			break;
+		}
 	}
 
-	if(rename(tmp_path, path)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to rename `%s' to `%s': %s", tmp_path, path, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		fclose(f);
-		return false;
+	config_pending_t *p = *pp;
+
+	if(p) {
+		free(p->buf);
+	} else {
+		p = xzalloc(sizeof(*p));
+		p->conf_subdir = xstrdup(conf_subdir);
+		p->name = xstrdup(name);
+		*pp = p;
 	}
 
-	if(fclose(f)) {
-		logger(mesh, MESHLINK_ERROR, "Failed to close `%s': %s", tmp_path, strerror(errno));
-		meshlink_errno = MESHLINK_ESTORAGE;
-		return false;
+	p->buf = buf;
+	p->len = config->len;
+	p->encrypted = key;
+
+	if(key) {
+		memcpy(p->key, key, sizeof(p->key));
 	}
 
+	// The coalescing window starts with the first write of a batch
+	if(first) {
+		clock_gettime(CLOCK_REALTIME, &writer->deadline);
+		writer->deadline.tv_sec += mesh->storage_flush_window / 1000;
+		writer->deadline.tv_nsec += (mesh->storage_flush_window % 1000) * 1000000;
+
+		if(writer->deadline.tv_nsec >= 1000000000) {
+			writer->deadline.tv_sec++;
+			writer->deadline.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_broadcast(&writer->cond);
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
 	return true;
 }
+
+/// Wait until all pending writes of the background writer have finished.
+void config_writer_flush(meshlink_handle_t *mesh) {
+	struct config_writer *writer = mesh->config_writer;
+
+	if(!writer) {
+		return;
+	}
+
+	pthread_mutex_lock(&writer->mutex);
+
+	if(writer->pending || writer->writing) {
+		writer->flush = true;
+		pthread_cond_broadcast(&writer->cond);
+
+		while(writer->pending || writer->writing) {
+			pthread_cond_wait(&writer->cond, &writer->mutex);
+		}
+
+		writer->flush = false;
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
+
+	report_messages(mesh, writer);
+}
+
+/// Find the newest queued write of a file, must be called with the writer mutex held.
+static config_pending_t *find_queued(struct config_writer *writer, const char *conf_subdir, const char *name) {
+	// Writes that are still pending are newer than those in the batch being written
+	config_pending_t *lists[] = {writer->pending, writer->writing};
+
+	for(size_t i = 0; i < sizeof(lists) / sizeof(*lists); i++) {
+		for(config_pending_t *p = lists[i]; p; p = p->next) {
+			if(!strcmp(p->name, name) && !strcmp(p->conf_subdir, conf_subdir)) {
+				return p;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/// Copy a file from the queue of the background writer, if it is queued with the same key.
+static config_queued_t config_writer_read(meshlink_handle_t *mesh, const char *conf_subdir, const char *name, config_t *config, const void *key) {
+	struct config_writer *writer = mesh->config_writer;
+
+	if(!writer) {
+		return CONFIG_NOT_QUEUED;
+	}
+
+	pthread_mutex_lock(&writer->mutex);
+
+	config_pending_t *p = find_queued(writer, conf_subdir, name);
+	config_queued_t result = p ? CONFIG_QUEUED : CONFIG_NOT_QUEUED;
+
+	if(p && config) {
+		if(!key != !p->encrypted || (key && memcmp(key, p->key, sizeof(p->key)))) {
+			result = CONFIG_QUEUED_OTHER_KEY;
+		} else {
+			uint8_t *buf = config_buffer(mesh, config, p->len ? p->len : 1);
+			memcpy(buf, p->buf, p->len);
+			config->buf = buf;
+			config->len = p->len;
+		}
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
+	return result;
+}
+
+/// Collect the names of all queued files in a sub-directory, returns how many there are.
+static size_t config_writer_names(meshlink_handle_t *mesh, const char *conf_subdir, char ***names) {
+	struct config_writer *writer = mesh->config_writer;
+	size_t count = 0;
+	*names = NULL;
+
+	if(!writer) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&writer->mutex);
+
+	config_pending_t *lists[] = {writer->pending, writer->writing};
+
+	for(size_t i = 0; i < sizeof(lists) / sizeof(*lists); i++) {
+		for(config_pending_t *p = lists[i]; p; p = p->next) {
+			if(strcmp(p->conf_subdir, conf_subdir) || !*p->name || find_queued(writer, conf_subdir, p->name) != p) {
+				continue;
+			}
+
+			*names = xrealloc(*names, (count + 1) * sizeof(**names));
+			(*names)[count++] = xstrdup(p->name);
+		}
+	}
+
+	pthread_mutex_unlock(&writer->mutex);
+	return count;
+}
+
+/// Check whether the background writer failed to write anything since the last call.
+bool config_writer_check(meshlink_handle_t *mesh) {
+	struct config_writer *writer = mesh->config_writer;
+
+	if(!writer) {
+		return true;
+	}
+
+	pthread_mutex_lock(&writer->mutex);
+	bool failed = writer->failed;
+	writer->failed = false;
+	pthread_mutex_unlock(&writer->mutex);
+
+	report_messages(mesh, writer);
+
+	return !failed;
+}
+
+/// Write out everything that is pending and stop the background writer.
+void config_writer_exit(meshlink_handle_t *mesh) {
+	struct config_writer *writer = mesh->config_writer;
+
+	if(!writer) {
+		return;
+	}
+
+	pthread_mutex_lock(&writer->mutex);
+	writer->stop = true;
+	pthread_cond_broadcast(&writer->cond);
+	pthread_mutex_unlock(&writer->mutex);
+
+	if(pthread_join(writer->thread, NULL) != 0) {
+		abort();
+	}
+
+	report_messages(mesh, writer);
+
+	pthread_cond_destroy(&writer->cond);
+	pthread_mutex_destroy(&writer->mutex);
+	free(writer);
+	mesh->config_writer = NULL;
+}
@@ -21,22 +21,36 @@
 */
 
 struct meshlink_handle;
+struct meshlink_storage_ops;
+
+/// A reusable buffer that configuration files are decrypted into.
+typedef struct config_arena_t {
+	uint8_t *buf;
+	size_t size;
+	bool busy;
+} config_arena_t;
 
 typedef struct config_t {
 	const uint8_t *buf;
 	size_t len;
+	bool mapped;                    ///< buf is a read-only mapping of the configuration file
+	struct config_arena_t *arena;   ///< buf belongs to this arena
 } config_t;
 
+typedef struct config_snapshot config_snapshot_t;
+
 typedef bool (*config_scan_action_t)(struct meshlink_handle *mesh, const char *name, void *arg);
 
 bool config_read_file(struct meshlink_handle *mesh, FILE *f, struct config_t *, const void *key) __attribute__((__warn_unused_result__));
 bool config_write_file(struct meshlink_handle *mesh, FILE *f, const struct config_t *, const void *key) __attribute__((__warn_unused_result__));
 void config_free(struct config_t *config);
+uint8_t *config_buffer(struct meshlink_handle *mesh, struct config_t *config, size_t len) __attribute__((__warn_unused_result__));
+void config_arena_free(struct meshlink_handle *mesh);
 
 bool meshlink_confbase_exists(struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
 
 bool config_init(struct meshlink_handle *mesh, const char *conf_subdir) __attribute__((__warn_unused_result__));
-bool config_destroy(const char *confbase, const char *conf_subdir) __attribute__((__warn_unused_result__));
+bool config_destroy(const char *confbase, const struct meshlink_storage_ops *ops, void *priv, const char *conf_subdir) __attribute__((__warn_unused_result__));
 bool config_copy(struct meshlink_handle *mesh, const char *src_dir_name, const void *src_key, const char *dst_dir_name, const void *dst_key) __attribute__((__warn_unused_result__));
 bool config_rename(struct meshlink_handle *mesh, const char *old_conf_subdir, const char *new_conf_subdir) __attribute__((__warn_unused_result__));
 bool config_sync(struct meshlink_handle *mesh, const char *conf_subdir) __attribute__((__warn_unused_result__));
@@ -52,6 +66,40 @@ bool config_exists(struct meshlink_handle *mesh, const char *conf_subdir, const
 bool config_read(struct meshlink_handle *mesh, const char *conf_subdir, const char *name, struct config_t *, void *key) __attribute__((__warn_unused_result__));
 bool config_write(struct meshlink_handle *mesh, const char *conf_subdir, const char *name, const struct config_t *, void *key) __attribute__((__warn_unused_result__));
 bool config_delete(struct meshlink_handle *mesh, const char *conf_subdir, const char *name) __attribute__((__warn_unused_result__));
+bool config_write_async(struct meshlink_handle *mesh, const char *conf_subdir, const char *name, const struct config_t *, void *key) __attribute__((__warn_unused_result__));
 bool config_scan_all(struct meshlink_handle *mesh, const char *conf_subdir, const char *conf_type, config_scan_action_t action, void *arg) __attribute__((__warn_unused_result__));
 
+extern const struct meshlink_storage_ops config_files_ops;
+extern const struct meshlink_storage_ops config_log_ops;
+bool config_in_confbase(const struct meshlink_storage_ops *ops) __attribute__((__warn_unused_result__));
+void *config_files_create(const char *confbase) __attribute__((__warn_unused_result__));
+void config_files_free(void *priv);
+bool config_files_read(struct meshlink_handle *mesh, const char *storage_key, struct config_t *, const void *key) __attribute__((__warn_unused_result__));
+void config_log_close(struct meshlink_handle *mesh);
+uint32_t config_crc32(const uint8_t *buf, size_t len) __attribute__((__warn_unused_result__));
+
+bool config_ops_exists(struct meshlink_handle *mesh, const char *conf_subdir, const char *name) __attribute__((__warn_unused_result__));
+bool config_ops_read(struct meshlink_handle *mesh, const char *conf_subdir, const char *name, struct config_t *, const void *key) __attribute__((__warn_unused_result__));
+bool config_ops_write(struct meshlink_handle *mesh, const char *conf_subdir, const char *name, const struct config_t *, const void *key) __attribute__((__warn_unused_result__));
+bool config_ops_delete(struct meshlink_handle *mesh, const char *conf_subdir, const char *name) __attribute__((__warn_unused_result__));
+bool config_ops_scan_all(struct meshlink_handle *mesh, const char *conf_subdir, config_scan_action_t action, void *arg) __attribute__((__warn_unused_result__));
+bool config_ops_sync(struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
+bool config_ops_wipe(const struct meshlink_storage_ops *ops, void *priv, const char *conf_subdir) __attribute__((__warn_unused_result__));
+bool config_ops_copy(struct meshlink_handle *mesh, const char *src_conf_subdir, const void *src_key, const char *dst_conf_subdir, const void *dst_key) __attribute__((__warn_unused_result__));
+bool config_ops_rename(struct meshlink_handle *mesh, const char *old_conf_subdir, const char *new_conf_subdir) __attribute__((__warn_unused_result__));
+
+bool config_snapshot_load(struct meshlink_handle *mesh);
+void config_snapshot_free(struct meshlink_handle *mesh);
+bool config_snapshot_remove(struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
+bool config_snapshot_write(struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
+bool config_snapshot_exists(struct meshlink_handle *mesh, const char *name) __attribute__((__warn_unused_result__));
+bool config_snapshot_read(struct meshlink_handle *mesh, const char *name, struct config_t *) __attribute__((__warn_unused_result__));
+bool config_snapshot_matches(struct meshlink_handle *mesh, const char *name, const struct config_t *) __attribute__((__warn_unused_result__));
+bool config_snapshot_scan_all(struct meshlink_handle *mesh, config_scan_action_t action, void *arg) __attribute__((__warn_unused_result__));
+
+void config_writer_flush(struct meshlink_handle *mesh);
+bool config_writer_check(struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
+bool config_writer_log(struct meshlink_handle *mesh, int level, const char *message);
+void config_writer_exit(struct meshlink_handle *mesh);
+
 #endif
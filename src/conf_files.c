@@ -0,0 +1,427 @@
+/*
+    conf_files.c -- configuration storage as separate files in the configuration directory
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+#include <assert.h>
+
+#include "conf.h"
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "xalloc.h"
+
+/* The storage keys are used as paths relative to the configuration directory.
+   Each file is written to a temporary file, which is only renamed into place when the storage is synced,
+   so a file is always either the old or the new version, and a new file only becomes visible once it is durable.
+   A sync writes all temporary files to disk at once, renames them in the order they were written,
+   and then syncs each directory files were renamed in or removed from once.
+*/
+
+#define FILES_MAX_DIRTY 4
+
+/// A file that has been written to a temporary file, but not renamed into place yet.
+typedef struct files_pending {
+	struct files_pending *next;
+	char path[];
+} files_pending_t;
+
+typedef struct files_storage {
+	char *confbase;
+	pthread_mutex_t mutex;
+	files_pending_t *pending;               // files to rename on the next sync, in the order they were written
+	files_pending_t **pending_tail;
+	int dirty_count;
+	bool overflow;                          // more directories were modified than fit in dirty
+	char *dirty[FILES_MAX_DIRTY];           // directories that need to be synced
+} files_storage_t;
+
+static void make_path(files_storage_t *storage, const char *key, char *path, size_t len) {
+	snprintf(path, len, "%s" SLASH "%s", storage->confbase, key);
+}
+
+/// Remember that the directory containing path needs to be synced, must be called with the mutex held.
+static void mark_dirty(files_storage_t *storage, const char *path) {
+	const char *slash = strrchr(path, '/');
+	size_t len = slash ? (size_t)(slash - path) : strlen(path);
+
+	for(int i = 0; i < storage->dirty_count; i++) {
+		if(strlen(storage->dirty[i]) == len && !strncmp(storage->dirty[i], path, len)) {
+			return;
+		}
+	}
+
+	if(storage->dirty_count < FILES_MAX_DIRTY) {
+		char *dir = xmalloc(len + 1);
+		memcpy(dir, path, len);
+		dir[len] = 0;
+		storage->dirty[storage->dirty_count++] = dir;
+	} else {
+		storage->overflow = true;
+	}
+}
+
+/// Find the pending rename of a file, must be called with the mutex held.
+static files_pending_t **find_pending(files_storage_t *storage, const char *path) {
+	files_pending_t **p;
+
+	for(p = &storage->pending; *p; p = &(*p)->next) {
+		if(!strcmp((*p)->path, path)) {
+			break;
+		}
+	}
+
+	return p;
+}
+
+/// Forget a pending rename and remove its temporary file, must be called with the mutex held.
+static void drop_pending(files_storage_t *storage, files_pending_t **p) {
+	files_pending_t *pending = *p;
+	char tmp_path[PATH_MAX + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", pending->path);
+	unlink(tmp_path);
+
+	*p = pending->next;
+
+	if(!*p) {
+		storage->pending_tail = p;
+	}
+
+	free(pending);
+}
+
+static bool files_read(void *priv, const char *key, void *data, size_t *len) {
+	char path[PATH_MAX];
+	make_path(priv, key, path, sizeof(path));
+
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+
+	if(fstat(fd, &st) || (data && *len < (size_t)st.st_size)) {
+		close(fd);
+		return false;
+	}
+
+	uint8_t *p = data;
+	size_t left = data ? st.st_size : 0;
+
+	while(left) {
+		ssize_t result = read(fd, p, left);
+
+		if(result <= 0) {
+			if(result < 0 && errno == EINTR) {
+				continue;
+			}
+
+			close(fd);
+			return false;
+		}
+
+		p += result;
+		left -= result;
+	}
+
+	close(fd);
+	*len = st.st_size;
+	return true;
+}
+
+/// Create the directories leading up to a file, the configuration directory itself must already exist.
+static bool make_dirs(files_storage_t *storage, char *path) {
+	for(char *slash = path + strlen(storage->confbase) + 1; (slash = strchr(slash, '/')); slash++) {
+		*slash = 0;
+		bool success = !mkdir(path, 0700) || errno == EEXIST;
+		*slash = '/';
+
+		if(!success) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool files_write(void *priv, const char *key, const void *data, size_t len) {
+	files_storage_t *storage = priv;
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 4];
+	make_path(storage, key, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *f = fopen(tmp_path, "w");
+
+	if(!f && errno == ENOENT && make_dirs(storage, tmp_path)) {
+		f = fopen(tmp_path, "w");
+	}
+
+	if(!f) {
+		return false;
+	}
+
+	// The data is only synced when the storage is, together with all other files written until then
+	bool written = !len || fwrite(data, len, 1, f) == 1;
+
+	if(fclose(f) || !written) {
+		unlink(tmp_path);
+		return false;
+	}
+
+	pthread_mutex_lock(&storage->mutex);
+
+	// A file written again before the storage is synced keeps its place in the order
+	if(!*find_pending(storage, path)) {
+		size_t pathlen = strlen(path) + 1;
+		files_pending_t *pending = xmalloc(sizeof(*pending) + pathlen);
+		pending->next = NULL;
+		memcpy(pending->path, path, pathlen);
+		*storage->pending_tail = pending;
+		storage->pending_tail = &pending->next;
+	}
+
+	pthread_mutex_unlock(&storage->mutex);
+	return true;
+}
+
+static bool files_remove(void *priv, const char *key) {
+	files_storage_t *storage = priv;
+	char path[PATH_MAX];
+	make_path(storage, key, path, sizeof(path));
+
+	pthread_mutex_lock(&storage->mutex);
+
+	files_pending_t **p = find_pending(storage, path);
+
+	if(*p) {
+		drop_pending(storage, p);
+	}
+
+	bool success = !unlink(path) || errno == ENOENT;
+
+	if(success) {
+		mark_dirty(storage, path);
+	}
+
+	pthread_mutex_unlock(&storage->mutex);
+	return success;
+}
+
+/// Call action for all files below a directory whose keys start with prefix.
+static bool scan_dir(files_storage_t *storage, const char *dir_key, const char *prefix, bool (*action)(void *arg, const char *key), void *arg) {
+	char path[PATH_MAX];
+	make_path(storage, dir_key, path, sizeof(path));
+
+	DIR *dir = opendir(path);
+
+	if(!dir) {
+		return errno == ENOENT || errno == ENOTDIR;
+	}
+
+	bool success = true;
+	struct dirent *ent;
+
+	while(success && (ent = readdir(dir))) {
+		size_t namelen = strlen(ent->d_name);
+
+		// Skip hidden files and temporary files that were left behind
+		if(ent->d_name[0] == '.' || (namelen > 4 && !strcmp(ent->d_name + namelen - 4, ".tmp"))) {
+			continue;
+		}
+
+		char key[PATH_MAX];
+		snprintf(key, sizeof(key), "%s%s%s", dir_key, *dir_key ? "/" : "", ent->d_name);
+		size_t keylen = strlen(key);
+
+		if(ent->d_type == DT_DIR) {
+			if(!strncmp(key, prefix, keylen < strlen(prefix) ? keylen : strlen(prefix))) {
+				success = scan_dir(storage, key, prefix, action, arg);
+			}
+		} else if(!strncmp(key, prefix, strlen(prefix))) {
+			success = action(arg, key);
+		}
+	}
+
+	closedir(dir);
+	return success;
+}
+
+static bool files_scan(void *priv, const char *prefix, bool (*action)(void *arg, const char *key), void *arg) {
+	// Start in the deepest directory that is part of the prefix
+	char dir_key[PATH_MAX];
+	snprintf(dir_key, sizeof(dir_key), "%s", prefix);
+	char *slash = strrchr(dir_key, '/');
+
+	if(slash) {
+		*slash = 0;
+	} else {
+		*dir_key = 0;
+	}
+
+	return scan_dir(priv, dir_key, prefix, action, arg);
+}
+
+/// Make sure the data of all pending files is on disk, must be called with the mutex held.
+static bool sync_pending(files_storage_t *storage) {
+	if(!storage->pending) {
+		return true;
+	}
+
+#ifdef HAVE_SYNCFS
+	// One call syncs all files, instead of waiting for each of them in turn
+	int fd = open(storage->confbase, O_RDONLY);
+
+	if(fd < 0) {
+		return false;
+	}
+
+	bool success = !syncfs(fd);
+	close(fd);
+	return success;
+#else
+
+	for(files_pending_t *p = storage->pending; p; p = p->next) {
+		char tmp_path[PATH_MAX + 4];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", p->path);
+
+		if(!sync_path(tmp_path)) {
+			return false;
+		}
+	}
+
+	return true;
+#endif
+}
+
+static bool files_sync(void *priv) {
+	files_storage_t *storage = priv;
+
+	pthread_mutex_lock(&storage->mutex);
+
+	// The data has to be on disk before the files are renamed into place
+	bool success = sync_pending(storage);
+
+	while(storage->pending) {
+		files_pending_t *p = storage->pending;
+		char tmp_path[PATH_MAX + 4];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", p->path);
+
+		if(success && !rename(tmp_path, p->path)) {
+			mark_dirty(storage, p->path);
+			storage->pending = p->next;
+			free(p);
+		} else {
+			success = false;
+			drop_pending(storage, &storage->pending);
+		}
+	}
+
+	storage->pending_tail = &storage->pending;
+
+	for(int i = 0; i < storage->dirty_count; i++) {
+		// The directory might have been renamed or removed since
+		if(success && !access(storage->dirty[i], F_OK) && !sync_path(storage->dirty[i])) {
+			success = false;
+		}
+
+		free(storage->dirty[i]);
+	}
+
+	storage->dirty_count = 0;
+
+	// Too many directories were modified to keep track of, just sync all of them
+	if(storage->overflow) {
+		storage->overflow = false;
+		static const char *const subdirs[] = {"current", "current/hosts", "new", "new/hosts", "old", "old/hosts"};
+
+		for(size_t i = 0; success && i < sizeof(subdirs) / sizeof(*subdirs); i++) {
+			char path[PATH_MAX];
+			make_path(storage, subdirs[i], path, sizeof(path));
+
+			if(!access(path, F_OK)) {
+				success = sync_path(path);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&storage->mutex);
+	return success;
+}
+
+const meshlink_storage_ops_t config_files_ops = {
+	.read = files_read,
+	.write = files_write,
+	.remove = files_remove,
+	.scan = files_scan,
+	.sync = files_sync,
+};
+
+/// Create the private data of the file storage operations.
+void *config_files_create(const char *confbase) {
+	files_storage_t *storage = xzalloc(sizeof(*storage));
+	storage->confbase = xstrdup(confbase);
+	storage->pending_tail = &storage->pending;
+	pthread_mutex_init(&storage->mutex, NULL);
+	return storage;
+}
+
+void config_files_free(void *priv) {
+	files_storage_t *storage = priv;
+
+	if(!storage) {
+		return;
+	}
+
+	// Files that were never synced are not kept
+	while(storage->pending) {
+		drop_pending(storage, &storage->pending);
+	}
+
+	for(int i = 0; i < storage->dirty_count; i++) {
+		free(storage->dirty[i]);
+	}
+
+	pthread_mutex_destroy(&storage->mutex);
+	free(storage->confbase);
+	free(storage);
+}
+
+/// Read a configuration file directly, so plaintext can be parsed from a mapping of the file.
+bool config_files_read(meshlink_handle_t *mesh, const char *storage_key, config_t *config, const void *key) {
+	char path[PATH_MAX];
+	make_path(mesh->storage_priv, storage_key, path, sizeof(path));
+
+	FILE *f = fopen(path, "r");
+
+	if(!f) {
+		logger(mesh, MESHLINK_ERROR, "Failed to open `%s': %s", path, strerror(errno));
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	if(!config_read_file(mesh, f, config, key)) {
+		logger(mesh, MESHLINK_ERROR, "Failed to read `%s': %s", path, strerror(errno));
+		fclose(f);
+		return false;
+	}
+
+	fclose(f);
+	return true;
+}
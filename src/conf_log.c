@@ -0,0 +1,645 @@
+/*
+    conf_log.c -- log-structured configuration storage
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+#include <assert.h>
+
+#include "conf.h"
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "splay_tree.h"
+#include "xalloc.h"
+
+/* All configuration files of a configuration sub-directory are stored as records
+   in a single append-only file, meshlink.log. It starts with a magic header,
+   followed by any number of records:
+
+   - uint32: length of the rest of the record
+   - uint8: record type
+   - uint8: length of the name
+   - name of the host configuration file, or nothing for the main configuration file
+   - contents of the configuration file as passed by conf_ops.c, so encrypted if a storage key is used (put only)
+   - uint32: CRC-32 of the type, name and contents
+
+   Integers are stored in little-endian order. The last record for a given name wins.
+   An incomplete record at the end of the log is discarded when the log is opened.
+   Once records that have been superseded take up more than half of the log,
+   the live records are copied to a new log, which then replaces the old one.
+
+   The logs are accessed through storage operations, with the mesh handle as the private pointer.
+   The storage keys are mapped to records as follows: "<subdir>/meshlink.conf" is the record
+   with the empty name in the log of that sub-directory, and "<subdir>/hosts/<name>" is the record <name>.
+*/
+
+static const uint8_t log_magic[8] = {'M', 'e', 's', 'h', 'L', 'o', 'g', 1};
+
+enum {
+	LOG_PUT = 1,
+	LOG_DELETE = 2,
+};
+
+/// Don't bother compacting logs that have less garbage than this.
+static const off_t LOG_COMPACT_MIN = 4096;
+
+typedef struct log_entry {
+	char *name;
+	off_t offset;           // offset of the contents in the log
+	uint32_t len;           // length of the contents
+	uint32_t size;          // size of the whole record
+} log_entry_t;
+
+struct config_log {
+	struct config_log *next;
+	char *conf_subdir;
+	int fd;
+	off_t size;
+	off_t garbage;
+	splay_tree_t *index;
+};
+
+/// Calculate the CRC-32 of a buffer.
+uint32_t config_crc32(const uint8_t *buf, size_t len) {
+	uint32_t crc = 0xffffffff;
+
+	while(len--) {
+		crc ^= *buf++;
+
+		for(int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+static uint32_t get_le32(const uint8_t *buf) {
+	return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+static void put_le32(uint8_t *buf, uint32_t val) {
+	buf[0] = val;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	buf[3] = val >> 24;
+}
+
+static int log_entry_compare(const void *va, const void *vb) {
+	const log_entry_t *a = va;
+	const log_entry_t *b = vb;
+
+	return strcmp(a->name, b->name);
+}
+
+static void free_log_entry(const void *data) {
+	log_entry_t *entry = (log_entry_t *)data;
+	free(entry->name);
+	free(entry);
+}
+
+static void make_log_path(meshlink_handle_t *mesh, const char *conf_subdir, const char *suffix, char *path, size_t len) {
+	assert(conf_subdir);
+	assert(path);
+	assert(len);
+
+	snprintf(path, len, "%s" SLASH "%s" SLASH "meshlink.log%s", mesh->confbase, conf_subdir, suffix);
+}
+
+static log_entry_t *log_lookup(struct config_log *log, const char *name) {
+	return splay_search(log->index, &(log_entry_t) {
+		.name = (char *)name
+	});
+}
+
+/// Update the index with the location of the record for the given name.
+static void log_index(struct config_log *log, uint8_t type, const char *name, off_t offset, uint32_t len, uint32_t size) {
+	log_entry_t *entry = log_lookup(log, name);
+
+	if(entry) {
+		log->garbage += entry->size;
+
+		if(type == LOG_DELETE) {
+			splay_delete(log->index, entry);
+		}
+	}
+
+	if(type == LOG_DELETE) {
+		log->garbage += size;
+		return;
+	}
+
+	if(!entry) {
+		entry = xzalloc(sizeof(*entry));
+		entry->name = xstrdup(name);
+		splay_insert(log->index, entry);
+	}
+
+	entry->offset = offset;
+	entry->len = len;
+	entry->size = size;
+}
+
+static bool write_all(int fd, const void *data, size_t len, off_t offset) {
+	const uint8_t *p = data;
+
+	while(len) {
+		ssize_t result = pwrite(fd, p, len, offset);
+
+		if(result <= 0) {
+			if(result < 0 && errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		p += result;
+		len -= result;
+		offset += result;
+	}
+
+	return true;
+}
+
+static bool read_all(int fd, void *data, size_t len, off_t offset) {
+	uint8_t *p = data;
+
+	while(len) {
+		ssize_t result = pread(fd, p, len, offset);
+
+		if(result <= 0) {
+			if(result < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if(!result) {
+				errno = EIO;
+			}
+
+			return false;
+		}
+
+		p += result;
+		len -= result;
+		offset += result;
+	}
+
+	return true;
+}
+
+static void close_log(struct config_log *log) {
+	if(!log) {
+		return;
+	}
+
+	close(log->fd);
+	splay_delete_tree(log->index);
+	free(log->conf_subdir);
+	free(log);
+}
+
+/// Open a log and build the index from its records.
+static struct config_log *open_log(meshlink_handle_t *mesh, const char *conf_subdir, bool create) {
+	char path[PATH_MAX];
+	make_log_path(mesh, conf_subdir, "", path, sizeof(path));
+
+	int fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0600);
+
+	if(fd < 0 && create && errno == ENOENT) {
+		char dir[PATH_MAX];
+		snprintf(dir, sizeof(dir), "%s" SLASH "%s", mesh->confbase, conf_subdir);
+
+		if(!mkdir(dir, 0700) || errno == EEXIST) {
+			fd = open(path, O_RDWR | O_CREAT, 0600);
+		}
+	}
+
+	if(fd < 0) {
+		if(errno != ENOENT) {
+			logger(mesh, MESHLINK_ERROR, "Failed to open `%s': %s", path, strerror(errno));
+			meshlink_errno = MESHLINK_ESTORAGE;
+		}
+
+		return NULL;
+	}
+
+#ifdef FD_CLOEXEC
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	struct stat st;
+
+	if(fstat(fd, &st)) {
+		logger(mesh, MESHLINK_ERROR, "Could not stat `%s': %s", path, strerror(errno));
+		close(fd);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return NULL;
+	}
+
+	struct config_log *log = xzalloc(sizeof(*log));
+	log->conf_subdir = xstrdup(conf_subdir);
+	log->fd = fd;
+	log->index = splay_alloc_tree(log_entry_compare, free_log_entry);
+
+	if(!st.st_size) {
+		char dir[PATH_MAX];
+		snprintf(dir, sizeof(dir), "%s" SLASH "%s", mesh->confbase, conf_subdir);
+
+		if(!write_all(fd, log_magic, sizeof(log_magic), 0) || fsync(fd) || !sync_path(dir)) {
+			logger(mesh, MESHLINK_ERROR, "Failed to write `%s': %s", path, strerror(errno));
+			close_log(log);
+			meshlink_errno = MESHLINK_ESTORAGE;
+			return NULL;
+		}
+
+		log->size = sizeof(log_magic);
+		return log;
+	}
+
+	// Read the whole log in one go
+	uint8_t *buf = xmalloc(st.st_size);
+
+	if(!read_all(fd, buf, st.st_size, 0)) {
+		logger(mesh, MESHLINK_ERROR, "Failed to read `%s': %s", path, strerror(errno));
+		free(buf);
+		close_log(log);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return NULL;
+	}
+
+	if((size_t)st.st_size < sizeof(log_magic) || memcmp(buf, log_magic, sizeof(log_magic))) {
+		logger(mesh, MESHLINK_ERROR, "`%s' is not a MeshLink configuration log", path);
+		free(buf);
+		close_log(log);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return NULL;
+	}
+
+	off_t offset = sizeof(log_magic);
+
+	while(st.st_size - offset >= 4) {
+		uint32_t reclen = get_le32(buf + offset);
+
+		if(reclen < 6 || reclen > st.st_size - offset - 4) {
+			break;
+		}
+
+		const uint8_t *rec = buf + offset + 4;
+		uint8_t type = rec[0];
+		uint8_t namelen = rec[1];
+
+		if((type != LOG_PUT && type != LOG_DELETE) || (uint32_t)namelen + 6 > reclen || config_crc32(rec, reclen - 4) != get_le32(rec + reclen - 4)) {
+			break;
+		}
+
+		char name[256];
+		memcpy(name, rec + 2, namelen);
+		name[namelen] = 0;
+
+		log_index(log, type, name, offset + 6 + namelen, reclen - 6 - namelen, reclen + 4);
+		offset += reclen + 4;
+	}
+
+	free(buf);
+
+	if(offset != st.st_size) {
+		logger(mesh, MESHLINK_WARNING, "Discarding %ld bytes of incomplete records at the end of `%s'", (long)(st.st_size - offset), path);
+
+		if(ftruncate(fd, offset)) {
+			logger(mesh, MESHLINK_ERROR, "Failed to truncate `%s': %s", path, strerror(errno));
+			close_log(log);
+			meshlink_errno = MESHLINK_ESTORAGE;
+			return NULL;
+		}
+	}
+
+	log->size = offset;
+	return log;
+}
+
+/// Get the log of a configuration sub-directory, opening it if necessary.
+/** This must be called with the config_log_mutex held, which also protects the log that is returned,
+ *  so the background writer and other threads never use a log that is being closed.
+ */
+static struct config_log *get_log(meshlink_handle_t *mesh, const char *conf_subdir, bool create) {
+	for(struct config_log *log = mesh->config_log; log; log = log->next) {
+		if(!strcmp(log->conf_subdir, conf_subdir)) {
+			return log;
+		}
+	}
+
+	// Logs stay open until config_log_close(), there are at most three of them
+	struct config_log *log = open_log(mesh, conf_subdir, create);
+
+	if(log) {
+		log->next = mesh->config_log;
+		mesh->config_log = log;
+	}
+
+	return log;
+}
+
+/// Rewrite the log so it only contains the live records.
+static bool compact_log(meshlink_handle_t *mesh, struct config_log *log) {
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	make_log_path(mesh, log->conf_subdir, "", path, sizeof(path));
+	make_log_path(mesh, log->conf_subdir, ".tmp", tmp_path, sizeof(tmp_path));
+
+	logger(mesh, MESHLINK_DEBUG, "Compacting `%s', %ld of %ld bytes are garbage", path, (long)log->garbage, (long)log->size);
+
+	int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+	if(fd < 0) {
+		logger(mesh, MESHLINK_ERROR, "Failed to open `%s': %s", tmp_path, strerror(errno));
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	bool success = write_all(fd, log_magic, sizeof(log_magic), 0);
+	off_t offset = sizeof(log_magic);
+
+	for splay_each(log_entry_t, entry, log->index) {
+		if(!success) {
+			break;
+		}
+
+		// Records are copied verbatim, so they don't need to be re-encrypted
+		uint8_t *rec = xmalloc(entry->size);
+		size_t namelen = strlen(entry->name);
+		success = read_all(log->fd, rec, entry->size, entry->offset - 6 - namelen) && write_all(fd, rec, entry->size, offset);
+		free(rec);
+		offset += entry->size;
+	}
+
+	if(!success || fsync(fd)) {
+		logger(mesh, MESHLINK_ERROR, "Failed to write `%s': %s", tmp_path, strerror(errno));
+		close(fd);
+		unlink(tmp_path);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	if(rename(tmp_path, path)) {
+		logger(mesh, MESHLINK_ERROR, "Failed to rename `%s' to `%s': %s", tmp_path, path, strerror(errno));
+		close(fd);
+		unlink(tmp_path);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+#ifdef FD_CLOEXEC
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+	close(log->fd);
+	log->fd = fd;
+	log->size = offset;
+	log->garbage = 0;
+
+	offset = sizeof(log_magic);
+
+	for splay_each(log_entry_t, entry, log->index) {
+		entry->offset = offset + 6 + strlen(entry->name);
+		offset += entry->size;
+	}
+
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s" SLASH "%s", mesh->confbase, log->conf_subdir);
+	return sync_path(dir);
+}
+
+/// Append a record to the log, without syncing it.
+static bool append_record(meshlink_handle_t *mesh, struct config_log *log, uint8_t type, const char *name, const void *data, size_t datalen) {
+	size_t namelen = strlen(name);
+
+	if(namelen > 255) {
+		logger(mesh, MESHLINK_ERROR, "Name too long for configuration log: %s", name);
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	uint32_t reclen = 6 + namelen + datalen;
+	uint8_t *rec = xmalloc(reclen + 4);
+
+	put_le32(rec, reclen);
+	rec[4] = type;
+	rec[5] = namelen;
+	memcpy(rec + 6, name, namelen);
+
+	if(datalen) {
+		memcpy(rec + 6 + namelen, data, datalen);
+	}
+
+	put_le32(rec + reclen, config_crc32(rec + 4, reclen - 4));
+
+	if(!write_all(log->fd, rec, reclen + 4, log->size)) {
+		logger(mesh, MESHLINK_ERROR, "Failed to append to configuration log: %s", strerror(errno));
+		free(rec);
+
+		// Don't leave a partial record behind
+		if(ftruncate(log->fd, log->size)) {
+			logger(mesh, MESHLINK_ERROR, "Failed to truncate configuration log: %s", strerror(errno));
+		}
+
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	free(rec);
+
+	log_index(log, type, name, log->size + 6 + namelen, datalen, reclen + 4);
+	log->size += reclen + 4;
+
+	if(log->garbage >= LOG_COMPACT_MIN && log->garbage > log->size / 2) {
+		// A failure to compact is not fatal, the log is still intact
+		if(!compact_log(mesh, log)) {
+			logger(mesh, MESHLINK_WARNING, "Could not compact configuration log");
+		}
+	}
+
+	return true;
+}
+
+/// Split a storage key into the sub-directory and the name of the record.
+static bool parse_key(const char *key, char *conf_subdir, size_t len, const char **name) {
+	const char *slash = strchr(key, '/');
+
+	if(!slash || (size_t)(slash - key) >= len) {
+		return false;
+	}
+
+	memcpy(conf_subdir, key, slash - key);
+	conf_subdir[slash - key] = 0;
+
+	if(!strcmp(slash + 1, "meshlink.conf")) {
+		*name = "";
+	} else if(!strncmp(slash + 1, "hosts/", 6) && slash[7] && !strchr(slash + 7, '/')) {
+		*name = slash + 7;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static bool log_read(void *priv, const char *key, void *data, size_t *len) {
+	meshlink_handle_t *mesh = priv;
+	char conf_subdir[PATH_MAX];
+	const char *name;
+
+	if(!parse_key(key, conf_subdir, sizeof(conf_subdir), &name)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&mesh->config_log_mutex);
+	struct config_log *log = get_log(mesh, conf_subdir, false);
+	log_entry_t *entry = log ? log_lookup(log, name) : NULL;
+	bool success = entry && (!data || (*len >= entry->len && read_all(log->fd, data, entry->len, entry->offset)));
+
+	if(success) {
+		*len = entry->len;
+	}
+
+	pthread_mutex_unlock(&mesh->config_log_mutex);
+	return success;
+}
+
+static bool log_write(void *priv, const char *key, const void *data, size_t len) {
+	meshlink_handle_t *mesh = priv;
+	char conf_subdir[PATH_MAX];
+	const char *name;
+
+	if(!parse_key(key, conf_subdir, sizeof(conf_subdir), &name)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&mesh->config_log_mutex);
+	struct config_log *log = get_log(mesh, conf_subdir, true);
+	bool success = log && append_record(mesh, log, LOG_PUT, name, data, len);
+	pthread_mutex_unlock(&mesh->config_log_mutex);
+
+	return success;
+}
+
+static bool log_remove(void *priv, const char *key) {
+	meshlink_handle_t *mesh = priv;
+	char conf_subdir[PATH_MAX];
+	const char *name;
+
+	if(!parse_key(key, conf_subdir, sizeof(conf_subdir), &name)) {
+		return true;
+	}
+
+	pthread_mutex_lock(&mesh->config_log_mutex);
+	struct config_log *log = get_log(mesh, conf_subdir, false);
+	bool success = !log || !log_lookup(log, name) || append_record(mesh, log, LOG_DELETE, name, NULL, 0);
+	pthread_mutex_unlock(&mesh->config_log_mutex);
+
+	return success;
+}
+
+static bool log_scan(void *priv, const char *prefix, bool (*action)(void *arg, const char *key), void *arg) {
+	meshlink_handle_t *mesh = priv;
+	const char *slash = strchr(prefix, '/');
+
+	if(!slash) {
+		return true;
+	}
+
+	char conf_subdir[PATH_MAX];
+	snprintf(conf_subdir, sizeof(conf_subdir), "%.*s", (int)(slash - prefix), prefix);
+
+	pthread_mutex_lock(&mesh->config_log_mutex);
+	struct config_log *log = get_log(mesh, conf_subdir, false);
+
+	if(!log) {
+		pthread_mutex_unlock(&mesh->config_log_mutex);
+		return true;
+	}
+
+	// Collect the keys first, so the action is called without holding the mutex
+	unsigned int count = 0;
+	char **keys = xzalloc((log->index->count + 1) * sizeof(*keys));
+
+	for splay_each(log_entry_t, entry, log->index) {
+		char key[PATH_MAX];
+
+		if(*entry->name) {
+			snprintf(key, sizeof(key), "%s/hosts/%s", log->conf_subdir, entry->name);
+		} else {
+			snprintf(key, sizeof(key), "%s/meshlink.conf", log->conf_subdir);
+		}
+
+		if(!strncmp(key, prefix, strlen(prefix))) {
+			keys[count++] = xstrdup(key);
+		}
+	}
+
+	pthread_mutex_unlock(&mesh->config_log_mutex);
+
+	bool success = true;
+
+	for(unsigned int i = 0; i < count; i++) {
+		if(success && !action(arg, keys[i])) {
+			success = false;
+		}
+
+		free(keys[i]);
+	}
+
+	free(keys);
+	return success;
+}
+
+static bool log_sync(void *priv) {
+	meshlink_handle_t *mesh = priv;
+	bool success = true;
+
+	pthread_mutex_lock(&mesh->config_log_mutex);
+
+	for(struct config_log *log = mesh->config_log; log; log = log->next) {
+		if(fsync(log->fd)) {
+			logger(mesh, MESHLINK_ERROR, "Failed to sync configuration log: %s\n", strerror(errno));
+			success = false;
+		}
+	}
+
+	pthread_mutex_unlock(&mesh->config_log_mutex);
+	return success;
+}
+
+const meshlink_storage_ops_t config_log_ops = {
+	.read = log_read,
+	.write = log_write,
+	.remove = log_remove,
+	.scan = log_scan,
+	.sync = log_sync,
+};
+
+/// Close all cached logs.
+void config_log_close(meshlink_handle_t *mesh) {
+	pthread_mutex_lock(&mesh->config_log_mutex);
+
+	for(struct config_log *next; mesh->config_log; mesh->config_log = next) {
+		next = mesh->config_log->next;
+		close_log(mesh->config_log);
+	}
+
+	pthread_mutex_unlock(&mesh->config_log_mutex);
+}
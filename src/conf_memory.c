@@ -0,0 +1,166 @@
+/*
+    conf_memory.c -- in-memory configuration storage
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "splay_tree.h"
+#include "xalloc.h"
+
+typedef struct memory_file {
+	char *key;
+	uint8_t *data;
+	size_t len;
+} memory_file_t;
+
+typedef struct memory_storage {
+	pthread_mutex_t mutex;
+	splay_tree_t *files;
+} memory_storage_t;
+
+static int memory_file_compare(const void *va, const void *vb) {
+	const memory_file_t *a = va;
+	const memory_file_t *b = vb;
+
+	return strcmp(a->key, b->key);
+}
+
+static void free_memory_file(const void *data) {
+	memory_file_t *file = (memory_file_t *)data;
+	free(file->key);
+	free(file->data);
+	free(file);
+}
+
+static memory_file_t *lookup_file(memory_storage_t *storage, const char *key) {
+	return splay_search(storage->files, &(memory_file_t) {
+		.key = (char *)key
+	});
+}
+
+static bool memory_read(void *priv, const char *key, void *data, size_t *len) {
+	memory_storage_t *storage = priv;
+	pthread_mutex_lock(&storage->mutex);
+
+	memory_file_t *file = lookup_file(storage, key);
+	bool success = file && (!data || *len >= file->len);
+
+	if(success) {
+		if(data) {
+			memcpy(data, file->data, file->len);
+		}
+
+		*len = file->len;
+	}
+
+	pthread_mutex_unlock(&storage->mutex);
+	return success;
+}
+
+static bool memory_write(void *priv, const char *key, const void *data, size_t len) {
+	memory_storage_t *storage = priv;
+	uint8_t *copy = xmalloc(len ? len : 1);
+	memcpy(copy, data, len);
+
+	pthread_mutex_lock(&storage->mutex);
+
+	memory_file_t *file = lookup_file(storage, key);
+
+	if(!file) {
+		file = xzalloc(sizeof(*file));
+		file->key = xstrdup(key);
+		splay_insert(storage->files, file);
+	}
+
+	free(file->data);
+	file->data = copy;
+	file->len = len;
+
+	pthread_mutex_unlock(&storage->mutex);
+	return true;
+}
+
+static bool memory_remove(void *priv, const char *key) {
+	memory_storage_t *storage = priv;
+	pthread_mutex_lock(&storage->mutex);
+
+	memory_file_t *file = lookup_file(storage, key);
+
+	if(file) {
+		splay_delete(storage->files, file);
+	}
+
+	pthread_mutex_unlock(&storage->mutex);
+	return true;
+}
+
+static bool memory_scan(void *priv, const char *prefix, bool (*action)(void *arg, const char *key), void *arg) {
+	memory_storage_t *storage = priv;
+	size_t prefixlen = strlen(prefix);
+	bool success = true;
+
+	pthread_mutex_lock(&storage->mutex);
+
+	for splay_each(memory_file_t, file, storage->files) {
+		if(!strncmp(file->key, prefix, prefixlen) && !action(arg, file->key)) {
+			success = false;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&storage->mutex);
+	return success;
+}
+
+static bool memory_sync(void *priv) {
+	(void)priv;
+	return true;
+}
+
+const meshlink_storage_ops_t meshlink_memory_storage_ops = {
+	.read = memory_read,
+	.write = memory_write,
+	.remove = memory_remove,
+	.scan = memory_scan,
+	.sync = memory_sync,
+};
+
+void *meshlink_memory_storage_create(void) {
+	logger(NULL, MESHLINK_DEBUG, "meshlink_memory_storage_create()");
+
+	memory_storage_t *storage = xzalloc(sizeof(*storage));
+	pthread_mutex_init(&storage->mutex, NULL);
+	storage->files = splay_alloc_tree(memory_file_compare, free_memory_file);
+	return storage;
+}
+
+void meshlink_memory_storage_destroy(void *priv) {
+	logger(NULL, MESHLINK_DEBUG, "meshlink_memory_storage_destroy()");
+
+	memory_storage_t *storage = priv;
+
+	if(!storage) {
+		return;
+	}
+
+	splay_delete_tree(storage->files);
+	pthread_mutex_destroy(&storage->mutex);
+	free(storage);
+}
@@ -0,0 +1,364 @@
+/*
+    conf_ops.c -- configuration storage using application-provided operations
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+#include <assert.h>
+
+#include "conf.h"
+#include "crypto.h"
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "xalloc.h"
+
+/* All configuration storage goes through storage operations: those provided by the application,
+   or the built-in file (conf_files.c) and log (conf_log.c) backends.
+   They see a flat key space: "<subdir>/meshlink.conf" for the main configuration file,
+   and "<subdir>/hosts/<name>" for the host configuration files.
+   Encryption is done before the data is handed to them.
+*/
+
+/// Generate the key of a configuration file. An empty name denotes the main configuration file.
+static void make_key(const char *conf_subdir, const char *name, char *key, size_t len) {
+	assert(conf_subdir);
+	assert(name);
+
+	if(*name) {
+		snprintf(key, len, "%s/hosts/%s", conf_subdir, name);
+	} else {
+		snprintf(key, len, "%s/meshlink.conf", conf_subdir);
+	}
+}
+
+/// Check the presence of a configuration file.
+bool config_ops_exists(meshlink_handle_t *mesh, const char *conf_subdir, const char *name) {
+	char key[PATH_MAX];
+	make_key(conf_subdir, name, key, sizeof(key));
+
+	size_t len = 0;
+	return mesh->storage_ops->read(mesh->storage_priv, key, NULL, &len);
+}
+
+/// Read a configuration file.
+bool config_ops_read(meshlink_handle_t *mesh, const char *conf_subdir, const char *name, config_t *config, const void *key) {
+	char storage_key[PATH_MAX];
+	make_key(conf_subdir, name, storage_key, sizeof(storage_key));
+
+	// Files can be parsed or decrypted directly from a mapping, without copying them first
+	if(mesh->storage_ops == &config_files_ops) {
+		return config_files_read(mesh, storage_key, config, key);
+	}
+
+	size_t len = 0;
+
+	if(!mesh->storage_ops->read(mesh->storage_priv, storage_key, NULL, &len) || !len) {
+		logger(mesh, MESHLINK_ERROR, "Failed to read `%s'", storage_key);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	// Encrypted files are read into the second half of the buffer, and decrypted into the first half
+	uint8_t *buf = config_buffer(mesh, config, key ? 2 * len : len);
+	uint8_t *data = key ? buf + len : buf;
+	size_t datalen = len;
+	config->buf = buf;
+	config->len = len;
+
+	if(!mesh->storage_ops->read(mesh->storage_priv, storage_key, data, &datalen) || datalen != len) {
+		logger(mesh, MESHLINK_ERROR, "Failed to read `%s'", storage_key);
+		config_free(config);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	if(key) {
+		size_t decrypted_len = len;
+		chacha_poly1305_ctx_t *ctx = chacha_poly1305_init();
+		chacha_poly1305_set_key(ctx, key);
+		bool success = len > 12 && chacha_poly1305_decrypt_iv96(ctx, data, data + 12, len - 12, buf, &decrypted_len);
+		chacha_poly1305_exit(ctx);
+
+		if(!success) {
+			logger(mesh, MESHLINK_ERROR, "Cannot decrypt config file\n");
+			config_free(config);
+			meshlink_errno = MESHLINK_ESTORAGE;
+			return false;
+		}
+
+		config->len = decrypted_len;
+	}
+
+	return true;
+}
+
+/// Write a configuration file, without syncing it.
+bool config_ops_write(meshlink_handle_t *mesh, const char *conf_subdir, const char *name, const config_t *config, const void *key) {
+	char storage_key[PATH_MAX];
+	make_key(conf_subdir, name, storage_key, sizeof(storage_key));
+
+	if(!key) {
+		if(!mesh->storage_ops->write(mesh->storage_priv, storage_key, config->buf, config->len)) {
+			logger(mesh, MESHLINK_ERROR, "Failed to write `%s'", storage_key);
+			meshlink_errno = MESHLINK_ESTORAGE;
+			return false;
+		}
+
+		return true;
+	}
+
+	size_t len = config->len + 16;
+	uint8_t *buf = xmalloc(12 + len);
+	randomize(buf, 12);
+	chacha_poly1305_ctx_t *ctx = chacha_poly1305_init();
+	chacha_poly1305_set_key(ctx, key);
+	bool success = chacha_poly1305_encrypt_iv96(ctx, buf, config->buf, config->len, buf + 12, &len);
+	chacha_poly1305_exit(ctx);
+
+	if(!success) {
+		logger(mesh, MESHLINK_ERROR, "Cannot encrypt config file\n");
+	} else if(!(success = mesh->storage_ops->write(mesh->storage_priv, storage_key, buf, 12 + len))) {
+		logger(mesh, MESHLINK_ERROR, "Failed to write `%s'", storage_key);
+	}
+
+	free(buf);
+
+	if(!success) {
+		meshlink_errno = MESHLINK_ESTORAGE;
+	}
+
+	return success;
+}
+
+/// Delete a configuration file.
+bool config_ops_delete(meshlink_handle_t *mesh, const char *conf_subdir, const char *name) {
+	char key[PATH_MAX];
+	make_key(conf_subdir, name, key, sizeof(key));
+
+	if(!mesh->storage_ops->remove(mesh->storage_priv, key)) {
+		logger(mesh, MESHLINK_ERROR, "Failed to delete `%s'", key);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	return true;
+}
+
+typedef struct scan_names {
+	size_t prefixlen;
+	size_t count;
+	char **names;
+} scan_names_t;
+
+static bool collect_host_name(void *arg, const char *key) {
+	scan_names_t *names = arg;
+	const char *name = key + names->prefixlen;
+
+	if(*name && !strchr(name, '/')) {
+		names->names = xrealloc(names->names, (names->count + 1) * sizeof(*names->names));
+		names->names[names->count++] = xstrdup(name);
+	}
+
+	return true;
+}
+
+/// Call an action for all host configuration files.
+bool config_ops_scan_all(meshlink_handle_t *mesh, const char *conf_subdir, config_scan_action_t action, void *arg) {
+	char prefix[PATH_MAX];
+	snprintf(prefix, sizeof(prefix), "%s/hosts/", conf_subdir);
+
+	// The action might modify the storage, so collect all names first
+	scan_names_t names = {.prefixlen = strlen(prefix)};
+	bool success = mesh->storage_ops->scan(mesh->storage_priv, prefix, collect_host_name, &names);
+
+	if(!success) {
+		logger(mesh, MESHLINK_ERROR, "Could not scan %s", prefix);
+		meshlink_errno = MESHLINK_ESTORAGE;
+	}
+
+	for(size_t i = 0; i < names.count; i++) {
+		if(success && !action(mesh, names.names[i], arg)) {
+			success = false;
+		}
+
+		free(names.names[i]);
+	}
+
+	free(names.names);
+	return success;
+}
+
+/// Make sure everything written so far is stored persistently.
+bool config_ops_sync(meshlink_handle_t *mesh) {
+	if(!mesh->storage_ops->sync(mesh->storage_priv)) {
+		logger(mesh, MESHLINK_ERROR, "Failed to sync storage");
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	return true;
+}
+
+static bool collect_key(void *arg, const char *key) {
+	scan_names_t *keys = arg;
+	keys->names = xrealloc(keys->names, (keys->count + 1) * sizeof(*keys->names));
+	keys->names[keys->count++] = xstrdup(key);
+	return true;
+}
+
+/// Delete all configuration files in a sub-directory.
+bool config_ops_wipe(const meshlink_storage_ops_t *ops, void *priv, const char *conf_subdir) {
+	char prefix[PATH_MAX];
+	snprintf(prefix, sizeof(prefix), "%s/", conf_subdir);
+
+	scan_names_t keys = {.prefixlen = strlen(prefix)};
+	bool success = ops->scan(priv, prefix, collect_key, &keys);
+
+	// Remove the main configuration file first, so a partially wiped sub-directory looks empty
+	for(size_t i = 0; i < keys.count; i++) {
+		if(success && !strcmp(keys.names[i] + keys.prefixlen, "meshlink.conf")) {
+			success = ops->remove(priv, keys.names[i]);
+		}
+	}
+
+	for(size_t i = 0; i < keys.count; i++) {
+		if(success && strcmp(keys.names[i] + keys.prefixlen, "meshlink.conf")) {
+			success = ops->remove(priv, keys.names[i]);
+		}
+
+		free(keys.names[i]);
+	}
+
+	free(keys.names);
+
+	if(!success || !ops->sync(priv)) {
+		logger(NULL, MESHLINK_ERROR, "Cannot delete %s", prefix);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	return true;
+}
+
+/// Copy all configuration files to another sub-directory, re-encrypting them with a different key.
+bool config_ops_copy(meshlink_handle_t *mesh, const char *src_conf_subdir, const void *src_key, const char *dst_conf_subdir, const void *dst_key) {
+	if(!config_ops_wipe(mesh->storage_ops, mesh->storage_priv, dst_conf_subdir)) {
+		return false;
+	}
+
+	char prefix[PATH_MAX];
+	snprintf(prefix, sizeof(prefix), "%s/", src_conf_subdir);
+
+	scan_names_t keys = {.prefixlen = strlen(prefix)};
+	bool success = mesh->storage_ops->scan(mesh->storage_priv, prefix, collect_key, &keys);
+
+	// Copy the main configuration file last, so a partial copy is never mistaken for a complete one
+	for(int pass = 0; pass < 2; pass++) {
+		for(size_t i = 0; i < keys.count; i++) {
+			const char *path = keys.names[i] + keys.prefixlen;
+			const char *name;
+
+			if(!strcmp(path, "meshlink.conf")) {
+				name = "";
+			} else if(!strncmp(path, "hosts/", 6) && path[6] && !strchr(path + 6, '/')) {
+				name = path + 6;
+			} else {
+				continue;
+			}
+
+			bool main_config = !*name;
+
+			if(!success || main_config != (pass == 1)) {
+				continue;
+			}
+
+			config_t config;
+
+			if(!config_ops_read(mesh, src_conf_subdir, name, &config, src_key)) {
+				success = false;
+				continue;
+			}
+
+			success = config_ops_write(mesh, dst_conf_subdir, name, &config, dst_key);
+			config_free(&config);
+		}
+	}
+
+	for(size_t i = 0; i < keys.count; i++) {
+		free(keys.names[i]);
+	}
+
+	free(keys.names);
+
+	return success && config_ops_sync(mesh);
+}
+
+/// Move all configuration files to another sub-directory, without decrypting them.
+bool config_ops_rename(meshlink_handle_t *mesh, const char *old_conf_subdir, const char *new_conf_subdir) {
+	const meshlink_storage_ops_t *ops = mesh->storage_ops;
+	void *priv = mesh->storage_priv;
+
+	if(!config_ops_wipe(ops, priv, new_conf_subdir)) {
+		return false;
+	}
+
+	char prefix[PATH_MAX];
+	snprintf(prefix, sizeof(prefix), "%s/", old_conf_subdir);
+
+	scan_names_t keys = {.prefixlen = strlen(prefix)};
+	bool success = ops->scan(priv, prefix, collect_key, &keys);
+
+	// Move the main configuration file last, so a partial copy is never mistaken for a complete one
+	for(int pass = 0; pass < 2; pass++) {
+		for(size_t i = 0; i < keys.count; i++) {
+			const char *path = keys.names[i] + keys.prefixlen;
+			bool main_config = !strcmp(path, "meshlink.conf");
+
+			if(!success || main_config != (pass == 1)) {
+				continue;
+			}
+
+			char new_key[PATH_MAX];
+			snprintf(new_key, sizeof(new_key), "%s/%s", new_conf_subdir, path);
+
+			size_t len = 0;
+
+			if(!ops->read(priv, keys.names[i], NULL, &len)) {
+				success = false;
+				continue;
+			}
+
+			uint8_t *buf = xmalloc(len ? len : 1);
+			success = ops->read(priv, keys.names[i], buf, &len) && ops->write(priv, new_key, buf, len);
+			free(buf);
+		}
+	}
+
+	for(size_t i = 0; i < keys.count; i++) {
+		free(keys.names[i]);
+	}
+
+	free(keys.names);
+
+	if(!success) {
+		logger(mesh, MESHLINK_ERROR, "Could not move %s to %s", old_conf_subdir, new_conf_subdir);
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	return config_ops_sync(mesh) && config_ops_wipe(ops, priv, old_conf_subdir);
+}
@@ -0,0 +1,514 @@
+/*
+    conf_snapshot.c -- configuration snapshot for fast startup
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+#include <assert.h>
+
+#include "conf.h"
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "packmsg.h"
+#include "protocol.h"
+#include "xalloc.h"
+
+/* When a mesh is closed cleanly, the main configuration file and all host configuration files
+   are stored together in one snapshot file, which can be read with a single read at the next startup.
+   The snapshot is only used with the file storage engine. It records the inode and modification time
+   of the main configuration file and the hosts directory, and it is ignored if those have changed,
+   so it stays on disk after it is loaded, and it is only rewritten if the configuration changed.
+   Modification times can be too coarse to notice a change made shortly after the snapshot was written,
+   so the snapshot is also removed from disk before the configuration is first changed after opening.
+*/
+
+#define SNAPSHOT_VERSION 1
+
+typedef struct snapshot_entry {
+	const char *name;
+	uint32_t namelen;
+	const uint8_t *buf;
+	uint32_t len;
+} snapshot_entry_t;
+
+struct config_snapshot {
+	config_t config;
+	uint32_t count;
+	snapshot_entry_t *entries;
+};
+
+/// The state of the configuration files a snapshot is valid for.
+typedef struct snapshot_stamp {
+	uint64_t main_ino;
+	uint64_t main_size;
+	int64_t main_mtime;
+	uint32_t main_mtime_nsec;
+	uint64_t hosts_ino;
+	int64_t hosts_mtime;
+	uint32_t hosts_mtime_nsec;
+} snapshot_stamp_t;
+
+static void make_snapshot_path(meshlink_handle_t *mesh, char *path, size_t len) {
+	snprintf(path, len, "%s" SLASH "current" SLASH "meshlink.snapshot", mesh->confbase);
+}
+
+static uint32_t mtime_nsec(const struct stat *st) {
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	return st->st_mtim.tv_nsec;
+#else
+	(void)st;
+	return 0;
+#endif
+}
+
+static bool get_stamp(meshlink_handle_t *mesh, snapshot_stamp_t *stamp) {
+	char path[PATH_MAX];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s" SLASH "current" SLASH "meshlink.conf", mesh->confbase);
+
+	if(stat(path, &st)) {
+		return false;
+	}
+
+	stamp->main_ino = st.st_ino;
+	stamp->main_size = st.st_size;
+	stamp->main_mtime = st.st_mtime;
+	stamp->main_mtime_nsec = mtime_nsec(&st);
+
+	snprintf(path, sizeof(path), "%s" SLASH "current" SLASH "hosts", mesh->confbase);
+
+	if(stat(path, &st)) {
+		return false;
+	}
+
+	stamp->hosts_ino = st.st_ino;
+	stamp->hosts_mtime = st.st_mtime;
+	stamp->hosts_mtime_nsec = mtime_nsec(&st);
+
+	return true;
+}
+
+static void add_stamp(packmsg_output_t *out, const snapshot_stamp_t *stamp) {
+	packmsg_add_uint64(out, stamp->main_ino);
+	packmsg_add_uint64(out, stamp->main_size);
+	packmsg_add_int64(out, stamp->main_mtime);
+	packmsg_add_uint32(out, stamp->main_mtime_nsec);
+	packmsg_add_uint64(out, stamp->hosts_ino);
+	packmsg_add_int64(out, stamp->hosts_mtime);
+	packmsg_add_uint32(out, stamp->hosts_mtime_nsec);
+}
+
+static snapshot_stamp_t get_stamp_msg(packmsg_input_t *in) {
+	snapshot_stamp_t stamp;
+	stamp.main_ino = packmsg_get_uint64(in);
+	stamp.main_size = packmsg_get_uint64(in);
+	stamp.main_mtime = packmsg_get_int64(in);
+	stamp.main_mtime_nsec = packmsg_get_uint32(in);
+	stamp.hosts_ino = packmsg_get_uint64(in);
+	stamp.hosts_mtime = packmsg_get_int64(in);
+	stamp.hosts_mtime_nsec = packmsg_get_uint32(in);
+	return stamp;
+}
+
+static bool stamp_equal(const snapshot_stamp_t *a, const snapshot_stamp_t *b) {
+	return a->main_ino == b->main_ino
+	       && a->main_size == b->main_size
+	       && a->main_mtime == b->main_mtime
+	       && a->main_mtime_nsec == b->main_mtime_nsec
+	       && a->hosts_ino == b->hosts_ino
+	       && a->hosts_mtime == b->hosts_mtime
+	       && a->hosts_mtime_nsec == b->hosts_mtime_nsec;
+}
+
+/// Check the CRC and version of a snapshot, and get the stamp it was written with.
+static bool parse_header(const config_t *config, packmsg_input_t *in, snapshot_stamp_t *stamp) {
+	const uint8_t *buf = config->buf;
+	size_t len = config->len;
+
+	// The snapshot ends with a CRC-32 of everything before it
+	if(len < 4) {
+		return false;
+	}
+
+	len -= 4;
+	uint32_t crc = buf[len] | buf[len + 1] << 8 | buf[len + 2] << 16 | (uint32_t)buf[len + 3] << 24;
+
+	if(config_crc32(buf, len) != crc) {
+		return false;
+	}
+
+	in->ptr = buf;
+	in->len = len;
+
+	if(packmsg_get_uint32(in) != SNAPSHOT_VERSION) {
+		return false;
+	}
+
+	*stamp = get_stamp_msg(in);
+	return packmsg_input_ok(in);
+}
+
+static bool parse_snapshot(meshlink_handle_t *mesh, config_snapshot_t *snapshot) {
+	packmsg_input_t in;
+	snapshot_stamp_t stamp;
+	snapshot_stamp_t current;
+
+	if(!parse_header(&snapshot->config, &in, &stamp)) {
+		return false;
+	}
+
+	if(!get_stamp(mesh, &current) || !stamp_equal(&stamp, &current)) {
+		logger(mesh, MESHLINK_DEBUG, "Configuration snapshot is stale");
+		return false;
+	}
+
+	uint32_t count = packmsg_get_array(&in);
+
+	if(!count || !packmsg_input_ok(&in) || count > (uint32_t)in.len) {
+		return false;
+	}
+
+	snapshot->entries = xzalloc(count * sizeof(*snapshot->entries));
+	snapshot->count = count;
+
+	// The first entry is the main configuration file, which has an empty name
+	for(uint32_t i = 0; i < count; i++) {
+		snapshot_entry_t *entry = &snapshot->entries[i];
+		entry->namelen = packmsg_get_str_raw(&in, &entry->name);
+		const void *data;
+		entry->len = packmsg_get_bin_raw(&in, &data);
+		entry->buf = data;
+
+		if(!packmsg_input_ok(&in) || !entry->len || (entry->namelen == 0) != (i == 0)) {
+			return false;
+		}
+	}
+
+	return packmsg_done(&in);
+}
+
+/// Load the snapshot of the current configuration, if there is a valid one.
+bool config_snapshot_load(meshlink_handle_t *mesh) {
+	assert(!mesh->config_snapshot);
+
+	if(!mesh->confbase || mesh->storage_ops != &config_files_ops) {
+		return false;
+	}
+
+	char path[PATH_MAX];
+	make_snapshot_path(mesh, path, sizeof(path));
+
+	FILE *f = fopen(path, "r");
+
+	if(!f) {
+		return false;
+	}
+
+	config_snapshot_t *snapshot = xzalloc(sizeof(*snapshot));
+
+	// If it cannot be decrypted, we are probably using the wrong key, so leave it alone
+	if(!config_read_file(mesh, f, &snapshot->config, mesh->config_key)) {
+		fclose(f);
+		free(snapshot);
+		return false;
+	}
+
+	fclose(f);
+	mesh->config_snapshot = snapshot;
+
+	// The snapshot stays on disk, changes made from now on make its stamp stale
+	if(!parse_snapshot(mesh, snapshot)) {
+		logger(mesh, MESHLINK_DEBUG, "Not using configuration snapshot %s", path);
+		config_snapshot_free(mesh);
+		return false;
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "Using configuration snapshot with %u files", snapshot->count);
+	return true;
+}
+
+/// Free a loaded snapshot.
+void config_snapshot_free(meshlink_handle_t *mesh) {
+	config_snapshot_t *snapshot = mesh->config_snapshot;
+
+	if(!snapshot) {
+		return;
+	}
+
+	config_free(&snapshot->config);
+	free(snapshot->entries);
+	free(snapshot);
+	mesh->config_snapshot = NULL;
+}
+
+/// Remove the snapshot from disk before changing the configuration files it describes.
+/** This is only done once after opening. The removal is synced, so after a crash there is never a snapshot of older files left behind. */
+bool config_snapshot_remove(meshlink_handle_t *mesh) {
+	if(mesh->config_snapshot_removed || !mesh->confbase || mesh->storage_ops != &config_files_ops) {
+		return true;
+	}
+
+	char path[PATH_MAX];
+	make_snapshot_path(mesh, path, sizeof(path));
+
+	if(unlink(path)) {
+		if(errno != ENOENT) {
+			logger(mesh, MESHLINK_ERROR, "Could not remove configuration snapshot `%s': %s", path, strerror(errno));
+			meshlink_errno = MESHLINK_ESTORAGE;
+			return false;
+		}
+	} else {
+		snprintf(path, sizeof(path), "%s" SLASH "current", mesh->confbase);
+
+		if(!sync_path(path)) {
+			return false;
+		}
+	}
+
+	mesh->config_snapshot_removed = true;
+	return true;
+}
+
+static const snapshot_entry_t *lookup_entry(const config_snapshot_t *snapshot, const char *name) {
+	size_t namelen = strlen(name);
+
+	for(uint32_t i = 0; i < snapshot->count; i++) {
+		const snapshot_entry_t *entry = &snapshot->entries[i];
+
+		if(entry->namelen == namelen && !memcmp(entry->name, name, namelen)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/// Check the presence of a configuration file in the snapshot. An empty name denotes the main configuration file.
+bool config_snapshot_exists(meshlink_handle_t *mesh, const char *name) {
+	return lookup_entry(mesh->config_snapshot, name);
+}
+
+/// Read a configuration file from the snapshot.
+bool config_snapshot_read(meshlink_handle_t *mesh, const char *name, config_t *config) {
+	const snapshot_entry_t *entry = lookup_entry(mesh->config_snapshot, name);
+
+	if(!entry) {
+		logger(mesh, MESHLINK_ERROR, "Configuration file for %s not found", *name ? name : "myself");
+		meshlink_errno = MESHLINK_ESTORAGE;
+		return false;
+	}
+
+	uint8_t *buf = config_buffer(mesh, config, entry->len);
+	memcpy(buf, entry->buf, entry->len);
+	config->buf = buf;
+	config->len = entry->len;
+	return true;
+}
+
+/// Check whether a configuration file in the snapshot has exactly the given contents.
+bool config_snapshot_matches(meshlink_handle_t *mesh, const char *name, const config_t *config) {
+	if(!mesh->config_snapshot) {
+		return false;
+	}
+
+	const snapshot_entry_t *entry = lookup_entry(mesh->config_snapshot, name);
+	return entry && entry->len == config->len && !memcmp(entry->buf, config->buf, config->len);
+}
+
+/// Call an action for all host configuration files in the snapshot.
+bool config_snapshot_scan_all(meshlink_handle_t *mesh, config_scan_action_t action, void *arg) {
+	config_snapshot_t *snapshot = mesh->config_snapshot;
+
+	for(uint32_t i = 1; i < snapshot->count; i++) {
+		char name[256];
+		const snapshot_entry_t *entry = &snapshot->entries[i];
+
+		if(entry->namelen >= sizeof(name)) {
+			continue;
+		}
+
+		memcpy(name, entry->name, entry->namelen);
+		name[entry->namelen] = 0;
+
+		if(!action(mesh, name, arg)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+typedef struct snapshot_files {
+	uint32_t count;
+	char **names;
+	config_t *configs;
+} snapshot_files_t;
+
+static bool collect_host_config(meshlink_handle_t *mesh, const char *name, void *arg) {
+	snapshot_files_t *files = arg;
+
+	// Skip temporary files and anything else that is not a valid host configuration file
+	if(!check_id(name)) {
+		return true;
+	}
+
+	config_t config;
+
+	if(!config_read(mesh, "current", name, &config, mesh->config_key)) {
+		return false;
+	}
+
+	// Keep a copy, the scratch arena is reused for the next file
+	uint8_t *buf = xmalloc(config.len);
+	memcpy(buf, config.buf, config.len);
+
+	files->names = xrealloc(files->names, (files->count + 1) * sizeof(*files->names));
+	files->configs = xrealloc(files->configs, (files->count + 1) * sizeof(*files->configs));
+	files->names[files->count] = xstrdup(name);
+	files->configs[files->count] = (config_t) {
+		.buf = buf, .len = config.len
+	};
+	files->count++;
+
+	config_free(&config);
+	return true;
+}
+
+/// Check whether the snapshot on disk was written for the given stamp.
+static bool snapshot_is_current(meshlink_handle_t *mesh, const snapshot_stamp_t *stamp) {
+	char path[PATH_MAX];
+	make_snapshot_path(mesh, path, sizeof(path));
+
+	FILE *f = fopen(path, "r");
+
+	if(!f) {
+		return false;
+	}
+
+	config_t config;
+	bool success = config_read_file(mesh, f, &config, mesh->config_key);
+	fclose(f);
+
+	if(!success) {
+		return false;
+	}
+
+	packmsg_input_t in;
+	snapshot_stamp_t old_stamp;
+	success = parse_header(&config, &in, &old_stamp) && stamp_equal(&old_stamp, stamp);
+	config_free(&config);
+	return success;
+}
+
+/// Write a snapshot of the current configuration, to be used at the next startup.
+bool config_snapshot_write(meshlink_handle_t *mesh) {
+	if(!mesh->confbase || mesh->storage_ops != &config_files_ops || mesh->storage_policy == MESHLINK_STORAGE_DISABLED) {
+		return true;
+	}
+
+	assert(!mesh->config_snapshot);
+
+	snapshot_stamp_t stamp;
+
+	if(!get_stamp(mesh, &stamp)) {
+		return false;
+	}
+
+	// Nothing changed since the snapshot that is already on disk was written
+	if(snapshot_is_current(mesh, &stamp)) {
+		return true;
+	}
+
+	// The snapshot contains exactly what is on disk, which with MESHLINK_STORAGE_KEYS_ONLY can be older than what is in memory
+	config_t main_config;
+
+	if(!main_config_read(mesh, "current", &main_config, mesh->config_key)) {
+		return false;
+	}
+
+	snapshot_files_t files = {0};
+	bool success = config_scan_all(mesh, "current", "hosts", collect_host_config, &files);
+
+	size_t size = 64 + main_config.len + 4;
+
+	for(uint32_t i = 0; i < files.count; i++) {
+		size += 16 + strlen(files.names[i]) + files.configs[i].len;
+	}
+
+	uint8_t *buf = xmalloc(size);
+	packmsg_output_t out = {buf, size - 4};
+
+	packmsg_add_uint32(&out, SNAPSHOT_VERSION);
+	add_stamp(&out, &stamp);
+	packmsg_add_array(&out, files.count + 1);
+	packmsg_add_str(&out, "");
+	packmsg_add_bin(&out, main_config.buf, main_config.len);
+
+	for(uint32_t i = 0; i < files.count; i++) {
+		packmsg_add_str(&out, files.names[i]);
+		packmsg_add_bin(&out, files.configs[i].buf, files.configs[i].len);
+		free(files.names[i]);
+		config_free(&files.configs[i]);
+	}
+
+	free(files.names);
+	free(files.configs);
+	config_free(&main_config);
+
+	if(!success || !packmsg_output_ok(&out)) {
+		free(buf);
+		return false;
+	}
+
+	size_t len = packmsg_output_size(&out, buf);
+	uint32_t crc = config_crc32(buf, len);
+	buf[len++] = crc;
+	buf[len++] = crc >> 8;
+	buf[len++] = crc >> 16;
+	buf[len++] = crc >> 24;
+
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 4];
+	make_snapshot_path(mesh, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *f = fopen(tmp_path, "w");
+
+	if(!f) {
+		logger(mesh, MESHLINK_WARNING, "Failed to open `%s': %s", tmp_path, strerror(errno));
+		free(buf);
+		return false;
+	}
+
+	config_t config = {.buf = buf, .len = len};
+	success = config_write_file(mesh, f, &config, mesh->config_key);
+	memset(buf, 0, len);
+	free(buf);
+
+	if(fclose(f)) {
+		success = false;
+	}
+
+	if(!success || rename(tmp_path, path)) {
+		logger(mesh, MESHLINK_WARNING, "Failed to write configuration snapshot `%s': %s", path, strerror(errno));
+		unlink(tmp_path);
+		return false;
+	}
+
+	return true;
+}
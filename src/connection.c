@@ -25,20 +25,25 @@
 #include "list.h"
 #include "logger.h"
 #include "meshlink_internal.h"
+#include "meta.h"
 #include "utils.h"
 #include "xalloc.h"
 
 void init_connections(meshlink_handle_t *mesh) {
-	assert(!mesh->connection);
-	mesh->connection = NULL;
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		assert(!mesh->connections[i]);
+		mesh->connections[i] = NULL;
+	}
 }
 
 void exit_connections(meshlink_handle_t *mesh) {
-	if(mesh->connection) {
-		free_connection(mesh->connection);
-	}
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->connections[i]) {
+			free_connection(mesh->connections[i]);
+		}
 
-	mesh->connection = NULL;
+		mesh->connections[i] = NULL;
+	}
 }
 
 connection_t *new_connection(void) {
@@ -69,17 +74,36 @@ void free_connection(connection_t *c) {
 
 void connection_add(meshlink_handle_t *mesh, connection_t *c) {
 	assert(c);
-	assert(!mesh->connection);
 
-	c->mesh = mesh;
-	mesh->connection = c;
+	// There is at most one connection per upstream node
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(!mesh->connections[i]) {
+			c->mesh = mesh;
+			mesh->connections[i] = c;
+			return;
+		}
+	}
+
+	abort();
 }
 
 void connection_del(meshlink_handle_t *mesh, connection_t *c) {
 	assert(c);
-	assert(mesh->connection == c);
 
-	io_del(&mesh->loop, &c->io);
-	free(mesh->connection);
-	mesh->connection = NULL;
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->connections[i] == c) {
+			update_outbuf_stats(mesh, c, -(int64_t)(c->outbuf.len - c->outbuf.offset));
+
+			if(c->node) {
+				stats_set(&c->node->stats.outbuf_depth, 0);
+			}
+
+			io_del(&mesh->loop, &c->io);
+			mesh->connections[i] = NULL;
+			free_connection(c);
+			return;
+		}
+	}
+
+	abort();
 }
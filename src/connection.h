@@ -34,7 +34,7 @@ typedef struct connection_status_t {
 	uint16_t pinged: 1;                 /* sent ping */
 	uint16_t active: 1;                 /* 1 if active.. */
 	uint16_t connecting: 1;             /* 1 if we are waiting for a non-blocking connect() to finish */
-	uint16_t unused: 1;
+	uint16_t keepalive: 1;              /* 1 if the kernel detects dead peers for us */
 	uint16_t control: 1;                /* 1 if this is a control connection */
 	uint16_t pcap: 1;                   /* 1 if this is a control connection requesting packet capture */
 	uint16_t log: 1;                    /* 1 if this is a control connection requesting log dump */
@@ -42,6 +42,7 @@ typedef struct connection_status_t {
 	uint16_t invitation_used: 1;        /* 1 if the invitation has been consumed */
 	uint16_t initiator: 1;              /* 1 if we initiated this connection */
 	uint16_t raw_packet: 1;             /* 1 if we are expecting a raw packet next */
+	uint16_t binary: 1;                 /* 1 if the peer accepts binary encoded requests */
 } connection_status_t;
 
 #include "ecdsa.h"
@@ -62,15 +63,22 @@ typedef struct connection_t {
 	sptps_t sptps;
 	struct buffer_t inbuf;
 	struct buffer_t outbuf;
+	uint64_t outbuf_sent;           /* total number of bytes written from outbuf to the socket */
 	io_t io;                        /* input/output event on this metadata connection */
 	int allow_request;              /* defined if there's only one request possible */
 	uint16_t packet_len;            /* length of a raw packet being received */
 	time_t last_ping_time;          /* last time we saw some activity from the other end or pinged them */
 	time_t last_key_renewal;        /* last time we renewed the SPTPS key */
+	struct timespec ping_sent;      /* when the outstanding PING was sent */
+	struct timespec last_received;  /* when the last record was received after authentication */
+	struct timespec renewal_start;  /* when we started the current SPTPS key renewal */
+	uint32_t srtt;                  /* smoothed round-trip time of PING/PONG, in microseconds */
+	uint32_t rttvar;                /* round-trip time variation, in microseconds */
 
 	struct outgoing_t *outgoing;    /* used to keep track of outgoing connections */
 
 	// Only used during authentication
+	struct timespec connect_start;  /* when we called connect(), to measure how long activation takes */
 	ecdsa_t *ecdsa;                 /* his public ECDSA key */
 	int protocol_major;             /* used protocol */
 	int protocol_minor;             /* used protocol */
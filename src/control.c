@@ -0,0 +1,468 @@
+/*
+    control.c -- local control socket
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "connection.h"
+#include "control.h"
+#include "list.h"
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "net.h"
+#include "node.h"
+#include "utils.h"
+#include "xalloc.h"
+
+/* The control socket is a UNIX stream socket that speaks a line based protocol.
+   Each request is a single line, each reply consists of zero or more lines
+   followed by a line that is either "ok" or "error <reason>".
+
+   Requests:
+     stats                                  counters of the whole instance
+     nodes                                  counters of each node
+     connections                            state of each meta-connection
+     timers                                 milliseconds until each pending timer fires
+     dump                                   all of the above
+     set log-level <0-4>                    change the log level, if a log callback is set
+     set ping <devclass> <interval> <timeout>
+                                            change the ping interval and timeout of a device class
+     reset watermarks                       reset the high-water marks of the queue and output buffer depths
+     quit                                   close the control connection
+
+   Clients are handled by the event loop, with the mesh mutex held,
+   so they see a consistent snapshot without the application having to do anything.
+*/
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_MAX_LINE 256
+#define CONTROL_MAX_OUTBUF 65536
+
+struct control {
+	int fd;
+	io_t io;
+	char *path;
+	list_t *clients;
+};
+
+#define COUNTER(field) {#field, offsetof(stats_t, field)}
+
+static const struct {
+	const char *name;
+	size_t offset;
+} counters[] = {
+	COUNTER(messages_queued),
+	COUNTER(bytes_queued),
+	COUNTER(messages_sent),
+	COUNTER(bytes_sent),
+	COUNTER(messages_received),
+	COUNTER(bytes_received),
+	COUNTER(records_encrypted),
+	COUNTER(records_decrypted),
+	COUNTER(queue_depth),
+	COUNTER(queue_max),
+	COUNTER(outbuf_depth),
+	COUNTER(outbuf_max),
+	COUNTER(handshakes),
+	COUNTER(handshake_time),
+	COUNTER(renewals),
+	COUNTER(renewal_time),
+	COUNTER(reconnects),
+	COUNTER(srtt),
+	COUNTER(rttvar),
+	COUNTER(callbacks),
+	COUNTER(callback_time),
+};
+
+static void free_client(meshlink_handle_t *mesh, connection_t *c) {
+	io_del(&mesh->loop, &c->io);
+	list_delete(mesh->control->clients, c);
+	free_connection(c);
+}
+
+// Send as much of the output buffer as possible, returns false if the client has been freed.
+static bool flush_client(meshlink_handle_t *mesh, connection_t *c) {
+	while(c->outbuf.len > c->outbuf.offset) {
+		ssize_t len = send(c->socket, c->outbuf.data + c->outbuf.offset, c->outbuf.len - c->outbuf.offset, MSG_NOSIGNAL);
+
+		if(len <= 0) {
+			if(len < 0 && sockwouldblock(sockerrno)) {
+				io_set(&mesh->loop, &c->io, IO_READ | IO_WRITE);
+				return true;
+			}
+
+			free_client(mesh, c);
+			return false;
+		}
+
+		buffer_read(&c->outbuf, len);
+	}
+
+	io_set(&mesh->loop, &c->io, IO_READ);
+	return true;
+}
+
+static void reply(connection_t *c, const char *format, ...) __attribute__((__format__(printf, 2, 3)));
+static void reply(connection_t *c, const char *format, ...) {
+	char line[1024];
+	va_list ap;
+
+	va_start(ap, format);
+	int len = vsnprintf(line, sizeof(line) - 1, format, ap);
+	va_end(ap);
+
+	if(len < 0) {
+		return;
+	}
+
+	if((size_t)len > sizeof(line) - 2) {
+		len = sizeof(line) - 2;
+	}
+
+	line[len++] = '\n';
+	buffer_add(&c->outbuf, line, len);
+}
+
+static void format_counters(char *buf, size_t size, const stats_t *stats) {
+	size_t len = 0;
+	buf[0] = 0;
+
+	for(size_t i = 0; i < sizeof(counters) / sizeof(*counters) && len < size; i++) {
+		const stats_counter_t *counter = (const stats_counter_t *)((const char *)stats + counters[i].offset);
+		int result = snprintf(buf + len, size - len, " %s=%lu", counters[i].name, (unsigned long)stats_get(counter));
+
+		if(result < 0) {
+			break;
+		}
+
+		len += result;
+	}
+}
+
+static void dump_stats(meshlink_handle_t *mesh, connection_t *c) {
+	char buf[900];
+	format_counters(buf, sizeof(buf), &mesh->stats);
+	reply(c, "stats%s", buf);
+}
+
+static void dump_nodes(meshlink_handle_t *mesh, connection_t *c) {
+	char buf[900];
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		node_t *n = mesh->peers[i];
+
+		if(!n) {
+			continue;
+		}
+
+		format_counters(buf, sizeof(buf), &n->stats);
+		reply(c, "node %s devclass=%d reachable=%d upstream=%d%s", n->name, n->devclass, n->status.reachable, mesh->upstream == n, buf);
+	}
+}
+
+static void dump_connections(meshlink_handle_t *mesh, connection_t *c) {
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		connection_t *conn = mesh->connections[i];
+
+		if(!conn) {
+			continue;
+		}
+
+		reply(c, "connection %s active=%d connecting=%d binary=%d keepalive=%d outbuf=%lu srtt=%u rttvar=%u idle=%ld",
+		      conn->name ? conn->name : "(unknown)", conn->status.active, conn->status.connecting, conn->status.binary, conn->status.keepalive,
+		      (unsigned long)(conn->outbuf.len - conn->outbuf.offset), conn->srtt, conn->rttvar, (long)(mesh->loop.now.tv_sec - conn->last_ping_time));
+	}
+}
+
+static void dump_timers(meshlink_handle_t *mesh, connection_t *c) {
+	for splay_each(timeout_t, timeout, &mesh->loop.timeouts) {
+		int64_t msec = (timeout->tv.tv_sec - mesh->loop.now.tv_sec) * 1000 + (timeout->tv.tv_nsec - mesh->loop.now.tv_nsec) / 1000000;
+		const char *name = timeout == &mesh->pingtimer ? "ping" : timeout == &mesh->periodictimer ? "periodic" : "other";
+		reply(c, "timer %s %ld", name, (long)msec);
+	}
+}
+
+static bool set_log_level(meshlink_handle_t *mesh, connection_t *c, const char *arg) {
+	char *end;
+	long level = arg ? strtol(arg, &end, 10) : -1;
+
+	if(!arg || *end || level < MESHLINK_DEBUG || level > MESHLINK_CRITICAL) {
+		reply(c, "error invalid log level");
+		return false;
+	}
+
+	if(!mesh->log_cb) {
+		reply(c, "error no log callback");
+		return false;
+	}
+
+	mesh->log_level = level;
+	return true;
+}
+
+static bool set_ping(meshlink_handle_t *mesh, connection_t *c, const char *args) {
+	int devclass, interval, timeout;
+
+	if(!args || sscanf(args, "%d %d %d", &devclass, &interval, &timeout) != 3 || devclass < 0 || devclass >= DEV_CLASS_COUNT || interval < 1 || timeout < 1 || timeout > interval) {
+		reply(c, "error invalid ping settings");
+		return false;
+	}
+
+	mesh->dev_class_traits[devclass].pinginterval = interval;
+	mesh->dev_class_traits[devclass].pingtimeout = timeout;
+	update_upstream_connections(mesh);
+	return true;
+}
+
+static void reset_watermarks(meshlink_handle_t *mesh) {
+	stats_set(&mesh->stats.queue_max, stats_get(&mesh->stats.queue_depth));
+	stats_set(&mesh->stats.outbuf_max, stats_get(&mesh->stats.outbuf_depth));
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		node_t *n = mesh->peers[i];
+
+		if(n) {
+			stats_set(&n->stats.queue_max, stats_get(&n->stats.queue_depth));
+			stats_set(&n->stats.outbuf_max, stats_get(&n->stats.outbuf_depth));
+		}
+	}
+}
+
+// Handle a request, returns false if the client should be disconnected.
+static bool handle_request(meshlink_handle_t *mesh, connection_t *c, char *line) {
+	char command[32] = "";
+	char arg[32] = "";
+	int offset = 0;
+
+	for(size_t len = strlen(line); len && isspace((unsigned char)line[len - 1]);) {
+		line[--len] = 0;
+	}
+
+	if(sscanf(line, "%31s %31s %n", command, arg, &offset) < 1) {
+		return true;
+	}
+
+	const char *rest = offset ? line + offset : NULL;
+	bool ok = true;
+
+	logger(mesh, MESHLINK_DEBUG, "Control request: %s", command);
+
+	if(!strcmp(command, "stats")) {
+		dump_stats(mesh, c);
+	} else if(!strcmp(command, "nodes")) {
+		dump_nodes(mesh, c);
+	} else if(!strcmp(command, "connections")) {
+		dump_connections(mesh, c);
+	} else if(!strcmp(command, "timers")) {
+		dump_timers(mesh, c);
+	} else if(!strcmp(command, "dump")) {
+		dump_stats(mesh, c);
+		dump_nodes(mesh, c);
+		dump_connections(mesh, c);
+		dump_timers(mesh, c);
+	} else if(!strcmp(command, "set") && !strcmp(arg, "log-level")) {
+		ok = set_log_level(mesh, c, rest);
+	} else if(!strcmp(command, "set") && !strcmp(arg, "ping")) {
+		ok = set_ping(mesh, c, rest);
+	} else if(!strcmp(command, "reset") && !strcmp(arg, "watermarks")) {
+		reset_watermarks(mesh);
+	} else if(!strcmp(command, "quit")) {
+		return false;
+	} else {
+		reply(c, "error unknown request");
+		ok = false;
+	}
+
+	if(ok) {
+		reply(c, "ok");
+	}
+
+	return true;
+}
+
+static void handle_client_io(event_loop_t *loop, void *data, int flags) {
+	meshlink_handle_t *mesh = loop->data;
+	connection_t *c = data;
+
+	if(flags & IO_WRITE) {
+		flush_client(mesh, c);
+		return;
+	}
+
+	char buf[CONTROL_MAX_LINE];
+	ssize_t len = recv(c->socket, buf, sizeof(buf), 0);
+
+	if(len <= 0) {
+		if(len < 0 && sockwouldblock(sockerrno)) {
+			return;
+		}
+
+		free_client(mesh, c);
+		return;
+	}
+
+	buffer_add(&c->inbuf, buf, len);
+
+	for(char *line; (line = buffer_readline(&c->inbuf));) {
+		if(!handle_request(mesh, c, line)) {
+			if(flush_client(mesh, c)) {
+				free_client(mesh, c);
+			}
+
+			return;
+		}
+	}
+
+	// Don't let a client make us buffer unbounded amounts of data
+	if(c->inbuf.len - c->inbuf.offset > CONTROL_MAX_LINE || c->outbuf.len - c->outbuf.offset > CONTROL_MAX_OUTBUF) {
+		logger(mesh, MESHLINK_WARNING, "Closing misbehaving control connection");
+		free_client(mesh, c);
+		return;
+	}
+
+	flush_client(mesh, c);
+}
+
+static void handle_control_accept(event_loop_t *loop, void *data, int flags) {
+	(void)flags;
+	meshlink_handle_t *mesh = loop->data;
+	struct control *control = data;
+
+	int fd = accept(control->fd, NULL, NULL);
+
+	if(fd < 0) {
+		if(!sockwouldblock(sockerrno)) {
+			logger(mesh, MESHLINK_ERROR, "Accepting a control connection failed: %s", strerror(errno));
+		}
+
+		return;
+	}
+
+	if(control->clients->count >= CONTROL_MAX_CLIENTS || fd >= FD_SETSIZE) {
+		logger(mesh, MESHLINK_WARNING, "Too many control connections");
+		closesocket(fd);
+		return;
+	}
+
+#ifdef FD_CLOEXEC
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+#ifdef O_NONBLOCK
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+
+	connection_t *c = new_connection();
+	c->name = xstrdup("<control>");
+	c->socket = fd;
+	c->mesh = mesh;
+	c->status.control = true;
+	list_insert_tail(control->clients, c);
+	io_add(&mesh->loop, &c->io, handle_client_io, c, fd, IO_READ);
+}
+
+bool control_open(meshlink_handle_t *mesh, const char *path) {
+#ifdef HAVE_SYS_UN_H
+	struct sockaddr_un sa = {.sun_family = AF_UNIX};
+
+	if(strlen(path) >= sizeof(sa.sun_path)) {
+		logger(mesh, MESHLINK_ERROR, "Control socket path too long: %s", path);
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	strcpy(sa.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if(fd < 0) {
+		logger(mesh, MESHLINK_ERROR, "Could not create control socket: %s", strerror(errno));
+		meshlink_errno = MESHLINK_ENETWORK;
+		return false;
+	}
+
+#ifdef FD_CLOEXEC
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+#ifdef O_NONBLOCK
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+
+	// Close the current control socket first, so it doesn't unlink its replacement if the path is the same
+	control_close(mesh);
+
+	// Remove a stale socket left behind by a previous instance, but never anything else
+	struct stat st;
+
+	if(!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+
+	if(bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		logger(mesh, MESHLINK_ERROR, "Could not bind control socket %s: %s", path, strerror(errno));
+		closesocket(fd);
+		meshlink_errno = MESHLINK_ENETWORK;
+		return false;
+	}
+
+	// Only the owner may connect, since the control socket allows changing settings.
+	// Nobody can connect before listen() is called, so there is no window where the permissions are too lax.
+	if(chmod(path, 0600) || listen(fd, 4)) {
+		logger(mesh, MESHLINK_ERROR, "Could not set up control socket %s: %s", path, strerror(errno));
+		closesocket(fd);
+		unlink(path);
+		meshlink_errno = MESHLINK_ENETWORK;
+		return false;
+	}
+
+	struct control *control = xzalloc(sizeof(*control));
+	control->fd = fd;
+	control->path = xstrdup(path);
+	control->clients = list_alloc(NULL);
+	mesh->control = control;
+	io_add(&mesh->loop, &control->io, handle_control_accept, control, fd, IO_READ);
+
+	logger(mesh, MESHLINK_INFO, "Listening for control connections on %s", path);
+	return true;
+#else
+	(void)path;
+	logger(mesh, MESHLINK_ERROR, "Control sockets are not supported on this platform");
+	meshlink_errno = MESHLINK_ENOTSUP;
+	return false;
+#endif
+}
+
+void control_close(meshlink_handle_t *mesh) {
+	struct control *control = mesh->control;
+
+	if(!control) {
+		return;
+	}
+
+	for list_each(connection_t, c, control->clients) {
+		free_client(mesh, c);
+	}
+
+	io_del(&mesh->loop, &control->io);
+	closesocket(control->fd);
+	unlink(control->path);
+
+	list_free(control->clients);
+	free(control->path);
+	free(control);
+	mesh->control = NULL;
+}
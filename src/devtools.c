@@ -76,12 +76,23 @@ void devtool_force_sptps_renewal(meshlink_handle_t *mesh, meshlink_node_t *node)
 		return;
 	}
 
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
 	node_t *n = (node_t *)node;
 	connection_t *c = n->connection;
 
 	if(c) {
 		c->last_key_renewal = -3600;
+
+		if(mesh->loop.running) {
+			reschedule_pingtimer(mesh);
+			signal_trigger(&mesh->loop, &mesh->datafromapp);
+		}
 	}
+
+	pthread_mutex_unlock(&mesh->mutex);
 }
 
 void devtool_set_meta_status_cb(meshlink_handle_t *mesh, meshlink_node_status_cb_t cb) {
@@ -0,0 +1,332 @@
+/*
+    dispatch.c -- deferred callback dispatch
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "node.h"
+#include "xalloc.h"
+
+/* When callbacks are deferred, events are appended to a single queue in the order they happen,
+   and there is only ever one thread taking them from the queue:
+   either the background thread while it doesn't hold the mesh mutex, or the callback thread.
+   So callbacks are called in order, and never concurrently.
+
+   Nodes are only freed when the handle is closed, after the queue has been drained,
+   so queued events can refer to them without holding a reference.
+*/
+
+static void invoke(meshlink_handle_t *mesh, const deferred_callback_t *d, const void *data) {
+	if(d->type == CALLBACK_LOG) {
+		d->cb.log(mesh, d->value, data);
+		return;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	switch(d->type) {
+	case CALLBACK_RECEIVE:
+		d->cb.receive(mesh, (meshlink_node_t *)d->node, data, d->len);
+		break;
+
+	case CALLBACK_NODE_STATUS:
+	case CALLBACK_META_STATUS:
+		d->cb.node_status(mesh, (meshlink_node_t *)d->node, d->value);
+		break;
+
+	case CALLBACK_NODE_DUPLICATE:
+		d->cb.node_duplicate(mesh, (meshlink_node_t *)d->node);
+		break;
+
+	case CALLBACK_CONNECTION_TRY:
+		d->cb.connection_try(mesh, (meshlink_node_t *)d->node);
+		break;
+
+	case CALLBACK_ERROR:
+		d->cb.error(mesh, d->value);
+		break;
+
+	default:
+		abort();
+	}
+
+	stats_callback_done(mesh, d->node, &start);
+}
+
+static void invoke_list(meshlink_handle_t *mesh, deferred_callback_t *d) {
+	while(d) {
+		deferred_callback_t *next = d->next;
+		invoke(mesh, d, d->data);
+		free(d);
+		d = next;
+	}
+}
+
+// Take all queued callbacks, must be called with the dispatch mutex held.
+static deferred_callback_t *take_all(dispatch_t *dispatch) {
+	deferred_callback_t *list = dispatch->head;
+	dispatch->head = NULL;
+	dispatch->tail = &dispatch->head;
+	return list;
+}
+
+void dispatch_callback(meshlink_handle_t *mesh, callback_type_t type, node_t *n, int value, const void *data, size_t len) {
+	deferred_callback_t d = {.type = type, .node = n, .value = value, .len = len};
+
+	switch(type) {
+	case CALLBACK_RECEIVE:
+		d.cb.receive = mesh->receive_cb;
+		break;
+
+	case CALLBACK_NODE_STATUS:
+		d.cb.node_status = mesh->node_status_cb;
+		break;
+
+	case CALLBACK_META_STATUS:
+		d.cb.node_status = mesh->meta_status_cb;
+		break;
+
+	case CALLBACK_NODE_DUPLICATE:
+		d.cb.node_duplicate = mesh->node_duplicate_cb;
+		break;
+
+	case CALLBACK_CONNECTION_TRY:
+		d.cb.connection_try = mesh->connection_try_cb;
+		break;
+
+	case CALLBACK_ERROR:
+		d.cb.error = mesh->error_cb;
+		break;
+
+	case CALLBACK_LOG:
+		d.cb.log = mesh->log_cb;
+		break;
+	}
+
+	bool deferred = mesh->dispatch.mode != MESHLINK_CALLBACKS_DIRECT;
+
+	// Log messages from the application's own threads are not queued, they are not holding up the background thread
+	if(type == CALLBACK_LOG && !(mesh->threadstarted && pthread_equal(mesh->thread, pthread_self()))) {
+		deferred = false;
+	}
+
+	if(!deferred) {
+		invoke(mesh, &d, data);
+		return;
+	}
+
+	deferred_callback_t *copy = xmalloc(sizeof(*copy) + len);
+	*copy = d;
+
+	if(len) {
+		memcpy(copy->data, data, len);
+	}
+
+	dispatch_t *dispatch = &mesh->dispatch;
+
+	if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+		abort();
+	}
+
+	*dispatch->tail = copy;
+	dispatch->tail = &copy->next;
+
+	bool wakeup = !dispatch->threadstarted && !(mesh->threadstarted && pthread_equal(mesh->thread, pthread_self()));
+
+	if(dispatch->threadstarted) {
+		pthread_cond_signal(&dispatch->cond);
+	}
+
+	pthread_mutex_unlock(&dispatch->mutex);
+
+	// Events caused by API calls from other threads are handled the next time the background thread wakes up
+	if(wakeup) {
+		signal_trigger(&mesh->loop, &mesh->datafromapp);
+	}
+}
+
+bool dispatch_run(meshlink_handle_t *mesh) {
+	dispatch_t *dispatch = &mesh->dispatch;
+	bool invoked = false;
+
+	// Callbacks can cause new events, keep going until the queue is empty
+	while(true) {
+		if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+			abort();
+		}
+
+		if(dispatch->threadstarted || !dispatch->head) {
+			pthread_mutex_unlock(&dispatch->mutex);
+			return invoked;
+		}
+
+		invoked = true;
+
+		deferred_callback_t *list = take_all(dispatch);
+		pthread_mutex_unlock(&dispatch->mutex);
+
+		invoke_list(mesh, list);
+	}
+}
+
+static void *dispatch_thread(void *arg) {
+	meshlink_handle_t *mesh = arg;
+	dispatch_t *dispatch = &mesh->dispatch;
+
+	if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+		abort();
+	}
+
+	// Only exit once everything queued before we were told to quit has been handled
+	while(dispatch->head || !dispatch->quit) {
+		if(!dispatch->head) {
+			pthread_cond_wait(&dispatch->cond, &dispatch->mutex);
+			continue;
+		}
+
+		deferred_callback_t *list = take_all(dispatch);
+		pthread_mutex_unlock(&dispatch->mutex);
+
+		invoke_list(mesh, list);
+
+		if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+			abort();
+		}
+	}
+
+	pthread_mutex_unlock(&dispatch->mutex);
+	return NULL;
+}
+
+// Stop the callback thread, if it is running, and wait for it to finish.
+static void stop_thread(meshlink_handle_t *mesh) {
+	dispatch_t *dispatch = &mesh->dispatch;
+
+	if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+		abort();
+	}
+
+	if(!dispatch->threadstarted) {
+		pthread_mutex_unlock(&dispatch->mutex);
+		return;
+	}
+
+	dispatch->quit = true;
+	pthread_cond_signal(&dispatch->cond);
+	pthread_mutex_unlock(&dispatch->mutex);
+
+	if(pthread_join(dispatch->thread, NULL) != 0) {
+		abort();
+	}
+
+	if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+		abort();
+	}
+
+	dispatch->threadstarted = false;
+	dispatch->quit = false;
+	pthread_mutex_unlock(&dispatch->mutex);
+}
+
+bool dispatch_set_mode(meshlink_handle_t *mesh, meshlink_callback_mode_t mode) {
+	dispatch_t *dispatch = &mesh->dispatch;
+
+	if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+		abort();
+	}
+
+	bool self = dispatch->threadstarted && pthread_equal(dispatch->thread, pthread_self());
+	pthread_mutex_unlock(&dispatch->mutex);
+
+	if(self) {
+		logger(mesh, MESHLINK_ERROR, "Cannot change the callback mode from the callback thread");
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	// The callback thread might be in a callback waiting for the mesh mutex, so stop it without holding that
+	if(mode != MESHLINK_CALLBACKS_THREAD) {
+		stop_thread(mesh);
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	if(pthread_mutex_lock(&dispatch->mutex) != 0) {
+		abort();
+	}
+
+	bool result = true;
+
+	if(mode == MESHLINK_CALLBACKS_THREAD && !dispatch->threadstarted) {
+		int err = pthread_create(&dispatch->thread, NULL, dispatch_thread, mesh);
+
+		if(!err) {
+			dispatch->threadstarted = true;
+		} else {
+			logger(mesh, MESHLINK_ERROR, "Could not start callback thread: %s", strerror(err));
+			meshlink_errno = MESHLINK_EINTERNAL;
+			result = false;
+		}
+	}
+
+	if(result) {
+		dispatch->mode = mode;
+	}
+
+	pthread_mutex_unlock(&dispatch->mutex);
+	pthread_mutex_unlock(&mesh->mutex);
+
+	// Anything still queued when switching away from deferred callbacks is handled by the background thread
+	if(result && mode == MESHLINK_CALLBACKS_DIRECT) {
+		signal_trigger(&mesh->loop, &mesh->datafromapp);
+	}
+
+	return result;
+}
+
+void dispatch_init(meshlink_handle_t *mesh) {
+	dispatch_t *dispatch = &mesh->dispatch;
+
+	pthread_mutex_init(&dispatch->mutex, NULL);
+	pthread_cond_init(&dispatch->cond, NULL);
+	dispatch->mode = MESHLINK_CALLBACKS_DIRECT;
+	dispatch->tail = &dispatch->head;
+}
+
+void dispatch_exit(meshlink_handle_t *mesh) {
+	dispatch_t *dispatch = &mesh->dispatch;
+
+	// The handle might be closed before it was fully opened
+	if(!dispatch->tail) {
+		return;
+	}
+
+	stop_thread(mesh);
+
+	// Deliver whatever is left, the background thread has already stopped at this point
+	dispatch_run(mesh);
+
+	pthread_cond_destroy(&dispatch->cond);
+	pthread_mutex_destroy(&dispatch->mutex);
+	dispatch->tail = NULL;
+}
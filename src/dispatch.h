@@ -0,0 +1,84 @@
+#ifndef MESHLINK_DISPATCH_H
+#define MESHLINK_DISPATCH_H
+
+/*
+    dispatch.h -- deferred callback dispatch
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* This header is included by meshlink_internal.h, after the public callback types have been declared. */
+
+#include <pthread.h>
+
+typedef enum callback_type_t {
+	CALLBACK_RECEIVE,
+	CALLBACK_NODE_STATUS,
+	CALLBACK_META_STATUS,
+	CALLBACK_NODE_DUPLICATE,
+	CALLBACK_CONNECTION_TRY,
+	CALLBACK_ERROR,
+	CALLBACK_LOG,
+} callback_type_t;
+
+struct meshlink_handle;
+struct node_t;
+
+typedef struct deferred_callback_t {
+	struct deferred_callback_t *next;
+	callback_type_t type;
+	union {
+		meshlink_receive_cb_t receive;
+		meshlink_node_status_cb_t node_status;
+		meshlink_node_duplicate_cb_t node_duplicate;
+		meshlink_connection_try_cb_t connection_try;
+		meshlink_error_cb_t error;
+		meshlink_log_cb_t log;
+	} cb;                                   /* the callback that was set when the event happened */
+	struct node_t *node;
+	int value;
+	size_t len;
+	char data[];
+} deferred_callback_t;
+
+typedef struct dispatch_t {
+	pthread_mutex_t mutex;                  /* protects everything below */
+	pthread_cond_t cond;
+	meshlink_callback_mode_t mode;          /* also written with the mesh mutex held, so it can be read with either */
+	deferred_callback_t *head;
+	deferred_callback_t **tail;
+	pthread_t thread;
+	bool threadstarted;
+	bool quit;
+} dispatch_t;
+
+/// Call an application callback, or queue it if callbacks are deferred.
+/** The value is the reachability for status callbacks, the errno for the error callback and the level for the log callback.
+ *  The data is copied if the callback is queued.
+ */
+void dispatch_callback(struct meshlink_handle *mesh, callback_type_t type, struct node_t *n, int value, const void *data, size_t len);
+
+/// Call the queued callbacks in the current thread, unless they are handled by the callback thread.
+/** This must be called without holding the mesh mutex. Returns true if any callbacks were called. */
+bool dispatch_run(struct meshlink_handle *mesh);
+
+void dispatch_init(struct meshlink_handle *mesh);
+void dispatch_exit(struct meshlink_handle *mesh);
+
+/// Change how callbacks are called, this must be called without holding the mesh mutex.
+bool dispatch_set_mode(struct meshlink_handle *mesh, meshlink_callback_mode_t mode);
+
+#endif
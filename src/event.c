@@ -25,6 +25,7 @@
 #include "meshlink-tiny.h"
 #include "net.h"
 #include "splay_tree.h"
+#include "trace.h"
 #include "utils.h"
 #include "xalloc.h"
 
@@ -66,6 +67,10 @@ static void timespec_clear(struct timespec *a) {
 	a->tv_sec = 0;
 }
 
+static bool timespec_isset(const struct timespec *a) {
+	return a->tv_sec;
+}
+
 static int io_compare(const io_t *a, const io_t *b) {
 	return a->fd - b->fd;
 }
@@ -161,6 +166,22 @@ void timeout_set(event_loop_t *loop, timeout_t *timeout, struct timespec *tv) {
 	loop->deletion = true;
 }
 
+/// Make the timeout fire after the given delay, unless it is already due to fire before that.
+void timeout_advance(event_loop_t *loop, timeout_t *timeout, struct timespec *tv) {
+	assert(timeout->cb);
+
+	if(timeout->node.data) {
+		struct timespec when;
+		timespec_add(&loop->now, tv, &when);
+
+		if(!timespec_lt(&when, &timeout->tv)) {
+			return;
+		}
+	}
+
+	timeout_set(loop, timeout, tv);
+}
+
 static void timeout_disable(event_loop_t *loop, timeout_t *timeout) {
 	if(timeout->node.data) {
 		splay_unlink_node(&loop->timeouts, &timeout->node);
@@ -279,6 +300,44 @@ void signal_del(event_loop_t *loop, signal_t *sig) {
 	}
 }
 
+static void histogram_add(event_loop_t *loop, event_histogram_t type, const struct timespec *start, const struct timespec *end) {
+	struct timespec diff;
+	uint64_t usec = 0;
+
+	if(timespec_lt(start, end)) {
+		timespec_sub(end, start, &diff);
+		usec = diff.tv_sec * 1000000ull + diff.tv_nsec / 1000;
+	}
+
+	int bucket = 0;
+
+	while(usec > 1 && bucket < EVENT_HISTOGRAM_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+
+	stats_inc(&loop->histograms[type][bucket], 1);
+}
+
+// Remember when a callback starts, only if the loop is instrumented.
+static void callback_start(const event_loop_t *loop, struct timespec *start) {
+	if(loop->instrument) {
+		clock_gettime(EVENT_CLOCK, start);
+	} else {
+		timespec_clear(start);
+	}
+}
+
+static void callback_done(event_loop_t *loop, event_histogram_t type, const struct timespec *start) {
+	if(!timespec_isset(start)) {
+		return;
+	}
+
+	struct timespec end;
+	clock_gettime(EVENT_CLOCK, &end);
+	histogram_add(loop, type, start, &end);
+}
+
 void idle_set(event_loop_t *loop, idle_cb_t cb, void *data) {
 	loop->idle_cb = cb;
 	loop->idle_data = data;
@@ -355,8 +414,18 @@ bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
 			timeout_t *timeout = loop->timeouts.head->data;
 
 			if(timespec_lt(&timeout->tv, &loop->now)) {
+				struct timespec start;
+				callback_start(loop, &start);
+
+				if(timespec_isset(&start)) {
+					histogram_add(loop, EVENT_HISTOGRAM_LATENESS, &timeout->tv, &start);
+				}
+
+				// Pass the times as they are, so nothing is computed while nobody is tracing
+				TRACE3(timer_fire, timeout->cb, &loop->now, &timeout->tv);
 				timeout_disable(loop, timeout);
 				timeout->cb(loop, timeout->data);
+				callback_done(loop, EVENT_HISTOGRAM_TIMEOUT, &start);
 			} else {
 				timespec_sub(&timeout->tv, &loop->now, &ts);
 				break;
@@ -381,9 +450,22 @@ bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
 			fds = last->fd + 1;
 		}
 
+		if(loop->instrument) {
+			stats_inc(&loop->iterations, 1);
+		}
+
 		// release mesh mutex during select
 		pthread_mutex_unlock(&mesh->mutex);
 
+		// Deferred callbacks are called while we don't hold the mutex, timers might be due after they return
+		if(dispatch_run(mesh)) {
+			ts.tv_sec = 0;
+			ts.tv_nsec = 0;
+		}
+
+		struct timespec wait_start;
+		callback_start(loop, &wait_start);
+
 #ifdef HAVE_PSELECT
 		int n = pselect(fds, &readable, &writable, NULL, &ts, NULL);
 #else
@@ -397,6 +479,10 @@ bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
 
 		clock_gettime(EVENT_CLOCK, &loop->now);
 
+		if(timespec_isset(&wait_start)) {
+			histogram_add(loop, EVENT_HISTOGRAM_WAIT, &wait_start, &loop->now);
+		}
+
 		if(n < 0) {
 			if(sockwouldblock(errno)) {
 				continue;
@@ -427,8 +513,14 @@ bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
 		loop->deletion = false;
 
 		for splay_each(io_t, io, &loop->ios) {
+			// Signals are delivered via the pipe, account for them separately
+			event_histogram_t type = io == &loop->signalio ? EVENT_HISTOGRAM_SIGNAL : EVENT_HISTOGRAM_IO;
+			struct timespec start;
+
 			if(FD_ISSET(io->fd, &writable) && io->cb) {
+				callback_start(loop, &start);
 				io->cb(loop, io->data, IO_WRITE);
+				callback_done(loop, type, &start);
 			}
 
 			if(loop->deletion) {
@@ -436,7 +528,9 @@ bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
 			}
 
 			if(FD_ISSET(io->fd, &readable) && io->cb) {
+				callback_start(loop, &start);
 				io->cb(loop, io->data, IO_READ);
+				callback_done(loop, type, &start);
 			}
 
 			if(loop->deletion) {
@@ -22,11 +22,26 @@
 
 #include "splay_tree.h"
 #include "system.h"
+#include "stats.h"
 #include <pthread.h>
 
 #define IO_READ 1
 #define IO_WRITE 2
 
+/* Histograms of the event loop, bucket i counts durations of [2^i, 2^(i+1)) microseconds,
+   the first bucket also counts zero, and the last one everything longer. */
+
+#define EVENT_HISTOGRAM_BUCKETS 24
+
+typedef enum event_histogram_t {
+	EVENT_HISTOGRAM_IO,             /* duration of I/O callbacks */
+	EVENT_HISTOGRAM_TIMEOUT,        /* duration of timeout callbacks */
+	EVENT_HISTOGRAM_SIGNAL,         /* duration of signal callbacks */
+	EVENT_HISTOGRAM_LATENESS,       /* how late timeout callbacks are called */
+	EVENT_HISTOGRAM_WAIT,           /* time spent waiting in select() */
+	EVENT_HISTOGRAM_COUNT
+} event_histogram_t;
+
 typedef struct event_loop_t event_loop_t;
 struct meshlink_handle;
 
@@ -79,6 +94,11 @@ struct event_loop_t {
 
 	io_t signalio;
 	int pipefd[2];
+
+	// Optional instrumentation, readable without holding the mesh mutex
+	bool instrument;
+	stats_counter_t iterations;
+	stats_counter_t histograms[EVENT_HISTOGRAM_COUNT][EVENT_HISTOGRAM_BUCKETS];
 };
 
 void io_add(event_loop_t *loop, io_t *io, io_cb_t cb, void *data, int fd, int flags);
@@ -88,6 +108,7 @@ void io_set(event_loop_t *loop, io_t *io, int flags);
 void timeout_add(event_loop_t *loop, timeout_t *timeout, timeout_cb_t cb, void *data, struct timespec *tv);
 void timeout_del(event_loop_t *loop, timeout_t *timeout);
 void timeout_set(event_loop_t *loop, timeout_t *timeout, struct timespec *tv);
+void timeout_advance(event_loop_t *loop, timeout_t *timeout, struct timespec *tv);
 
 void signal_add(event_loop_t *loop, signal_t *sig, signal_cb_t cb, void *data, uint8_t signum);
 void signal_trigger(event_loop_t *loop, signal_t *sig);
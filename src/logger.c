@@ -23,9 +23,9 @@
 #include "meshlink_internal.h"
 #include "sptps.h"
 
-#ifndef logger
+#ifndef NDEBUG
 // TODO: refactor logging code to use a meshlink_handle_t *.
-void logger(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *format, ...) {
+void logger_write(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *format, ...) {
 	assert(format);
 
 	if(mesh) {
@@ -49,8 +49,13 @@ void logger(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *for
 		message[len - 1] = 0;
 	}
 
+	// Messages of the configuration writer thread are passed on later, by a thread holding the mesh mutex
+	if(mesh && config_writer_log(mesh, level, message)) {
+		return;
+	}
+
 	if(mesh) {
-		mesh->log_cb(mesh, level, message);
+		dispatch_callback(mesh, CALLBACK_LOG, NULL, level, message, strlen(message) + 1);
 	} else {
 		global_log_cb(NULL, level, message);
 	}
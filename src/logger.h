@@ -22,10 +22,30 @@
 
 #include "meshlink_internal.h"
 
+#ifndef MESHLINK_MIN_LOG_LEVEL
+#define MESHLINK_MIN_LOG_LEVEL MESHLINK_DEBUG
+#endif
+
 #ifdef NDEBUG
 #define logger(mesh, ...) do {(void)mesh;} while(0)
 #else
-void logger(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *format, ...) __attribute__((__format__(printf, 3, 4)));
+void logger_write(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *format, ...) __attribute__((__format__(printf, 3, 4)));
+
+static inline bool logger_enabled(const meshlink_handle_t *mesh, meshlink_log_level_t level) {
+	if(mesh) {
+		return level >= mesh->log_level && mesh->log_cb;
+	} else {
+		return level >= global_log_level && global_log_cb;
+	}
+}
+
+/* The level is checked before the arguments are evaluated.
+   Messages below MESHLINK_MIN_LOG_LEVEL are removed by the compiler. */
+#define logger(mesh, level, ...) do { \
+		if((level) >= MESHLINK_MIN_LOG_LEVEL && logger_enabled((mesh), (level))) { \
+			logger_write((mesh), (level), __VA_ARGS__); \
+		} \
+	} while(0)
 #endif
 
 #endif
@@ -212,6 +212,19 @@ public:
 		meshlink_stop(handle);
 	}
 
+	/// Set how callbacks are called.
+	/** By default, callbacks are called from MeshLink's own thread while it holds the handle's mutex.
+	 *  Deferred callbacks are called in order after that mutex has been released,
+	 *  either by MeshLink's own thread or by a dedicated callback thread.
+	 *
+	 *  @param mode     The callback mode. The default is MESHLINK_CALLBACKS_DIRECT.
+	 *
+	 *  @return         This function returns true if the callback mode has been changed, false otherwise.
+	 */
+	bool set_callback_mode(meshlink_callback_mode_t mode) {
+		return meshlink_set_callback_mode(handle, mode);
+	}
+
 	/// Send data to another node.
 	/** This functions sends one packet of data to another node in the mesh.
 	 *  The packet is sent using UDP semantics, which means that
@@ -255,6 +268,87 @@ public:
 		return meshlink_get_node_reachability(handle, node, last_reachable, last_unreachable);
 	}
 
+	/// Get the measured round-trip time to a node.
+	/** This function returns the smoothed round-trip time of keepalive packets on the connection with a given node.
+	 *
+	 *  @param node              A pointer to a meshlink::node describing the node.
+	 *  @param srtt              A pointer to a variable that will be filled in with the smoothed round-trip time, in microseconds.
+	 *  @param rttvar            A pointer to a variable that will be filled in with the round-trip time variation, in microseconds.
+	 *
+	 *  @return                  This function returns true if the round-trip time is known, false otherwise.
+	 */
+	bool get_node_rtt(node *node, uint32_t *srtt, uint32_t *rttvar = NULL) {
+		return meshlink_get_node_rtt(handle, node, srtt, rttvar);
+	}
+
+	/// Get the performance counters of this instance.
+	/** This function returns a snapshot of the counters of the whole instance, without taking any locks.
+	 *
+	 *  @param stats             A pointer to a meshlink_stats_t that will be filled in.
+	 *
+	 *  @return                  This function returns true if the counters have been filled in, false otherwise.
+	 */
+	bool get_stats(meshlink_stats_t *stats) {
+		return meshlink_get_stats(handle, stats);
+	}
+
+	/// Get the performance counters of a node.
+	/** This function returns a snapshot of the counters of a single node, without taking any locks.
+	 *
+	 *  @param node              A pointer to a meshlink::node describing the node.
+	 *  @param stats             A pointer to a meshlink_stats_t that will be filled in.
+	 *
+	 *  @return                  This function returns true if the counters have been filled in, false otherwise.
+	 */
+	bool get_node_stats(node *node, meshlink_stats_t *stats) {
+		return meshlink_get_node_stats(handle, node, stats);
+	}
+
+	/// Capture meta-connection records to a file.
+	/** This writes the decrypted records exchanged with other nodes to a ring file,
+	 *  which can be converted to pcapng format with the capture2pcapng example program.
+	 *
+	 *  @param path          The path of the file to write to, which will be overwritten. If NULL, capturing is stopped.
+	 *  @param size          The size of the file in bytes.
+	 *
+	 *  @return              This function returns true if capturing has been started or stopped, false otherwise.
+	 */
+	bool set_capture_file(const char *path, size_t size) {
+		return meshlink_set_capture_file(handle, path, size);
+	}
+
+	/// Listen for local control connections.
+	/** This opens a UNIX socket that serves statistics, connection state and timers,
+	 *  and accepts commands to change the log level and ping timeouts at runtime.
+	 *
+	 *  @param path          The path of the socket. If NULL, the control socket is closed.
+	 *
+	 *  @return              This function returns true if the control socket has been opened or closed, false otherwise.
+	 */
+	bool set_control_socket(const char *path) {
+		return meshlink_set_control_socket(handle, path);
+	}
+
+	/// Enable or disable event loop instrumentation.
+	/** When enabled, the background thread records histograms of its callback durations, timer lateness and wait times.
+	 *
+	 *  @param enable        If true, instrument the event loop. The default is false.
+	 */
+	void set_loop_instrumentation(bool enable) {
+		meshlink_set_loop_instrumentation(handle, enable);
+	}
+
+	/// Get the event loop statistics.
+	/** This function returns a snapshot of the event loop histograms, without taking any locks.
+	 *
+	 *  @param stats             A pointer to a meshlink_loop_stats_t that will be filled in.
+	 *
+	 *  @return                  This function returns true if the statistics have been filled in, false otherwise.
+	 */
+	bool get_loop_stats(meshlink_loop_stats_t *stats) {
+		return meshlink_get_loop_stats(handle, stats);
+	}
+
 	/// Get a handle for our own node.
 	/** This function returns a handle for the local node.
 	 *
@@ -363,6 +457,20 @@ public:
 		meshlink_set_storage_policy(handle, policy);
 	}
 
+	/// Sets the window in which MeshLink coalesces updates to node configuration files
+	/** Updates to node information that MeshLink learns while running, such as recently seen addresses,
+	 *  are written to storage by a background thread, so the MeshLink thread never has to wait for storage.
+	 *  All updates made within the given window are written out together, and the storage is synced only once
+	 *  for the whole batch. A larger window reduces wear on flash storage, at the cost of losing more recent
+	 *  updates if the application crashes. Pending updates are always written out when MeshLink is stopped.
+	 *  The default value is 0, meaning updates are written out as soon as possible.
+	 *
+	 *  @param window  The coalescing window in milliseconds.
+	 */
+	void set_storage_flush_window(int window) {
+		meshlink_set_storage_flush_window(handle, window);
+	}
+
 	/// Use an invitation to join a mesh.
 	/** This function allows the local node to join an existing mesh using an invitation URL generated by another node.
 	 *  An invitation can only be used if the local node has never connected to other nodes before.
@@ -448,9 +556,20 @@ public:
 		meshlink_set_dev_class_timeouts(handle, devclass, pinginterval, pingtimeout);
 	}
 
+	/// Set device class adaptive ping timeout
+	/** This makes the ping timeout for a given device class depend on the measured round-trip time to the peer.
+	 *
+	 *  @param devclass      The device class to update
+	 *  @param factor        The multiple of the retransmission timeout after which a peer is considered unreachable, between 1 and 100,
+	 *                       or 0 to use the fixed ping timeout. The default is 0.
+	 */
+	void set_dev_class_adaptive_timeout(dev_class_t devclass, int factor) {
+		meshlink_set_dev_class_adaptive_timeout(handle, devclass, factor);
+	}
+
 	/// Set device class fast retry period
 	/** This sets the fast retry period for a given device class.
-	 *  During this period after the last time the mesh becomes unreachable, connections are tried once a second.
+	 *  During this period after the last time the mesh becomes unreachable, connections are retried without backing off.
 	 *
 	 *  @param devclass           The device class to update
 	 *  @param fast_retry_period  The period during which fast connection retries are done. The default is 0.
@@ -469,6 +588,27 @@ public:
 		meshlink_set_dev_class_maxtimeout(handle, devclass, maxtimeout);
 	}
 
+	/// Set device class reconnection backoff
+	/** This sets how the delay between outgoing connection retries grows for a given device class.
+	 *
+	 *  @param devclass      The device class to update
+	 *  @param base          The base delay between reconnection attempts, in milliseconds. The default is 1000.
+	 *  @param jitter        Whether to randomize the delays. The default is true.
+	 */
+	void set_dev_class_backoff(dev_class_t devclass, int base, bool jitter) {
+		meshlink_set_dev_class_backoff(handle, devclass, base, jitter);
+	}
+
+	/// Let the operating system detect unreachable peers
+	/** This enables TCP keepalive on meta-connections, using the ping interval and timeout of the peer's device class.
+	 *  On connections where the operating system supports this, MeshLink stops sending its own keepalive packets.
+	 *
+	 *  @param enable        If true, let the operating system detect unreachable peers. The default is false.
+	 */
+	void set_tcp_keepalive(bool enable) {
+		meshlink_set_tcp_keepalive(handle, enable);
+	}
+
 	/// Set which order invitations are committed
 	/** This determines in which order configuration files are written to disk during an invitation.
 	 *  By default, the invitee saves the configuration to disk first, then the inviter.
@@ -480,6 +620,30 @@ public:
 		meshlink_set_inviter_commits_first(handle, inviter_commits_first);
 	}
 
+	/// Keep a warm standby connection to a second upstream node
+	/** By default, only one upstream node is connected to.
+	 *  When enabled, a connection to a second known node is kept alive as well,
+	 *  and packets are immediately sent via that node when the connection to the first one fails.
+	 *
+	 *  @param standby       If true, keep a connection to the second upstream node as well. The default is false.
+	 */
+	void set_upstream_standby(bool standby) {
+		meshlink_set_upstream_standby(handle, standby);
+	}
+
+	/// Use multiple upstream nodes at the same time
+	/** This sets how many of the known upstream nodes are connected to, and how packets are spread over them.
+	 *  Packets for the same destination are always sent via the same upstream node, so they are never reordered.
+	 *
+	 *  @param policy        The policy used to pick an upstream node for each destination.
+	 *  @param count         The number of upstream nodes to keep connected, between 1 and 4.
+	 *
+	 *  @return              This function returns true if the policy was set, false otherwise.
+	 */
+	bool set_upstream_policy(meshlink_upstream_policy_t policy, int count) {
+		return meshlink_set_upstream_policy(handle, policy, count);
+	}
+
 private:
 	// non-copyable:
 	mesh(const mesh &) /* TODO: C++11: = delete */;
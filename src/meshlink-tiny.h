@@ -84,6 +84,108 @@ typedef enum {
 	MESHLINK_STORAGE_KEYS_ONLY   ///< Only store updates when a node's key has changed.
 } meshlink_storage_policy_t;
 
+/// Storage engine
+typedef enum {
+	MESHLINK_STORAGE_ENGINE_FILES,  ///< Store each configuration file separately.
+	MESHLINK_STORAGE_ENGINE_LOG     ///< Store all configuration files in a single append-only log.
+} meshlink_storage_engine_t;
+
+/// Upstream policy
+typedef enum {
+	MESHLINK_UPSTREAM_FAILOVER,      ///< Send all packets via the most preferred reachable upstream node.
+	MESHLINK_UPSTREAM_ROUND_ROBIN,   ///< Assign destinations to the reachable upstream nodes in turn.
+	MESHLINK_UPSTREAM_LEAST_QUEUED,  ///< Assign destinations to the upstream connection with the fewest bytes waiting to be sent.
+	MESHLINK_UPSTREAM_HASH           ///< Assign destinations to upstream nodes based on a hash of their names.
+} meshlink_upstream_policy_t;
+
+/// Callback mode
+typedef enum {
+	MESHLINK_CALLBACKS_DIRECT,       ///< Call callbacks from the background thread while it holds the mesh mutex.
+	MESHLINK_CALLBACKS_DEFERRED,     ///< Call callbacks from the background thread after it released the mesh mutex.
+	MESHLINK_CALLBACKS_THREAD        ///< Call callbacks from a dedicated callback thread.
+} meshlink_callback_mode_t;
+
+/// Storage operations
+/** A set of functions MeshLink uses to store its configuration files, instead of using the filesystem.
+ *  The configuration files are identified by keys, which look like relative paths,
+ *  for example "current/meshlink.conf" and "current/hosts/foo".
+ *  If a storage key is set, the data is encrypted before it is passed to these functions.
+ *  These functions can be called from the background thread, so they must be thread-safe.
+ */
+typedef struct meshlink_storage_ops {
+	/// Read the data stored under a key.
+	/** If data is NULL, only the size of the stored data is returned in len.
+	 *  Otherwise, len contains the size of the buffer pointed to by data,
+	 *  and on success it is set to the size of the stored data.
+	 *  This function must return false if the key does not exist or the buffer is too small.
+	 */
+	bool (*read)(void *priv, const char *key, void *data, size_t *len);
+
+	/// Store data under a key, replacing any data previously stored under that key.
+	bool (*write)(void *priv, const char *key, const void *data, size_t len);
+
+	/// Remove a key. This function must return true if the key does not exist.
+	bool (*remove)(void *priv, const char *key);
+
+	/// Call action for every key that starts with prefix, until action returns false.
+	/** The action does not modify the storage. This function must return false if action returned false.
+	 */
+	bool (*scan)(void *priv, const char *prefix, bool (*action)(void *arg, const char *key), void *arg);
+
+	/// Make sure everything written and removed so far is stored persistently.
+	bool (*sync)(void *priv);
+} meshlink_storage_ops_t;
+
+/// Performance counters
+/** Counters of an instance of MeshLink, or of a single node, as returned by meshlink_get_stats() and meshlink_get_node_stats().
+ *  All counters start at zero when the instance is opened. Times are in microseconds.
+ */
+typedef struct meshlink_stats {
+	uint64_t messages_queued;     ///< Messages passed to meshlink_send().
+	uint64_t bytes_queued;        ///< Bytes passed to meshlink_send().
+	uint64_t messages_sent;       ///< Messages handed to a meta-connection.
+	uint64_t bytes_sent;          ///< Bytes of messages handed to a meta-connection.
+	uint64_t messages_received;   ///< Messages received and passed to the receive callback.
+	uint64_t bytes_received;      ///< Bytes of messages received.
+	uint64_t records_encrypted;   ///< SPTPS records encrypted, including handshake records.
+	uint64_t records_decrypted;   ///< SPTPS records decrypted, including handshake records.
+	uint64_t queue_depth;         ///< Messages currently waiting in the queue of the background thread.
+	uint64_t queue_max;           ///< Highest number of messages that were waiting in the queue.
+	uint64_t outbuf_depth;        ///< Bytes currently waiting to be written to sockets.
+	uint64_t outbuf_max;          ///< Highest number of bytes that were waiting to be written to sockets.
+	uint64_t handshakes;          ///< Meta-connections that completed authentication.
+	uint64_t handshake_time;      ///< Total time from connecting until authentication completed, for outgoing connections.
+	uint64_t renewals;            ///< SPTPS key renewals.
+	uint64_t renewal_time;        ///< Total time taken by the key renewals we started.
+	uint64_t reconnects;          ///< Times an outgoing connection was retried.
+	uint64_t srtt;                ///< The most recently smoothed PING round-trip time.
+	uint64_t rttvar;              ///< The most recent PING round-trip time variation.
+	uint64_t callbacks;           ///< Application callbacks called.
+	uint64_t callback_time;       ///< Total time spent in application callbacks.
+} meshlink_stats_t;
+
+/// Event loop histograms
+typedef enum {
+	MESHLINK_HISTOGRAM_IO,        ///< Duration of socket I/O callbacks, including storage writes and crypto done by them.
+	MESHLINK_HISTOGRAM_TIMEOUT,   ///< Duration of timer callbacks.
+	MESHLINK_HISTOGRAM_SIGNAL,    ///< Duration of callbacks for events from other threads, such as sending queued packets.
+	MESHLINK_HISTOGRAM_LATENESS,  ///< How long after their deadline timers were handled.
+	MESHLINK_HISTOGRAM_WAIT,      ///< Time spent waiting for events.
+	MESHLINK_HISTOGRAM_COUNT
+} meshlink_histogram_t;
+
+/// Number of buckets in each event loop histogram.
+/** Bucket i counts durations between 2^i and 2^(i+1) microseconds,
+ *  the first bucket also counts durations shorter than a microsecond and the last bucket counts all longer durations.
+ */
+#define MESHLINK_HISTOGRAM_BUCKETS 24
+
+/// Event loop statistics
+typedef struct meshlink_loop_stats {
+	uint64_t iterations;                                                          ///< Number of times the event loop waited for events.
+	uint64_t histograms[MESHLINK_HISTOGRAM_COUNT][MESHLINK_HISTOGRAM_BUCKETS];   ///< Histograms, indexed by meshlink_histogram_t.
+} meshlink_loop_stats_t;
+
 /// Invitation flags
 static const uint32_t MESHLINK_INVITE_LOCAL = 1;    // Only use local addresses in the URL
 static const uint32_t MESHLINK_INVITE_PUBLIC = 2;   // Only use public or canonical addresses in the URL
@@ -181,6 +283,58 @@ bool meshlink_open_params_set_storage_key(meshlink_open_params_t *params, const
  */
 bool meshlink_open_params_set_storage_policy(meshlink_open_params_t *params, meshlink_storage_policy_t policy) __attribute__((__warn_unused_result__));
 
+/// Set the storage engine MeshLink should use for local storage.
+/** This function changes the open parameters to use the given storage engine.
+ *  By default, MESHLINK_STORAGE_ENGINE_FILES is used, which stores the main configuration file
+ *  and each host configuration file as separate files.
+ *  With MESHLINK_STORAGE_ENGINE_LOG, all configuration files are stored as records in a single append-only log,
+ *  which is compacted automatically. Each update then costs only a single append and sync,
+ *  and reading the configuration at startup only needs a single sequential read.
+ *  The same storage engine must be used every time a given configuration directory is opened.
+ *
+ *  @param params   A pointer to a meshlink_open_params_t which must have been created earlier with meshlink_open_params_init().
+ *  @param engine   The storage engine to use.
+ *
+ *  @return         This function will return true if the open parameters have been successfully updated, false otherwise.
+ */
+bool meshlink_open_params_set_storage_engine(meshlink_open_params_t *params, meshlink_storage_engine_t engine) __attribute__((__warn_unused_result__));
+
+/// Set the storage operations MeshLink should use for local storage.
+/** This function changes the open parameters to store all configuration files using the given storage operations,
+ *  instead of in the configuration directory. A confbase must still be given to open a persistent instance,
+ *  but nothing will be created there. The storage engine is ignored when storage operations are set.
+ *  The same storage operations must be passed to meshlink_destroy_ex() to remove the stored configuration.
+ *
+ *  @param params   A pointer to a meshlink_open_params_t which must have been created earlier with meshlink_open_params_init().
+ *  @param ops      A pointer to the storage operations, or NULL to use the filesystem again.
+ *                  The operations must remain valid until the instance has been closed.
+ *  @param priv     A private pointer that is passed to all storage operations.
+ *
+ *  @return         This function will return true if the open parameters have been successfully updated, false otherwise.
+ */
+bool meshlink_open_params_set_storage_ops(meshlink_open_params_t *params, const meshlink_storage_ops_t *ops, void *priv) __attribute__((__warn_unused_result__));
+
+/// Storage operations that keep the configuration in memory.
+/** The private pointer passed along with these operations must be created with meshlink_memory_storage_create().
+ *  The configuration survives closing and reopening a MeshLink instance, but not the application itself.
+ */
+extern const meshlink_storage_ops_t meshlink_memory_storage_ops;
+
+/// Create an in-memory store.
+/** This function creates an empty store to be used with meshlink_memory_storage_ops.
+ *
+ *  @return         A pointer to the store, which must be passed to meshlink_open_params_set_storage_ops().
+ */
+void *meshlink_memory_storage_create(void) __attribute__((__warn_unused_result__));
+
+/// Destroy an in-memory store.
+/** This function frees all the memory used by a store created with meshlink_memory_storage_create().
+ *  No instance using the store may be open at the time this function is called.
+ *
+ *  @param priv     A pointer to a store created with meshlink_memory_storage_create(), or NULL.
+ */
+void meshlink_memory_storage_destroy(void *priv);
+
 /// Set the filename of the lockfile.
 /** This function changes the path of the lockfile used to ensure only one instance of MeshLink can be open at the same time.
  *  If an application changes this, it must always set it to the same location.
@@ -322,6 +476,16 @@ bool meshlink_start(struct meshlink_handle *mesh) __attribute__((__warn_unused_r
  */
 void meshlink_stop(struct meshlink_handle *mesh);
 
+/// Stop multiple instances of MeshLink.
+/** This function has the same effect as calling meshlink_stop() on each handle,
+ *  but it first tells all their threads to shut down, and only then waits for each of them,
+ *  so the threads shut down in parallel.
+ *
+ *  @param meshes   An array of handles which represent instances of MeshLink. NULL entries are skipped.
+ *  @param count    The number of entries in the array.
+ */
+void meshlink_stop_many(struct meshlink_handle **meshes, size_t count);
+
 /// Close the MeshLink handle.
 /** This function calls meshlink_stop() if necessary,
  *  and frees the struct meshlink_handle and all associacted memory allocated by MeshLink.
@@ -336,6 +500,15 @@ void meshlink_stop(struct meshlink_handle *mesh);
  */
 void meshlink_close(struct meshlink_handle *mesh);
 
+/// Close multiple MeshLink handles.
+/** This function stops all the instances with meshlink_stop_many(), then calls meshlink_close() on each handle.
+ *  The same restrictions apply as for meshlink_close().
+ *
+ *  @param meshes   An array of handles which represent instances of MeshLink. NULL entries are skipped.
+ *  @param count    The number of entries in the array.
+ */
+void meshlink_close_many(struct meshlink_handle **meshes, size_t count);
+
 /// Destroy a MeshLink instance.
 /** This function remove all configuration files of a MeshLink instance. It should only be called when the application
  *  does not have an open handle to this instance. Afterwards, a call to meshlink_open() will create a completely
@@ -526,6 +699,34 @@ typedef void (*meshlink_error_cb_t)(struct meshlink_handle *mesh, meshlink_errno
  */
 void meshlink_set_error_cb(struct meshlink_handle *mesh, meshlink_error_cb_t cb);
 
+/// Set how callbacks are called.
+/** By default, callbacks are called from MeshLink's own thread while it holds the mutex that protects the handle,
+ *  so a slow callback blocks all other threads that call MeshLink functions on the same handle.
+ *  With MESHLINK_CALLBACKS_DEFERRED, the background thread queues the callbacks,
+ *  and calls them once it has released the mutex, before it waits for new events.
+ *  With MESHLINK_CALLBACKS_THREAD, the queued callbacks are called from a dedicated thread instead,
+ *  so slow callbacks don't delay network I/O either.
+ *
+ *  When callbacks are deferred, the following guarantees hold:
+ *  - Callbacks are called in the order in which the events happened, one at a time.
+ *  - Each callback is called with the callback function that was set when the event happened,
+ *    so callbacks can still be called shortly after they have been changed or disabled.
+ *  - The data passed to the receive callback is a copy, and node pointers remain valid until the handle is closed.
+ *  - Log messages caused by MeshLink functions called from the application's own threads, including callbacks running in the callback thread,
+ *    are still passed to the log callback directly, and can therefore overtake queued callbacks.
+ *  - With MESHLINK_CALLBACKS_DEFERRED, callbacks caused by meshlink_stop() are called before it returns.
+ *  - Queued callbacks are still called when the callback mode is changed, and before meshlink_close() returns.
+ *
+ *  This function must not be called from the callback thread.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh      A handle which represents an instance of MeshLink.
+ *  @param mode      The callback mode. The default is MESHLINK_CALLBACKS_DIRECT.
+ *
+ *  @return          This function returns true if the callback mode has been changed, false otherwise.
+ */
+bool meshlink_set_callback_mode(struct meshlink_handle *mesh, meshlink_callback_mode_t mode);
+
 /// Send data to another node.
 /** This functions sends one packet of data to another node in the mesh.
  *  The packet is sent using UDP semantics, which means that
@@ -693,6 +894,124 @@ dev_class_t meshlink_get_node_dev_class(struct meshlink_handle *mesh, struct mes
  */
 bool meshlink_get_node_reachability(struct meshlink_handle *mesh, struct meshlink_node *node, time_t *last_reachable, time_t *last_unreachable);
 
+/// Get the measured round-trip time to a node.
+/** This function returns the round-trip time of keepalive packets on the connection with a given node,
+ *  smoothed and with its variation calculated the same way TCP does.
+ *  This is only available while there is an active connection with the node, and after a keepalive packet has been answered.
+ *
+ *  \memberof meshlink_node
+ *  @param mesh              A handle which represents an instance of MeshLink.
+ *  @param node              A pointer to a struct meshlink_node describing the node.
+ *  @param srtt              A pointer to a variable that will be filled in with the smoothed round-trip time, in microseconds.
+ *                           Pass NULL to not have anything written.
+ *  @param rttvar            A pointer to a variable that will be filled in with the round-trip time variation, in microseconds.
+ *                           Pass NULL to not have anything written.
+ *
+ *  @return                  This function returns true if the round-trip time is known, false otherwise.
+ */
+bool meshlink_get_node_rtt(struct meshlink_handle *mesh, struct meshlink_node *node, uint32_t *srtt, uint32_t *rttvar);
+
+/// Get the performance counters of an instance of MeshLink.
+/** This function returns a snapshot of the counters of the whole instance.
+ *  It does not take any locks, so it can be called at any time, even from within callbacks.
+ *  The counters are read one at a time, so they are not guaranteed to be consistent with each other.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh              A handle which represents an instance of MeshLink.
+ *  @param stats             A pointer to a struct meshlink_stats that will be filled in.
+ *
+ *  @return                  This function returns true if the counters have been filled in, false otherwise.
+ */
+bool meshlink_get_stats(struct meshlink_handle *mesh, meshlink_stats_t *stats);
+
+/// Get the performance counters of a node.
+/** This function returns a snapshot of the counters of a single node.
+ *  The queue counters refer to messages sent to this node,
+ *  all other counters refer to the meta-connections with this node.
+ *  It does not take any locks, so it can be called at any time, even from within callbacks.
+ *
+ *  \memberof meshlink_node
+ *  @param mesh              A handle which represents an instance of MeshLink.
+ *  @param node              A pointer to a struct meshlink_node describing the node.
+ *  @param stats             A pointer to a struct meshlink_stats that will be filled in.
+ *
+ *  @return                  This function returns true if the counters have been filled in, false otherwise.
+ */
+bool meshlink_get_node_stats(struct meshlink_handle *mesh, struct meshlink_node *node, meshlink_stats_t *stats);
+
+/// Capture meta-connection records to a file.
+/** This writes every request and packet exchanged with other nodes after authentication to a file,
+ *  after decryption, with a timestamp, the peer's name, the direction and the record type.
+ *  The file is a ring of fixed size slots, so when it is full, the oldest records are overwritten.
+ *  Records longer than 200 bytes are truncated, but their original length is kept.
+ *  The file can be converted to pcapng format with the capture2pcapng example program.
+ *
+ *  The file is memory mapped, so capturing is cheap enough to leave enabled,
+ *  and the records survive a crash of the application.
+ *  Note that the file contains the decrypted contents of all packets, so it should be protected accordingly.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param path          The path of the file to write to, which will be overwritten. If NULL, capturing is stopped.
+ *  @param size          The size of the file in bytes.
+ *
+ *  @return              This function returns true if capturing has been started or stopped, false otherwise.
+ */
+bool meshlink_set_capture_file(struct meshlink_handle *mesh, const char *path, size_t size);
+
+/// Listen for local control connections.
+/** This opens a UNIX stream socket on which other processes on the same host,
+ *  such as a monitoring agent, can read the state of this instance without linking against MeshLink.
+ *  Only the owner of the process can connect to it.
+ *  The protocol is line based: each request is a single line,
+ *  and each reply consists of zero or more lines followed by either "ok" or "error <reason>".
+ *
+ *  The following requests are supported:
+ *  - stats: the counters of the whole instance, as returned by meshlink_get_stats().
+ *  - nodes: the counters of each node, as returned by meshlink_get_node_stats().
+ *  - connections: the state of each meta-connection, its output buffer size and round-trip time.
+ *  - timers: the number of milliseconds until each pending timer fires.
+ *  - dump: all of the above.
+ *  - set log-level LEVEL: change the log level, if a log callback has been set.
+ *  - set ping DEVCLASS INTERVAL TIMEOUT: the same as meshlink_set_dev_class_timeouts().
+ *  - reset watermarks: reset the high-water marks of the queue and output buffer depths to their current values.
+ *  - quit: close the connection.
+ *
+ *  Requests are handled by the background thread, so the control socket only responds while MeshLink is running.
+ *  A previously opened control socket is closed first. An existing socket at the given path is replaced,
+ *  and the socket is removed when it is closed.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param path          The path of the socket. If NULL, the control socket is closed.
+ *
+ *  @return              This function returns true if the control socket has been opened or closed, false otherwise.
+ */
+bool meshlink_set_control_socket(struct meshlink_handle *mesh, const char *path);
+
+/// Enable or disable event loop instrumentation.
+/** When enabled, the background thread measures how long its callbacks take, how late timers are handled
+ *  and how long it waits for events, and records these in histograms that can be read with meshlink_get_loop_stats().
+ *  This costs a few clock reads per event. Disabling it keeps the histograms collected so far.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param enable        If true, instrument the event loop. The default is false.
+ */
+void meshlink_set_loop_instrumentation(struct meshlink_handle *mesh, bool enable);
+
+/// Get the event loop statistics.
+/** This function returns a snapshot of the event loop histograms.
+ *  It does not take any locks, so it can be called at any time, even from within callbacks.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh              A handle which represents an instance of MeshLink.
+ *  @param stats             A pointer to a struct meshlink_loop_stats that will be filled in.
+ *
+ *  @return                  This function returns true if the statistics have been filled in, false otherwise.
+ */
+bool meshlink_get_loop_stats(struct meshlink_handle *mesh, meshlink_loop_stats_t *stats);
+
 /// Verify the signature generated by another node of a piece of data.
 /** This function verifies the signature that another node generated for a piece of data.
  *
@@ -862,9 +1181,25 @@ bool meshlink_encrypted_key_rotate(struct meshlink_handle *mesh, const void *key
  */
 void meshlink_set_dev_class_timeouts(struct meshlink_handle *mesh, dev_class_t devclass, int pinginterval, int pingtimeout);
 
+/// Set device class adaptive ping timeout
+/** This makes the ping timeout for a given device class depend on the measured round-trip time to the peer.
+ *  Once a keepalive packet has been answered, the timeout becomes @a factor times the retransmission timeout
+ *  that TCP would calculate from the measured round-trip times, that is the smoothed round-trip time plus four times its variation.
+ *  The timeout is at least 200 milliseconds, and at most the ping interval.
+ *  This detects unreachable peers much faster on low latency links, and avoids false timeouts on high latency links.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param devclass      The device class to update
+ *  @param factor        The multiple of the retransmission timeout after which a peer is considered unreachable, between 1 and 100,
+ *                       or 0 to use the fixed ping timeout. The default is 0.
+ */
+void meshlink_set_dev_class_adaptive_timeout(struct meshlink_handle *mesh, dev_class_t devclass, int factor);
+
 /// Set device class fast retry period
 /** This sets the fast retry period for a given device class.
- *  During this period after the last time the mesh becomes unreachable, connections are tried once a second.
+ *  During this period after the last time the mesh becomes unreachable, connections are retried without backing off,
+ *  at intervals around the base set with meshlink_set_dev_class_backoff().
  *
  *  \memberof meshlink_handle
  *  @param mesh               A handle which represents an instance of MeshLink.
@@ -883,6 +1218,36 @@ void meshlink_set_dev_class_fast_retry_period(struct meshlink_handle *mesh, dev_
  */
 void meshlink_set_dev_class_maxtimeout(struct meshlink_handle *mesh, dev_class_t devclass, int maxtimeout);
 
+/// Set device class reconnection backoff
+/** This sets how the delay between outgoing connection retries grows for a given device class.
+ *  With jitter enabled, each delay is picked randomly between the base and three times the previous delay,
+ *  and the first retry after losing a connection is picked randomly between zero and the base.
+ *  This prevents many nodes that lost the same peer from reconnecting in lockstep.
+ *  Without jitter, the delay starts at the base and doubles after each failure.
+ *  In both cases, the delay is limited by the maximum timeout set with meshlink_set_dev_class_maxtimeout().
+ *  A peer can also ask for a longer delay in the error message it sends when it refuses a connection.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param devclass      The device class to update
+ *  @param base          The base delay between reconnection attempts, in milliseconds. The default is 1000.
+ *  @param jitter        Whether to randomize the delays. The default is true.
+ */
+void meshlink_set_dev_class_backoff(struct meshlink_handle *mesh, dev_class_t devclass, int base, bool jitter);
+
+/// Let the operating system detect unreachable peers
+/** This enables TCP keepalive on meta-connections, using the ping interval and timeout of the peer's device class.
+ *  It also limits how long sent data may remain unacknowledged to the ping timeout.
+ *  On connections where the operating system supports this, MeshLink stops sending its own keepalive packets,
+ *  so the application does not need to wake up to send them.
+ *  If it is not supported, MeshLink keeps sending its own keepalive packets.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param enable        If true, let the operating system detect unreachable peers. The default is false.
+ */
+void meshlink_set_tcp_keepalive(struct meshlink_handle *mesh, bool enable);
+
 /// Reset all connection timers
 /** This resets all timers related to connections, causing pending outgoing connections to be retried immediately.
  * It also sends keepalive packets on all active connections immediately.
@@ -903,6 +1268,42 @@ void meshlink_reset_timers(struct meshlink_handle *mesh);
  */
 void meshlink_set_inviter_commits_first(struct meshlink_handle *mesh, bool inviter_commits_first);
 
+/// Keep a warm standby connection to a second upstream node
+/** MeshLink-tiny normally only connects to one upstream node, and sends all its packets to that node.
+ *  Another node can be made known with meshlink_import(), but it will not be connected to by default.
+ *  By calling this function with @a standby set to true, MeshLink-tiny will also make a connection to the second node,
+ *  and keep it authenticated and alive with infrequent pings.
+ *  When the connection to the first node fails, packets are immediately sent via the second node instead,
+ *  without having to wait for a new connection to be made. Once the first node is reachable again, packets are sent to it again.
+ *  This is equivalent to calling meshlink_set_upstream_policy() with @a count set to 2 or 1, keeping the current policy.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param standby       If true, keep a connection to the second upstream node as well. The default is false.
+ */
+void meshlink_set_upstream_standby(struct meshlink_handle *mesh, bool standby);
+
+/// Use multiple upstream nodes at the same time
+/** MeshLink-tiny can keep track of up to four upstream nodes, which can be made known with meshlink_import().
+ *  This function sets how many of them are connected to, and how packets are spread over them.
+ *  With MESHLINK_UPSTREAM_FAILOVER, all packets are sent via the first reachable upstream node,
+ *  and the other connections are only kept alive.
+ *  With the other policies, each destination is assigned to one of the reachable upstream nodes.
+ *  Packets for the same destination are always sent via the same upstream node,
+ *  and a destination is only reassigned once it has been idle for a second and all its packets have been written
+ *  to the connection with its upstream node, or once its upstream node became unreachable,
+ *  so packets for the same destination are never reordered while they are being sent.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param policy        The policy used to pick an upstream node for each destination.
+ *                       The default is MESHLINK_UPSTREAM_FAILOVER.
+ *  @param count         The number of upstream nodes to keep connected, between 1 and 4. The default is 1.
+ *
+ *  @return              This function returns true if the policy was set, false otherwise.
+ */
+bool meshlink_set_upstream_policy(struct meshlink_handle *mesh, meshlink_upstream_policy_t policy, int count);
+
 /// Set the scheduling granularity of the application
 /** This should be set to the effective scheduling granularity for the application.
  *  This depends on the scheduling granularity of the operating system, the application's
@@ -928,6 +1329,20 @@ void meshlink_set_scheduling_granularity(struct meshlink_handle *mesh, long gran
  */
 void meshlink_set_storage_policy(struct meshlink_handle *mesh, meshlink_storage_policy_t policy);
 
+/// Sets the window in which MeshLink coalesces updates to node configuration files
+/** Updates to node information that MeshLink learns while running, such as recently seen addresses,
+ *  are written to storage by a background thread, so the MeshLink thread never has to wait for storage.
+ *  All updates made within the given window are written out together, and the storage is synced only once
+ *  for the whole batch. A larger window reduces wear on flash storage, at the cost of losing more recent
+ *  updates if the application crashes. Pending updates are always written out when MeshLink is stopped.
+ *  The default value is 0, meaning updates are written out as soon as possible.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh    A handle which represents an instance of MeshLink.
+ *  @param window  The coalescing window in milliseconds.
+ */
+void meshlink_set_storage_flush_window(struct meshlink_handle *mesh, int window);
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,6 +20,9 @@
 #include "system.h"
 #include <pthread.h>
 
+#include "adns.h"
+#include "capture.h"
+#include "control.h"
 #include "crypto.h"
 #include "ecdsagen.h"
 #include "logger.h"
@@ -31,6 +34,7 @@
 #include "prf.h"
 #include "protocol.h"
 #include "sockaddr.h"
+#include "trace.h"
 #include "utils.h"
 #include "xalloc.h"
 #include "ed25519/sha512.h"
@@ -167,7 +171,7 @@ static bool write_main_config_files(meshlink_handle_t *mesh) {
 		return false;
 	}
 
-	config_t config = {buf, packmsg_output_size(&out, buf)};
+	config_t config = {.buf = buf, .len = packmsg_output_size(&out, buf)};
 
 	if(!main_config_write(mesh, "current", &config, mesh->config_key)) {
 		return false;
@@ -272,7 +276,7 @@ static bool finalize_join(join_state_t *state, const void *buf, uint16_t len) {
 		node_t *n = new_node();
 		n->name = name2;
 
-		config_t config = {data, data_len};
+		config_t config = {.buf = data, .len = data_len};
 
 		if(!node_read_from_config(mesh, n, &config)) {
 			free_node(n);
@@ -293,16 +297,20 @@ static bool finalize_join(join_state_t *state, const void *buf, uint16_t len) {
 			}
 		}
 
-		if(!node_write_config(mesh, n, true)) {
+		if(!node_add(mesh, n)) {
+			logger(mesh, MESHLINK_WARNING, "Ignoring host config file of %s, we can only keep track of %d nodes\n", n->name, MAX_UPSTREAMS);
 			free_node(n);
-			return false;
+			continue;
 		}
 
-		node_add(mesh, n);
+		if(!node_write_config(mesh, n, true)) {
+			node_del(mesh, n);
+			return false;
+		}
 	}
 
 	/* Ensure the configuration directory metadata is on disk */
-	if(!config_sync(mesh, "current") || (mesh->confbase && !sync_path(mesh->confbase))) {
+	if(!config_sync(mesh, "current") || (mesh->confbase && config_in_confbase(mesh->storage_ops) && !sync_path(mesh->confbase))) {
 		return false;
 	}
 
@@ -499,13 +507,13 @@ static struct timespec idle(event_loop_t *loop, void *data) {
 }
 
 static bool meshlink_setup(meshlink_handle_t *mesh) {
-	if(!config_destroy(mesh->confbase, "new")) {
+	if(!config_destroy(mesh->confbase, mesh->storage_ops, mesh->storage_priv, "new")) {
 		logger(mesh, MESHLINK_ERROR, "Could not delete configuration in %s/new: %s\n", mesh->confbase, strerror(errno));
 		meshlink_errno = MESHLINK_ESTORAGE;
 		return false;
 	}
 
-	if(!config_destroy(mesh->confbase, "old")) {
+	if(!config_destroy(mesh->confbase, mesh->storage_ops, mesh->storage_priv, "old")) {
 		logger(mesh, MESHLINK_ERROR, "Could not delete configuration in %s/old: %s\n", mesh->confbase, strerror(errno));
 		meshlink_errno = MESHLINK_ESTORAGE;
 		return false;
@@ -707,6 +715,33 @@ bool meshlink_open_params_set_storage_policy(meshlink_open_params_t *params, mes
 	return true;
 }
 
+bool meshlink_open_params_set_storage_engine(meshlink_open_params_t *params, meshlink_storage_engine_t engine) {
+	logger(NULL, MESHLINK_DEBUG, "meshlink_open_params_set_storage_engine(%d)", engine);
+
+	if(!params || (engine != MESHLINK_STORAGE_ENGINE_FILES && engine != MESHLINK_STORAGE_ENGINE_LOG)) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	params->storage_engine = engine;
+
+	return true;
+}
+
+bool meshlink_open_params_set_storage_ops(meshlink_open_params_t *params, const meshlink_storage_ops_t *ops, void *priv) {
+	logger(NULL, MESHLINK_DEBUG, "meshlink_open_params_set_storage_ops(%p, %p)", (const void *)ops, priv);
+
+	if(!params || (ops && (!ops->read || !ops->write || !ops->remove || !ops->scan || !ops->sync))) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	params->storage_ops = ops;
+	params->storage_priv = priv;
+
+	return true;
+}
+
 bool meshlink_open_params_set_lock_filename(meshlink_open_params_t *params, const char *filename) {
 	logger(NULL, MESHLINK_DEBUG, "meshlink_open_params_set_lock_filename(%s)", filename);
 
@@ -755,6 +790,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	}
 
 	devtool_keyrotate_probe(1);
+	TRACE1(key_rotate, 1);
 
 	// Rename confbase/current/ to confbase/old
 
@@ -766,6 +802,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	}
 
 	devtool_keyrotate_probe(2);
+	TRACE1(key_rotate, 2);
 
 	// Rename confbase/new/ to confbase/current
 
@@ -777,10 +814,11 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	}
 
 	devtool_keyrotate_probe(3);
+	TRACE1(key_rotate, 3);
 
 	// Cleanup the "old" confbase sub-directory
 
-	if(!config_destroy(mesh->confbase, "old")) {
+	if(!config_destroy(mesh->confbase, mesh->storage_ops, mesh->storage_priv, "old")) {
 		pthread_mutex_unlock(&mesh->mutex);
 		return false;
 	}
@@ -813,10 +851,10 @@ void meshlink_open_params_free(meshlink_open_params_t *params) {
 
 /// Device class traits
 static const dev_class_traits_t default_class_traits[DEV_CLASS_COUNT] = {
-	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .min_connects = 3, .max_connects = 10000, .edge_weight = 1 }, // DEV_CLASS_BACKBONE
-	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .min_connects = 3, .max_connects = 100, .edge_weight = 3 },   // DEV_CLASS_STATIONARY
-	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .min_connects = 3, .max_connects = 3, .edge_weight = 6 },     // DEV_CLASS_PORTABLE
-	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .min_connects = 1, .max_connects = 1, .edge_weight = 9 },     // DEV_CLASS_UNKNOWN
+	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .retry_base = 1000, .retry_jitter = true, .min_connects = 3, .max_connects = 10000, .edge_weight = 1 }, // DEV_CLASS_BACKBONE
+	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .retry_base = 1000, .retry_jitter = true, .min_connects = 3, .max_connects = 100, .edge_weight = 3 },   // DEV_CLASS_STATIONARY
+	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .retry_base = 1000, .retry_jitter = true, .min_connects = 3, .max_connects = 3, .edge_weight = 6 },     // DEV_CLASS_PORTABLE
+	{ .pingtimeout = 5, .pinginterval = 60, .maxtimeout = 900, .retry_base = 1000, .retry_jitter = true, .min_connects = 1, .max_connects = 1, .edge_weight = 9 },     // DEV_CLASS_UNKNOWN
 };
 
 meshlink_handle_t *meshlink_open(const char *confbase, const char *name, const char *appname, dev_class_t devclass) {
@@ -957,12 +995,26 @@ meshlink_handle_t *meshlink_open_ex(const meshlink_open_params_t *params) {
 		mesh->confbase = xstrdup(params->confbase);
 	}
 
+	// All storage goes through one set of operations, the built-in backends are just the default ones
+	if(params->storage_ops) {
+		mesh->storage_ops = params->storage_ops;
+		mesh->storage_priv = params->storage_priv;
+	} else if(params->confbase && params->storage_engine == MESHLINK_STORAGE_ENGINE_LOG) {
+		mesh->storage_ops = &config_log_ops;
+		mesh->storage_priv = mesh;
+	} else if(params->confbase) {
+		mesh->storage_ops = &config_files_ops;
+		mesh->storage_priv = config_files_create(mesh->confbase);
+	}
+
 	mesh->appname = xstrdup(params->appname);
 	mesh->devclass = params->devclass;
 	mesh->netns = params->netns;
 	mesh->log_cb = global_log_cb;
 	mesh->log_level = global_log_level;
 	mesh->packet = xmalloc(sizeof(vpn_packet_t));
+	mesh->upstream_count = 1;
+	mesh->upstream_policy = MESHLINK_UPSTREAM_FAILOVER;
 
 	randomize(&mesh->prng_state, sizeof(mesh->prng_state));
 
@@ -995,7 +1047,9 @@ meshlink_handle_t *meshlink_open_ex(const meshlink_open_params_t *params) {
 	}
 
 	pthread_mutex_init(&mesh->mutex, &attr);
+	pthread_mutex_init(&mesh->config_log_mutex, &attr);
 	pthread_cond_init(&mesh->cond, NULL);
+	dispatch_init(mesh);
 
 	mesh->threadstarted = false;
 	event_loop_init(&mesh->loop);
@@ -1029,6 +1083,8 @@ meshlink_handle_t *meshlink_open_ex(const meshlink_open_params_t *params) {
 
 		new_configuration = true;
 	} else {
+		config_snapshot_load(mesh);
+
 		if(!meshlink_read_config(mesh)) {
 			logger(NULL, MESHLINK_ERROR, "Cannot read main configuration\n");
 			meshlink_close(mesh);
@@ -1077,6 +1133,9 @@ meshlink_handle_t *meshlink_open_ex(const meshlink_open_params_t *params) {
 		return NULL;
 	}
 
+	// Everything that was in the snapshot has been loaded now
+	config_snapshot_free(mesh);
+
 	idle_set(&mesh->loop, idle, mesh);
 
 	logger(NULL, MESHLINK_DEBUG, "meshlink_open returning\n");
@@ -1111,6 +1170,9 @@ static void *meshlink_main_loop(void *arg) {
 
 	pthread_mutex_unlock(&mesh->mutex);
 
+	// Deliver the callbacks that were deferred until after the last iteration
+	dispatch_run(mesh);
+
 	return NULL;
 }
 
@@ -1138,8 +1200,8 @@ bool meshlink_start(meshlink_handle_t *mesh) {
 	}
 
 	// Reset node connection timers
-	if(mesh->peer) {
-		mesh->peer->last_connect_try = 0;
+	for(int i = 0; i < MAX_UPSTREAMS && mesh->peers[i]; i++) {
+		mesh->peers[i]->last_connect_try = 0;
 	}
 
 	//Check that a valid name is set
@@ -1177,25 +1239,29 @@ bool meshlink_start(meshlink_handle_t *mesh) {
 	return true;
 }
 
-void meshlink_stop(meshlink_handle_t *mesh) {
-	logger(mesh, MESHLINK_DEBUG, "meshlink_stop()\n");
-
-	if(!mesh) {
-		meshlink_errno = MESHLINK_EINVAL;
-		return;
-	}
-
+// Tell the main thread to stop, without waiting for it.
+static void stop_begin(meshlink_handle_t *mesh) {
 	if(pthread_mutex_lock(&mesh->mutex) != 0) {
 		abort();
 	}
 
-	// Shut down the main thread
 	event_loop_stop(&mesh->loop);
 
-	// TODO: send something to a local socket to kick the event loop
+	if(mesh->threadstarted) {
+		// The event loop only wakes up when there is something to do, so kick it
+		signal_trigger(&mesh->loop, &mesh->datafromapp);
+	}
+
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
+// Wait for the main thread to finish, and close all connections.
+static void stop_finish(meshlink_handle_t *mesh) {
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
 
 	if(mesh->threadstarted) {
-		// Wait for the main thread to finish
 		pthread_mutex_unlock(&mesh->mutex);
 
 		if(pthread_join(mesh->thread, NULL) != 0) {
@@ -1210,21 +1276,79 @@ void meshlink_stop(meshlink_handle_t *mesh) {
 	}
 
 	// Close all metaconnections
-	if(mesh->connection) {
-		mesh->connection->outgoing = NULL;
-		terminate_connection(mesh, mesh->connection, false);
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->connections[i]) {
+			mesh->connections[i]->outgoing = NULL;
+			terminate_connection(mesh, mesh->connections[i], false);
+		}
 	}
 
 	exit_outgoings(mesh);
 
 	// Try to write out any changed node config files, ignore errors at this point.
-	if(mesh->peer && mesh->peer->status.dirty) {
-		if(!node_write_config(mesh, mesh->peer, false)) {
-			// ignore
+	for(int i = 0; i < MAX_UPSTREAMS && mesh->peers[i]; i++) {
+		if(mesh->peers[i]->status.dirty) {
+			if(!node_write_config(mesh, mesh->peers[i], false)) {
+				// ignore
+			}
 		}
 	}
 
+	// Wait for the background writer, so everything is on storage once stopped
+	config_writer_flush(mesh);
+
 	pthread_mutex_unlock(&mesh->mutex);
+
+	// Closing the connections might have caused deferred callbacks
+	dispatch_run(mesh);
+}
+
+void meshlink_stop(meshlink_handle_t *mesh) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_stop()\n");
+
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	stop_begin(mesh);
+	stop_finish(mesh);
+}
+
+void meshlink_stop_many(meshlink_handle_t **meshes, size_t count) {
+	if(!meshes) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	// Let all the main threads shut down in parallel, then wait for each of them
+	for(size_t i = 0; i < count; i++) {
+		if(meshes[i]) {
+			logger(meshes[i], MESHLINK_DEBUG, "meshlink_stop_many()");
+			stop_begin(meshes[i]);
+		}
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		if(meshes[i]) {
+			stop_finish(meshes[i]);
+		}
+	}
+}
+
+void meshlink_close_many(meshlink_handle_t **meshes, size_t count) {
+	if(!meshes) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	meshlink_stop_many(meshes, count);
+
+	for(size_t i = 0; i < count; i++) {
+		if(meshes[i]) {
+			meshlink_close(meshes[i]);
+		}
+	}
 }
 
 void meshlink_close(meshlink_handle_t *mesh) {
@@ -1237,6 +1361,7 @@ void meshlink_close(meshlink_handle_t *mesh) {
 
 	// stop can be called even if mesh has not been started
 	meshlink_stop(mesh);
+	dispatch_exit(mesh);
 
 	// lock is not released after this
 	if(pthread_mutex_lock(&mesh->mutex) != 0) {
@@ -1245,7 +1370,25 @@ void meshlink_close(meshlink_handle_t *mesh) {
 
 	// Close and free all resources used.
 
+	config_writer_exit(mesh);
+	config_snapshot_free(mesh);
+
+	// Leave a snapshot of the configuration behind, so the next start is faster
+	if(mesh->self && !config_snapshot_write(mesh)) {
+		logger(mesh, MESHLINK_WARNING, "Could not write configuration snapshot");
+	}
+
+	config_log_close(mesh);
+	config_arena_free(mesh);
+
+	if(mesh->storage_ops == &config_files_ops) {
+		config_files_free(mesh->storage_priv);
+	}
+
 	close_network_connections(mesh);
+	free_adns(mesh);
+	capture_close(mesh);
+	control_close(mesh);
 
 	logger(mesh, MESHLINK_INFO, "Terminating");
 
@@ -1281,6 +1424,7 @@ void meshlink_close(meshlink_handle_t *mesh) {
 
 	pthread_mutex_unlock(&mesh->mutex);
 	pthread_mutex_destroy(&mesh->mutex);
+	pthread_mutex_destroy(&mesh->config_log_mutex);
 
 	memset(mesh, 0, sizeof(*mesh));
 
@@ -1300,6 +1444,16 @@ bool meshlink_destroy_ex(const meshlink_open_params_t *params) {
 		return true;
 	}
 
+	if(params->storage_ops) {
+		/* Nothing is stored in the confbase directory, and the application is responsible for locking */
+		if(!config_destroy(params->confbase, params->storage_ops, params->storage_priv, "current") || !config_destroy(params->confbase, params->storage_ops, params->storage_priv, "new") || !config_destroy(params->confbase, params->storage_ops, params->storage_priv, "old")) {
+			logger(NULL, MESHLINK_ERROR, "Cannot remove configuration\n");
+			return false;
+		}
+
+		return true;
+	}
+
 	/* Exit early if the confbase directory itself doesn't exist */
 	if(access(params->confbase, F_OK) && errno == ENOENT) {
 		return true;
@@ -1331,7 +1485,7 @@ bool meshlink_destroy_ex(const meshlink_open_params_t *params) {
 
 #endif
 
-	if(!config_destroy(params->confbase, "current") || !config_destroy(params->confbase, "new") || !config_destroy(params->confbase, "old")) {
+	if(!config_destroy(params->confbase, NULL, NULL, "current") || !config_destroy(params->confbase, NULL, NULL, "new") || !config_destroy(params->confbase, NULL, NULL, "old")) {
 		logger(NULL, MESHLINK_ERROR, "Cannot remove sub-directories in %s: %s\n", params->confbase, strerror(errno));
 		return false;
 	}
@@ -1449,6 +1603,17 @@ void meshlink_set_log_cb(meshlink_handle_t *mesh, meshlink_log_level_t level, me
 	}
 }
 
+bool meshlink_set_callback_mode(struct meshlink_handle *mesh, meshlink_callback_mode_t mode) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_callback_mode(%d)", mode);
+
+	if(!mesh || mode < MESHLINK_CALLBACKS_DIRECT || mode > MESHLINK_CALLBACKS_THREAD) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	return dispatch_set_mode(mesh, mode);
+}
+
 void meshlink_set_error_cb(struct meshlink_handle *mesh, meshlink_error_cb_t cb) {
 	logger(mesh, MESHLINK_DEBUG, "meshlink_set_error_cb(%p)", (void *)(intptr_t)cb);
 
@@ -1491,16 +1656,24 @@ bool meshlink_send(meshlink_handle_t *mesh, meshlink_node_t *destination, const
 		return false;
 	}
 
+	packet->destination = (node_t *)destination;
 	packet->len = len;
 	memcpy(packet->data, data, len);
 
-	// Queue it
+	// Queue it, count it first so the background thread never sees a negative queue depth
+	stats_add_depth(mesh, destination, queue, 1);
+
 	if(!meshlink_queue_push(&mesh->outpacketqueue, packet)) {
+		stats_add_depth(mesh, destination, queue, -1);
 		free(packet);
 		meshlink_errno = MESHLINK_ENOMEM;
 		return false;
 	}
 
+	stats_add(mesh, destination, messages_queued, 1);
+	stats_add(mesh, destination, bytes_queued, len);
+	TRACE2(message_enqueue, destination->name, len);
+
 	logger(mesh, MESHLINK_DEBUG, "Adding packet of %zu bytes to packet queue", len);
 
 	// Notify event loop
@@ -1517,7 +1690,15 @@ void meshlink_send_from_queue(event_loop_t *loop, void *data) {
 
 	for(vpn_packet_t *packet; (packet = meshlink_queue_pop(&mesh->outpacketqueue));) {
 		logger(mesh, MESHLINK_DEBUG, "Removing packet of %d bytes from packet queue", packet->len);
-		send_raw_packet(mesh, mesh->peer->connection, packet);
+		stats_add_depth(mesh, packet->destination, queue, -1);
+		TRACE2(message_dequeue, packet->destination->name, packet->len);
+		connection_t *c = select_upstream(mesh, packet->destination);
+
+		if(send_raw_packet(mesh, c, packet)) {
+			// Remember where this packet ends in the outbuf, see select_upstream()
+			packet->destination->via_queued = c->outbuf_sent + c->outbuf.len - c->outbuf.offset;
+		}
+
 		free(packet);
 	}
 }
@@ -1752,7 +1933,7 @@ bool meshlink_join(meshlink_handle_t *mesh, const char *invitation) {
 	}
 
 	// Refuse to join a mesh if we are already part of one. We are part of one if we know at least one other node.
-	if(mesh->peer) {
+	if(mesh->peers[0]) {
 		logger(mesh, MESHLINK_ERROR, "Already part of an existing mesh\n");
 		meshlink_errno = MESHLINK_EINVAL;
 		goto exit;
@@ -2063,6 +2244,23 @@ char *meshlink_export(meshlink_handle_t *mesh) {
 	return (char *)buf2;
 }
 
+// Let the periodic handler make or break upstream connections right away, and recalculate the ping deadlines and keepalive settings.
+void update_upstream_connections(meshlink_handle_t *mesh) {
+	if(mesh->loop.running && mesh->periodictimer.cb) {
+		timeout_set(&mesh->loop, &mesh->periodictimer, &(struct timespec) {
+			0, 0
+		});
+		reschedule_pingtimer(mesh);
+		signal_trigger(&mesh->loop, &mesh->datafromapp);
+	}
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->connections[i]) {
+			update_keepalive(mesh, mesh->connections[i]);
+		}
+	}
+}
+
 bool meshlink_import(meshlink_handle_t *mesh, const char *data) {
 	logger(mesh, MESHLINK_DEBUG, "meshlink_import(%p)", (const void *)data);
 
@@ -2130,7 +2328,7 @@ bool meshlink_import(meshlink_handle_t *mesh, const char *data) {
 		n = new_node();
 		n->name = name;
 
-		config_t config = {data2, len2};
+		config_t config = {.buf = data2, .len = len2};
 
 		if(!node_read_from_config(mesh, n, &config)) {
 			free_node(n);
@@ -2138,15 +2336,24 @@ bool meshlink_import(meshlink_handle_t *mesh, const char *data) {
 			break;
 		}
 
-		if(!node_write_config(mesh, n, true)) {
+		if(!node_add(mesh, n)) {
+			logger(mesh, MESHLINK_ERROR, "Cannot import %s, we can only keep track of %d nodes\n", n->name, MAX_UPSTREAMS);
 			free_node(n);
+			pthread_mutex_unlock(&mesh->mutex);
 			free(buf);
+			meshlink_errno = MESHLINK_EINVAL;
 			return false;
 		}
 
-		node_add(mesh, n);
+		if(!node_write_config(mesh, n, true)) {
+			node_del(mesh, n);
+			pthread_mutex_unlock(&mesh->mutex);
+			free(buf);
+			return false;
+		}
 	}
 
+	update_upstream_connections(mesh);
 	pthread_mutex_unlock(&mesh->mutex);
 
 	free(buf);
@@ -2193,7 +2400,7 @@ void meshlink_hint_address(meshlink_handle_t *mesh, meshlink_node_t *node, const
 
 void update_node_status(meshlink_handle_t *mesh, node_t *n) {
 	if(mesh->node_status_cb) {
-		mesh->node_status_cb(mesh, (meshlink_node_t *)n, n->status.reachable && !n->status.blacklisted);
+		dispatch_callback(mesh, CALLBACK_NODE_STATUS, n, n->status.reachable && !n->status.blacklisted, NULL, 0);
 	}
 }
 
@@ -2203,7 +2410,7 @@ void handle_duplicate_node(meshlink_handle_t *mesh, node_t *n) {
 	}
 
 	n->status.duplicate = true;
-	mesh->node_duplicate_cb(mesh, (meshlink_node_t *)n);
+	dispatch_callback(mesh, CALLBACK_NODE_DUPLICATE, n, 0, NULL, 0);
 }
 
 void meshlink_hint_network_change(struct meshlink_handle *mesh) {
@@ -2240,6 +2447,29 @@ void meshlink_set_dev_class_timeouts(meshlink_handle_t *mesh, dev_class_t devcla
 
 	mesh->dev_class_traits[devclass].pinginterval = pinginterval;
 	mesh->dev_class_traits[devclass].pingtimeout = pingtimeout;
+	update_upstream_connections(mesh);
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
+void meshlink_set_dev_class_adaptive_timeout(struct meshlink_handle *mesh, dev_class_t devclass, int factor) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_dev_class_adaptive_timeout(%d, %d)", devclass, factor);
+
+	if(!mesh || devclass < 0 || devclass >= DEV_CLASS_COUNT) {
+		meshlink_errno = EINVAL;
+		return;
+	}
+
+	if(factor < 0 || factor > 100) {
+		meshlink_errno = EINVAL;
+		return;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	mesh->dev_class_traits[devclass].rtt_factor = factor;
+	update_upstream_connections(mesh);
 	pthread_mutex_unlock(&mesh->mutex);
 }
 
@@ -2285,6 +2515,28 @@ void meshlink_set_dev_class_maxtimeout(struct meshlink_handle *mesh, dev_class_t
 	pthread_mutex_unlock(&mesh->mutex);
 }
 
+void meshlink_set_dev_class_backoff(struct meshlink_handle *mesh, dev_class_t devclass, int base, bool jitter) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_dev_class_backoff(%d, %d, %d)", devclass, base, jitter);
+
+	if(!mesh || devclass < 0 || devclass >= DEV_CLASS_COUNT) {
+		meshlink_errno = EINVAL;
+		return;
+	}
+
+	if(base < 1) {
+		meshlink_errno = EINVAL;
+		return;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	mesh->dev_class_traits[devclass].retry_base = base;
+	mesh->dev_class_traits[devclass].retry_jitter = jitter;
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
 void meshlink_reset_timers(struct meshlink_handle *mesh) {
 	logger(mesh, MESHLINK_DEBUG, "meshlink_reset_timers()");
 
@@ -2317,6 +2569,222 @@ void meshlink_set_inviter_commits_first(struct meshlink_handle *mesh, bool invit
 	pthread_mutex_unlock(&mesh->mutex);
 }
 
+bool meshlink_get_node_rtt(struct meshlink_handle *mesh, struct meshlink_node *node, uint32_t *srtt, uint32_t *rttvar) {
+	if(!mesh || !node) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	node_t *n = (node_t *)node;
+	connection_t *c = n->connection;
+	bool measured = c && c->status.active && c->srtt;
+
+	if(measured) {
+		if(srtt) {
+			*srtt = c->srtt;
+		}
+
+		if(rttvar) {
+			*rttvar = c->rttvar;
+		}
+	}
+
+	pthread_mutex_unlock(&mesh->mutex);
+	return measured;
+}
+
+static void read_stats(const stats_t *counters, meshlink_stats_t *stats) {
+	stats->messages_queued = stats_get(&counters->messages_queued);
+	stats->bytes_queued = stats_get(&counters->bytes_queued);
+	stats->messages_sent = stats_get(&counters->messages_sent);
+	stats->bytes_sent = stats_get(&counters->bytes_sent);
+	stats->messages_received = stats_get(&counters->messages_received);
+	stats->bytes_received = stats_get(&counters->bytes_received);
+	stats->records_encrypted = stats_get(&counters->records_encrypted);
+	stats->records_decrypted = stats_get(&counters->records_decrypted);
+	stats->queue_depth = stats_get(&counters->queue_depth);
+	stats->queue_max = stats_get(&counters->queue_max);
+	stats->outbuf_depth = stats_get(&counters->outbuf_depth);
+	stats->outbuf_max = stats_get(&counters->outbuf_max);
+	stats->handshakes = stats_get(&counters->handshakes);
+	stats->handshake_time = stats_get(&counters->handshake_time);
+	stats->renewals = stats_get(&counters->renewals);
+	stats->renewal_time = stats_get(&counters->renewal_time);
+	stats->reconnects = stats_get(&counters->reconnects);
+	stats->srtt = stats_get(&counters->srtt);
+	stats->rttvar = stats_get(&counters->rttvar);
+	stats->callbacks = stats_get(&counters->callbacks);
+	stats->callback_time = stats_get(&counters->callback_time);
+}
+
+bool meshlink_get_stats(struct meshlink_handle *mesh, meshlink_stats_t *stats) {
+	if(!mesh || !stats) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	read_stats(&mesh->stats, stats);
+	return true;
+}
+
+bool meshlink_get_node_stats(struct meshlink_handle *mesh, struct meshlink_node *node, meshlink_stats_t *stats) {
+	if(!mesh || !node || !stats) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	read_stats(&((node_t *)node)->stats, stats);
+	return true;
+}
+
+bool meshlink_set_capture_file(struct meshlink_handle *mesh, const char *path, size_t size) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_capture_file(%s, %lu)", path ? path : "(null)", (unsigned long)size);
+
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	bool result = true;
+
+	if(path) {
+		result = capture_open(mesh, path, size);
+	} else {
+		capture_close(mesh);
+	}
+
+	pthread_mutex_unlock(&mesh->mutex);
+	return result;
+}
+
+bool meshlink_set_control_socket(struct meshlink_handle *mesh, const char *path) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_control_socket(%s)", path ? path : "(null)");
+
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	bool result = true;
+
+	if(path) {
+		result = control_open(mesh, path);
+	} else {
+		control_close(mesh);
+	}
+
+	if(mesh->threadstarted) {
+		// Make the event loop pick up the changed set of file descriptors
+		signal_trigger(&mesh->loop, &mesh->datafromapp);
+	}
+
+	pthread_mutex_unlock(&mesh->mutex);
+	return result;
+}
+
+void meshlink_set_loop_instrumentation(struct meshlink_handle *mesh, bool enable) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_loop_instrumentation(%d)", enable);
+
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	mesh->loop.instrument = enable;
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
+bool meshlink_get_loop_stats(struct meshlink_handle *mesh, meshlink_loop_stats_t *stats) {
+	if(!mesh || !stats) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	static_assert((int)MESHLINK_HISTOGRAM_COUNT == (int)EVENT_HISTOGRAM_COUNT && MESHLINK_HISTOGRAM_BUCKETS == EVENT_HISTOGRAM_BUCKETS, "event loop histograms do not match the API");
+
+	stats->iterations = stats_get(&mesh->loop.iterations);
+
+	for(int i = 0; i < MESHLINK_HISTOGRAM_COUNT; i++) {
+		for(int j = 0; j < MESHLINK_HISTOGRAM_BUCKETS; j++) {
+			stats->histograms[i][j] = stats_get(&mesh->loop.histograms[i][j]);
+		}
+	}
+
+	return true;
+}
+
+void meshlink_set_tcp_keepalive(struct meshlink_handle *mesh, bool enable) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_tcp_keepalive(%d)", enable);
+
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	mesh->tcp_keepalive = enable;
+	update_upstream_connections(mesh);
+
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
+void meshlink_set_upstream_standby(struct meshlink_handle *mesh, bool standby) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_upstream_standby(%d)", standby);
+
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	mesh->upstream_count = standby ? 2 : 1;
+	update_upstream_connections(mesh);
+
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
+bool meshlink_set_upstream_policy(struct meshlink_handle *mesh, meshlink_upstream_policy_t policy, int count) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_upstream_policy(%d, %d)", policy, count);
+
+	if(!mesh || policy < MESHLINK_UPSTREAM_FAILOVER || policy > MESHLINK_UPSTREAM_HASH || count < 1 || count > MAX_UPSTREAMS) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	mesh->upstream_policy = policy;
+	mesh->upstream_count = count;
+	update_upstream_connections(mesh);
+
+	pthread_mutex_unlock(&mesh->mutex);
+	return true;
+}
+
 void meshlink_set_storage_policy(struct meshlink_handle *mesh, meshlink_storage_policy_t policy) {
 	logger(mesh, MESHLINK_DEBUG, "meshlink_set_storage_policy(%d)", policy);
 
@@ -2333,6 +2801,22 @@ void meshlink_set_storage_policy(struct meshlink_handle *mesh, meshlink_storage_
 	pthread_mutex_unlock(&mesh->mutex);
 }
 
+void meshlink_set_storage_flush_window(struct meshlink_handle *mesh, int window) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_storage_flush_window(%d)", window);
+
+	if(!mesh || window < 0) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	mesh->storage_flush_window = window;
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
 void handle_network_change(meshlink_handle_t *mesh, bool online) {
 	(void)online;
 
@@ -2355,7 +2839,7 @@ void call_error_cb(meshlink_handle_t *mesh, meshlink_errno_t cb_errno) {
 	}
 
 	if(mesh->thread == pthread_self()) {
-		mesh->error_cb(mesh, cb_errno);
+		dispatch_callback(mesh, CALLBACK_ERROR, NULL, cb_errno, NULL, 0);
 	}
 }
 
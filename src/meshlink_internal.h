@@ -26,17 +26,21 @@
 
 #include "system.h"
 
+#include "conf.h"
 #include "event.h"
 #include "hash.h"
 #include "meshlink-tiny.h"
+#include "dispatch.h"
 #include "meshlink_queue.h"
 #include "sockaddr.h"
 #include "sptps.h"
+#include "stats.h"
 #include "xoshiro.h"
 
 #include <pthread.h>
 
 #define MAXSOCKETS 4    /* Probably overkill... */
+#define MAX_UPSTREAMS 4 /* Maximum number of upstream nodes we keep track of */
 
 static const char meshlink_invitation_label[] = "MeshLink invitation";
 static const char meshlink_tcp_label[] = "MeshLink TCP";
@@ -59,6 +63,9 @@ struct meshlink_open_params {
 	const void *key;
 	size_t keylen;
 	meshlink_storage_policy_t storage_policy;
+	meshlink_storage_engine_t storage_engine;
+	const meshlink_storage_ops_t *storage_ops;
+	void *storage_priv;
 };
 
 /// Device class traits
@@ -67,6 +74,9 @@ typedef struct {
 	int pingtimeout;
 	int fast_retry_period;
 	int maxtimeout;
+	int retry_base;
+	bool retry_jitter;
+	int rtt_factor;
 	unsigned int min_connects;
 	unsigned int max_connects;
 	int edge_weight;
@@ -93,13 +103,21 @@ struct meshlink_handle {
 	meshlink_queue_t outpacketqueue;
 	signal_t datafromapp;
 
-	struct node_t *peer;
-	struct connection_t *connection;
-	struct outgoing_t *outgoing;
+	// Upstream nodes in order of preference, and the connections we make to them
+	struct node_t *peers[MAX_UPSTREAMS];
+	struct connection_t *connections[MAX_UPSTREAMS];
+	struct outgoing_t *outgoings[MAX_UPSTREAMS];
+	struct node_t *upstream;        /* the most preferred upstream node we have an active connection with */
+	int upstream_count;             /* the number of upstream nodes to keep connected */
+	meshlink_upstream_policy_t upstream_policy;
+	unsigned int upstream_next;     /* for round robin assignment */
+	struct adns *adns;
 
 	int contradicting_add_edge;
 	int contradicting_del_edge;
+	time_t contradicting_since;      /* start of the window in which contradicting edges are counted */
 	int sleeptime;
+	time_t backoff_until;            /* don't announce edges or autoconnect before this time, see periodic_handler() */
 	time_t last_unreachable;
 	timeout_t pingtimer;
 	timeout_t periodictimer;
@@ -114,6 +132,7 @@ struct meshlink_handle {
 	meshlink_node_duplicate_cb_t node_duplicate_cb;
 	meshlink_connection_try_cb_t connection_try_cb;
 	meshlink_error_cb_t error_cb;
+	dispatch_t dispatch;
 
 	// Mesh parameters
 	char *appname;
@@ -128,6 +147,7 @@ struct meshlink_handle {
 	int netns;
 
 	bool inviter_commits_first;
+	bool tcp_keepalive;
 
 	// Configuration
 	char *confbase;
@@ -135,6 +155,20 @@ struct meshlink_handle {
 	void *config_key;
 	char *external_address_url;
 	meshlink_storage_policy_t storage_policy;
+	const meshlink_storage_ops_t *storage_ops;  /* never NULL if there is a confbase */
+	void *storage_priv;
+	int storage_flush_window;
+	struct config_writer *config_writer;
+	struct config_log *config_log;
+	pthread_mutex_t config_log_mutex;       /* protects config_log and the logs it points to */
+	config_snapshot_t *config_snapshot;
+	bool config_snapshot_removed;           /* the snapshot on disk has been removed since opening */
+	config_arena_t config_arena;
+
+	// Performance counters
+	stats_t stats;
+	struct capture *capture;
+	struct control *control;
 
 	// Thread management
 	pthread_t thread;
@@ -150,6 +184,7 @@ struct meshlink_node {
 
 void meshlink_send_from_queue(event_loop_t *loop, void *mesh);
 void update_node_status(meshlink_handle_t *mesh, struct node_t *n);
+void update_upstream_connections(meshlink_handle_t *mesh);
 extern meshlink_log_level_t global_log_level;
 extern meshlink_log_cb_t global_log_cb;
 void handle_duplicate_node(meshlink_handle_t *mesh, struct node_t *n);
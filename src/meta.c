@@ -19,12 +19,14 @@
 
 #include "system.h"
 
+#include "capture.h"
 #include "connection.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "meta.h"
 #include "net.h"
 #include "protocol.h"
+#include "trace.h"
 #include "utils.h"
 #include "xalloc.h"
 
@@ -41,9 +43,32 @@ bool send_meta_sptps(void *handle, uint8_t type, const void *buffer, size_t leng
 	buffer_add(&c->outbuf, (const char *)buffer, length);
 	io_set(&mesh->loop, &c->io, IO_READ | IO_WRITE);
 
+	stats_add(mesh, c->node, records_encrypted, 1);
+	update_outbuf_stats(mesh, c, length);
+
 	return true;
 }
 
+void update_outbuf_stats(meshlink_handle_t *mesh, connection_t *c, int64_t delta) {
+	stats_max(&mesh->stats.outbuf_max, stats_inc(&mesh->stats.outbuf_depth, (uint64_t)delta));
+
+	/* The connection is only associated with a node after authentication, so track its depth directly */
+	if(c->node) {
+		uint64_t depth = c->outbuf.len - c->outbuf.offset;
+		stats_set(&c->node->stats.outbuf_depth, depth);
+		stats_max(&c->node->stats.outbuf_max, depth);
+	}
+}
+
+void receive_packet(meshlink_handle_t *mesh, connection_t *c, const void *data, uint16_t length) {
+	stats_add(mesh, c->node, messages_received, 1);
+	stats_add(mesh, c->node, bytes_received, length);
+
+	if(mesh->receive_cb) {
+		dispatch_callback(mesh, CALLBACK_RECEIVE, c->node, 0, data, length);
+	}
+}
+
 bool send_meta(meshlink_handle_t *mesh, connection_t *c, const char *buffer, int length) {
 	assert(c);
 	assert(buffer);
@@ -54,9 +79,14 @@ bool send_meta(meshlink_handle_t *mesh, connection_t *c, const char *buffer, int
 	if(c->allow_request == ID) {
 		buffer_add(&c->outbuf, buffer, length);
 		io_set(&mesh->loop, &c->io, IO_READ | IO_WRITE);
+		update_outbuf_stats(mesh, c, length);
 		return true;
 	}
 
+	if(mesh->capture) {
+		capture_record(mesh, c, CAPTURE_OUT, 0, buffer, length);
+	}
+
 	return sptps_send_record(&c->sptps, 0, buffer, length);
 }
 
@@ -64,10 +94,13 @@ void broadcast_meta(meshlink_handle_t *mesh, connection_t *from, const char *buf
 	assert(buffer);
 	assert(length);
 
-	if(mesh->connection)
-		if(mesh->connection != from && mesh->connection->status.active) {
-			send_meta(mesh, mesh->connection, buffer, length);
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		connection_t *c = mesh->connections[i];
+
+		if(c && c != from && c->status.active) {
+			send_meta(mesh, c, buffer, length);
 		}
+	}
 }
 
 bool receive_meta_sptps(void *handle, uint8_t type, const void *data, uint16_t length) {
@@ -83,30 +116,56 @@ bool receive_meta_sptps(void *handle, uint8_t type, const void *data, uint16_t l
 		abort();
 	}
 
+	stats_add(mesh, c->node, records_decrypted, 1);
+
+	if(mesh->capture && type < SPTPS_HANDSHAKE) {
+		capture_record(mesh, c, CAPTURE_IN, type, data, length);
+	}
+
 	if(type == SPTPS_HANDSHAKE) {
 		if(c->allow_request == ACK) {
+			TRACE1(handshake_sptps_done, c->name);
 			return send_ack(mesh, c);
-		} else {
-			return true;
 		}
+
+		/* A key renewal finished, we only know how long it took if we started it */
+		stats_add(mesh, c->node, renewals, 1);
+
+		if(c->renewal_start.tv_sec) {
+			stats_add(mesh, c->node, renewal_time, stats_elapsed(&c->renewal_start, &mesh->loop.now));
+			c->renewal_start.tv_sec = 0;
+			c->renewal_start.tv_nsec = 0;
+		}
+
+		return true;
 	}
 
 	if(!request) {
 		return true;
 	}
 
-	/* Are we receiving a raw packet? */
+	/* Any record from the peer shows that it is alive, so only ping it after a period of silence. */
 
-	if(c->status.raw_packet) {
-		c->status.raw_packet = false;
+	if(c->status.active) {
+		c->last_received = mesh->loop.now;
 
-		if(mesh->receive_cb) {
-			mesh->receive_cb(mesh, (meshlink_node_t *)c->node, data, length);
+		if(!c->status.pinged) {
+			c->last_ping_time = mesh->loop.now.tv_sec;
 		}
+	}
+
+	/* Are we receiving a raw packet? */
 
+	if(c->status.raw_packet) {
+		c->status.raw_packet = false;
+		receive_packet(mesh, c, data, length);
 		return true;
 	}
 
+	if(type == SPTPS_BINARY_REQUEST) {
+		return receive_binary_request(mesh, c, data, length);
+	}
+
 	/* Change newline to null byte, just like non-SPTPS requests */
 
 	if(request[length - 1] == '\n') {
@@ -137,6 +196,7 @@ bool receive_meta(meshlink_handle_t *mesh, connection_t *c) {
 	}
 
 	logger(mesh, MESHLINK_DEBUG, "Received %d bytes of metadata from %s", inlen, c->name);
+	TRACE2(socket_recv, c->name, inlen);
 
 	if(c->allow_request == ID) {
 		buffer_add(&c->inbuf, inbuf, inlen);
@@ -23,6 +23,8 @@
 #include "connection.h"
 
 bool send_meta(struct meshlink_handle *mesh, struct connection_t *, const char *, int);
+void update_outbuf_stats(struct meshlink_handle *mesh, struct connection_t *, int64_t);
+void receive_packet(struct meshlink_handle *mesh, struct connection_t *, const void *, uint16_t);
 bool send_meta_sptps(void *, uint8_t, const void *, size_t);
 bool receive_meta_sptps(void *, uint8_t, const void *, uint16_t);
 void broadcast_meta(struct meshlink_handle *mesh, struct connection_t *, const char *, int);
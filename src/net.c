@@ -19,6 +19,7 @@
 
 #include "system.h"
 
+#include "adns.h"
 #include "utils.h"
 #include "conf.h"
 #include "connection.h"
@@ -30,6 +31,7 @@
 #include "netutl.h"
 #include "protocol.h"
 #include "sptps.h"
+#include "trace.h"
 #include "xalloc.h"
 
 #include <assert.h>
@@ -43,6 +45,141 @@ static inline int min(int a, int b) {
 static const int default_timeout = 5;
 static const int default_interval = 60;
 
+/* Standby connections only need to be kept alive, so they are pinged less often. */
+static const int standby_ping_factor = 4;
+
+/* The lower limit for adaptive ping timeouts, in milliseconds, so scheduling delays don't cause false disconnects. */
+static const int min_adaptive_timeout = 200;
+
+/*
+  Send packets to the most preferred upstream node we have an active connection with.
+  Since this is only called from the event loop, switching over is atomic as far as the packet queue is concerned.
+*/
+void update_upstream(meshlink_handle_t *mesh) {
+	node_t *upstream = NULL;
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		node_t *n = mesh->peers[i];
+
+		if(n && n->connection && n->connection->status.active) {
+			upstream = n;
+			break;
+		}
+	}
+
+	if(upstream == mesh->upstream) {
+		return;
+	}
+
+	if(upstream && mesh->upstream) {
+		logger(mesh, MESHLINK_INFO, "Switching upstream from %s to %s", mesh->upstream->name, upstream->name);
+	}
+
+	mesh->upstream = upstream;
+
+	// The standby connections are pinged less often than the upstream
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->connections[i]) {
+			update_keepalive(mesh, mesh->connections[i]);
+		}
+	}
+
+	reschedule_pingtimer(mesh);
+}
+
+static bool upstream_usable(const node_t *n) {
+	return n && n->connection && n->connection->status.active;
+}
+
+// Rendezvous hashing, so only the destinations of an upstream node that goes away are moved elsewhere.
+static uint32_t upstream_hash(const char *a, const char *b) {
+	uint32_t hash = 2166136261u;
+
+	for(; *a; a++) {
+		hash = (hash ^ (uint8_t)*a) * 16777619u;
+	}
+
+	hash = (hash ^ 0xff) * 16777619u;
+
+	for(; *b; b++) {
+		hash = (hash ^ (uint8_t)*b) * 16777619u;
+	}
+
+	return hash;
+}
+
+/* Whether packets for the destination are still waiting in the outbuf of the connection to its upstream node. */
+static bool upstream_holds(const node_t *destination) {
+	const connection_t *c = destination->via->connection;
+	uint64_t queued = c->outbuf_sent + c->outbuf.len - c->outbuf.offset;
+
+	// If the mark lies beyond all data queued on this connection, it belongs to an earlier connection that is gone
+	return c->outbuf_sent < destination->via_queued && destination->via_queued <= queued;
+}
+
+/*
+  Pick the connection to send a packet for the given destination to, according to the upstream policy.
+  Destinations stick to the upstream node they were assigned to while packets are being sent to them,
+  and as long as their earlier packets have not been written to its socket,
+  so that packets for the same destination never overtake each other.
+*/
+connection_t *select_upstream(meshlink_handle_t *mesh, node_t *destination) {
+	if(!mesh->upstream) {
+		return NULL;
+	}
+
+	if(mesh->upstream_policy == MESHLINK_UPSTREAM_FAILOVER || !destination) {
+		return mesh->upstream->connection;
+	}
+
+	node_t *via = destination->via;
+
+	if(mesh->upstream_policy != MESHLINK_UPSTREAM_HASH && upstream_usable(via) && (destination->last_sent + 1 >= mesh->loop.now.tv_sec || upstream_holds(destination))) {
+		destination->last_sent = mesh->loop.now.tv_sec;
+		return via->connection;
+	}
+
+	via = NULL;
+
+	for(unsigned int j = 0; j < MAX_UPSTREAMS; j++) {
+		unsigned int i = (mesh->upstream_next + j) % MAX_UPSTREAMS;
+		node_t *n = mesh->peers[i];
+
+		if(!upstream_usable(n)) {
+			continue;
+		}
+
+		switch(mesh->upstream_policy) {
+		case MESHLINK_UPSTREAM_ROUND_ROBIN:
+			if(!via) {
+				via = n;
+				mesh->upstream_next = i + 1;
+			}
+
+			break;
+
+		case MESHLINK_UPSTREAM_LEAST_QUEUED:
+			if(!via || n->connection->outbuf.len - n->connection->outbuf.offset < via->connection->outbuf.len - via->connection->outbuf.offset) {
+				via = n;
+			}
+
+			break;
+
+		default:
+			if(!via || upstream_hash(destination->name, n->name) > upstream_hash(destination->name, via->name)) {
+				via = n;
+			}
+
+			break;
+		}
+	}
+
+	assert(via);
+	destination->via = via;
+	destination->last_sent = mesh->loop.now.tv_sec;
+	return via->connection;
+}
+
 /*
   Terminate a connection:
   - Mark it as inactive
@@ -58,14 +195,16 @@ void terminate_connection(meshlink_handle_t *mesh, connection_t *c, bool report)
 
 	if(c->node && c->node->connection == c) {
 		if(c->status.active && mesh->meta_status_cb) {
-			mesh->meta_status_cb(mesh, (meshlink_node_t *)c->node, false);
+			dispatch_callback(mesh, CALLBACK_META_STATUS, c->node, false, NULL, 0);
 		}
 
 		c->node->connection = NULL;
 		c->node->status.reachable = false;
+		update_upstream(mesh);
 		update_node_status(mesh, c->node);
 	}
 
+	bool was_active = c->status.active;
 	c->status.active = false;
 
 	outgoing_t *outgoing = c->outgoing;
@@ -73,7 +212,20 @@ void terminate_connection(meshlink_handle_t *mesh, connection_t *c, bool report)
 
 	/* Check if this was our outgoing connection */
 
-	if(outgoing) {
+	if(!outgoing) {
+		return;
+	}
+
+	if(was_active || outgoing->retry_after) {
+		/* Don't reconnect right away, either the peer asked us not to,
+		   or it might just have restarted and every other node is trying to reconnect as well. */
+		if(was_active) {
+			outgoing->timeout = 0;
+		}
+
+		reset_outgoing(outgoing);
+		retry_outgoing(mesh, outgoing);
+	} else {
 		do_outgoing_connection(mesh, outgoing);
 	}
 }
@@ -86,23 +238,124 @@ void terminate_connection(meshlink_handle_t *mesh, connection_t *c, bool report)
   end does not reply in time, we consider them dead
   and close the connection.
 */
+static int connection_pingtimeout(meshlink_handle_t *mesh, const connection_t *c) {
+	if(c->outgoing && !c->status.active && c->outgoing->timeout < 5000) {
+		return 1;
+	}
+
+	return c->node ? mesh->dev_class_traits[c->node->devclass].pingtimeout : default_timeout;
+}
+
+static int connection_pinginterval(meshlink_handle_t *mesh, const connection_t *c) {
+	int pinginterval = c->node ? mesh->dev_class_traits[c->node->devclass].pinginterval : default_interval;
+
+	if(mesh->upstream_policy == MESHLINK_UPSTREAM_FAILOVER && c->node && c->node != mesh->upstream) {
+		pinginterval *= standby_ping_factor;
+	}
+
+	return pinginterval;
+}
+
+/* If the kernel can detect dead peers for us, we don't have to send our own pings. */
+static bool connection_needs_ping(const connection_t *c) {
+	// retry() asks for a ping right away by setting last_ping_time to a negative value
+	return !c->status.keepalive || c->last_ping_time < 0;
+}
+
+/*
+  Let the kernel detect dead peers on an active connection, with the same timeouts we would use for our own pings.
+  This avoids waking up for pings, and also detects data that is not being acknowledged.
+*/
+void update_keepalive(meshlink_handle_t *mesh, connection_t *c) {
+	if(mesh->tcp_keepalive && c->status.active) {
+		c->status.keepalive = configure_tcp_keepalive(c->socket, connection_pinginterval(mesh, c), connection_pingtimeout(mesh, c));
+	} else if(c->status.keepalive) {
+		configure_tcp_keepalive(c->socket, 0, 0);
+		c->status.keepalive = false;
+	}
+}
+
+/*
+  When a PING should have been answered, in milliseconds on the event loop's clock.
+  In adaptive mode, this is a multiple of the RTO as TCP would calculate it, once we have measured the RTT.
+  It never exceeds the ping interval, and never drops below min_adaptive_timeout.
+  Other records received in the mean time show the peer is still alive, and postpone the deadline.
+*/
+static int64_t ping_deadline(meshlink_handle_t *mesh, const connection_t *c) {
+	int factor = c->node ? mesh->dev_class_traits[c->node->devclass].rtt_factor : 0;
+	const struct timespec *since = &c->ping_sent;
+
+	if(c->last_received.tv_sec > since->tv_sec || (c->last_received.tv_sec == since->tv_sec && c->last_received.tv_nsec > since->tv_nsec)) {
+		since = &c->last_received;
+	}
+
+	if(!factor || !c->srtt) {
+		return ((int64_t)since->tv_sec + connection_pingtimeout(mesh, c) + 1) * 1000;
+	}
+
+	int64_t timeout = factor * ((int64_t)c->srtt + 4 * (int64_t)c->rttvar) / 1000;
+	int64_t max = (int64_t)connection_pinginterval(mesh, c) * 1000;
+
+	if(timeout > max) {
+		timeout = max;
+	}
+
+	if(timeout < min_adaptive_timeout) {
+		timeout = min_adaptive_timeout;
+	}
+
+	return (int64_t)since->tv_sec * 1000 + since->tv_nsec / 1000000 + timeout;
+}
+
+/* The first time at which timeout_handler() has something to do for this connection, in milliseconds. */
+static int64_t connection_deadline(meshlink_handle_t *mesh, const connection_t *c) {
+	if(!c->status.active) {
+		return ((int64_t)c->last_ping_time + connection_pingtimeout(mesh, c) + 1) * 1000;
+	}
+
+	if(c->status.pinged) {
+		return ping_deadline(mesh, c);
+	}
+
+	int64_t renewal = ((int64_t)c->last_key_renewal + 3600 + 1) * 1000;
+
+	if(!connection_needs_ping(c)) {
+		return renewal;
+	}
+
+	int64_t deadline = ((int64_t)c->last_ping_time + connection_pinginterval(mesh, c)) * 1000;
+
+	return renewal < deadline ? renewal : deadline;
+}
+
 static void timeout_handler(event_loop_t *loop, void *data) {
 	assert(data);
 
 	meshlink_handle_t *mesh = loop->data;
 	logger(mesh, MESHLINK_DEBUG, "timeout_handler()");
 
-	for(connection_t *c = mesh->connection; c; c = NULL) {
-		int pingtimeout = c->node ? mesh->dev_class_traits[c->node->devclass].pingtimeout : default_timeout;
-		int pinginterval = c->node ? mesh->dev_class_traits[c->node->devclass].pinginterval : default_interval;
+	int64_t now = (int64_t)mesh->loop.now.tv_sec * 1000 + mesh->loop.now.tv_nsec / 1000000;
 
-		if(c->outgoing && !c->status.active && c->outgoing->timeout < 5) {
-			pingtimeout = 1;
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		connection_t *c = mesh->connections[i];
+
+		if(!c) {
+			continue;
+		}
+
+		if(!c->status.active) {
+			if(c->last_ping_time + connection_pingtimeout(mesh, c) < mesh->loop.now.tv_sec) {
+				logger(mesh, MESHLINK_WARNING, "Timeout from %s during authentication", c->name);
+				terminate_connection(mesh, c, false);
+			}
+
+			continue;
 		}
 
 		// Also make sure that if outstanding key requests for the UDP counterpart of a connection has timed out, we restart it.
-		if(c->status.active && c->last_key_renewal + 3600 < mesh->loop.now.tv_sec) {
+		if(c->last_key_renewal + 3600 < mesh->loop.now.tv_sec) {
 			devtool_sptps_renewal_probe((meshlink_node_t *)c->node);
+			TRACE1(key_renewal, c->name);
 
 			if(!sptps_force_kex(&c->sptps)) {
 				logger(mesh, MESHLINK_ERROR, "SPTPS key renewal for connection with %s failed", c->name);
@@ -110,86 +363,193 @@ static void timeout_handler(event_loop_t *loop, void *data) {
 				continue;
 			} else {
 				c->last_key_renewal = mesh->loop.now.tv_sec;
+				c->renewal_start = mesh->loop.now;
 			}
 		}
 
-		if(c->last_ping_time + pingtimeout < mesh->loop.now.tv_sec) {
-			if(c->status.active) {
-				if(c->status.pinged) {
-					logger(mesh, MESHLINK_INFO, "%s didn't respond to PING in %ld seconds", c->name, (long)mesh->loop.now.tv_sec - c->last_ping_time);
-				} else if(c->last_ping_time + pinginterval <= mesh->loop.now.tv_sec) {
-					send_ping(mesh, c);
-					continue;
-				} else {
-					continue;
-				}
-			} else {
-				if(c->status.connecting) {
-					logger(mesh, MESHLINK_WARNING, "Timeout while connecting to %s", c->name);
-				} else {
-					logger(mesh, MESHLINK_WARNING, "Timeout from %s during authentication", c->name);
-				}
+		if(c->status.pinged) {
+			if(now >= ping_deadline(mesh, c)) {
+				int64_t elapsed = now - ((int64_t)c->ping_sent.tv_sec * 1000 + c->ping_sent.tv_nsec / 1000000);
+				logger(mesh, MESHLINK_INFO, "%s didn't respond to PING in %ld ms", c->name, (long)elapsed);
+				terminate_connection(mesh, c, true);
 			}
+		} else if(connection_needs_ping(c) && c->last_ping_time + connection_pinginterval(mesh, c) <= mesh->loop.now.tv_sec) {
+			send_ping(mesh, c);
+		}
+	}
 
-			terminate_connection(mesh, c, c->status.active);
+	/* Sleep until the next connection needs attention. Without connections, there is nothing to wake up for. */
+	int64_t next = 0;
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		connection_t *c = mesh->connections[i];
+
+		if(!c) {
+			continue;
+		}
+
+		int64_t deadline = connection_deadline(mesh, c);
+
+		if(!next || deadline < next) {
+			next = deadline;
 		}
 	}
 
+	if(!next) {
+		return;
+	}
+
+	int64_t delay = next - now;
+
+	if(delay < 10) {
+		delay = 10;
+	}
+
 	timeout_set(&mesh->loop, data, &(struct timespec) {
-		1, prng(mesh, TIMER_FUDGE)
+		delay / 1000, (delay % 1000) * 1000000
 	});
 }
 
+/* Let timeout_handler() recalculate its deadline, because a connection was added or its timeouts became shorter. */
+void reschedule_pingtimer(meshlink_handle_t *mesh) {
+	if(mesh->pingtimer.cb) {
+		timeout_set(&mesh->loop, &mesh->pingtimer, &(struct timespec) {
+			0, 0
+		});
+	}
+}
+
+/* Make sure periodic_handler() runs within the given number of seconds. */
+void schedule_periodic(meshlink_handle_t *mesh, int seconds) {
+	if(mesh->periodictimer.cb) {
+		timeout_advance(&mesh->loop, &mesh->periodictimer, &(struct timespec) {
+			seconds, prng(mesh, TIMER_FUDGE)
+		});
+	}
+}
+
 static void periodic_handler(event_loop_t *loop, void *data) {
 	meshlink_handle_t *mesh = loop->data;
 
 	/* Check if there are too many contradicting ADD_EDGE and DEL_EDGE messages.
 	   This usually only happens when another node has the same Name as this node.
-	   If so, sleep for a short while to prevent a storm of contradicting messages.
+	   They are counted over windows of CONTRADICTING_EDGE_WINDOW seconds, starting at the first one.
+	   If so, back off for a while to prevent a storm of contradicting messages.
+	   While backing off, we don't announce our edges or make new connections,
+	   but the event loop keeps handling the connections we already have.
 	*/
 
-	if(mesh->contradicting_del_edge > 100 && mesh->contradicting_add_edge > 100) {
-		logger(mesh, MESHLINK_WARNING, "Possible node with same Name as us! Sleeping %d seconds.", mesh->sleeptime);
-		struct timespec ts = {mesh->sleeptime, 0};
-		nanosleep(&ts, NULL);
-		mesh->sleeptime *= 2;
+	time_t window_end = mesh->contradicting_since + CONTRADICTING_EDGE_WINDOW;
 
-		if(mesh->sleeptime < 0) {
-			mesh->sleeptime = 3600;
-		}
-	} else {
-		mesh->sleeptime /= 2;
+	if(mesh->contradicting_since && mesh->loop.now.tv_sec >= window_end) {
+		if(mesh->contradicting_del_edge > 100 && mesh->contradicting_add_edge > 100) {
+			if(mesh->sleeptime < 10) {
+				mesh->sleeptime = 10;
+			}
+
+			logger(mesh, MESHLINK_WARNING, "Possible node with same Name as us! Backing off %d seconds.", mesh->sleeptime);
+			mesh->backoff_until = mesh->loop.now.tv_sec + mesh->sleeptime;
+			mesh->sleeptime *= 2;
+
+			if(mesh->sleeptime > 3600) {
+				mesh->sleeptime = 3600;
+			}
+		} else {
+			mesh->sleeptime /= 2;
 
-		if(mesh->sleeptime < 10) {
-			mesh->sleeptime = 10;
+			if(mesh->sleeptime < 10) {
+				mesh->sleeptime = 10;
+			}
 		}
+
+		mesh->contradicting_add_edge = 0;
+		mesh->contradicting_del_edge = 0;
+		mesh->contradicting_since = 0;
 	}
 
-	mesh->contradicting_add_edge = 0;
-	mesh->contradicting_del_edge = 0;
+	bool backoff = mesh->loop.now.tv_sec < mesh->backoff_until;
+
+	if(!backoff && mesh->backoff_until) {
+		logger(mesh, MESHLINK_INFO, "Backoff ended, announcing our edges again");
+		mesh->backoff_until = 0;
+
+		for(int i = 0; i < MAX_UPSTREAMS; i++) {
+			connection_t *c = mesh->connections[i];
+
+			if(c && c->status.active) {
+				send_add_edge(mesh, c, 0);
+			}
+		}
+	}
 
-	int timeout = default_timeout;
+	/* Only come back if there is something left to do, anything that creates more work reschedules us. */
+	bool busy = false;
 
 	/* Check if we need to make or break connections. */
 
-	if(mesh->peer && !mesh->connection && !mesh->outgoing) {
-		logger(mesh, MESHLINK_DEBUG, "Autoconnecting to %s", mesh->peer->name);
-		mesh->outgoing = xzalloc(sizeof(outgoing_t));
-		mesh->outgoing->node = mesh->peer;
-		setup_outgoing_connection(mesh, mesh->outgoing);
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		node_t *n = mesh->peers[i];
+
+		if(!n) {
+			break;
+		}
+
+		outgoing_t *outgoing = lookup_outgoing(mesh, n);
+
+		if(i >= mesh->upstream_count) {
+			if(outgoing) {
+				logger(mesh, MESHLINK_DEBUG, "Dropping upstream connection to %s", n->name);
+				outgoing_del(mesh, outgoing);
+			}
+		} else if(!n->connection && !outgoing && !backoff) {
+			logger(mesh, MESHLINK_DEBUG, "Autoconnecting to %s", n->name);
+			setup_outgoing_connection(mesh, outgoing_add(mesh, n));
+		}
+	}
+
+	/* Report failures of earlier background writes, and try again. */
+
+	if(!config_writer_check(mesh)) {
+		call_error_cb(mesh, MESHLINK_ESTORAGE);
+
+		for(int i = 0; i < MAX_UPSTREAMS && mesh->peers[i]; i++) {
+			mesh->peers[i]->status.dirty = true;
+		}
 	}
 
-	for(node_t *n = mesh->peer; n; n = NULL) {
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		node_t *n = mesh->peers[i];
+
+		if(!n) {
+			continue;
+		}
+
 		if(n->status.dirty) {
-			if(!node_write_config(mesh, n, false)) {
+			if(!node_write_config_async(mesh, n)) {
 				logger(mesh, MESHLINK_DEBUG, "Could not update %s", n->name);
 			}
+
+			// Check whether the write succeeded next time
+			busy = true;
 		}
 	}
 
-	timeout_set(&mesh->loop, data, &(struct timespec) {
-		timeout, prng(mesh, TIMER_FUDGE)
-	});
+	if(backoff) {
+		int remaining = mesh->backoff_until - mesh->loop.now.tv_sec;
+
+		timeout_set(&mesh->loop, data, &(struct timespec) {
+			busy && default_timeout < remaining ? default_timeout : remaining, prng(mesh, TIMER_FUDGE)
+		});
+	} else if(busy) {
+		timeout_set(&mesh->loop, data, &(struct timespec) {
+			default_timeout, prng(mesh, TIMER_FUDGE)
+		});
+	}
+
+	/* Come back when the current window of contradicting edges closes. */
+	if(mesh->contradicting_since) {
+		schedule_periodic(mesh, window_end > mesh->loop.now.tv_sec ? window_end - mesh->loop.now.tv_sec : 0);
+	}
 }
 
 void handle_meta_connection_data(meshlink_handle_t *mesh, connection_t *c) {
@@ -201,7 +561,13 @@ void handle_meta_connection_data(meshlink_handle_t *mesh, connection_t *c) {
 
 void retry(meshlink_handle_t *mesh) {
 	/* Reset the reconnection timers for all outgoing connections */
-	for(outgoing_t *outgoing = mesh->outgoing; outgoing; outgoing = NULL) {
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		outgoing_t *outgoing = mesh->outgoings[i];
+
+		if(!outgoing) {
+			continue;
+		}
+
 		outgoing->timeout = 0;
 
 		if(outgoing->ev.cb) {
@@ -213,7 +579,13 @@ void retry(meshlink_handle_t *mesh) {
 
 	/* For active connections, check if their addresses are still valid.
 	 * If yes, reset their ping timers, otherwise terminate them. */
-	for(connection_t *c = mesh->connection; c; c = NULL) {
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		connection_t *c = mesh->connections[i];
+
+		if(!c) {
+			continue;
+		}
+
 		if(!c->status.active) {
 			continue;
 		}
@@ -278,12 +650,14 @@ void main_loop(meshlink_handle_t *mesh) {
 	//Add signal handler
 	mesh->datafromapp.signum = 0;
 	signal_add(&mesh->loop, &mesh->datafromapp, meshlink_send_from_queue, mesh, mesh->datafromapp.signum);
+	init_adns(mesh);
 
 	if(!event_loop_run(&mesh->loop, mesh)) {
 		logger(mesh, MESHLINK_ERROR, "Error while waiting for input: %s", strerror(errno));
 		call_error_cb(mesh, MESHLINK_ENETWORK);
 	}
 
+	exit_adns(mesh);
 	signal_del(&mesh->loop, &mesh->datafromapp);
 	timeout_del(&mesh->loop, &mesh->periodictimer);
 	timeout_del(&mesh->loop, &mesh->pingtimer);
@@ -39,6 +39,7 @@
 #define MAXBUFSIZE ((MAXSIZE * 8) / 6 + 128)
 
 typedef struct vpn_packet_t {
+	struct node_t *destination; /* the node the application sent this packet to */
 	uint16_t len;           /* the actual number of bytes in the `data' field */
 	uint8_t data[MAXSIZE];
 } vpn_packet_t;
@@ -46,21 +47,35 @@ typedef struct vpn_packet_t {
 #include "conf.h"
 #include "list.h"
 
+#define OUTGOING_MAX_ATTEMPTS 4      /* maximum number of parallel connection attempts */
+#define OUTGOING_ATTEMPT_DELAY 250    /* milliseconds between starting connection attempts */
+#define CONTRADICTING_EDGE_WINDOW 5   /* seconds over which contradicting edges are counted */
+
+typedef struct outgoing_attempt_t {
+	struct outgoing_t *outgoing;
+	int socket;
+	io_t io;
+	sockaddr_t address;
+	struct timespec started;
+} outgoing_attempt_t;
+
 typedef struct outgoing_t {
 	struct node_t *node;
 	enum {
 		OUTGOING_START,
-		OUTGOING_CANONICAL_RESOLVE,
-		OUTGOING_CANONICAL,
-		OUTGOING_RECENT,
-		OUTGOING_KNOWN,
+		OUTGOING_CONNECTING,
 		OUTGOING_END,
 		OUTGOING_NO_KNOWN_ADDRESSES,
 	} state;
-	int timeout;
+	int timeout;                    /* the current reconnection backoff, in milliseconds */
+	int retry_after;                /* the reconnection delay the peer asked for, in seconds */
 	timeout_t ev;
-	struct addrinfo *ai;
-	struct addrinfo *aip;
+	sockaddr_t *addresses;          /* candidate addresses, in the order they are tried */
+	int address_count;
+	int next_address;
+	bool resolving;                 /* the canonical address is being looked up */
+	outgoing_attempt_t attempts[OUTGOING_MAX_ATTEMPTS];
+	timeout_t attempt_ev;           /* starts the next attempt and expires stalled ones */
 } outgoing_t;
 
 /* Yes, very strange placement indeed, but otherwise the typedefs get all tangled up */
@@ -69,8 +84,12 @@ typedef struct outgoing_t {
 
 void init_outgoings(struct meshlink_handle *mesh);
 void exit_outgoings(struct meshlink_handle *mesh);
+outgoing_t *lookup_outgoing(struct meshlink_handle *mesh, const struct node_t *n) __attribute__((__warn_unused_result__));
+outgoing_t *outgoing_add(struct meshlink_handle *mesh, struct node_t *n);
+void outgoing_del(struct meshlink_handle *mesh, outgoing_t *outgoing);
 
 void retry_outgoing(struct meshlink_handle *mesh, outgoing_t *);
+bool configure_tcp_keepalive(int sock, int idle, int timeout);
 void handle_incoming_vpn_data(struct event_loop_t *loop, void *, int);
 void finish_connecting(struct meshlink_handle *mesh, struct connection_t *);
 void do_outgoing_connection(struct meshlink_handle *mesh, struct outgoing_t *);
@@ -83,11 +102,17 @@ void setup_outgoing_connection(struct meshlink_handle *mesh, struct outgoing_t *
 void close_network_connections(struct meshlink_handle *mesh);
 void main_loop(struct meshlink_handle *mesh);
 void terminate_connection(struct meshlink_handle *mesh, struct connection_t *, bool);
+void update_upstream(struct meshlink_handle *mesh);
+void reschedule_pingtimer(struct meshlink_handle *mesh);
+void update_keepalive(struct meshlink_handle *mesh, struct connection_t *c);
+void schedule_periodic(struct meshlink_handle *mesh, int seconds);
+struct connection_t *select_upstream(struct meshlink_handle *mesh, struct node_t *destination);
 bool node_read_public_key(struct meshlink_handle *mesh, struct node_t *) __attribute__((__warn_unused_result__));
 bool node_read_from_config(struct meshlink_handle *mesh, struct node_t *, const config_t *config) __attribute__((__warn_unused_result__));
 bool read_ecdsa_public_key(struct meshlink_handle *mesh, struct connection_t *) __attribute__((__warn_unused_result__));
 bool read_ecdsa_private_key(struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
 bool node_write_config(struct meshlink_handle *mesh, struct node_t *, bool new_key) __attribute__((__warn_unused_result__));
+bool node_write_config_async(struct meshlink_handle *mesh, struct node_t *) __attribute__((__warn_unused_result__));
 void handle_meta_connection_data(struct meshlink_handle *mesh, struct connection_t *);
 void retry(struct meshlink_handle *mesh);
 void flush_meta(struct meshlink_handle *mesh, struct connection_t *);
@@ -60,6 +60,39 @@ static bool node_get_config(meshlink_handle_t *mesh, node_t *n, config_t *config
 	return true;
 }
 
+/// Read the optional address statistics that follow the fixed part of a host config file.
+static void read_address_stats(packmsg_input_t *in, node_t *n, uint32_t offset) {
+	// Older versions of MeshLink do not write these
+	if(packmsg_done(in)) {
+		return;
+	}
+
+	uint32_t count = packmsg_get_array(in);
+
+	for(uint32_t i = 0; i < count; i++) {
+		uint32_t fields = packmsg_get_array(in);
+
+		if(fields < 4) {
+			packmsg_input_invalidate(in);
+			return;
+		}
+
+		address_stats_t stats;
+		stats.successes = packmsg_get_uint16(in);
+		stats.failures = packmsg_get_uint16(in);
+		stats.rtt = packmsg_get_uint32(in);
+		stats.last_failure = packmsg_get_int64(in);
+
+		for(uint32_t j = 4; j < fields; j++) {
+			packmsg_skip_element(in);
+		}
+
+		if(i + offset < MAX_RECENT) {
+			n->recent_stats[i + offset] = stats;
+		}
+	}
+}
+
 /// Read the public key from a host config file. Used whenever we need to start an SPTPS session.
 bool node_read_public_key(meshlink_handle_t *mesh, node_t *n) {
 	if(ecdsa_active(n->ecdsa)) {
@@ -121,6 +154,8 @@ bool node_read_public_key(meshlink_handle_t *mesh, node_t *n) {
 	packmsg_skip_element(&in); // last_reachable
 	packmsg_skip_element(&in); // last_unreachable
 
+	read_address_stats(&in, n, known_count);
+
 	config_free(&config);
 	return true;
 }
@@ -194,10 +229,12 @@ bool node_read_from_config(meshlink_handle_t *mesh, node_t *n, const config_t *c
 	packmsg_skip_element(&in); // last_reachable
 	packmsg_skip_element(&in); // last_unreachable
 
+	read_address_stats(&in, n, 0);
+
 	return packmsg_done(&in);
 }
 
-bool node_write_config(meshlink_handle_t *mesh, node_t *n, bool new_key) {
+static bool write_node_config(meshlink_handle_t *mesh, node_t *n, bool new_key, bool async) {
 	if(!mesh->confbase) {
 		return true;
 	}
@@ -253,14 +290,36 @@ bool node_write_config(meshlink_handle_t *mesh, node_t *n, bool new_key) {
 	packmsg_add_int64(&out, 0); // last_reachable
 	packmsg_add_int64(&out, 0); // last_unreachable
 
+	packmsg_add_array(&out, count);
+
+	for(uint32_t i = 0; i < count; i++) {
+		const address_stats_t *stats = &n->recent_stats[i];
+		packmsg_add_array(&out, 4);
+		packmsg_add_uint16(&out, stats->successes);
+		packmsg_add_uint16(&out, stats->failures);
+		packmsg_add_uint32(&out, stats->rtt);
+		packmsg_add_int64(&out, stats->last_failure);
+	}
+
 	if(!packmsg_output_ok(&out)) {
 		meshlink_errno = MESHLINK_EINTERNAL;
 		return false;
 	}
 
-	config_t config = {buf, packmsg_output_size(&out, buf)};
+	config_t config = {.buf = buf, .len = packmsg_output_size(&out, buf)};
 
-	if(!config_write(mesh, "current", n->name, &config, mesh->config_key)) {
+	// Don't touch files that did not change since the snapshot was written, so the snapshot stays valid
+	if(config_snapshot_matches(mesh, n->name, &config)) {
+		n->status.dirty = false;
+		return true;
+	}
+
+	if(async) {
+		if(!config_write_async(mesh, "current", n->name, &config, mesh->config_key)) {
+			call_error_cb(mesh, MESHLINK_ESTORAGE);
+			return false;
+		}
+	} else if(!config_write(mesh, "current", n->name, &config, mesh->config_key)) {
 		call_error_cb(mesh, MESHLINK_ESTORAGE);
 		return false;
 	}
@@ -269,6 +328,15 @@ bool node_write_config(meshlink_handle_t *mesh, node_t *n, bool new_key) {
 	return true;
 }
 
+bool node_write_config(meshlink_handle_t *mesh, node_t *n, bool new_key) {
+	return write_node_config(mesh, n, new_key, false);
+}
+
+/// Queue a node's config file to be written by the background writer, without blocking the caller.
+bool node_write_config_async(meshlink_handle_t *mesh, node_t *n) {
+	return write_node_config(mesh, n, false, true);
+}
+
 static bool load_node(meshlink_handle_t *mesh, const char *name, void *priv) {
 	(void)priv;
 
@@ -311,7 +379,10 @@ static bool load_node(meshlink_handle_t *mesh, const char *name, void *priv) {
 
 	config_free(&config);
 
-	node_add(mesh, n);
+	if(!node_add(mesh, n)) {
+		logger(mesh, MESHLINK_WARNING, "Not loading %s, we can only keep track of %d nodes", n->name, MAX_UPSTREAMS);
+		free_node(n);
+	}
 
 	return true;
 }
@@ -322,7 +393,9 @@ static bool load_node(meshlink_handle_t *mesh, const char *name, void *priv) {
 static bool setup_myself(meshlink_handle_t *mesh) {
 	mesh->self->nexthop = mesh->self;
 
-	node_add(mesh, mesh->self);
+	if(!node_add(mesh, mesh->self)) {
+		return false;
+	}
 
 	if(!config_scan_all(mesh, "current", "hosts", load_node, NULL)) {
 		logger(mesh, MESHLINK_WARNING, "Could not scan all host config files");
@@ -353,9 +426,11 @@ bool setup_network(meshlink_handle_t *mesh) {
   close all open network connections
 */
 void close_network_connections(meshlink_handle_t *mesh) {
-	if(mesh->connection) {
-		mesh->connection->outgoing = NULL;
-		terminate_connection(mesh, mesh->connection, false);
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->connections[i]) {
+			mesh->connections[i]->outgoing = NULL;
+			terminate_connection(mesh, mesh->connections[i], false);
+		}
 	}
 
 	exit_nodes(mesh);
@@ -19,6 +19,7 @@
 
 #include "system.h"
 
+#include "adns.h"
 #include "conf.h"
 #include "connection.h"
 #include "list.h"
@@ -28,9 +29,12 @@
 #include "net.h"
 #include "netutl.h"
 #include "protocol.h"
+#include "trace.h"
 #include "utils.h"
 #include "xalloc.h"
 
+#include <assert.h>
+
 /* Needed on Mac OS/X */
 #ifndef SOL_TCP
 #define SOL_TCP IPPROTO_TCP
@@ -42,36 +46,81 @@
 
 /* Setup sockets */
 
-static void configure_tcp(connection_t *c) {
+static void configure_tcp(meshlink_handle_t *mesh, int sock) {
 #ifdef O_NONBLOCK
-	int flags = fcntl(c->socket, F_GETFL);
+	int flags = fcntl(sock, F_GETFL);
 
-	if(fcntl(c->socket, F_SETFL, flags | O_NONBLOCK) < 0) {
-		logger(c->mesh, MESHLINK_ERROR, "System call `%s' failed: %s", "fcntl", strerror(errno));
+	if(fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		logger(mesh, MESHLINK_ERROR, "System call `%s' failed: %s", "fcntl", strerror(errno));
 	}
 
 #elif defined(WIN32)
 	unsigned long arg = 1;
 
-	if(ioctlsocket(c->socket, FIONBIO, &arg) != 0) {
-		logger(c->mesh, MESHLINK_ERROR, "System call `%s' failed: %s", "ioctlsocket", sockstrerror(sockerrno));
+	if(ioctlsocket(sock, FIONBIO, &arg) != 0) {
+		logger(mesh, MESHLINK_ERROR, "System call `%s' failed: %s", "ioctlsocket", sockstrerror(sockerrno));
 	}
 
 #endif
 
 #if defined(SOL_TCP) && defined(TCP_NODELAY)
 	int nodelay = 1;
-	setsockopt(c->socket, SOL_TCP, TCP_NODELAY, (void *)&nodelay, sizeof(nodelay));
+	setsockopt(sock, SOL_TCP, TCP_NODELAY, (void *)&nodelay, sizeof(nodelay));
 #endif
 
 #if defined(IP_TOS) && defined(IPTOS_LOWDELAY)
 	int lowdelay = IPTOS_LOWDELAY;
-	setsockopt(c->socket, IPPROTO_IP, IP_TOS, (void *)&lowdelay, sizeof(lowdelay));
+	setsockopt(sock, IPPROTO_IP, IP_TOS, (void *)&lowdelay, sizeof(lowdelay));
 #endif
 
 #if defined(SO_NOSIGPIPE)
 	int nosigpipe = 1;
-	setsockopt(c->socket, SOL_SOCKET, SO_NOSIGPIPE, (void *)&nosigpipe, sizeof(nosigpipe));
+	setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&nosigpipe, sizeof(nosigpipe));
+#endif
+}
+
+/*
+  Let the kernel check whether the peer is still alive.
+  After idle seconds without traffic, it sends keepalive probes, and gives up if they are not answered within timeout seconds.
+  It also gives up if data that was sent is not acknowledged within timeout seconds.
+  Returns true if the kernel supports all of this, false otherwise. An idle time of zero turns it off again.
+*/
+bool configure_tcp_keepalive(int sock, int idle, int timeout) {
+#if defined(SO_KEEPALIVE) && defined(SOL_TCP) && (defined(TCP_KEEPIDLE) || defined(TCP_KEEPALIVE)) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT) && defined(TCP_USER_TIMEOUT)
+	int enable = idle > 0;
+
+	if(setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (void *)&enable, sizeof(enable))) {
+		return false;
+	}
+
+	unsigned int user_timeout = enable ? timeout * 1000 : 0;
+
+	if(setsockopt(sock, SOL_TCP, TCP_USER_TIMEOUT, (void *)&user_timeout, sizeof(user_timeout))) {
+		return false;
+	}
+
+	if(!enable) {
+		return false;
+	}
+
+	// Spread a few probes over the timeout, so a single lost probe does not kill the connection
+	int count = timeout >= 3 ? 3 : timeout;
+	int interval = timeout / count;
+
+#ifdef TCP_KEEPIDLE
+	int idle_option = TCP_KEEPIDLE;
+#else
+	int idle_option = TCP_KEEPALIVE;
+#endif
+
+	return !setsockopt(sock, SOL_TCP, idle_option, (void *)&idle, sizeof(idle))
+	       && !setsockopt(sock, SOL_TCP, TCP_KEEPINTVL, (void *)&interval, sizeof(interval))
+	       && !setsockopt(sock, SOL_TCP, TCP_KEEPCNT, (void *)&count, sizeof(count));
+#else
+	(void)sock;
+	(void)idle;
+	(void)timeout;
+	return false;
 #endif
 }
 
@@ -80,27 +129,75 @@ static void retry_outgoing_handler(event_loop_t *loop, void *data) {
 
 	meshlink_handle_t *mesh = loop->data;
 	outgoing_t *outgoing = data;
+
+	// While backing off from a storm of contradicting edges, don't reconnect either, see periodic_handler()
+	if(mesh->loop.now.tv_sec < mesh->backoff_until) {
+		timeout_set(&mesh->loop, &outgoing->ev, &(struct timespec) {
+			mesh->backoff_until - mesh->loop.now.tv_sec, prng(mesh, TIMER_FUDGE)
+		});
+		return;
+	}
+
 	setup_outgoing_connection(mesh, outgoing);
 }
 
+/*
+  Schedule the next connection attempt using decorrelated jitter backoff:
+  each delay is picked uniformly between the base and three times the previous delay, up to the maximum.
+  The first retry after losing an established connection is picked uniformly between zero and the base,
+  so a large number of nodes losing the same peer at the same time do not all come back at once.
+*/
 void retry_outgoing(meshlink_handle_t *mesh, outgoing_t *outgoing) {
-	if(!mesh->reachable && mesh->loop.now.tv_sec < mesh->last_unreachable + mesh->dev_class_traits[outgoing->node->devclass].fast_retry_period) {
-		outgoing->timeout = 1;
+	const dev_class_traits_t *traits = &mesh->dev_class_traits[outgoing->node->devclass];
+	int base = traits->retry_base;
+	int cap = traits->maxtimeout * 1000;
+	int delay;
+
+	stats_add(mesh, outgoing->node, reconnects, 1);
+
+	if(base > cap) {
+		base = cap;
+	}
+
+	if(!mesh->reachable && mesh->loop.now.tv_sec < mesh->last_unreachable + traits->fast_retry_period) {
+		outgoing->timeout = base;
+		delay = traits->retry_jitter ? base / 2 + prng(mesh, base / 2 + 1) : base;
+	} else if(!outgoing->timeout) {
+		outgoing->timeout = base;
+		delay = traits->retry_jitter ? prng(mesh, base + 1) : base;
 	} else {
-		outgoing->timeout += 5;
+		int64_t max = (int64_t)outgoing->timeout * (traits->retry_jitter ? 3 : 2);
+
+		if(max > cap) {
+			max = cap;
+		}
+
+		delay = traits->retry_jitter && max > base ? base + prng(mesh, max - base + 1) : (int)max;
+
+		if(delay < base) {
+			delay = base;
+		}
+
+		outgoing->timeout = delay;
 	}
 
-	int maxtimeout = mesh->dev_class_traits[outgoing->node->devclass].maxtimeout;
+	// Honor the delay the peer asked for, but never wait longer than the maximum
+	if(outgoing->retry_after) {
+		int64_t retry_after = (int64_t)outgoing->retry_after * 1000;
+
+		if(delay < retry_after) {
+			retry_after += traits->retry_jitter && base ? prng(mesh, base) : 0;
+			delay = retry_after > cap ? cap : (int)retry_after;
+		}
 
-	if(outgoing->timeout > maxtimeout) {
-		outgoing->timeout = maxtimeout;
+		outgoing->retry_after = 0;
 	}
 
 	timeout_add(&mesh->loop, &outgoing->ev, retry_outgoing_handler, outgoing, &(struct timespec) {
-		outgoing->timeout, prng(mesh, TIMER_FUDGE)
+		delay / 1000, (delay % 1000) * 1000000
 	});
 
-	logger(mesh, MESHLINK_INFO, "Trying to re-establish outgoing connection in %d seconds", outgoing->timeout);
+	logger(mesh, MESHLINK_INFO, "Trying to re-establish outgoing connection in %d.%03d seconds", delay / 1000, delay % 1000);
 }
 
 void finish_connecting(meshlink_handle_t *mesh, connection_t *c) {
@@ -108,6 +205,7 @@ void finish_connecting(meshlink_handle_t *mesh, connection_t *c) {
 
 	c->last_ping_time = mesh->loop.now.tv_sec;
 	c->status.connecting = false;
+	reschedule_pingtimer(mesh);
 
 	send_id(mesh, c);
 }
@@ -133,7 +231,10 @@ static void handle_meta_write(meshlink_handle_t *mesh, connection_t *c) {
 		return;
 	}
 
+	TRACE2(socket_send, c->name, outlen);
 	buffer_read(&c->outbuf, outlen);
+	c->outbuf_sent += outlen;
+	update_outbuf_stats(mesh, c, -outlen);
 
 	if(!c->outbuf.len) {
 		io_set(&mesh->loop, &c->io, IO_READ);
@@ -148,22 +249,6 @@ static void handle_meta_io(event_loop_t *loop, void *data, int flags) {
 	meshlink_handle_t *mesh = loop->data;
 	connection_t *c = data;
 
-	if(c->status.connecting) {
-		c->status.connecting = false;
-
-		int result;
-		socklen_t len = sizeof(result);
-		getsockopt(c->socket, SOL_SOCKET, SO_ERROR, (void *)&result, &len);
-
-		if(!result) {
-			finish_connecting(mesh, c);
-		} else {
-			logger(mesh, MESHLINK_ERROR, "Error while connecting to %s: %s", c->name, sockstrerror(result));
-			terminate_connection(mesh, c, false);
-			return;
-		}
-	}
-
 	if(flags & IO_WRITE) {
 		handle_meta_write(mesh, c);
 	} else {
@@ -171,235 +256,424 @@ static void handle_meta_io(event_loop_t *loop, void *data, int flags) {
 	}
 }
 
-// Build a list of recently seen addresses.
-static struct addrinfo *get_recent_addresses(node_t *n) {
-	struct addrinfo *ai = NULL;
-	struct addrinfo *aip;
-
-	for(int i = 0; i < 5; i++) {
-		if(!n->recent[i].sa.sa_family) {
-			break;
-		}
+/* Outgoing connections are made in the style of RFC 8305 (Happy Eyeballs).
+   All known addresses of a node are collected up front, and interleaved by address family.
+   A new connect() attempt is started every OUTGOING_ATTEMPT_DELAY milliseconds,
+   or immediately when an attempt fails, with at most OUTGOING_MAX_ATTEMPTS attempts in parallel.
+   The first attempt to connect becomes the meta connection, and all other attempts are cancelled.
+   Hostnames are resolved in the background, attempts to the other addresses start in the meantime.
+*/
 
-		// Create a new struct addrinfo, and put it at the end of the list.
-		struct addrinfo *nai = xzalloc(sizeof(*nai) + SALEN(n->recent[i].sa));
+static void add_outgoing_address(outgoing_t *outgoing, const sockaddr_t *sa) {
+	if(sa->sa.sa_family != AF_INET && sa->sa.sa_family != AF_INET6) {
+		return;
+	}
 
-		if(!ai) {
-			ai = nai;
-		} else {
-			aip->ai_next = nai;
+	for(int i = 0; i < outgoing->address_count; i++) {
+		if(!sockaddrcmp(&outgoing->addresses[i], sa)) {
+			return;
 		}
+	}
 
-		aip = nai;
+	outgoing->addresses = xrealloc(outgoing->addresses, (outgoing->address_count + 1) * sizeof(*outgoing->addresses));
+	outgoing->addresses[outgoing->address_count++] = *sa;
+}
 
-		nai->ai_family = n->recent[i].sa.sa_family;
-		nai->ai_socktype = SOCK_STREAM;
-		nai->ai_protocol = IPPROTO_TCP;
-		nai->ai_addrlen = SALEN(n->recent[i].sa);
-		nai->ai_addr = (struct sockaddr *)(nai + 1);
-		memcpy(nai->ai_addr, &n->recent[i], nai->ai_addrlen);
+// Reorder the addresses from start onwards so they alternate between the family of the first one and any other family.
+static void interleave_outgoing_addresses(outgoing_t *outgoing, int start) {
+	int count = outgoing->address_count - start;
+
+	if(count < 3) {
+		return;
 	}
 
-	return ai;
-}
+	const sockaddr_t *addresses = outgoing->addresses + start;
+	sockaddr_t *sorted = xmalloc(count * sizeof(*sorted));
+	int family = addresses[0].sa.sa_family;
 
-// Free struct addrinfo list from get_known_addresses().
-static void free_known_addresses(struct addrinfo *ai) {
-	for(struct addrinfo *aip = ai, *next; aip; aip = next) {
-		next = aip->ai_next;
-		free(aip);
+	for(int i = 0, a = 0, b = 0; i < count;) {
+		while(a < count && addresses[a].sa.sa_family != family) {
+			a++;
+		}
+
+		if(a < count) {
+			sorted[i++] = addresses[a++];
+		}
+
+		while(b < count && addresses[b].sa.sa_family == family) {
+			b++;
+		}
+
+		if(b < count) {
+			sorted[i++] = addresses[b++];
+		}
 	}
+
+	memcpy(outgoing->addresses + start, sorted, count * sizeof(*sorted));
+	free(sorted);
 }
 
-static bool get_next_outgoing_address(meshlink_handle_t *mesh, outgoing_t *outgoing) {
-	(void)mesh;
+static void outgoing_resolved(meshlink_handle_t *mesh, void *data, const sockaddr_t *addresses, int count) {
+	outgoing_t *outgoing = data;
 
-	bool start = false;
+	assert(outgoing->resolving);
+	outgoing->resolving = false;
 
-	if(outgoing->state == OUTGOING_START) {
-		start = true;
-		outgoing->state = OUTGOING_CANONICAL_RESOLVE;
+	// Add the new addresses to the ones that have not been tried yet
+	for(int i = 0; i < count; i++) {
+		add_outgoing_address(outgoing, &addresses[i]);
 	}
 
-	if(outgoing->state == OUTGOING_CANONICAL_RESOLVE) {
-		node_t *n = outgoing->node;
+	interleave_outgoing_addresses(outgoing, outgoing->next_address);
 
-		if(n->canonical_address) {
-			char *address = xstrdup(n->canonical_address);
-			char *port = strchr(address, ' ');
+	if(outgoing->state == OUTGOING_CONNECTING && !outgoing->address_count) {
+		outgoing->state = OUTGOING_NO_KNOWN_ADDRESSES;
+	}
 
-			if(port) {
-				*port++ = 0;
-				outgoing->ai = str2addrinfo(address, port, SOCK_STREAM);
-				outgoing->aip = NULL;
-				outgoing->state = OUTGOING_CANONICAL;
-			} else {
-				logger(mesh, MESHLINK_ERROR, "Canonical address for %s is missing port number", n->name);
-				outgoing->state = OUTGOING_RECENT;
-			}
+	do_outgoing_connection(mesh, outgoing);
+}
 
-			free(address);
+// Add the addresses the canonical address resolves to, or start looking them up in the background.
+static void add_canonical_address(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	node_t *n = outgoing->node;
+	char *address = xstrdup(n->canonical_address);
+	char *port = strchr(address, ' ');
+
+	if(port) {
+		*port++ = 0;
+		sockaddr_t sa = str2sockaddr(address, port);
+		const sockaddr_t *addresses;
+		int count;
+
+		if(sa.sa.sa_family != AF_UNKNOWN) {
+			add_outgoing_address(outgoing, &sa);
+		} else if(adns_lookup_cached(mesh, address, port, &addresses, &count)) {
+			for(int i = 0; i < count; i++) {
+				add_outgoing_address(outgoing, &addresses[i]);
+			}
 		} else {
-			outgoing->state = OUTGOING_RECENT;
+			adns_queue(mesh, address, port, outgoing_resolved, outgoing);
+			outgoing->resolving = true;
 		}
+
+		sockaddrfree(&sa);
+	} else {
+		logger(mesh, MESHLINK_ERROR, "Canonical address for %s is missing port number", n->name);
 	}
 
-	if(outgoing->state == OUTGOING_CANONICAL) {
-		if(!outgoing->aip) {
-			outgoing->aip = outgoing->ai;
-		} else {
-			outgoing->aip = outgoing->aip->ai_next;
-		}
+	free(address);
+}
 
-		if(outgoing->aip) {
-			return true;
-		}
+// Collect the canonical and recently seen addresses of the node, best candidates first.
+static void get_outgoing_addresses(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	node_t *n = outgoing->node;
 
-		if(outgoing->ai) {
-			freeaddrinfo(outgoing->ai);
-		}
+	// Recent addresses that are known to work go first, the canonical address next, and the rest last
+	int order[MAX_RECENT];
+	int count = node_sort_recent_addresses(mesh, n, order);
+	int i = 0;
 
-		outgoing->ai = NULL;
-		outgoing->aip = NULL;
-		outgoing->state = OUTGOING_END;
+	for(; i < count && n->recent_stats[order[i]].successes; i++) {
+		add_outgoing_address(outgoing, &n->recent[order[i]]);
 	}
 
-	if(outgoing->state == OUTGOING_RECENT) {
-		if(!outgoing->aip) {
-			outgoing->ai = get_recent_addresses(outgoing->node);
-			outgoing->aip = outgoing->ai;
-		} else {
-			outgoing->aip = outgoing->aip->ai_next;
-		}
+	if(n->canonical_address) {
+		add_canonical_address(mesh, outgoing);
+	}
 
-		if(outgoing->aip) {
-			return true;
-		}
+	for(; i < count; i++) {
+		add_outgoing_address(outgoing, &n->recent[order[i]]);
+	}
+
+	interleave_outgoing_addresses(outgoing, 0);
+}
 
-		free_known_addresses(outgoing->ai);
-		outgoing->ai = NULL;
-		outgoing->aip = NULL;
-		outgoing->state = OUTGOING_END;
+static bool get_next_outgoing_address(meshlink_handle_t *mesh, outgoing_t *outgoing, sockaddr_t *sa) {
+	if(outgoing->state == OUTGOING_START) {
+		get_outgoing_addresses(mesh, outgoing);
+		outgoing->state = outgoing->address_count || outgoing->resolving ? OUTGOING_CONNECTING : OUTGOING_NO_KNOWN_ADDRESSES;
 	}
 
-	if(start) {
-		outgoing->state = OUTGOING_NO_KNOWN_ADDRESSES;
+	if(outgoing->state == OUTGOING_CONNECTING) {
+		if(outgoing->next_address < outgoing->address_count) {
+			*sa = outgoing->addresses[outgoing->next_address++];
+			return true;
+		}
+
+		// More addresses might still be on their way
+		if(!outgoing->resolving) {
+			outgoing->state = OUTGOING_END;
+		}
 	}
 
 	return false;
 }
 
-static void free_outgoing(outgoing_t *outgoing) {
-	meshlink_handle_t *mesh = outgoing->node->mesh;
+static int pending_attempts(const outgoing_t *outgoing) {
+	int count = 0;
 
-	timeout_del(&mesh->loop, &outgoing->ev);
+	for(int i = 0; i < OUTGOING_MAX_ATTEMPTS; i++) {
+		if(outgoing->attempts[i].io.cb) {
+			count++;
+		}
+	}
 
-	if(outgoing->ai) {
-		if(outgoing->state == OUTGOING_RECENT || outgoing->state == OUTGOING_KNOWN) {
-			free_known_addresses(outgoing->ai);
-		} else {
-			freeaddrinfo(outgoing->ai);
+	return count;
+}
+
+static void cancel_attempt(meshlink_handle_t *mesh, outgoing_attempt_t *attempt) {
+	io_del(&mesh->loop, &attempt->io);
+	closesocket(attempt->socket);
+	attempt->socket = -1;
+}
+
+static void cancel_attempts(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	for(int i = 0; i < OUTGOING_MAX_ATTEMPTS; i++) {
+		if(outgoing->attempts[i].io.cb) {
+			cancel_attempt(mesh, &outgoing->attempts[i]);
 		}
 	}
 
-	free(outgoing);
+	timeout_del(&mesh->loop, &outgoing->attempt_ev);
 }
 
-void do_outgoing_connection(meshlink_handle_t *mesh, outgoing_t *outgoing) {
-begin:
-
-	if(!get_next_outgoing_address(mesh, outgoing)) {
-		if(outgoing->state == OUTGOING_CANONICAL_RESOLVE) {
-			/* We are waiting for a callback from the ADNS thread */
-		} else if(outgoing->state == OUTGOING_NO_KNOWN_ADDRESSES) {
-			logger(mesh, MESHLINK_ERROR, "No known addresses for %s", outgoing->node->name);
-			free_outgoing(outgoing);
-			mesh->outgoing = NULL;
-		} else {
-			logger(mesh, MESHLINK_ERROR, "Could not set up a meta connection to %s", outgoing->node->name);
-			retry_outgoing(mesh, outgoing);
+static void handle_attempt_io(event_loop_t *loop, void *data, int flags) {
+	(void)flags;
+
+	meshlink_handle_t *mesh = loop->data;
+	outgoing_attempt_t *attempt = data;
+	outgoing_t *outgoing = attempt->outgoing;
+
+	int result;
+	socklen_t len = sizeof(result);
+
+	if(getsockopt(attempt->socket, SOL_SOCKET, SO_ERROR, (void *)&result, &len)) {
+		result = sockerrno;
+	}
+
+	TRACE2(connect_done, outgoing->node->name, result);
+
+	if(result) {
+		if(mesh->log_level <= MESHLINK_ERROR) {
+			char *hostname = sockaddr2hostname(&attempt->address);
+			logger(mesh, MESHLINK_ERROR, "Error while connecting to %s at %s: %s", outgoing->node->name, hostname, sockstrerror(result));
+			free(hostname);
 		}
 
+		node_address_failed(mesh, outgoing->node, &attempt->address);
+		cancel_attempt(mesh, attempt);
+		do_outgoing_connection(mesh, outgoing);
 		return;
 	}
 
+	/* We have a winner, cancel all other attempts and turn this one into the meta connection. */
+
 	connection_t *c = new_connection();
 	c->outgoing = outgoing;
+	c->socket = attempt->socket;
+	c->address = attempt->address;
+	c->connect_start = attempt->started;
 
-	memcpy(&c->address, outgoing->aip->ai_addr, outgoing->aip->ai_addrlen);
+	io_del(&mesh->loop, &attempt->io);
+	attempt->socket = -1;
+	cancel_attempts(mesh, outgoing);
 
-	if(mesh->log_level <= MESHLINK_INFO) {
-		char *hostname = sockaddr2hostname(&c->address);
-		logger(mesh, MESHLINK_INFO, "Trying to connect to %s at %s", outgoing->node->name, hostname);
-		free(hostname);
-	}
+	c->status.initiator = true;
+	c->name = xstrdup(outgoing->node->name);
 
-	c->socket = socket(c->address.sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
+	connection_add(mesh, c);
 
-	if(c->socket == -1) {
-		if(mesh->log_level <= MESHLINK_ERROR) {
-			char *hostname = sockaddr2hostname(&c->address);
-			logger(mesh, MESHLINK_ERROR, "Creating socket for %s at %s failed: %s", c->name, hostname, sockstrerror(sockerrno));
-			free(hostname);
+	io_add(&mesh->loop, &c->io, handle_meta_io, c, c->socket, IO_READ);
+	finish_connecting(mesh, c);
+}
+
+// Start a connect() attempt to the next address, if there is room for one.
+static bool start_attempt(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	outgoing_attempt_t *attempt = NULL;
+
+	for(int i = 0; i < OUTGOING_MAX_ATTEMPTS; i++) {
+		if(!outgoing->attempts[i].io.cb) {
+			attempt = &outgoing->attempts[i];
+			break;
 		}
+	}
 
-		free_connection(c);
-		goto begin;
+	if(!attempt) {
+		return false;
 	}
 
-	configure_tcp(c);
+	sockaddr_t sa;
+
+	while(get_next_outgoing_address(mesh, outgoing, &sa)) {
+		char *hostname = NULL;
+
+		if(mesh->log_level <= MESHLINK_INFO) {
+			hostname = sockaddr2hostname(&sa);
+			logger(mesh, MESHLINK_INFO, "Trying to connect to %s at %s", outgoing->node->name, hostname);
+		}
+
+		int sock = socket(sa.sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
+
+		if(sock == -1) {
+			int err = sockerrno;
+
+			// The address is only formatted up front if it is logged anyway
+			if(!hostname) {
+				hostname = sockaddr2hostname(&sa);
+			}
+
+			logger(mesh, MESHLINK_ERROR, "Creating socket for %s at %s failed: %s", outgoing->node->name, hostname, sockstrerror(err));
+			free(hostname);
+			continue;
+		}
+
+		configure_tcp(mesh, sock);
 
 #ifdef FD_CLOEXEC
-	fcntl(c->socket, F_SETFD, FD_CLOEXEC);
+		fcntl(sock, F_SETFD, FD_CLOEXEC);
 #endif
 
 #if defined(IPV6_V6ONLY)
 
-	if(c->address.sa.sa_family == AF_INET6) {
-		static const int option = 1;
-		setsockopt(c->socket, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&option, sizeof(option));
-	}
+		if(sa.sa.sa_family == AF_INET6) {
+			static const int option = 1;
+			setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&option, sizeof(option));
+		}
 
 #endif
 
-	/* Connect */
+		TRACE1(connect_start, outgoing->node->name);
 
-	int result = connect(c->socket, &c->address.sa, SALEN(c->address.sa));
+		if(connect(sock, &sa.sa, SALEN(sa.sa)) == -1 && !sockinprogress(sockerrno)) {
+			int err = sockerrno;
 
-	if(result == -1 && !sockinprogress(sockerrno)) {
-		if(mesh->log_level <= MESHLINK_ERROR) {
-			char *hostname = sockaddr2hostname(&c->address);
-			logger(mesh, MESHLINK_ERROR, "Could not connect to %s: %s", outgoing->node->name, sockstrerror(sockerrno));
+			if(!hostname) {
+				hostname = sockaddr2hostname(&sa);
+			}
+
+			logger(mesh, MESHLINK_ERROR, "Could not connect to %s at %s: %s", outgoing->node->name, hostname, sockstrerror(err));
+			closesocket(sock);
 			free(hostname);
+			continue;
 		}
 
-		free_connection(c);
-		goto begin;
+		free(hostname);
+
+		attempt->outgoing = outgoing;
+		attempt->socket = sock;
+		attempt->address = sa;
+		attempt->started = mesh->loop.now;
+		io_add(&mesh->loop, &attempt->io, handle_attempt_io, attempt, sock, IO_WRITE);
+		return true;
 	}
 
-	/* Now that there is a working socket, fill in the rest and register this connection. */
+	return false;
+}
 
-	c->status.connecting = true;
-	c->status.initiator = true;
-	c->name = xstrdup(outgoing->node->name);
-	c->last_ping_time = mesh->loop.now.tv_sec;
+static void attempt_timeout_handler(event_loop_t *loop, void *data);
 
-	connection_add(mesh, c);
+// Make sure the timer runs as long as there are attempts in progress.
+static void schedule_attempts(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	if(!pending_attempts(outgoing)) {
+		timeout_del(&mesh->loop, &outgoing->attempt_ev);
+		return;
+	}
 
-	io_add(&mesh->loop, &c->io, handle_meta_io, c, c->socket, IO_READ | IO_WRITE);
+	bool more = outgoing->state == OUTGOING_CONNECTING && outgoing->next_address < outgoing->address_count;
+
+	timeout_add(&mesh->loop, &outgoing->attempt_ev, attempt_timeout_handler, outgoing, &(struct timespec) {
+		more ? 0 : 1, more ? OUTGOING_ATTEMPT_DELAY * 1000000 : 0
+	});
 }
 
-void reset_outgoing(outgoing_t *outgoing) {
-	if(outgoing->ai) {
-		if(outgoing->state == OUTGOING_RECENT || outgoing->state == OUTGOING_KNOWN) {
-			free_known_addresses(outgoing->ai);
-		} else {
-			freeaddrinfo(outgoing->ai);
+static void free_outgoing(outgoing_t *outgoing) {
+	meshlink_handle_t *mesh = outgoing->node->mesh;
+
+	timeout_del(&mesh->loop, &outgoing->ev);
+	cancel_attempts(mesh, outgoing);
+	adns_cancel(mesh, outgoing);
+
+	free(outgoing->addresses);
+	free(outgoing);
+}
+
+static void outgoing_failed(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	// Make sure a stale attempt timer does not count this failure twice
+	timeout_del(&mesh->loop, &outgoing->attempt_ev);
+
+	if(outgoing->state == OUTGOING_NO_KNOWN_ADDRESSES) {
+		logger(mesh, MESHLINK_ERROR, "No known addresses for %s", outgoing->node->name);
+		outgoing_del(mesh, outgoing);
+
+		// Let the periodic handler try again later
+		schedule_periodic(mesh, 5);
+	} else {
+		logger(mesh, MESHLINK_ERROR, "Could not set up a meta connection to %s", outgoing->node->name);
+		retry_outgoing(mesh, outgoing);
+	}
+}
+
+static void attempt_timeout_handler(event_loop_t *loop, void *data) {
+	meshlink_handle_t *mesh = loop->data;
+	outgoing_t *outgoing = data;
+	int timeout = outgoing->timeout < 5000 ? 1 : mesh->dev_class_traits[outgoing->node->devclass].pingtimeout;
+
+	for(int i = 0; i < OUTGOING_MAX_ATTEMPTS; i++) {
+		outgoing_attempt_t *attempt = &outgoing->attempts[i];
+
+		if(!attempt->io.cb) {
+			continue;
+		}
+
+		int64_t elapsed = (mesh->loop.now.tv_sec - attempt->started.tv_sec) * 1000 + (mesh->loop.now.tv_nsec - attempt->started.tv_nsec) / 1000000;
+
+		if(elapsed >= timeout * 1000) {
+			if(mesh->log_level <= MESHLINK_WARNING) {
+				char *hostname = sockaddr2hostname(&attempt->address);
+				logger(mesh, MESHLINK_WARNING, "Timeout while connecting to %s at %s", outgoing->node->name, hostname);
+				free(hostname);
+			}
+
+			node_address_failed(mesh, outgoing->node, &attempt->address);
+			cancel_attempt(mesh, attempt);
+		}
+	}
+
+	if(!start_attempt(mesh, outgoing) && !pending_attempts(outgoing)) {
+		if(!outgoing->resolving) {
+			outgoing_failed(mesh, outgoing);
+		}
+
+		return;
+	}
+
+	schedule_attempts(mesh, outgoing);
+}
+
+void do_outgoing_connection(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	if(!start_attempt(mesh, outgoing) && !pending_attempts(outgoing)) {
+		// Wait for outgoing_resolved() to call us again
+		if(!outgoing->resolving) {
+			outgoing_failed(mesh, outgoing);
 		}
+
+		return;
 	}
 
-	outgoing->ai = NULL;
-	outgoing->aip = NULL;
+	schedule_attempts(mesh, outgoing);
+}
+
+void reset_outgoing(outgoing_t *outgoing) {
+	meshlink_handle_t *mesh = outgoing->node->mesh;
+
+	cancel_attempts(mesh, outgoing);
+	adns_cancel(mesh, outgoing);
+
+	free(outgoing->addresses);
+	outgoing->addresses = NULL;
+	outgoing->address_count = 0;
+	outgoing->next_address = 0;
+	outgoing->resolving = false;
 	outgoing->state = OUTGOING_START;
 }
 
@@ -420,19 +694,68 @@ void setup_outgoing_connection(meshlink_handle_t *mesh, outgoing_t *outgoing) {
 	}
 
 	if(mesh->connection_try_cb) {
-		mesh->connection_try_cb(mesh, (meshlink_node_t *)outgoing->node);
+		dispatch_callback(mesh, CALLBACK_CONNECTION_TRY, outgoing->node, 0, NULL, 0);
 	}
 
 	do_outgoing_connection(mesh, outgoing);
 }
 
+/// Find the outgoing connection we are making to a node.
+outgoing_t *lookup_outgoing(meshlink_handle_t *mesh, const node_t *n) {
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->outgoings[i] && mesh->outgoings[i]->node == n) {
+			return mesh->outgoings[i];
+		}
+	}
+
+	return NULL;
+}
+
+/// Create a new outgoing connection to a node. It has to be started with setup_outgoing_connection().
+outgoing_t *outgoing_add(meshlink_handle_t *mesh, node_t *n) {
+	assert(!lookup_outgoing(mesh, n));
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(!mesh->outgoings[i]) {
+			outgoing_t *outgoing = xzalloc(sizeof(*outgoing));
+			outgoing->node = n;
+			mesh->outgoings[i] = outgoing;
+			return outgoing;
+		}
+	}
+
+	abort();
+}
+
+/// Stop making an outgoing connection, and close the meta connection belonging to it.
+void outgoing_del(meshlink_handle_t *mesh, outgoing_t *outgoing) {
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		connection_t *c = mesh->connections[i];
+
+		if(c && c->outgoing == outgoing) {
+			c->outgoing = NULL;
+			terminate_connection(mesh, c, c->status.active);
+		}
+	}
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->outgoings[i] == outgoing) {
+			mesh->outgoings[i] = NULL;
+		}
+	}
+
+	free_outgoing(outgoing);
+}
+
 void init_outgoings(meshlink_handle_t *mesh) {
-	mesh->outgoing = NULL;
+	memset(mesh->outgoings, 0, sizeof(mesh->outgoings));
 }
 
 void exit_outgoings(meshlink_handle_t *mesh) {
-	if(mesh->outgoing) {
-		free_outgoing(mesh->outgoing);
-		mesh->outgoing = NULL;
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->outgoings[i]) {
+			free_outgoing(mesh->outgoings[i]);
+			mesh->outgoings[i] = NULL;
+		}
 	}
 }
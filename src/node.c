@@ -29,15 +29,20 @@
 #include "xalloc.h"
 
 void init_nodes(meshlink_handle_t *mesh) {
-	mesh->peer = NULL;
+	memset(mesh->peers, 0, sizeof(mesh->peers));
+	mesh->upstream = NULL;
 }
 
 void exit_nodes(meshlink_handle_t *mesh) {
-	if(mesh->peer) {
-		free_node(mesh->peer);
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->peers[i]) {
+			free_node(mesh->peers[i]);
+		}
+
+		mesh->peers[i] = NULL;
 	}
 
-	mesh->peer = NULL;
+	mesh->upstream = NULL;
 }
 
 node_t *new_node(void) {
@@ -59,14 +64,20 @@ void free_node(node_t *n) {
 	free(n);
 }
 
-void node_add(meshlink_handle_t *mesh, node_t *n) {
+bool node_add(meshlink_handle_t *mesh, node_t *n) {
 	if(n == mesh->self) {
-		return;
+		return true;
+	}
+
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(!mesh->peers[i]) {
+			n->mesh = mesh;
+			mesh->peers[i] = n;
+			return true;
+		}
 	}
 
-	assert(!mesh->peer);
-	n->mesh = mesh;
-	mesh->peer = n;
+	return false;
 }
 
 void node_del(meshlink_handle_t *mesh, node_t *n) {
@@ -74,19 +85,91 @@ void node_del(meshlink_handle_t *mesh, node_t *n) {
 		return;
 	}
 
-	assert(mesh->peer && mesh->peer == n);
+	int i = 0;
+
+	while(i < MAX_UPSTREAMS && mesh->peers[i] != n) {
+		i++;
+	}
+
+	assert(i < MAX_UPSTREAMS);
+
+	// Keep the remaining nodes in order of preference
+	memmove(mesh->peers + i, mesh->peers + i + 1, (MAX_UPSTREAMS - i - 1) * sizeof(*mesh->peers));
+	mesh->peers[MAX_UPSTREAMS - 1] = NULL;
+
+	if(mesh->upstream == n) {
+		mesh->upstream = NULL;
+	}
+
 	free_node(n);
-	mesh->peer = NULL;
 }
 
 node_t *lookup_node(meshlink_handle_t *mesh, const char *name) {
-	if(mesh->peer && !strcmp(name, mesh->peer->name)) {
-		return mesh->peer;
-	} else if(!strcmp(name, mesh->self->name)) {
+	for(int i = 0; i < MAX_UPSTREAMS; i++) {
+		if(mesh->peers[i] && !strcmp(name, mesh->peers[i]->name)) {
+			return mesh->peers[i];
+		}
+	}
+
+	if(!strcmp(name, mesh->self->name)) {
 		return mesh->self;
-	} else {
-		return NULL;
 	}
+
+	return NULL;
+}
+
+/* Returns a negative value if address a is a better candidate to connect to than address b.
+   Addresses that failed recently go last, then addresses are ranked by success rate and round trip time.
+*/
+static int compare_address_stats(const address_stats_t *a, const address_stats_t *b, int64_t now) {
+	bool a_failed = a->last_failure && now - a->last_failure < ADDRESS_FAILURE_HOLDOFF;
+	bool b_failed = b->last_failure && now - b->last_failure < ADDRESS_FAILURE_HOLDOFF;
+
+	if(a_failed != b_failed) {
+		return a_failed ? 1 : -1;
+	}
+
+	// Success rate in tenths, where addresses without any history count as 50%
+	int a_rate = (a->successes + 1) * 10 / (a->successes + a->failures + 2);
+	int b_rate = (b->successes + 1) * 10 / (b->successes + b->failures + 2);
+
+	if(a_rate != b_rate) {
+		return b_rate - a_rate;
+	}
+
+	// Addresses with an unknown round trip time go after those with a known one
+	if(a->rtt != b->rtt) {
+		if(!a->rtt || !b->rtt) {
+			return a->rtt ? -1 : 1;
+		}
+
+		return a->rtt < b->rtt ? -1 : 1;
+	}
+
+	return 0;
+}
+
+static int find_recent_address(const node_t *n, const sockaddr_t *sa) {
+	for(int i = 0; i < MAX_RECENT && n->recent[i].sa.sa_family; i++) {
+		if(!sockaddrcmp(&n->recent[i], sa)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/// Mark the host config file of a node as changed. The periodic handler writes it out shortly after, together with other changes.
+void node_set_dirty(meshlink_handle_t *mesh, node_t *n) {
+	n->status.dirty = true;
+	schedule_periodic(mesh, 1);
+}
+
+static void remove_recent_address(node_t *n, int i) {
+	memmove(n->recent + i, n->recent + i + 1, (MAX_RECENT - i - 1) * sizeof(*n->recent));
+	memmove(n->recent_stats + i, n->recent_stats + i + 1, (MAX_RECENT - i - 1) * sizeof(*n->recent_stats));
+	memset(&n->recent[MAX_RECENT - 1], 0, sizeof(*n->recent));
+	memset(&n->recent_stats[MAX_RECENT - 1], 0, sizeof(*n->recent_stats));
 }
 
 bool node_add_recent_address(meshlink_handle_t *mesh, node_t *n, const sockaddr_t *sa) {
@@ -107,13 +190,98 @@ bool node_add_recent_address(meshlink_handle_t *mesh, node_t *n, const sockaddr_
 		return false;
 	}
 
-	if(i >= MAX_RECENT) {
+	address_stats_t stats = {0};
+
+	if(found) {
+		stats = n->recent_stats[i];
+	} else if(i >= MAX_RECENT) {
+		/* Make room by dropping the worst address, preferring to drop older ones */
+		int64_t now = time(NULL);
 		i = MAX_RECENT - 1;
+
+		for(int j = MAX_RECENT - 2; j >= 0; j--) {
+			if(compare_address_stats(&n->recent_stats[j], &n->recent_stats[i], now) > 0) {
+				i = j;
+			}
+		}
 	}
 
 	memmove(n->recent + 1, n->recent, i * sizeof(*n->recent));
+	memmove(n->recent_stats + 1, n->recent_stats, i * sizeof(*n->recent_stats));
 	memcpy(n->recent, sa, SALEN(sa->sa));
+	n->recent_stats[0] = stats;
 
-	n->status.dirty = true;
+	node_set_dirty(mesh, n);
 	return !found;
 }
+
+static void age_address_stats(address_stats_t *stats) {
+	if(stats->successes + stats->failures >= ADDRESS_MAX_HISTORY) {
+		stats->successes /= 2;
+		stats->failures /= 2;
+	}
+}
+
+/// Record that a meta connection via the given address was activated, rtt milliseconds after connect() was called.
+void node_address_succeeded(meshlink_handle_t *mesh, node_t *n, const sockaddr_t *sa, uint32_t rtt) {
+	node_add_recent_address(mesh, n, sa);
+
+	address_stats_t *stats = &n->recent_stats[0];
+	age_address_stats(stats);
+	stats->successes++;
+	stats->last_failure = 0;
+
+	if(!rtt) {
+		rtt = 1;
+	}
+
+	stats->rtt = stats->rtt ? (stats->rtt * 7 + rtt) / 8 : rtt;
+	node_set_dirty(mesh, n);
+}
+
+/// Record that connecting to the given address failed. Addresses that never worked are forgotten after a few tries.
+void node_address_failed(meshlink_handle_t *mesh, node_t *n, const sockaddr_t *sa) {
+	int i = find_recent_address(n, sa);
+
+	if(i < 0) {
+		return;
+	}
+
+	address_stats_t *stats = &n->recent_stats[i];
+	age_address_stats(stats);
+	stats->failures++;
+	stats->last_failure = time(NULL);
+
+	if(!stats->successes && stats->failures >= ADDRESS_MAX_FAILURES) {
+		if(mesh->log_level <= MESHLINK_INFO) {
+			char *hostname = sockaddr2hostname(sa);
+			logger(mesh, MESHLINK_INFO, "Forgetting address %s of %s", hostname, n->name);
+			free(hostname);
+		}
+
+		remove_recent_address(n, i);
+	}
+
+	node_set_dirty(mesh, n);
+}
+
+/// Fill order with the indices of the recent addresses, best candidate first. Returns the number of addresses.
+int node_sort_recent_addresses(meshlink_handle_t *mesh, const node_t *n, int order[MAX_RECENT]) {
+	(void)mesh;
+	int64_t now = time(NULL);
+	int count = 0;
+
+	// Insertion sort, so addresses that compare equal stay in most recently seen order
+	for(int i = 0; i < MAX_RECENT && n->recent[i].sa.sa_family; i++) {
+		int j = count++;
+
+		while(j > 0 && compare_address_stats(&n->recent_stats[i], &n->recent_stats[order[j - 1]], now) < 0) {
+			order[j] = order[j - 1];
+			j--;
+		}
+
+		order[j] = i;
+	}
+
+	return count;
+}
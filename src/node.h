@@ -41,6 +41,17 @@ typedef struct node_status_t {
 
 #define MAX_RECENT 5
 
+#define ADDRESS_MAX_FAILURES 5          /* forget addresses that failed this many times without ever working */
+#define ADDRESS_MAX_HISTORY 64          /* halve the counters when they reach this, so recent results count more */
+#define ADDRESS_FAILURE_HOLDOFF 60      /* seconds during which a failed address is tried after the others */
+
+typedef struct address_stats_t {
+	uint16_t successes;                 /* number of connections that got activated */
+	uint16_t failures;                  /* number of connection attempts that failed or timed out */
+	uint32_t rtt;                       /* smoothed time in milliseconds from connect() until activation */
+	int64_t last_failure;               /* wall clock time of the last failure */
+} address_stats_t;
+
 typedef struct node_t {
 	// Public member variables
 	char *name;                             /* name of this node */
@@ -63,17 +74,27 @@ typedef struct node_t {
 
 	char *canonical_address;                /* The canonical address of this node, if known */
 	sockaddr_t recent[MAX_RECENT];          /* Recently seen addresses */
+	address_stats_t recent_stats[MAX_RECENT]; /* Connection statistics for each of the recent addresses */
 
 	struct node_t *nexthop;                 /* nearest node from us to him */
+	struct node_t *via;                     /* upstream node packets for this node were last sent to */
+	time_t last_sent;                       /* when a packet for this node was last sent */
+	uint64_t via_queued;                    /* the outbuf_sent value of the connection to via once our last packet is written */
+
+	stats_t stats;                          /* Performance counters of this node */
 } node_t;
 
 void init_nodes(struct meshlink_handle *mesh);
 void exit_nodes(struct meshlink_handle *mesh);
 node_t *new_node(void) __attribute__((__malloc__));
 void free_node(node_t *n);
-void node_add(struct meshlink_handle *mesh, node_t *n);
+bool node_add(struct meshlink_handle *mesh, node_t *n) __attribute__((__warn_unused_result__));
 void node_del(struct meshlink_handle *mesh, node_t *n);
 node_t *lookup_node(struct meshlink_handle *mesh, const char *name) __attribute__((__warn_unused_result__));
+void node_set_dirty(struct meshlink_handle *mesh, node_t *n);
 bool node_add_recent_address(struct meshlink_handle *mesh, node_t *n, const sockaddr_t *addr);
+void node_address_succeeded(struct meshlink_handle *mesh, node_t *n, const sockaddr_t *addr, uint32_t rtt);
+void node_address_failed(struct meshlink_handle *mesh, node_t *n, const sockaddr_t *addr);
+int node_sort_recent_addresses(struct meshlink_handle *mesh, const node_t *n, int order[MAX_RECENT]);
 
 #endif
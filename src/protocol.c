@@ -19,11 +19,13 @@
 
 #include "system.h"
 
+#include "capture.h"
 #include "conf.h"
 #include "connection.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "meta.h"
+#include "packmsg.h"
 #include "protocol.h"
 #include "utils.h"
 #include "xalloc.h"
@@ -46,6 +48,58 @@ static bool (*request_handlers[NUM_REQUESTS])(meshlink_handle_t *, connection_t
 	[PACKET] = raw_packet_h,
 };
 
+/* Field types of binary encoded requests, 'i' is an integer, 's' a string and 'b' binary data.
+   Only requests that are sent after authentication can be binary encoded.
+   The fields follow the same order as in the text encoding, peers may append more fields. */
+
+static const char *binary_request_formats[NUM_REQUESTS] = {
+	[STATUS] = "",
+	[ERROR] = "is",
+	[TERMREQ] = "",
+	[PING] = "",
+	[PONG] = "",
+	[ADD_EDGE] = "isissssisiiii",
+	[DEL_EDGE] = "iss",
+	[KEY_CHANGED] = "",
+	[REQ_KEY] = "",
+	[ANS_KEY] = "",
+	[PACKET] = "b",
+};
+
+static bool ignored_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	(void)mesh;
+	(void)c;
+	(void)args;
+	(void)argc;
+
+	return true;
+}
+
+static bool termreq_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	(void)mesh;
+	(void)c;
+	(void)args;
+	(void)argc;
+
+	return false;
+}
+
+/* Jumptable for the binary request handlers */
+
+static bool (*binary_request_handlers[NUM_REQUESTS])(meshlink_handle_t *, connection_t *, const request_arg_t *, int) = {
+	[STATUS] = ignored_bin_h,
+	[ERROR] = error_bin_h,
+	[TERMREQ] = termreq_bin_h,
+	[PING] = ping_bin_h,
+	[PONG] = pong_bin_h,
+	[ADD_EDGE] = add_edge_bin_h,
+	[DEL_EDGE] = del_edge_bin_h,
+	[KEY_CHANGED] = ignored_bin_h,
+	[REQ_KEY] = ignored_bin_h,
+	[ANS_KEY] = ignored_bin_h,
+	[PACKET] = packet_bin_h,
+};
+
 /* Request names */
 
 static const char *request_name[NUM_REQUESTS] __attribute__((unused)) = {
@@ -149,3 +203,145 @@ bool receive_request(meshlink_handle_t *mesh, connection_t *c, const char *reque
 
 	return true;
 }
+
+/* Binary request routines, only used after authentication with peers that support them */
+
+bool send_binary_request(meshlink_handle_t *mesh, connection_t *c, request_t req, const request_arg_t *args) {
+	assert(c);
+	assert(req >= 0 && req < NUM_REQUESTS && binary_request_formats[req]);
+	assert(c->status.binary);
+
+	const char *format = binary_request_formats[req];
+	uint8_t buf[MAXBUFSIZE];
+	packmsg_output_t out = {buf, sizeof(buf)};
+
+	packmsg_add_int32(&out, req);
+
+	for(int i = 0; format[i]; i++) {
+		assert(args[i].type == format[i]);
+
+		switch(args[i].type) {
+		case 'i':
+			packmsg_add_int64(&out, args[i].i);
+			break;
+
+		case 's':
+			packmsg_add_str_raw(&out, args[i].data, args[i].len);
+			break;
+
+		case 'b':
+			packmsg_add_bin(&out, args[i].data, args[i].len);
+			break;
+
+		default:
+			abort();
+		}
+	}
+
+	if(!packmsg_output_ok(&out)) {
+		logger(mesh, MESHLINK_ERROR, "Output buffer overflow while sending request to %s", c->name);
+		return false;
+	}
+
+	size_t len = packmsg_output_size(&out, buf);
+	logger(mesh, MESHLINK_DEBUG, "Sending binary %s to %s (%lu bytes)", request_name[req], c->name, (unsigned long)len);
+
+	if(mesh->capture) {
+		capture_record(mesh, c, CAPTURE_OUT, SPTPS_BINARY_REQUEST, buf, len);
+	}
+
+	return sptps_send_record(&c->sptps, SPTPS_BINARY_REQUEST, buf, len);
+}
+
+bool receive_binary_request(meshlink_handle_t *mesh, connection_t *c, const void *data, uint16_t len) {
+	assert(!len || data);
+
+	if(!c->status.active) {
+		logger(mesh, MESHLINK_ERROR, "Unauthorized request from %s", c->name);
+		return false;
+	}
+
+	packmsg_input_t in = {data, len};
+	int32_t reqno = packmsg_get_int32(&in);
+
+	if(!packmsg_input_ok(&in)) {
+		logger(mesh, MESHLINK_ERROR, "Bogus data received from %s", c->name);
+		return false;
+	}
+
+	if(reqno < 0 || reqno >= NUM_REQUESTS || !binary_request_handlers[reqno]) {
+		logger(mesh, MESHLINK_DEBUG, "Unknown binary request %d from %s", reqno, c->name);
+		return false;
+	}
+
+	/* Decode all fields first, so the handlers don't have to deal with packmsg */
+
+	request_arg_t args[MAX_REQUEST_ARGS] = {0};
+	int argc = 0;
+
+	while(argc < MAX_REQUEST_ARGS && !packmsg_done(&in)) {
+		request_arg_t *arg = &args[argc++];
+
+		switch(packmsg_get_type(&in)) {
+		case PACKMSG_POSITIVE_FIXINT:
+		case PACKMSG_INT8:
+		case PACKMSG_INT16:
+		case PACKMSG_INT32:
+		case PACKMSG_INT64:
+			arg->type = 'i';
+			arg->i = packmsg_get_int64(&in);
+			break;
+
+		case PACKMSG_UINT8:
+		case PACKMSG_UINT16:
+		case PACKMSG_UINT32:
+		case PACKMSG_UINT64:
+			arg->type = 'i';
+			arg->i = (int64_t)packmsg_get_uint64(&in);
+			break;
+
+		case PACKMSG_STR: {
+			const char *str;
+			arg->type = 's';
+			arg->len = packmsg_get_str_raw(&in, &str);
+			arg->data = str;
+			break;
+		}
+
+		case PACKMSG_BIN:
+			arg->type = 'b';
+			arg->len = packmsg_get_bin_raw(&in, &arg->data);
+			break;
+
+		default:
+			arg->type = '?';
+			packmsg_skip_element(&in);
+			break;
+		}
+
+		if(!packmsg_input_ok(&in)) {
+			logger(mesh, MESHLINK_ERROR, "Got bad binary %s from %s", request_name[reqno], c->name);
+			return false;
+		}
+	}
+
+	/* Check the fields we know about, ignore any extra ones */
+
+	const char *format = binary_request_formats[reqno];
+
+	for(int i = 0; format[i]; i++) {
+		if(i >= argc || args[i].type != format[i]) {
+			logger(mesh, MESHLINK_ERROR, "Got bad binary %s from %s", request_name[reqno], c->name);
+			return false;
+		}
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "Got binary %s from %s", request_name[reqno], c->name);
+
+	if(!binary_request_handlers[reqno](mesh, c, args, argc)) {
+		logger(mesh, MESHLINK_ERROR, "Error while processing %s from %s", request_name[reqno], c->name);
+		return false;
+	}
+
+	return true;
+}
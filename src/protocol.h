@@ -60,6 +60,33 @@ typedef enum request_error_t {
 /* Protocol support flags */
 
 static const uint32_t PROTOCOL_TINY = 1; // Peer is using meshlink-tiny
+static const uint32_t PROTOCOL_BINARY = 2; // Peer accepts binary encoded requests after authentication
+
+/* Binary encoded requests are sent as SPTPS records of this type, text requests use type 0.
+ * They consist of the request number followed by the fields of the request, encoded with packmsg.
+ *
+ * Note that full MeshLink does not implement this encoding and never sets PROTOCOL_BINARY,
+ * so in practice connections to full MeshLink upstreams still send all requests as text.
+ * The binary encoding takes effect as soon as an upstream advertises the flag, test/binary-requests.c
+ * exercises it against a fake upstream that does.
+ */
+
+static const uint8_t SPTPS_BINARY_REQUEST = 1;
+
+#define MAX_REQUEST_ARGS 16
+
+/* A field of a binary encoded request */
+
+typedef struct request_arg_t {
+	char type;                      /* 'i' for integers, 's' for strings, 'b' for binary data */
+	int64_t i;                      /* the value of an integer */
+	const void *data;               /* the contents of a string or binary data, strings are not NUL-terminated */
+	uint32_t len;                   /* the length of a string or binary data */
+} request_arg_t;
+
+#define REQUEST_INT(value) {.type = 'i', .i = (value)}
+#define REQUEST_STR(value) {.type = 's', .data = (value), .len = strlen(value)}
+#define REQUEST_BIN(value, length) {.type = 'b', .data = (value), .len = (length)}
 
 /* Maximum size of strings in a request.
  * scanf terminates %2048s with a NUL character,
@@ -76,6 +103,8 @@ static const uint32_t PROTOCOL_TINY = 1; // Peer is using meshlink-tiny
 
 bool send_request(struct meshlink_handle *mesh, struct connection_t *, const char *, ...) __attribute__((__format__(printf, 3, 4)));
 bool receive_request(struct meshlink_handle *mesh, struct connection_t *, const char *);
+bool send_binary_request(struct meshlink_handle *mesh, struct connection_t *, request_t, const request_arg_t *);
+bool receive_binary_request(struct meshlink_handle *mesh, struct connection_t *, const void *, uint16_t);
 bool check_id(const char *);
 
 /* Requests */
@@ -105,4 +134,13 @@ bool req_key_h(struct meshlink_handle *mesh, struct connection_t *, const char *
 bool ans_key_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool raw_packet_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 
+/* Binary request handlers */
+
+bool error_bin_h(struct meshlink_handle *mesh, struct connection_t *, const request_arg_t *, int);
+bool ping_bin_h(struct meshlink_handle *mesh, struct connection_t *, const request_arg_t *, int);
+bool pong_bin_h(struct meshlink_handle *mesh, struct connection_t *, const request_arg_t *, int);
+bool add_edge_bin_h(struct meshlink_handle *mesh, struct connection_t *, const request_arg_t *, int);
+bool del_edge_bin_h(struct meshlink_handle *mesh, struct connection_t *, const request_arg_t *, int);
+bool packet_bin_h(struct meshlink_handle *mesh, struct connection_t *, const request_arg_t *, int);
+
 #endif
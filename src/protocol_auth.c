@@ -33,6 +33,7 @@
 #include "prf.h"
 #include "protocol.h"
 #include "sptps.h"
+#include "trace.h"
 #include "utils.h"
 #include "xalloc.h"
 #include "ed25519/sha512.h"
@@ -42,7 +43,8 @@
 extern bool node_write_devclass(meshlink_handle_t *mesh, node_t *n);
 
 bool send_id(meshlink_handle_t *mesh, connection_t *c) {
-	return send_request(mesh, c, "%d %s %d.%d %s %u", ID, mesh->self->name, PROT_MAJOR, PROT_MINOR, mesh->appname, PROTOCOL_TINY);
+	TRACE1(handshake_id_sent, c->name);
+	return send_request(mesh, c, "%d %s %d.%d %s %u", ID, mesh->self->name, PROT_MAJOR, PROT_MINOR, mesh->appname, PROTOCOL_TINY | PROTOCOL_BINARY);
 }
 
 bool id_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
@@ -109,8 +111,10 @@ bool id_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		return false;
 	}
 
+	TRACE1(handshake_id_received, c->name);
 	c->allow_request = ACK;
 	c->last_ping_time = mesh->loop.now.tv_sec;
+	c->status.binary = !!(flags & PROTOCOL_BINARY);
 	char label[sizeof(meshlink_tcp_label) + strlen(mesh->self->name) + strlen(c->name) + 2];
 
 	if(c->outgoing) {
@@ -167,14 +171,26 @@ bool ack_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	if(!n) {
 		n = new_node();
 		n->name = xstrdup(c->name);
-		node_add(mesh, n);
+
+		if(!node_add(mesh, n)) {
+			free_node(n);
+			return false;
+		}
 	}
 
 	n->devclass = devclass;
-	n->status.dirty = true;
+	node_set_dirty(mesh, n);
 
 	n->last_successfull_connection = mesh->loop.now.tv_sec;
 
+	stats_add(mesh, n, handshakes, 1);
+
+	if(c->status.initiator) {
+		int64_t rtt = (mesh->loop.now.tv_sec - c->connect_start.tv_sec) * 1000 + (mesh->loop.now.tv_nsec - c->connect_start.tv_nsec) / 1000000;
+		node_address_succeeded(mesh, n, &c->address, rtt > 0 ? (uint32_t)rtt : 0);
+		stats_add(mesh, n, handshake_time, stats_elapsed(&c->connect_start, &mesh->loop.now));
+	}
+
 	n->connection = c;
 	n->nexthop = n;
 	c->node = n;
@@ -186,12 +202,19 @@ bool ack_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	c->status.active = true;
 
 	logger(mesh, MESHLINK_INFO, "Connection with %s activated", c->name);
+	TRACE1(handshake_activated, c->name);
+	update_upstream(mesh);
+	update_keepalive(mesh, c);
 
 	if(mesh->meta_status_cb) {
-		mesh->meta_status_cb(mesh, (meshlink_node_t *)n, true);
+		dispatch_callback(mesh, CALLBACK_META_STATUS, n, true, NULL, 0);
+	}
+
+	// While backing off from a storm of contradicting edges, periodic_handler() announces it later
+	if(mesh->loop.now.tv_sec >= mesh->backoff_until) {
+		send_add_edge(mesh, c, 0);
 	}
 
-	send_add_edge(mesh, c, 0);
 	n->status.reachable = true;
 	update_node_status(mesh, c->node);
 
@@ -34,11 +34,21 @@
 bool send_add_edge(meshlink_handle_t *mesh, connection_t *c, int contradictions) {
 	char *address, *port;
 	sockaddr2str(&c->address, &address, &port);
+	bool result;
 
-	bool result = send_request(mesh, c, "%d %x %s %d %s %s %s %s %d %s %x %d %d %x", ADD_EDGE, prng(mesh, UINT_MAX),
-	                           mesh->self->name, mesh->self->devclass, CORE_MESH,
-	                           mesh->peer->name, address, port,
-	                           mesh->peer->devclass, CORE_MESH, 0, 1000, contradictions, mesh->peer->session_id);
+	if(c->status.binary) {
+		const request_arg_t args[] = {
+			REQUEST_INT(prng(mesh, UINT_MAX)), REQUEST_STR(mesh->self->name), REQUEST_INT(mesh->self->devclass), REQUEST_STR(CORE_MESH),
+			REQUEST_STR(c->node->name), REQUEST_STR(address), REQUEST_STR(port),
+			REQUEST_INT(c->node->devclass), REQUEST_STR(CORE_MESH), REQUEST_INT(0), REQUEST_INT(1000), REQUEST_INT(contradictions), REQUEST_INT(c->node->session_id),
+		};
+		result = send_binary_request(mesh, c, ADD_EDGE, args);
+	} else {
+		result = send_request(mesh, c, "%d %x %s %d %s %s %s %s %d %s %x %d %d %x", ADD_EDGE, prng(mesh, UINT_MAX),
+		                     mesh->self->name, mesh->self->devclass, CORE_MESH,
+		                     c->node->name, address, port,
+		                     c->node->devclass, CORE_MESH, 0, 1000, contradictions, c->node->session_id);
+	}
 
 	free(address);
 	free(port);
@@ -46,26 +56,127 @@ bool send_add_edge(meshlink_handle_t *mesh, connection_t *c, int contradictions)
 	return result;
 }
 
+/* Edges from us only exist while we have an active meta-connection to the other end.
+   Returns that connection, or NULL if the edge should not exist. */
+static connection_t *own_edge_connection(meshlink_handle_t *mesh, const char *to) {
+	node_t *n = lookup_node(mesh, to);
+
+	if(!n || !n->connection || !n->connection->status.active) {
+		return NULL;
+	}
+
+	return n->connection;
+}
+
+/* Count contradicting edges over a fixed window, and make sure periodic_handler() checks them when it closes. */
+static void count_contradiction(meshlink_handle_t *mesh, int *counter) {
+	if(!mesh->contradicting_since) {
+		mesh->contradicting_since = mesh->loop.now.tv_sec;
+		schedule_periodic(mesh, CONTRADICTING_EDGE_WINDOW);
+	}
+
+	(*counter)++;
+}
+
+/* Someone else claims to have an edge from us that we don't have.
+   This usually means another node is using our name, see periodic_handler(). */
+static bool add_edge(meshlink_handle_t *mesh, connection_t *c, const char *from_name, const char *to_name) {
+	if(!strcmp(from_name, mesh->self->name) && !own_edge_connection(mesh, to_name)) {
+		logger(mesh, MESHLINK_WARNING, "Got %s from %s for ourself which does not match an existing edge", "ADD_EDGE", c->name);
+		count_contradiction(mesh, &mesh->contradicting_add_edge);
+	}
+
+	return true;
+}
+
+/* Someone else deleted an edge of ours that still exists, send back a correction,
+   unless we are backing off from a storm of these, see periodic_handler(). */
+static bool del_edge(meshlink_handle_t *mesh, connection_t *c, const char *from_name, const char *to_name) {
+	if(strcmp(from_name, mesh->self->name)) {
+		return true;
+	}
+
+	connection_t *other = own_edge_connection(mesh, to_name);
+
+	if(!other) {
+		return true;
+	}
+
+	logger(mesh, MESHLINK_WARNING, "Got %s from %s for ourself", "DEL_EDGE", c->name);
+	count_contradiction(mesh, &mesh->contradicting_del_edge);
+
+	if(mesh->loop.now.tv_sec >= mesh->backoff_until) {
+		return send_add_edge(mesh, other, mesh->contradicting_del_edge);
+	}
+
+	return true;
+}
+
 bool add_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	assert(request);
 	assert(*request);
 
-	(void)mesh;
-	(void)c;
-	(void)request;
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
 
-	/* TODO: Check if this is an edge we would own. */
-	return true;
+	if(sscanf(request, "%*d %*x " MAX_STRING " %*d %*s " MAX_STRING, from_name, to_name) != 2) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "ADD_EDGE", c->name);
+		return false;
+	}
+
+	return add_edge(mesh, c, from_name, to_name);
 }
 
 bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	assert(request);
 	assert(*request);
 
-	(void)mesh;
-	(void)c;
-	(void)request;
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
 
-	/* TODO: Check if this is an edge we would own. */
+	if(sscanf(request, "%*d %*x " MAX_STRING " " MAX_STRING, from_name, to_name) != 2) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "DEL_EDGE", c->name);
+		return false;
+	}
+
+	return del_edge(mesh, c, from_name, to_name);
+}
+
+/* Copy a string field of a binary request, which is not NUL-terminated */
+static bool get_name(const request_arg_t *arg, char name[MAX_STRING_SIZE]) {
+	if(arg->len >= MAX_STRING_SIZE || memchr(arg->data, 0, arg->len)) {
+		return false;
+	}
+
+	memcpy(name, arg->data, arg->len);
+	name[arg->len] = 0;
 	return true;
 }
+
+bool add_edge_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	(void)argc;
+
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+
+	if(!get_name(&args[1], from_name) || !get_name(&args[4], to_name)) {
+		logger(mesh, MESHLINK_ERROR, "Got bad binary %s from %s", "ADD_EDGE", c->name);
+		return false;
+	}
+
+	return add_edge(mesh, c, from_name, to_name);
+}
+
+bool del_edge_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	(void)argc;
+
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+
+	if(!get_name(&args[1], from_name) || !get_name(&args[2], to_name)) {
+		logger(mesh, MESHLINK_ERROR, "Got bad binary %s from %s", "DEL_EDGE", c->name);
+		return false;
+	}
+
+	return del_edge(mesh, c, from_name, to_name);
+}
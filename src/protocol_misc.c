@@ -42,19 +42,58 @@ bool status_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 }
 
 bool send_error(meshlink_handle_t *mesh, connection_t *c, request_error_t err, const char *message) {
-	send_request(mesh, c, "%d %d %s", ERROR, err, message);
+	if(c->status.binary && c->status.active) {
+		const request_arg_t args[] = {REQUEST_INT(err), REQUEST_STR(message)};
+		send_binary_request(mesh, c, ERROR, args);
+	} else {
+		send_request(mesh, c, "%d %d %s", ERROR, err, message);
+	}
+
 	flush_meta(mesh, c);
 	return false;
 }
 
-bool error_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
-	(void)mesh;
-	(void)c;
-	(void)request;
+static bool receive_error(meshlink_handle_t *mesh, connection_t *c, int err, const char *message, int retry_after) {
+	logger(mesh, MESHLINK_INFO, "Error message from %s: %d: %s", c->name, err, message);
+
+	/* The peer can optionally tell us how many seconds to wait before reconnecting */
+	if(retry_after > 0 && c->outgoing) {
+		logger(mesh, MESHLINK_INFO, "%s asked us to wait %d seconds before reconnecting", c->name, retry_after);
+		c->outgoing->retry_after = retry_after;
+	}
 
 	return false;
 }
 
+bool error_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
+	assert(request);
+	assert(*request);
+
+	int err;
+	char message[MAX_STRING_SIZE] = "";
+	int retry_after;
+
+	int n = sscanf(request, "%*d %d " MAX_STRING " %d", &err, message, &retry_after);
+
+	if(n < 1) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "ERROR", c->name);
+		return false;
+	}
+
+	return receive_error(mesh, c, err, message, n == 3 ? retry_after : 0);
+}
+
+bool error_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	char message[MAX_STRING_SIZE];
+	int len = args[1].len < sizeof(message) ? (int)args[1].len : (int)sizeof(message) - 1;
+	memcpy(message, args[1].data, len);
+	message[len] = 0;
+
+	int retry_after = argc > 2 && args[2].type == 'i' && args[2].i <= INT_MAX ? (int)args[2].i : 0;
+
+	return receive_error(mesh, c, (int)args[0].i, message, retry_after);
+}
+
 bool termreq_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	(void)mesh;
 	(void)c;
@@ -66,6 +105,11 @@ bool termreq_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 bool send_ping(meshlink_handle_t *mesh, connection_t *c) {
 	c->status.pinged = true;
 	c->last_ping_time = mesh->loop.now.tv_sec;
+	c->ping_sent = mesh->loop.now;
+
+	if(c->status.binary) {
+		return send_binary_request(mesh, c, PING, NULL);
+	}
 
 	return send_request(mesh, c, "%d", PING);
 }
@@ -79,19 +123,54 @@ bool ping_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	return send_pong(mesh, c);
 }
 
+bool ping_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	(void)args;
+	(void)argc;
+
+	return send_pong(mesh, c);
+}
+
 bool send_pong(meshlink_handle_t *mesh, connection_t *c) {
+	if(c->status.binary) {
+		return send_binary_request(mesh, c, PONG, NULL);
+	}
+
 	return send_request(mesh, c, "%d", PONG);
 }
 
-bool pong_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
-	(void)mesh;
-	(void)request;
-
-	assert(request);
-	assert(*request);
+static bool receive_pong(meshlink_handle_t *mesh, connection_t *c) {
+	/* Update the RTT estimate the same way TCP does (RFC 6298). */
+	if(c->status.pinged) {
+		int64_t rtt = (mesh->loop.now.tv_sec - c->ping_sent.tv_sec) * 1000000 + (mesh->loop.now.tv_nsec - c->ping_sent.tv_nsec) / 1000;
+
+		if(rtt < 1) {
+			rtt = 1;
+		} else if(rtt > UINT32_MAX / 8) {
+			rtt = UINT32_MAX / 8;
+		}
+
+		if(!c->srtt) {
+			c->srtt = rtt;
+			c->rttvar = rtt / 2;
+		} else {
+			int64_t delta = rtt > c->srtt ? rtt - c->srtt : c->srtt - rtt;
+			c->rttvar = (3 * (int64_t)c->rttvar + delta) / 4;
+			c->srtt = (7 * (int64_t)c->srtt + rtt) / 8;
+		}
+	}
 
 	c->status.pinged = false;
 
+	if(c->srtt) {
+		stats_set(&mesh->stats.srtt, c->srtt);
+		stats_set(&mesh->stats.rttvar, c->rttvar);
+		stats_set(&c->node->stats.srtt, c->srtt);
+		stats_set(&c->node->stats.rttvar, c->rttvar);
+	}
+
+	/* Don't wake up for the ping timeout anymore, but only when the next ping is due. */
+	reschedule_pingtimer(mesh);
+
 	/* Successful connection, reset timeout if this is an outgoing connection. */
 
 	if(c->outgoing) {
@@ -101,8 +180,42 @@ bool pong_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	return true;
 }
 
+bool pong_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
+	(void)request;
+
+	assert(request);
+	assert(*request);
+
+	return receive_pong(mesh, c);
+}
+
+bool pong_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	(void)args;
+	(void)argc;
+
+	return receive_pong(mesh, c);
+}
+
 bool send_raw_packet(meshlink_handle_t *mesh, connection_t *c, const vpn_packet_t *packet) {
-	return send_request(mesh, c, "%d", PACKET) && send_meta(mesh, c, (const char *)packet->data, packet->len);
+	if(!c) {
+		logger(mesh, MESHLINK_ERROR, "Trying to send request to non-existing connection");
+		return false;
+	}
+
+	/* The binary encoding carries the packet in the same record as the request */
+	if(c->status.binary) {
+		const request_arg_t args[] = {REQUEST_BIN(packet->data, packet->len)};
+
+		if(!send_binary_request(mesh, c, PACKET, args)) {
+			return false;
+		}
+	} else if(!send_request(mesh, c, "%d", PACKET) || !send_meta(mesh, c, (const char *)packet->data, packet->len)) {
+		return false;
+	}
+
+	stats_add(mesh, c->node, messages_sent, 1);
+	stats_add(mesh, c->node, bytes_sent, packet->len);
+	return true;
 }
 
 bool raw_packet_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
@@ -111,3 +224,10 @@ bool raw_packet_h(meshlink_handle_t *mesh, connection_t *c, const char *request)
 	c->status.raw_packet = true;
 	return true;
 }
+
+bool packet_bin_h(meshlink_handle_t *mesh, connection_t *c, const request_arg_t *args, int argc) {
+	(void)argc;
+
+	receive_packet(mesh, c, args[0].data, args[0].len);
+	return true;
+}
@@ -26,6 +26,7 @@
 #include "logger.h"
 #include "prf.h"
 #include "sptps.h"
+#include "trace.h"
 
 /*
    Nonce MUST be exchanged first (done)
@@ -132,6 +133,7 @@ static bool send_record_priv(sptps_t *s, uint8_t type, const void *data, uint16_
 
 	if(s->outstate) {
 		// If first handshake has finished, encrypt and HMAC
+		TRACE2(record_encrypt, type, len);
 		chacha_poly1305_encrypt(s->outcipher, seqno, buffer + 2, len + 1, buffer + 2, NULL);
 		return s->send_data(s->handle, type, buffer, len + 19UL);
 	} else {
@@ -652,6 +654,8 @@ bool sptps_receive_data(sptps_t *s, const void *data, size_t len) {
 			if(!chacha_poly1305_decrypt(s->incipher, seqno, s->inbuf + 2UL, s->reclen + 17UL, s->inbuf + 2UL, NULL)) {
 				return error(s, EINVAL, "Failed to decrypt and verify record");
 			}
+
+			TRACE2(record_decrypt, s->inbuf[2], s->reclen);
 		}
 
 		// Append a NULL byte for safety.
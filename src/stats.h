@@ -0,0 +1,105 @@
+#ifndef MESHLINK_STATS_H
+#define MESHLINK_STATS_H
+
+/*
+    stats.h -- performance counters
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* The counters are only updated with relaxed atomic operations,
+   so the application can read them at any time without taking the mesh mutex.
+   Each counter exists once for the whole instance, and once for each node. */
+
+typedef atomic_uint_least64_t stats_counter_t;
+
+typedef struct stats_t {
+	stats_counter_t messages_queued;
+	stats_counter_t bytes_queued;
+	stats_counter_t messages_sent;
+	stats_counter_t bytes_sent;
+	stats_counter_t messages_received;
+	stats_counter_t bytes_received;
+	stats_counter_t records_encrypted;
+	stats_counter_t records_decrypted;
+	stats_counter_t queue_depth;
+	stats_counter_t queue_max;
+	stats_counter_t outbuf_depth;
+	stats_counter_t outbuf_max;
+	stats_counter_t handshakes;
+	stats_counter_t handshake_time;
+	stats_counter_t renewals;
+	stats_counter_t renewal_time;
+	stats_counter_t reconnects;
+	stats_counter_t srtt;
+	stats_counter_t rttvar;
+	stats_counter_t callbacks;
+	stats_counter_t callback_time;
+} stats_t;
+
+static inline uint64_t stats_get(const stats_counter_t *counter) {
+	return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static inline void stats_set(stats_counter_t *counter, uint64_t value) {
+	atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+/// Add a value to a counter, and return the new value.
+static inline uint64_t stats_inc(stats_counter_t *counter, uint64_t value) {
+	return atomic_fetch_add_explicit(counter, value, memory_order_relaxed) + value;
+}
+
+/// Raise a high-water mark to the given value.
+static inline void stats_max(stats_counter_t *max, uint64_t value) {
+	uint64_t old = stats_get(max);
+
+	while(value > old && !atomic_compare_exchange_weak_explicit(max, &old, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+/// Add a value to a counter of both the instance and a node, which may be NULL.
+#define stats_add(mesh, n, field, value) do { \
+		uint64_t stats_value_ = (value); \
+		stats_inc(&(mesh)->stats.field, stats_value_); \
+		if(n) { \
+			stats_inc(&((node_t *)(n))->stats.field, stats_value_); \
+		} \
+	} while(0)
+
+/// Change a depth by a possibly negative amount, and update its high-water mark.
+#define stats_add_depth(mesh, n, field, delta) do { \
+		int64_t stats_delta_ = (delta); \
+		stats_max(&(mesh)->stats.field##_max, stats_inc(&(mesh)->stats.field##_depth, (uint64_t)stats_delta_)); \
+		if(n) { \
+			stats_max(&((node_t *)(n))->stats.field##_max, stats_inc(&((node_t *)(n))->stats.field##_depth, (uint64_t)stats_delta_)); \
+		} \
+	} while(0)
+
+/// Time elapsed since start, in microseconds.
+static inline uint64_t stats_elapsed(const struct timespec *start, const struct timespec *now) {
+	int64_t usec = (now->tv_sec - start->tv_sec) * 1000000 + (now->tv_nsec - start->tv_nsec) / 1000;
+	return usec > 0 ? (uint64_t)usec : 0;
+}
+
+/// Account the time spent in an application callback that was started at the given time.
+#define stats_callback_done(mesh, n, start) do { \
+		struct timespec stats_now_; \
+		clock_gettime(CLOCK_MONOTONIC, &stats_now_); \
+		stats_add(mesh, n, callbacks, 1); \
+		stats_add(mesh, n, callback_time, stats_elapsed((start), &stats_now_)); \
+	} while(0)
+
+#endif
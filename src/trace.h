@@ -0,0 +1,62 @@
+#ifndef MESHLINK_TRACE_H
+#define MESHLINK_TRACE_H
+
+/*
+    trace.h -- static tracepoints
+    Copyright (C) 2026 agent <agent@local>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Static tracepoints in the "meshlink" provider, usable with perf, bpftrace or SystemTap.
+   A tracepoint is a single nop instruction until a tracer attaches to it.
+   Its arguments are still evaluated, so they should only be values that are at hand anyway.
+   Without <sys/sdt.h>, they compile to nothing and their arguments are not evaluated.
+
+   Tracepoints and their arguments:
+     message_enqueue(node, len)        meshlink_send() queued a message for node
+     message_dequeue(node, len)        the background thread took a message from the queue
+     record_encrypt(type, len)         an SPTPS record is about to be encrypted
+     record_decrypt(type, len)         an SPTPS record has been decrypted
+     socket_send(node, len)            bytes were written to a meta-connection
+     socket_recv(node, len)            bytes were read from a meta-connection
+     connect_start(node)               a connect() attempt was started
+     connect_done(node, error)         a connect() attempt finished, error is 0 on success
+     handshake_id_sent(node)           we sent our ID request
+     handshake_id_received(node)       we received the peer's ID request
+     handshake_sptps_done(node)        the SPTPS key exchange finished
+     handshake_activated(node)         the connection became active
+     key_renewal(node)                 we started an SPTPS key renewal
+     key_rotate(stage)                 a storage key rotation reached the given stage
+     timer_fire(cb, now, due)          a timeout callback is called, now and due point to struct timespec,
+                                       the difference between them is how late the callback is
+     config_write(subdir, name, len)   a configuration file is written synchronously
+     config_batch_start(subdir)        the writer thread starts writing a batch of files
+     config_batch_done(success)        the writer thread finished a batch
+*/
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define TRACE1(name, a) DTRACE_PROBE1(meshlink, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(meshlink, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(meshlink, name, a, b, c)
+#else
+#define TRACE1(name, a) do {(void)sizeof(a);} while(0)
+#define TRACE2(name, a, b) do {(void)sizeof(a); (void)sizeof(b);} while(0)
+#define TRACE3(name, a, b, c) do {(void)sizeof(a); (void)sizeof(b); (void)sizeof(c);} while(0)
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+// Wait for the given number of connections, and return when the last one was accepted
+static int64_t wait_connections(fake_upstream_t *upstream, int count) {
+	fake_upstream_wait(&upstream->connections, count);
+	return upstream->connected_at;
+}
+
+static void check_delay(int64_t start, int64_t end, int expected) {
+	fprintf(stderr, "Reconnected after %d ms, expected %d ms\n", (int)(end - start), expected);
+	assert(end - start >= expected - 10);
+	assert(end - start <= expected + 250);
+}
+
+static void set_backoff(meshlink_handle_t *mesh, int base, bool jitter, int maxtimeout) {
+	// The upstream is known as a backbone node until it tells us its device class
+	for(dev_class_t devclass = 0; devclass < DEV_CLASS_COUNT; devclass++) {
+		meshlink_set_dev_class_backoff(mesh, devclass, base, jitter);
+		meshlink_set_dev_class_maxtimeout(mesh, devclass, maxtimeout);
+		meshlink_set_dev_class_fast_retry_period(mesh, devclass, 0);
+	}
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	fake_upstream_t upstreams[1] = {{.name = "bar", .reject = 5}};
+	meshlink_handle_t *mesh = fake_upstream_setup("backoff_conf", "foo", "backoff", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+
+	// Without jitter, the delay between failed attempts doubles until it reaches the maximum
+
+	set_backoff(mesh, 200, false, 1);
+	assert(meshlink_start(mesh));
+
+	const int expected[] = {200, 400, 800, 1000, 1000};
+	int64_t last = wait_connections(&upstreams[0], 1);
+
+	for(int n = 0; n < 5; n++) {
+		int64_t next = wait_connections(&upstreams[0], n + 2);
+		check_delay(last, next, expected[n]);
+		last = next;
+	}
+
+	assert_after(upstreams[0].active, 15);
+	meshlink_stop(mesh);
+	assert_after(!upstreams[0].active, 15);
+
+	// An ERROR with a retry-after delay overrides a shorter backoff
+
+	set_backoff(mesh, 200, false, 5);
+	upstreams[0].reject = 1;
+	upstreams[0].retry_after = 2;
+	assert(meshlink_start(mesh));
+
+	last = wait_connections(&upstreams[0], 7);
+	check_delay(last, wait_connections(&upstreams[0], 8), 2000);
+
+	assert_after(upstreams[0].active, 15);
+	meshlink_stop(mesh);
+	assert_after(!upstreams[0].active, 15);
+
+	// The retry-after delay never exceeds the maximum, not even with jitter added to it
+
+	set_backoff(mesh, 1000, true, 2);
+	upstreams[0].reject = 1;
+	upstreams[0].retry_after = 30;
+	assert(meshlink_start(mesh));
+
+	last = wait_connections(&upstreams[0], 9);
+	check_delay(last, wait_connections(&upstreams[0], 10), 2000);
+
+	assert_after(upstreams[0].active, 15);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("backoff_conf"));
+}
@@ -0,0 +1,71 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+static atomic_int received;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)mesh;
+	(void)source;
+
+	assert(len == 5);
+	assert(!memcmp(data, "hello", 5));
+	received++;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open an instance with an upstream that supports binary encoded requests,
+	// and which contradicts the first edge we announce
+
+	fake_upstream_t upstreams[1] = {{.name = "bar", .binary = true, .del_edges = 1}};
+	meshlink_handle_t *mesh = fake_upstream_setup("binary_requests_conf", "foo", "binary-requests", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_receive_cb(mesh, receive_cb);
+	meshlink_set_tcp_keepalive(mesh, false);
+	meshlink_set_dev_class_timeouts(mesh, DEV_CLASS_STATIONARY, 1, 1);
+
+	meshlink_node_t *bar = meshlink_get_node(mesh, "bar");
+	assert(bar);
+
+	// After authentication, our edge should be announced in binary, and announced again after it was deleted
+
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+	assert_after(upstreams[0].add_edges == 2, 15);
+
+	// Messages should be sent and echoed back as binary PACKETs
+
+	for(int n = 0; n < 3; n++) {
+		assert(meshlink_send(mesh, bar, "hello", 5));
+	}
+
+	assert_after(received == 3, 15);
+	assert(upstreams[0].packets == 3);
+
+	// PINGs should be sent in binary as well, and the PONGs should keep the connection alive
+
+	assert_after(upstreams[0].pings >= 2, 15);
+	assert(upstreams[0].active);
+	assert(upstreams[0].connections == 1);
+
+	// Everything after authentication was binary encoded
+
+	assert(upstreams[0].binary_requests == upstreams[0].add_edges + upstreams[0].packets + upstreams[0].pings);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("binary_requests_conf"));
+}
@@ -0,0 +1,138 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+#define MESSAGES 10
+
+// Every callback appends an event, the status callback a negative one for unreachable
+static struct {
+	pthread_mutex_t mutex;
+	int count;
+	int values[4 * MESSAGES];
+	pthread_t threads[4 * MESSAGES];
+} events = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_t main_thread;
+static atomic_int received;
+static atomic_bool mode_rejected;
+
+static void add_event(meshlink_handle_t *mesh, int value) {
+	// Deferred callbacks are called without the mesh mutex held, so they can call back into MeshLink
+	assert(meshlink_get_self(mesh));
+
+	assert(!pthread_mutex_lock(&events.mutex));
+	assert(events.count < 4 * MESSAGES);
+	events.values[events.count] = value;
+	events.threads[events.count] = pthread_self();
+	events.count++;
+	assert(!pthread_mutex_unlock(&events.mutex));
+}
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)source;
+
+	int value;
+	assert(len == sizeof(value));
+	memcpy(&value, data, len);
+	assert(!pthread_equal(pthread_self(), main_thread));
+	add_event(mesh, value);
+	received++;
+}
+
+static void status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	if(strcmp(node->name, "bar")) {
+		return;
+	}
+
+	add_event(mesh, reachable ? 0 : -1);
+}
+
+static void thread_receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	// The callback mode cannot be changed from the callback thread
+	if(!meshlink_set_callback_mode(mesh, MESHLINK_CALLBACKS_DEFERRED)) {
+		mode_rejected = true;
+	}
+
+	receive_cb(mesh, source, data, len);
+}
+
+static void send_messages(meshlink_handle_t *mesh, meshlink_node_t *bar, int first, int count) {
+	for(int i = first; i < first + count; i++) {
+		assert(meshlink_send(mesh, bar, &i, sizeof(i)));
+	}
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+	main_thread = pthread_self();
+
+	fake_upstream_t upstreams[1] = {{.name = "bar"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("callback_mode_conf", "foo", "callback-mode", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_receive_cb(mesh, receive_cb);
+	meshlink_set_node_status_cb(mesh, status_cb);
+
+	meshlink_node_t *bar = meshlink_get_node(mesh, "bar");
+	assert(bar);
+
+	// With deferred callbacks, they are called in order from the background thread
+
+	assert(meshlink_set_callback_mode(mesh, MESHLINK_CALLBACKS_DEFERRED));
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+
+	send_messages(mesh, bar, 1, MESSAGES);
+	assert_after(received == MESSAGES, 15);
+
+	// With the callback thread, they are called in order from yet another thread
+
+	meshlink_set_receive_cb(mesh, thread_receive_cb);
+	assert(meshlink_set_callback_mode(mesh, MESHLINK_CALLBACKS_THREAD));
+
+	send_messages(mesh, bar, MESSAGES + 1, MESSAGES);
+	assert_after(received == 2 * MESSAGES, 15);
+	assert(mode_rejected);
+
+	// With deferred callbacks, those caused by stopping are called before meshlink_stop() returns
+
+	assert(meshlink_set_callback_mode(mesh, MESHLINK_CALLBACKS_DEFERRED));
+	meshlink_stop(mesh);
+
+	assert(!pthread_mutex_lock(&events.mutex));
+	assert(events.count == 2 * MESSAGES + 2);
+	assert(events.values[0] == 0);
+	assert(events.values[2 * MESSAGES + 1] == -1);
+
+	for(int i = 1; i <= 2 * MESSAGES; i++) {
+		assert(events.values[i] == i);
+	}
+
+	// The deferred callbacks came from the background thread, the threaded ones from another thread,
+	// and the one caused by meshlink_stop() from the thread calling it
+	for(int i = 1; i <= MESSAGES; i++) {
+		assert(pthread_equal(events.threads[i], events.threads[0]));
+		assert(!pthread_equal(events.threads[MESSAGES + i], events.threads[0]));
+		assert(pthread_equal(events.threads[MESSAGES + i], events.threads[MESSAGES + 1]));
+	}
+
+	assert(!pthread_equal(events.threads[0], main_thread));
+	assert(pthread_equal(events.threads[2 * MESSAGES + 1], main_thread));
+
+	assert(!pthread_mutex_unlock(&events.mutex));
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("callback_mode_conf"));
+}
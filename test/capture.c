@@ -0,0 +1,150 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "../src/capture.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+#define SLOTS 16
+
+static atomic_int received;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)mesh;
+	(void)source;
+	(void)data;
+	(void)len;
+
+	received++;
+}
+
+static uint8_t *read_capture(const char *path, size_t *size) {
+	FILE *f = fopen(path, "r");
+	assert(f);
+	assert(!fseek(f, 0, SEEK_END));
+	*size = ftell(f);
+	assert(!fseek(f, 0, SEEK_SET));
+
+	uint8_t *buf = malloc(*size);
+	assert(buf);
+	assert(fread(buf, *size, 1, f) == 1);
+	assert(!fclose(f));
+	return buf;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	fake_upstream_t upstreams[1] = {{.name = "bar"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("capture_conf", "foo", "capture", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_receive_cb(mesh, receive_cb);
+
+	// A capture file must have room for at least one record
+
+	assert(!meshlink_set_capture_file(mesh, "capture.bin", 10));
+
+	// Capture enough traffic to make the ring wrap around
+
+	size_t header_size = (sizeof(capture_header_t) + 63) & ~(size_t)63;
+	size_t slot_size = (sizeof(capture_record_t) + CAPTURE_SNAPLEN + 7) & ~(size_t)7;
+	assert(meshlink_set_capture_file(mesh, "capture.bin", header_size + SLOTS * slot_size));
+
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+
+	meshlink_node_t *bar = meshlink_get_node(mesh, "bar");
+	assert(bar);
+
+	// Wait for each echo, so records in both directions end up in the ring
+	for(int n = 1; n <= SLOTS; n++) {
+		assert(meshlink_send(mesh, bar, "hello", 5));
+		assert_after(received == n, 15);
+	}
+
+	meshlink_stop(mesh);
+	assert_after(!upstreams[0].active, 15);
+
+	// Check the header
+
+	size_t size;
+	uint8_t *buf = read_capture("capture.bin", &size);
+	assert(size == header_size + SLOTS * slot_size);
+
+	const capture_header_t *header = (const capture_header_t *)buf;
+	assert(!memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)));
+	assert(header->version == CAPTURE_VERSION);
+	assert(header->header_size == header_size);
+	assert(header->slot_size == slot_size);
+	assert(header->slot_count == SLOTS);
+	assert(!strcmp(header->name, "foo"));
+
+	// Each message causes a PACKET request and its payload in both directions
+	assert(header->head >= 4 * SLOTS);
+
+	// Read back the records still in the ring, oldest first, starting at head
+
+	uint64_t previous_time = 0;
+	int payloads_out = 0;
+	int payloads_in = 0;
+
+	for(uint64_t i = header->head - SLOTS; i < header->head; i++) {
+		const capture_record_t *record = (const capture_record_t *)(buf + header_size + (i % SLOTS) * slot_size);
+		const char *data = (const char *)(record + 1);
+
+		assert(record->time >= previous_time);
+		previous_time = record->time;
+
+		assert(record->direction == CAPTURE_IN || record->direction == CAPTURE_OUT);
+		assert(record->caplen == record->len);
+		assert(!strcmp(record->peer, "bar"));
+
+		if(record->len == 5) {
+			assert(!memcmp(data, "hello", 5));
+
+			if(record->direction == CAPTURE_OUT) {
+				payloads_out++;
+			} else {
+				payloads_in++;
+			}
+		}
+	}
+
+	assert(payloads_out > 0);
+	assert(payloads_in > 0);
+	free(buf);
+
+	// Stop capturing, no more records should be written
+
+	assert(meshlink_set_capture_file(mesh, NULL, 0));
+	buf = read_capture("capture.bin", &size);
+	uint64_t head = ((const capture_header_t *)buf)->head;
+	free(buf);
+
+	received = 0;
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+	assert(meshlink_send(mesh, bar, "hello", 5));
+	assert_after(received == 1, 15);
+
+	buf = read_capture("capture.bin", &size);
+	assert(((const capture_header_t *)buf)->head == head);
+	free(buf);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("capture_conf"));
+	assert(!unlink("capture.bin"));
+}
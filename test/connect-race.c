@@ -0,0 +1,132 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+static atomic_int attempts;
+static atomic_int timeouts;
+
+static void count_log_cb(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *text) {
+	log_cb(mesh, level, text);
+
+	if(!strncmp(text, "Trying to connect to bar at", 27)) {
+		attempts++;
+	} else if(!strncmp(text, "Timeout while connecting to bar at", 34)) {
+		timeouts++;
+	}
+}
+
+/* Listen on the given port without ever accepting, and fill the accept queue,
+   so the kernel drops all further SYNs and connect() to this port stalls. */
+static int dead_listener(int port, int *filler) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(fd != -1);
+
+	static const int one = 1;
+	assert(!setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)));
+
+	struct sockaddr_in sin = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	assert(!bind(fd, (struct sockaddr *)&sin, sizeof(sin)));
+	assert(!listen(fd, 0));
+
+	*filler = socket(AF_INET, SOCK_STREAM, 0);
+	assert(*filler != -1);
+	assert(!connect(*filler, (struct sockaddr *)&sin, sizeof(sin)));
+	return fd;
+}
+
+static uint64_t reconnects(meshlink_handle_t *mesh, meshlink_node_t *bar) {
+	meshlink_stats_t stats;
+	assert(meshlink_get_node_stats(mesh, bar, &stats));
+	return stats.reconnects;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	fake_upstream_t upstreams[1] = {{.name = "bar"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("connect_race_conf", "foo", "connect-race", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, count_log_cb);
+
+	meshlink_node_t *bar = meshlink_get_node(mesh, "bar");
+	assert(bar);
+
+	// Connect once, so the address of the upstream becomes a recent address that worked
+
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+	meshlink_stop(mesh);
+	assert_after(!upstreams[0].active, 15);
+
+	// Move the upstream to another port, and make the old one dead.
+	// The recent address is tried first, the canonical address with the new port 250 ms later.
+
+	int old_port = upstreams[0].port;
+	fake_upstream_move(&upstreams[0]);
+	int filler;
+	int dead = dead_listener(old_port, &filler);
+
+	char port[16];
+	snprintf(port, sizeof(port), "%d", upstreams[0].port);
+	assert(meshlink_set_canonical_address(mesh, bar, "127.0.0.1", port));
+
+	attempts = 0;
+	int connections = upstreams[0].connections;
+	int64_t start = now_ms();
+	assert(meshlink_start(mesh));
+	fake_upstream_wait(&upstreams[0].connections, connections + 1);
+	int64_t connected = upstreams[0].connected_at;
+	fprintf(stderr, "Connected to the live address after %d ms\n", (int)(connected - start));
+	assert(connected - start >= 250 - 10);
+	assert(connected - start <= 250 + 250);
+	assert_after(upstreams[0].active, 15);
+
+	// The winner cancelled the stalled attempt, so it never times out, and nothing is retried
+
+	sleep(2);
+	assert(attempts == 2);
+	assert(timeouts == 0);
+	assert(upstreams[0].active);
+	assert(upstreams[0].connections == connections + 1);
+	meshlink_stop(mesh);
+	assert_after(!upstreams[0].active, 15);
+
+	// When all attempts fail, the failure is counted once, after the stalled attempt timed out
+
+	for(dev_class_t devclass = 0; devclass < DEV_CLASS_COUNT; devclass++) {
+		meshlink_set_dev_class_backoff(mesh, devclass, 10000, false);
+	}
+
+	fake_upstream_cleanup(upstreams, 1);
+	uint64_t before = reconnects(mesh, bar);
+	attempts = 0;
+	assert(meshlink_start(mesh));
+
+	assert_after(timeouts == 1, 15);
+	sleep(1);
+	assert(attempts == 2);
+	assert(timeouts == 1);
+	assert(reconnects(mesh, bar) == before + 1);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	close(filler);
+	close(dead);
+	assert(meshlink_destroy("connect_race_conf"));
+}
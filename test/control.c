@@ -0,0 +1,117 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "meshlink-tiny.h"
+#include "utils.h"
+
+#define CONTROL_PATH "control.sock"
+
+static int control_connect(void) {
+	struct sockaddr_un sa = {.sun_family = AF_UNIX, .sun_path = CONTROL_PATH};
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(fd != -1);
+	assert(!connect(fd, (struct sockaddr *)&sa, sizeof(sa)));
+
+	struct timeval tv = {5, 0};
+	assert(!setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+	return fd;
+}
+
+// Send a request and read its reply, up to and including the final "ok" or "error" line
+static void request(int fd, const char *line, char *reply, size_t size) {
+	assert(send(fd, line, strlen(line), 0) == (ssize_t)strlen(line));
+
+	size_t len = 0;
+	size_t start = 0;
+
+	while(len < size - 1) {
+		assert(recv(fd, reply + len, 1, 0) == 1);
+
+		if(reply[len++] != '\n') {
+			continue;
+		}
+
+		if(!strncmp(reply + start, "ok\n", 3) || !strncmp(reply + start, "error", 5)) {
+			break;
+		}
+
+		start = len;
+	}
+
+	reply[len] = 0;
+}
+
+static void check_socket(void) {
+	struct stat st;
+	assert(!lstat(CONTROL_PATH, &st));
+	assert(S_ISSOCK(st.st_mode));
+	assert((st.st_mode & 0777) == 0600);
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	assert(meshlink_destroy("control_conf"));
+	unlink(CONTROL_PATH);
+
+	meshlink_handle_t *mesh = meshlink_open("control_conf", "foo", "control", DEV_CLASS_BACKBONE);
+	assert(mesh);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	assert(meshlink_start(mesh));
+
+	// Open the control socket while running, only the owner should be able to connect
+
+	assert(meshlink_set_control_socket(mesh, CONTROL_PATH));
+	check_socket();
+
+	int fd = control_connect();
+	char reply[4096];
+
+	request(fd, "stats\n", reply, sizeof(reply));
+	assert(!strncmp(reply, "stats messages_queued=", 22));
+	assert(strstr(reply, "\nok\n"));
+
+	request(fd, "set ping 1 10 5\n", reply, sizeof(reply));
+	assert(!strcmp(reply, "ok\n"));
+
+	request(fd, "set ping 1 5 10\n", reply, sizeof(reply));
+	assert(!strcmp(reply, "error invalid ping settings\n"));
+
+	// After quit the connection should be closed
+
+	assert(send(fd, "quit\n", 5, 0) == 5);
+	assert(recv(fd, reply, sizeof(reply), 0) == 0);
+	close(fd);
+
+	// Reopening the same path should leave a working socket behind
+
+	assert(meshlink_set_control_socket(mesh, CONTROL_PATH));
+	check_socket();
+
+	fd = control_connect();
+	request(fd, "stats\n", reply, sizeof(reply));
+	assert(!strncmp(reply, "stats messages_queued=", 22));
+	close(fd);
+
+	// Closing the control socket should remove it
+
+	assert(meshlink_set_control_socket(mesh, NULL));
+	assert(access(CONTROL_PATH, F_OK) == -1);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	assert(meshlink_destroy("control_conf"));
+}
@@ -0,0 +1,354 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "../src/system.h"
+
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../src/meshlink_internal.h"
+#include "../src/ecdsa.h"
+#include "../src/packmsg.h"
+#include "../src/protocol.h"
+#include "../src/sptps.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+static bool send_data(void *handle, uint8_t type, const void *data, size_t len) {
+	(void)type;
+	fake_upstream_t *f = handle;
+	const char *p = data;
+
+	while(len) {
+		ssize_t result = send(f->fd, p, len, MSG_NOSIGNAL);
+
+		if(result <= 0) {
+			return false;
+		}
+
+		p += result;
+		len -= result;
+	}
+
+	return true;
+}
+
+static void send_text_request(fake_upstream_t *f, const char *request) {
+	char buf[256];
+	int len = snprintf(buf, sizeof(buf), "%s\n", request);
+	assert(sptps_send_record(f->sptps, 0, buf, len));
+}
+
+// Count a PING, and wait as long as we should before answering it
+static bool count_ping(fake_upstream_t *f) {
+	f->pings++;
+	int delay = f->pong_delay;
+
+	if(delay > 0) {
+		nanosleep(&(struct timespec) {
+			delay / 1000, (delay % 1000) * 1000000
+		}, NULL);
+	}
+
+	return delay >= 0;
+}
+
+static void send_binary_reply(fake_upstream_t *f, packmsg_output_t *out, uint8_t *buf) {
+	assert(packmsg_output_ok(out));
+	assert(sptps_send_record(f->sptps, SPTPS_BINARY_REQUEST, buf, packmsg_output_size(out, buf)));
+}
+
+static void handle_binary_request(fake_upstream_t *f, const void *data, uint16_t len) {
+	f->binary_requests++;
+
+	packmsg_input_t in = {data, len};
+	uint8_t buf[4096];
+	packmsg_output_t out = {buf, sizeof(buf)};
+
+	switch(packmsg_get_int32(&in)) {
+	case PING:
+		if(!count_ping(f)) {
+			break;
+		}
+
+		packmsg_add_int32(&out, PONG);
+		send_binary_reply(f, &out, buf);
+		break;
+
+	case PACKET: {
+		const void *packet;
+		uint32_t packetlen = packmsg_get_bin_raw(&in, &packet);
+		assert(packmsg_input_ok(&in));
+		f->packets++;
+		packmsg_add_int32(&out, PACKET);
+		packmsg_add_bin(&out, packet, packetlen);
+		send_binary_reply(f, &out, buf);
+		break;
+	}
+
+	case ADD_EDGE:
+		f->add_edges++;
+
+		if(f->del_edges > 0) {
+			f->del_edges--;
+			packmsg_add_int32(&out, DEL_EDGE);
+			packmsg_add_int64(&out, 0);
+			packmsg_add_str(&out, f->peer);
+			packmsg_add_str(&out, f->name);
+			send_binary_reply(f, &out, buf);
+		}
+
+		break;
+
+	default:
+		break;
+	}
+}
+
+static bool receive_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	fake_upstream_t *f = handle;
+
+	if(type == SPTPS_HANDSHAKE && f->rejecting) {
+		char error[64];
+		snprintf(error, sizeof(error), "%d %d %s %d", ERROR, 0, "rejected", (int)f->retry_after);
+		send_text_request(f, error);
+		return false;
+	}
+
+	if(type == SPTPS_HANDSHAKE) {
+		// ACK with our port, DEV_CLASS_STATIONARY and protocol minor version 3 in the options
+		char ack[64];
+		snprintf(ack, sizeof(ack), "%d %d %d %x", ACK, f->port, 1, 3 << 24);
+		send_text_request(f, ack);
+		f->active = true;
+		return true;
+	}
+
+	if(type == SPTPS_BINARY_REQUEST) {
+		handle_binary_request(f, data, len);
+		return true;
+	}
+
+	// The payload of a PACKET request is sent in the next record, echo it back
+	if(f->raw_packet) {
+		f->raw_packet = false;
+		f->packets++;
+
+		char request[16];
+		snprintf(request, sizeof(request), "%d", PACKET);
+		send_text_request(f, request);
+		return sptps_send_record(f->sptps, 0, data, len);
+	}
+
+	switch(atoi(data)) {
+	case PING: {
+		if(!count_ping(f)) {
+			break;
+		}
+
+		char request[16];
+		snprintf(request, sizeof(request), "%d", PONG);
+		send_text_request(f, request);
+		break;
+	}
+
+	case PACKET:
+		f->raw_packet = true;
+		break;
+
+	case ADD_EDGE:
+		f->add_edges++;
+
+		if(f->del_edges > 0) {
+			f->del_edges--;
+			char request[256];
+			snprintf(request, sizeof(request), "%d %x %s %s", DEL_EDGE, 0, f->peer, f->name);
+			send_text_request(f, request);
+		}
+
+		break;
+
+	default:
+		break;
+	}
+
+	return true;
+}
+
+/// Read the ID line of the peer, and send our own.
+static bool exchange_id(fake_upstream_t *f) {
+	char line[256];
+	size_t len = 0;
+
+	while(len < sizeof(line) - 1) {
+		if(recv(f->fd, line + len, 1, 0) != 1) {
+			return false;
+		}
+
+		if(line[len++] == '\n') {
+			break;
+		}
+	}
+
+	char id[256];
+	int idlen = snprintf(id, sizeof(id), "%d %s %d.%d %s %u\n", ID, f->name, PROT_MAJOR, PROT_MINOR, "fake-upstream", f->binary ? PROTOCOL_BINARY : 0);
+	return send(f->fd, id, idlen, MSG_NOSIGNAL) == idlen;
+}
+
+static void handle_connection(fake_upstream_t *f) {
+	f->connected_at = now_ms();
+	f->connections++;
+	f->rejecting = f->reject > 0;
+
+	if(f->rejecting) {
+		f->reject--;
+
+		if(!f->retry_after) {
+			return;
+		}
+	}
+
+	if(!exchange_id(f)) {
+		return;
+	}
+
+	char label[256];
+	int labellen = snprintf(label, sizeof(label), "%s %s %s", meshlink_tcp_label, f->peer, f->name);
+	assert(sptps_start(f->sptps, f, false, false, f->mykey, f->hiskey, label, labellen, send_data, receive_record));
+
+	while(!f->stop && !f->drop) {
+		struct pollfd pfd = {f->fd, POLLIN, 0};
+
+		if(poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+
+		char buf[4096];
+		ssize_t result = recv(f->fd, buf, sizeof(buf), 0);
+
+		if(result <= 0 || !sptps_receive_data(f->sptps, buf, result)) {
+			break;
+		}
+	}
+
+	f->active = false;
+	f->drop = false;
+	f->raw_packet = false;
+	sptps_stop(f->sptps);
+}
+
+static void *upstream_thread(void *arg) {
+	fake_upstream_t *f = arg;
+
+	while(!f->stop) {
+		struct pollfd pfd = {f->listen_fd, POLLIN, 0};
+
+		if(poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+
+		f->fd = accept(f->listen_fd, NULL, NULL);
+
+		if(f->fd < 0) {
+			continue;
+		}
+
+		handle_connection(f);
+		close(f->fd);
+		f->fd = -1;
+	}
+
+	return NULL;
+}
+
+static void start_upstream(fake_upstream_t *f) {
+	f->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(f->listen_fd != -1);
+
+	struct sockaddr_in sin = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	socklen_t len = sizeof(sin);
+	assert(!bind(f->listen_fd, (struct sockaddr *)&sin, sizeof(sin)));
+	assert(!getsockname(f->listen_fd, (struct sockaddr *)&sin, &len));
+	assert(!listen(f->listen_fd, 1));
+
+	f->port = ntohs(sin.sin_port);
+	f->fd = -1;
+	f->sptps = calloc(1, sizeof(*f->sptps));
+	assert(f->sptps);
+	assert(!pthread_create(&f->thread, NULL, upstream_thread, f));
+}
+
+meshlink_handle_t *fake_upstream_setup(const char *confbase, const char *name, const char *appname, fake_upstream_t *upstreams, int count) {
+	assert(meshlink_destroy(confbase));
+	meshlink_handle_t *mesh = meshlink_open(confbase, name, appname, DEV_CLASS_BACKBONE);
+	assert(mesh);
+
+	for(int i = 0; i < count; i++) {
+		fake_upstream_t *f = &upstreams[i];
+
+		// Borrow a meshlink-tiny instance to generate the upstream's identity
+		char upstream_confbase[PATH_MAX];
+		snprintf(upstream_confbase, sizeof(upstream_confbase), "%s_%s", confbase, f->name);
+		assert(meshlink_destroy(upstream_confbase));
+		meshlink_handle_t *upstream = meshlink_open(upstream_confbase, f->name, appname, DEV_CLASS_BACKBONE);
+		assert(upstream);
+
+		char *data = meshlink_export(upstream);
+		assert(data);
+		assert(meshlink_import(mesh, data));
+		free(data);
+
+		f->mykey = ecdsa_set_private_key(ecdsa_get_private_key(upstream->private_key));
+		f->hiskey = ecdsa_set_public_key(ecdsa_get_public_key(mesh->private_key));
+		f->peer = name;
+		meshlink_close(upstream);
+		assert(meshlink_destroy(upstream_confbase));
+
+		start_upstream(f);
+
+		char port[16];
+		snprintf(port, sizeof(port), "%d", f->port);
+		meshlink_node_t *node = meshlink_get_node(mesh, f->name);
+		assert(node);
+		assert(meshlink_set_canonical_address(mesh, node, "127.0.0.1", port));
+	}
+
+	return mesh;
+}
+
+void fake_upstream_move(fake_upstream_t *f) {
+	f->stop = true;
+	assert(!pthread_join(f->thread, NULL));
+	close(f->listen_fd);
+	free(f->sptps);
+
+	f->stop = false;
+	start_upstream(f);
+}
+
+int64_t fake_upstream_wait(atomic_int *counter, int value) {
+	int64_t deadline = now_ms() + 15000;
+
+	while(*counter < value) {
+		assert(now_ms() < deadline);
+		nanosleep(&(struct timespec) {
+			0, 1000000
+		}, NULL);
+	}
+
+	return now_ms();
+}
+
+void fake_upstream_cleanup(fake_upstream_t *upstreams, int count) {
+	for(int i = 0; i < count; i++) {
+		fake_upstream_t *f = &upstreams[i];
+		f->stop = true;
+		assert(!pthread_join(f->thread, NULL));
+		close(f->listen_fd);
+		free(f->sptps);
+		ecdsa_free(f->mykey);
+		ecdsa_free(f->hiskey);
+	}
+}
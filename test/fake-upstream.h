@@ -0,0 +1,63 @@
+#ifndef MESHLINK_TEST_FAKE_UPSTREAM_H
+#define MESHLINK_TEST_FAKE_UPSTREAM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../src/meshlink-tiny.h"
+
+/* meshlink-tiny instances cannot connect to each other, so tests that need a peer use this
+ * stand-in for a full MeshLink upstream node. It accepts one meta-connection at a time,
+ * presents itself as a DEV_CLASS_STATIONARY node, answers PINGs with PONGs and echoes PACKETs back to the sender.
+ * If binary is set, it advertises PROTOCOL_BINARY and answers in the binary encoding.
+ * It can also reject connections, either by closing them right away or by sending an ERROR.
+ * Tests using it have to be linked statically, since it uses the library's internal SPTPS code.
+ */
+
+typedef struct fake_upstream {
+	const char *name;               // name of the upstream node
+	int port;                       // TCP port, filled in by fake_upstream_setup()
+	bool binary;                    // advertise support for binary encoded requests
+	atomic_int del_edges;           // number of ADD_EDGEs from the peer to contradict with a DEL_EDGE
+	atomic_int reject;              // number of connections to reject
+	atomic_bool drop;               // close the current connection
+	atomic_int pong_delay;          // milliseconds to wait before answering a PING, or -1 to not answer at all
+	atomic_int retry_after;         // if non-zero, reject with an ERROR asking to wait this many seconds instead of closing
+
+	// Counters, updated by the upstream's own thread
+	atomic_int connections;         // meta-connections accepted
+	atomic_llong connected_at;      // when the last one was accepted, in milliseconds on the monotonic clock
+	atomic_bool active;             // a meta-connection is authenticated
+	atomic_int pings;               // PING requests received
+	atomic_int packets;             // PACKET requests received and echoed
+	atomic_int add_edges;           // ADD_EDGE requests received
+	atomic_int binary_requests;     // binary encoded requests received
+
+	// Internal state
+	struct ecdsa *mykey;
+	struct ecdsa *hiskey;
+	const char *peer;
+	int listen_fd;
+	int fd;
+	bool raw_packet;
+	bool rejecting;
+	atomic_bool stop;
+	pthread_t thread;
+	struct sptps *sptps;
+} fake_upstream_t;
+
+/// Open a meshlink-tiny instance that knows the given upstreams, and start the upstreams.
+extern meshlink_handle_t *fake_upstream_setup(const char *confbase, const char *name, const char *appname, fake_upstream_t *upstreams, int count);
+
+/// Make the upstream listen on a new port, and stop listening on the old one. It must not have a connection at this time.
+extern void fake_upstream_move(fake_upstream_t *upstream);
+
+/// Wait up to 15 seconds for one of the counters of an upstream to reach the given value, and return when that happened in milliseconds.
+extern int64_t fake_upstream_wait(atomic_int *counter, int value);
+
+/// Stop the given upstreams and free their resources.
+extern void fake_upstream_cleanup(fake_upstream_t *upstreams, int count);
+
+#endif
@@ -0,0 +1,118 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+static atomic_int received;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)mesh;
+	(void)source;
+	(void)data;
+	(void)len;
+
+	received++;
+}
+
+static uint64_t histogram_total(const meshlink_loop_stats_t *stats, meshlink_histogram_t type) {
+	uint64_t total = 0;
+
+	for(int i = 0; i < MESHLINK_HISTOGRAM_BUCKETS; i++) {
+		total += stats->histograms[type][i];
+	}
+
+	return total;
+}
+
+static void exchange_messages(meshlink_handle_t *mesh, meshlink_node_t *bar) {
+	int expected = received + 10;
+
+	for(int n = 0; n < 10; n++) {
+		assert(meshlink_send(mesh, bar, "hello", 5));
+	}
+
+	assert_after(received == expected, 15);
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	fake_upstream_t upstreams[1] = {{.name = "bar"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("loop_stats_conf", "foo", "loop-stats", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_receive_cb(mesh, receive_cb);
+
+	meshlink_node_t *bar = meshlink_get_node(mesh, "bar");
+	assert(bar);
+
+	// Invalid arguments
+
+	meshlink_loop_stats_t stats;
+	meshlink_errno = MESHLINK_OK;
+	assert(!meshlink_get_loop_stats(NULL, &stats));
+	assert(meshlink_errno == MESHLINK_EINVAL);
+
+	meshlink_errno = MESHLINK_OK;
+	assert(!meshlink_get_loop_stats(mesh, NULL));
+	assert(meshlink_errno == MESHLINK_EINVAL);
+
+	// Without instrumentation, nothing is recorded
+
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+	exchange_messages(mesh, bar);
+
+	meshlink_loop_stats_t zero;
+	memset(&zero, 0, sizeof(zero));
+	assert(meshlink_get_loop_stats(mesh, &stats));
+	assert(!memcmp(&stats, &zero, sizeof(stats)));
+
+	// With instrumentation, the iterations and the histograms of the events that happened go up
+
+	meshlink_set_loop_instrumentation(mesh, true);
+	exchange_messages(mesh, bar);
+
+	assert(meshlink_get_loop_stats(mesh, &stats));
+	assert(stats.iterations > 0);
+	assert(histogram_total(&stats, MESHLINK_HISTOGRAM_IO) > 0);
+	assert(histogram_total(&stats, MESHLINK_HISTOGRAM_SIGNAL) > 0);
+	assert(histogram_total(&stats, MESHLINK_HISTOGRAM_WAIT) > 0);
+
+	// Sending and receiving the messages took well under a second, and so did waiting for them
+
+	for(int i = 20; i < MESHLINK_HISTOGRAM_BUCKETS; i++) {
+		assert(!stats.histograms[MESHLINK_HISTOGRAM_IO][i]);
+		assert(!stats.histograms[MESHLINK_HISTOGRAM_SIGNAL][i]);
+	}
+
+	// Disabling it keeps what was collected so far, but records nothing new
+
+	meshlink_set_loop_instrumentation(mesh, false);
+	exchange_messages(mesh, bar);
+
+	meshlink_loop_stats_t before;
+	assert(meshlink_get_loop_stats(mesh, &before));
+	assert(before.iterations >= stats.iterations);
+
+	exchange_messages(mesh, bar);
+
+	meshlink_loop_stats_t after;
+	assert(meshlink_get_loop_stats(mesh, &after));
+	assert(!memcmp(&before, &after, sizeof(after)));
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("loop_stats_conf"));
+}
@@ -0,0 +1,98 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+// Stop answering PINGs, and return how long it took from the next PING until the connection was closed
+static int64_t time_to_close(fake_upstream_t *upstream) {
+	upstream->pong_delay = -1;
+	int64_t pinged = fake_upstream_wait(&upstream->pings, upstream->pings + 1);
+
+	while(upstream->active) {
+		assert(now_ms() - pinged < 15000);
+		nanosleep(&(struct timespec) {
+			0, 1000000
+		}, NULL);
+	}
+
+	int64_t elapsed = now_ms() - pinged;
+	fprintf(stderr, "Connection closed %d ms after the unanswered PING\n", (int)elapsed);
+	return elapsed;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	fake_upstream_t upstreams[1] = {{.name = "bar"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("rtt_conf", "foo", "rtt", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_dev_class_timeouts(mesh, DEV_CLASS_STATIONARY, 2, 1);
+	meshlink_set_dev_class_adaptive_timeout(mesh, DEV_CLASS_STATIONARY, 100);
+
+	meshlink_node_t *bar = meshlink_get_node(mesh, "bar");
+	assert(bar);
+
+	// Without a connection, the round-trip time is not known
+
+	uint32_t srtt = 0;
+	uint32_t rttvar = 0;
+	assert(!meshlink_get_node_rtt(mesh, bar, &srtt, &rttvar));
+
+	// Once a slow PONG has been received, the estimate should start at its round-trip time
+
+	upstreams[0].pong_delay = 100;
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+	assert(!meshlink_get_node_rtt(mesh, bar, &srtt, &rttvar));
+
+	fake_upstream_wait(&upstreams[0].pings, 1);
+	assert_after(meshlink_get_node_rtt(mesh, bar, &srtt, &rttvar), 15);
+	fprintf(stderr, "srtt %u rttvar %u\n", srtt, rttvar);
+	assert(srtt >= 100000 && srtt < 200000);
+	assert(rttvar >= srtt / 2 - 1 && rttvar <= srtt / 2);
+
+	// Faster PONGs should bring the estimate down
+
+	upstreams[0].pong_delay = 0;
+	fake_upstream_wait(&upstreams[0].pings, 3);
+	assert_after(meshlink_get_node_rtt(mesh, bar, &srtt, NULL) && srtt < 100000, 15);
+	fprintf(stderr, "srtt %u\n", srtt);
+
+	// With a large factor, the adaptive timeout is limited to the ping interval.
+	// The PING is counted when it arrives, slightly after the timeout started
+
+	int64_t elapsed = time_to_close(&upstreams[0]);
+	assert(elapsed >= 2000 - 50 && elapsed <= 2000 + 250);
+	assert(!meshlink_get_node_rtt(mesh, bar, NULL, NULL));
+
+	// With a small factor and a fast peer, the adaptive timeout is at least 200 milliseconds,
+	// and much shorter than the fixed timeout of one second
+
+	meshlink_set_dev_class_adaptive_timeout(mesh, DEV_CLASS_STATIONARY, 1);
+	upstreams[0].pong_delay = 0;
+	assert_after(upstreams[0].active, 15);
+	int pings = upstreams[0].pings;
+	fake_upstream_wait(&upstreams[0].pings, pings + 1);
+	assert_after(meshlink_get_node_rtt(mesh, bar, &srtt, &rttvar), 15);
+	fprintf(stderr, "srtt %u rttvar %u\n", srtt, rttvar);
+	assert(srtt < 50000);
+
+	elapsed = time_to_close(&upstreams[0]);
+	assert(elapsed >= 200 - 50 && elapsed <= 200 + 250);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("rtt_conf"));
+}
@@ -0,0 +1,83 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+static atomic_int received;
+static atomic_bool primary_lost;
+static const char *primary_name;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)mesh;
+	(void)source;
+	(void)data;
+	(void)len;
+
+	received++;
+}
+
+static void status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	(void)mesh;
+
+	if(!reachable && primary_name && !strcmp(node->name, primary_name)) {
+		primary_lost = true;
+	}
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	fake_upstream_t upstreams[2] = {{.name = "bar"}, {.name = "baz"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("standby_conf", "foo", "standby", upstreams, 2);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_receive_cb(mesh, receive_cb);
+	meshlink_set_node_status_cb(mesh, status_cb);
+
+	meshlink_node_t *dest = meshlink_get_node(mesh, "bar");
+	assert(dest);
+
+	// With a standby, both upstreams are connected to, but packets only go to one of them
+
+	meshlink_set_upstream_standby(mesh, true);
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active && upstreams[1].active, 15);
+
+	assert(meshlink_send(mesh, dest, "hello", 5));
+	assert_after(received == 1, 15);
+	assert(upstreams[0].packets + upstreams[1].packets == 1);
+
+	fake_upstream_t *primary = upstreams[0].packets ? &upstreams[0] : &upstreams[1];
+	fake_upstream_t *standby = upstreams[0].packets ? &upstreams[1] : &upstreams[0];
+	primary_name = primary->name;
+
+	// Kill the primary and keep it down, the next packet should go out via the standby right away
+
+	primary->reject = 1000;
+	primary->drop = true;
+	assert_after(primary_lost, 15);
+
+	int64_t start = now_ms();
+	assert(meshlink_send(mesh, dest, "hello", 5));
+	fake_upstream_wait(&standby->packets, 1);
+	fprintf(stderr, "Sent via the standby after %d ms\n", (int)(now_ms() - start));
+	assert(now_ms() - start < 100);
+
+	assert_after(received == 2, 15);
+	assert(primary->packets == 1);
+	assert(standby->active);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 2);
+	assert(meshlink_destroy("standby_conf"));
+}
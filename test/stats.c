@@ -0,0 +1,95 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+static atomic_int received;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)mesh;
+	(void)source;
+
+	assert(len == 5);
+	assert(!memcmp(data, "hello", 5));
+	received++;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open an instance with an upstream, all counters should start at zero
+
+	fake_upstream_t upstreams[1] = {{.name = "bar"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("stats_conf", "foo", "stats", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_receive_cb(mesh, receive_cb);
+
+	meshlink_node_t *bar = meshlink_get_node(mesh, "bar");
+	assert(bar);
+
+	meshlink_stats_t stats;
+	meshlink_stats_t zero;
+	memset(&zero, 0, sizeof(zero));
+	assert(meshlink_get_stats(mesh, &stats));
+	assert(!memcmp(&stats, &zero, sizeof(stats)));
+
+	// Connect and send some messages, the upstream echoes them back
+
+	assert(meshlink_start(mesh));
+	assert_after(upstreams[0].active, 15);
+
+	for(int i = 0; i < 3; i++) {
+		assert(meshlink_send(mesh, bar, "hello", 5));
+	}
+
+	assert_after(received == 3, 15);
+	assert(upstreams[0].packets == 3);
+
+	// The counters of the instance should reflect that
+
+	assert(meshlink_get_stats(mesh, &stats));
+	assert(stats.messages_queued == 3);
+	assert(stats.bytes_queued == 15);
+	assert(stats.messages_sent == 3);
+	assert(stats.bytes_sent == 15);
+	assert(stats.messages_received == 3);
+	assert(stats.bytes_received == 15);
+	assert(stats.records_encrypted > 3);
+	assert(stats.records_decrypted > 3);
+	assert(stats.queue_depth == 0);
+	assert(stats.queue_max >= 1);
+	assert(stats.outbuf_max > 0);
+	assert(stats.handshakes == 1);
+	assert(stats.handshake_time > 0);
+	assert(stats.callbacks >= 3);
+
+	// And so should the counters of the upstream node
+
+	meshlink_stats_t node_stats;
+	assert(meshlink_get_node_stats(mesh, bar, &node_stats));
+	assert(node_stats.messages_queued == 3);
+	assert(node_stats.messages_sent == 3);
+	assert(node_stats.messages_received == 3);
+	assert(node_stats.bytes_received == 15);
+	assert(node_stats.handshakes == 1);
+
+	// The counters of ourself are not meaningful, but they can be read
+
+	assert(meshlink_get_node_stats(mesh, meshlink_get_self(mesh), &node_stats));
+	assert(!meshlink_get_node_stats(mesh, NULL, &node_stats));
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("stats_conf"));
+}
@@ -0,0 +1,93 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+#define COUNT 3
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open several instances, each with its own upstream, and leave a hole in the array
+
+	fake_upstream_t upstreams[COUNT] = {{.name = "bar"}, {.name = "baz"}, {.name = "qux"}};
+	meshlink_handle_t *meshes[COUNT + 1] = {NULL};
+	char confbase[32];
+
+	for(int i = 0; i < COUNT; i++) {
+		snprintf(confbase, sizeof(confbase), "stop_many_conf.%d", i);
+		meshes[i + 1] = fake_upstream_setup(confbase, "foo", "stop-many", &upstreams[i], 1);
+		meshlink_set_log_cb(meshes[i + 1], MESHLINK_DEBUG, log_cb);
+	}
+
+	// Invalid arguments
+
+	meshlink_errno = MESHLINK_OK;
+	meshlink_stop_many(NULL, COUNT);
+	assert(meshlink_errno == MESHLINK_EINVAL);
+
+	meshlink_errno = MESHLINK_OK;
+	meshlink_close_many(NULL, COUNT);
+	assert(meshlink_errno == MESHLINK_EINVAL);
+
+	// Stopping instances that have never been started is allowed
+
+	meshlink_stop_many(meshes, COUNT + 1);
+
+	// Start all instances, stopping them should close all their connections
+
+	for(int i = 0; i < COUNT; i++) {
+		assert(meshlink_start(meshes[i + 1]));
+	}
+
+	for(int i = 0; i < COUNT; i++) {
+		assert_after(upstreams[i].active, 15);
+	}
+
+	// The event loops are idle now, but should wake up right away instead of at the next ping
+
+	sleep(1);
+	int64_t start = now_ms();
+	meshlink_stop_many(meshes, COUNT + 1);
+	fprintf(stderr, "Stopped %d instances in %d ms\n", COUNT, (int)(now_ms() - start));
+	assert(now_ms() - start < 500);
+
+	for(int i = 0; i < COUNT; i++) {
+		assert_after(!upstreams[i].active, 15);
+	}
+
+	// The instances can be started again afterwards
+
+	for(int i = 0; i < COUNT; i++) {
+		assert(meshlink_start(meshes[i + 1]));
+	}
+
+	for(int i = 0; i < COUNT; i++) {
+		assert_after(upstreams[i].connections == 2 && upstreams[i].active, 15);
+	}
+
+	// Closing running instances should stop them as well
+
+	meshlink_close_many(meshes, COUNT + 1);
+
+	for(int i = 0; i < COUNT; i++) {
+		assert_after(!upstreams[i].active, 15);
+	}
+
+	// Clean up.
+
+	fake_upstream_cleanup(upstreams, COUNT);
+
+	for(int i = 0; i < COUNT; i++) {
+		snprintf(confbase, sizeof(confbase), "stop_many_conf.%d", i);
+		assert(meshlink_destroy(confbase));
+	}
+}
@@ -0,0 +1,99 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "meshlink-tiny.h"
+#include "utils.h"
+
+static meshlink_handle_t *open_log(const char *key) {
+	meshlink_open_params_t *params = meshlink_open_params_init("storage_log_conf", "foo", "storage-log", DEV_CLASS_BACKBONE);
+	assert(params);
+	assert(meshlink_open_params_set_storage_engine(params, MESHLINK_STORAGE_ENGINE_LOG));
+	assert(meshlink_open_params_set_storage_key(params, key, strlen(key)));
+	meshlink_handle_t *mesh = meshlink_open_ex(params);
+	meshlink_open_params_free(params);
+	return mesh;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open a new meshlink instance using the log storage engine.
+
+	assert(meshlink_destroy("storage_log_conf"));
+	meshlink_handle_t *mesh = open_log("right");
+	assert(mesh);
+
+	struct stat st;
+	assert(!stat("storage_log_conf/current/meshlink.log", &st));
+	assert(stat("storage_log_conf/current/hosts", &st) && errno == ENOENT);
+
+	char *fingerprint = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+	assert(fingerprint);
+
+	// Update our own host config many times, the log should be compacted.
+
+	for(int i = 0; i < 200; i++) {
+		char address[32];
+		snprintf(address, sizeof(address), "host%d.example.com", i);
+		assert(meshlink_set_canonical_address(mesh, meshlink_get_self(mesh), address, NULL));
+	}
+
+	assert(!stat("storage_log_conf/current/meshlink.log", &st));
+	assert(st.st_size < 8192);
+
+	// Close the mesh and open it again, everything should still be there.
+
+	meshlink_close(mesh);
+
+	assert(!open_log("wrong"));
+
+	mesh = open_log("right");
+	assert(mesh);
+
+	char *fingerprint2 = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+	assert(fingerprint2);
+	assert(!strcmp(fingerprint, fingerprint2));
+	free(fingerprint2);
+
+	// Rotate the key and reopen with the new key.
+
+	assert(meshlink_encrypted_key_rotate(mesh, "new", 3));
+	meshlink_close(mesh);
+
+	assert(!open_log("right"));
+
+	mesh = open_log("new");
+	assert(mesh);
+
+	fingerprint2 = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+	assert(fingerprint2);
+	assert(!strcmp(fingerprint, fingerprint2));
+	free(fingerprint2);
+	free(fingerprint);
+
+	meshlink_close(mesh);
+
+	// Destroy the mesh.
+
+	assert(meshlink_destroy("storage_log_conf"));
+
+	DIR *dir = opendir("storage_log_conf");
+	assert(dir);
+	struct dirent *ent;
+
+	while((ent = readdir(dir))) {
+		assert(!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."));
+	}
+
+	closedir(dir);
+}
@@ -0,0 +1,99 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "meshlink-tiny.h"
+#include "utils.h"
+
+static meshlink_handle_t *open_memory(void *store, const char *key) {
+	meshlink_open_params_t *params = meshlink_open_params_init("storage_memory_conf", "foo", "storage-memory", DEV_CLASS_BACKBONE);
+	assert(params);
+	assert(meshlink_open_params_set_storage_ops(params, &meshlink_memory_storage_ops, store));
+
+	if(key) {
+		assert(meshlink_open_params_set_storage_key(params, key, strlen(key)));
+	}
+
+	meshlink_handle_t *mesh = meshlink_open_ex(params);
+	meshlink_open_params_free(params);
+	return mesh;
+}
+
+static void test_store(const char *key) {
+	void *store = meshlink_memory_storage_create();
+	assert(store);
+
+	// Open a new meshlink instance, nothing should be written to the filesystem.
+
+	meshlink_handle_t *mesh = open_memory(store, key);
+	assert(mesh);
+
+	struct stat st;
+	assert(stat("storage_memory_conf", &st) && errno == ENOENT);
+
+	char *fingerprint = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+	assert(fingerprint);
+	assert(meshlink_set_canonical_address(mesh, meshlink_get_self(mesh), "foo.example.com", NULL));
+
+	// Close the mesh and open it again from the same store, everything should still be there.
+
+	meshlink_close(mesh);
+
+	if(key) {
+		assert(!open_memory(store, "wrong"));
+	}
+
+	mesh = open_memory(store, key);
+	assert(mesh);
+
+	char *fingerprint2 = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+	assert(fingerprint2);
+	assert(!strcmp(fingerprint, fingerprint2));
+	free(fingerprint2);
+
+	// Rotate the key and reopen with the new key.
+
+	if(key) {
+		assert(meshlink_encrypted_key_rotate(mesh, "new", 3));
+		meshlink_close(mesh);
+
+		assert(!open_memory(store, key));
+		mesh = open_memory(store, "new");
+		assert(mesh);
+
+		fingerprint2 = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+		assert(fingerprint2);
+		assert(!strcmp(fingerprint, fingerprint2));
+		free(fingerprint2);
+	}
+
+	free(fingerprint);
+	meshlink_close(mesh);
+
+	// Destroy the mesh, a new one should be created when opening it again.
+
+	meshlink_open_params_t *params = meshlink_open_params_init("storage_memory_conf", NULL, "storage-memory", DEV_CLASS_BACKBONE);
+	assert(params);
+	assert(meshlink_open_params_set_storage_ops(params, &meshlink_memory_storage_ops, store));
+	assert(meshlink_destroy_ex(params));
+	assert(!meshlink_open_ex(params));
+	meshlink_open_params_free(params);
+
+	assert(stat("storage_memory_conf", &st) && errno == ENOENT);
+
+	meshlink_memory_storage_destroy(store);
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	test_store(NULL);
+	test_store("right");
+}
@@ -0,0 +1,149 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "meshlink-tiny.h"
+#include "utils.h"
+
+static bool snapshot_used;
+
+static void snapshot_log_cb(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *text) {
+	if(strstr(text, "Using configuration snapshot")) {
+		snapshot_used = true;
+	}
+
+	log_cb(mesh, level, text);
+}
+
+static meshlink_handle_t *open_snapshot(const char *key) {
+	snapshot_used = false;
+	meshlink_handle_t *mesh = meshlink_open_encrypted("storage_snapshot_conf", "foo", "storage-snapshot", DEV_CLASS_BACKBONE, key, strlen(key));
+
+	if(mesh) {
+		meshlink_set_log_cb(mesh, MESHLINK_DEBUG, snapshot_log_cb);
+	}
+
+	return mesh;
+}
+
+static bool snapshot_exists(void) {
+	struct stat st;
+	return !stat("storage_snapshot_conf/current/meshlink.snapshot", &st);
+}
+
+static ino_t snapshot_inode(void) {
+	struct stat st;
+	assert(!stat("storage_snapshot_conf/current/meshlink.snapshot", &st));
+	return st.st_ino;
+}
+
+static void check_fingerprint(meshlink_handle_t *mesh, const char *fingerprint) {
+	char *fingerprint2 = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+	assert(fingerprint2);
+	assert(!strcmp(fingerprint, fingerprint2));
+	free(fingerprint2);
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, snapshot_log_cb);
+
+	// Open a new instance, a snapshot should be written when closing it.
+
+	assert(meshlink_destroy("storage_snapshot_conf"));
+	meshlink_handle_t *mesh = open_snapshot("right");
+	assert(mesh);
+	assert(!snapshot_used);
+
+	char *fingerprint = meshlink_get_fingerprint(mesh, meshlink_get_self(mesh));
+	assert(fingerprint);
+
+	meshlink_close(mesh);
+	assert(snapshot_exists());
+
+	// A snapshot that cannot be decrypted is not used, but it is not removed either.
+
+	assert(!open_snapshot("wrong"));
+	assert(!snapshot_used);
+	assert(snapshot_exists());
+
+	// The next open should use the snapshot. Nothing changed, so it is not rewritten when closing.
+
+	ino_t inode = snapshot_inode();
+	mesh = open_snapshot("right");
+	assert(mesh);
+	assert(snapshot_used);
+	check_fingerprint(mesh, fingerprint);
+	meshlink_close(mesh);
+	assert(snapshot_inode() == inode);
+
+	// A snapshot is stale if the host configuration files have changed since it was written.
+
+	FILE *f = fopen("storage_snapshot_conf/current/hosts/bar.tmp", "w");
+	assert(f);
+	assert(!fclose(f));
+
+	mesh = open_snapshot("right");
+	assert(mesh);
+	assert(!snapshot_used);
+	check_fingerprint(mesh, fingerprint);
+
+	// The stale snapshot was removed when the configuration was written, and no snapshot is written if storage is disabled.
+
+	assert(!snapshot_exists());
+	meshlink_set_storage_policy(mesh, MESHLINK_STORAGE_DISABLED);
+	meshlink_close(mesh);
+	assert(!snapshot_exists());
+
+	// Otherwise, a new snapshot is written when closing.
+
+	mesh = open_snapshot("right");
+	assert(mesh);
+	assert(!snapshot_used);
+	meshlink_close(mesh);
+	assert(snapshot_exists());
+
+	// The first change after opening removes the snapshot right away, without relying on modification times,
+	// so a crash before closing doesn't leave a snapshot of the old configuration behind.
+
+	mesh = open_snapshot("right");
+	assert(mesh);
+	assert(snapshot_used);
+	assert(snapshot_exists());
+	assert(meshlink_set_canonical_address(mesh, meshlink_get_self(mesh), "localhost", NULL));
+	assert(!snapshot_exists());
+	meshlink_close(mesh);
+
+	mesh = open_snapshot("right");
+	assert(mesh);
+	assert(snapshot_used);
+	meshlink_close(mesh);
+
+	// A corrupted snapshot is ignored.
+
+	assert(snapshot_exists());
+	f = fopen("storage_snapshot_conf/current/meshlink.snapshot", "r+");
+	assert(f);
+	assert(!fseek(f, 20, SEEK_SET));
+	assert(fputc('x', f) != EOF);
+	assert(!fclose(f));
+
+	mesh = open_snapshot("right");
+	assert(mesh);
+	assert(!snapshot_used);
+	check_fingerprint(mesh, fingerprint);
+	meshlink_close(mesh);
+
+	free(fingerprint);
+
+	// Destroying the mesh also removes the snapshot.
+
+	assert(meshlink_destroy("storage_snapshot_conf"));
+	assert(!snapshot_exists());
+}
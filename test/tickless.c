@@ -0,0 +1,88 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "meshlink-tiny.h"
+#include "fake-upstream.h"
+#include "utils.h"
+
+#define HOST_CONFIG "tickless_conf/current/hosts/bar"
+
+static size_t read_file(const char *path, char *buf, size_t size) {
+	FILE *f = fopen(path, "rb");
+	assert(f);
+	size_t len = fread(buf, 1, size, f);
+	assert(len < size);
+	fclose(f);
+	return len;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	fake_upstream_t upstreams[1] = {{.name = "bar"}};
+	meshlink_handle_t *mesh = fake_upstream_setup("tickless_conf", "foo", "tickless", upstreams, 1);
+	meshlink_set_log_cb(mesh, MESHLINK_DEBUG, log_cb);
+	meshlink_set_dev_class_timeouts(mesh, DEV_CLASS_STATIONARY, 3, 1);
+
+	char before[4096];
+	size_t before_len = read_file(HOST_CONFIG, before, sizeof(before));
+
+	// Activating the connection marks the upstream's host config dirty,
+	// which should pull the periodic handler forward to write it out within a second or so
+
+	assert(meshlink_start(mesh));
+	int64_t activated = fake_upstream_wait(&upstreams[0].connections, 1);
+	assert_after(upstreams[0].active, 15);
+
+	char after[4096];
+	size_t after_len = 0;
+
+	do {
+		assert(now_ms() - activated < 2500);
+		nanosleep(&(struct timespec) {
+			0, 10000000
+		}, NULL);
+		after_len = read_file(HOST_CONFIG, after, sizeof(after));
+	} while(after_len == before_len && !memcmp(before, after, after_len));
+
+	// An idle connection is only pinged once per ping interval
+
+	meshlink_set_loop_instrumentation(mesh, true);
+	int64_t last = fake_upstream_wait(&upstreams[0].pings, 1);
+
+	meshlink_loop_stats_t start;
+	assert(meshlink_get_loop_stats(mesh, &start));
+
+	for(int n = 2; n <= 3; n++) {
+		int64_t next = fake_upstream_wait(&upstreams[0].pings, n);
+		fprintf(stderr, "PING after %d ms\n", (int)(next - last));
+
+		// The deadline has a resolution of one second
+		assert(next - last >= 2000 - 10);
+		assert(next - last <= 3000 + 250);
+		last = next;
+	}
+
+	// In between, the event loop only woke up for the pings themselves and their PONGs,
+	// waking up every second would have taken at least six more iterations
+
+	meshlink_loop_stats_t end;
+	assert(meshlink_get_loop_stats(mesh, &end));
+	fprintf(stderr, "%d event loop iterations for 2 PINGs\n", (int)(end.iterations - start.iterations));
+	assert(end.iterations - start.iterations <= 10);
+
+	// Clean up.
+
+	meshlink_close(mesh);
+	fake_upstream_cleanup(upstreams, 1);
+	assert(meshlink_destroy("tickless_conf"));
+}
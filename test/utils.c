@@ -184,3 +184,9 @@ void log_cb(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *tex
 	        levelstr[level],
 	        text);
 }
+
+int64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
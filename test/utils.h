@@ -2,6 +2,7 @@
 #define MESHLINK_TEST_UTILS_H
 
 #include <assert.h>
+#include <stdint.h>
 #include <time.h>
 #include <pthread.h>
 
@@ -39,6 +40,9 @@ extern void link_meshlink_pair(meshlink_handle_t *a, meshlink_handle_t *b);
 /// Default log callback
 extern void log_cb(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *text);
 
+/// The current time on the monotonic clock, in milliseconds.
+extern int64_t now_ms(void);
+
 #define assert_after(cond, timeout)\
 	do {\
 		for(int i = 0; i++ <= timeout;) {\